@@ -0,0 +1,658 @@
+/****
+ *
+ *  AsyncFetch.h
+ *  Part of the "AsyncFetch" library for Arduino. Version 0.1.0
+ *
+ * An AsyncFetch GETs a URL over HTTP/1.1, with or without TLS, without ever waiting for
+ * anything. Each call to run() does one small slice of the work -- see whether the host name
+ * has resolved or the connection is up, take a step of the TLS handshake, write what the
+ * connection will take of the request, or deal with what's arrived of the response -- and
+ * returns, so a fetch can go on for seconds while a cooperative scheduler keeps the things that
+ * mustn't be kept waiting, like stepper motors, on time. Each phase of a fetch has its own
+ * timeout, and a fetch can be cancelled at any point.
+ *
+ * The response body goes into a buffer allocated for it, up to a size limit given when the
+ * fetch is started. It's NUL-terminated, so a text body can be used as a C string, and it's
+ * kept until release() or the next fetch. A body may come with a Content-Length, chunked or,
+ * from an HTTP/1.0 server, ended by the server closing the connection.
+ *
+ * The connection is kept open afterwards, unless the server says otherwise, so the next fetch
+ * from the same server, if it's started within the keep time, needn't connect and do a TLS
+ * handshake again. If the server has closed the kept connection in the meantime, the fetch is
+ * tried once more on a new one.
+ *
+ * It's a template so that it can be built with whatever supplies the connection: EspLink (see
+ * EspLink.h), on lwIP and mbedTLS, on the device; something built on POSIX sockets on a host
+ * (see tools/fetchloop.cpp). Each of Link's methods must return at once:
+ *
+ *   int8_t resolve(const char *host)     Look up host; AF_LINK_DONE, AF_LINK_AGAIN (not yet) or
+ *                                        AF_LINK_FAILED
+ *   int8_t connect(uint16_t port)        Connect to port at the address looked up; the same
+ *   int8_t handshake(const char *host)   Do the TLS handshake, checking the server is host; the same
+ *   int read(uint8_t *buf, size_t len)   Read up to len bytes of what's arrived; 0 if nothing
+ *                                        has, -1 if the connection is closed or broken
+ *   int write(const uint8_t *buf, size_t len)  Write as much of buf as it'll take; the same
+ *   void stop()                          Close the connection, if any, and forget the address
+ *
+ * The first call to each of resolve(), connect() and handshake() after a stop() starts that
+ * phase; the ones after that see how it's going.
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// Some constants
+#define AF_LINK_DONE            (1)         // What Link's phases return: done
+#define AF_LINK_AGAIN           (0)         //   not yet
+#define AF_LINK_FAILED          (-1)        //   failed
+#define AF_HOST_SIZE            (64)        // Room for the host name
+#define AF_REQUEST_SIZE         (384)       // Room for the request
+#define AF_LINE_SIZE            (96)        // Room for a response header line; longer ones are cut short
+#define AF_READ_SIZE            (512)       // The most response bytes dealt with per call to run()
+#define AF_GROW_SIZE            (2048)      // How much a body of unknown length grows its buffer at a time
+#define AF_KEEP_MILLIS          (10000)     // How long to keep a connection for the next fetch, by default
+
+// The default timeouts for each phase of a fetch (millis()). Reading the response times out
+// only if it makes no progress for that long.
+#define AF_RESOLVE_MILLIS       (5000)
+#define AF_CONNECT_MILLIS       (5000)
+#define AF_HANDSHAKE_MILLIS     (15000)
+#define AF_SEND_MILLIS          (5000)
+#define AF_HEADERS_MILLIS       (10000)
+#define AF_BODY_MILLIS          (5000)
+
+// What status() is when a fetch didn't get a response
+#define AF_ERR_URL              (-1)        // The URL isn't one we can fetch
+#define AF_ERR_RESOLVE          (-2)        // The host name didn't resolve
+#define AF_ERR_CONNECT          (-3)        // The connection was refused or couldn't be made
+#define AF_ERR_HANDSHAKE        (-4)        // The TLS handshake failed
+#define AF_ERR_LOST             (-5)        // The connection broke or closed before the response was complete
+#define AF_ERR_RESPONSE         (-6)        // The response wasn't HTTP
+#define AF_ERR_TOO_BIG          (-7)        // The body is bigger than the limit
+#define AF_ERR_MEMORY           (-8)        // There wasn't memory for the body
+#define AF_ERR_TIMEOUT          (-9)        // A phase took too long; see failedIn()
+#define AF_ERR_CANCELLED        (-10)       // cancel() was called
+
+enum af_phase_t : uint8_t {afIdle, afResolving, afConnecting, afHandshaking, afSending, afReadingHeaders, afReadingBody, afPhases};
+
+template <typename Link>
+class AsyncFetch {
+public:
+  /**
+   * @brief Construct a new AsyncFetch object
+   *
+   * @param link      What supplies the connection
+   */
+  AsyncFetch(Link &link) : link(link) {
+    static const unsigned long defaults[afPhases] =
+      {0, AF_RESOLVE_MILLIS, AF_CONNECT_MILLIS, AF_HANDSHAKE_MILLIS, AF_SEND_MILLIS, AF_HEADERS_MILLIS, AF_BODY_MILLIS};
+    memcpy(timeouts, defaults, sizeof(timeouts));
+    keepMillis = AF_KEEP_MILLIS;
+    phase = afIdle;
+    failedPhase = afIdle;
+    kept = false;
+    code = 0;
+    body = nullptr;
+    bodyCap = 0;
+    bodyLen = 0;
+    nHandshakes = 0;
+    host[0] = '\0';
+  }
+
+  ~AsyncFetch() {
+    release();
+  }
+
+  /**
+   * @brief Start fetching url, abandoning any fetch under way. run() does the work.
+   *
+   * @param url       The URL: http:// or https://, host, optional :port, and path
+   * @param maxSize   The most body bytes to accept
+   * @param nowMillis The current time (millis())
+   * @return true     Started
+   * @return false    The URL won't do; status() is AF_ERR_URL
+   */
+  bool start(const char *url, size_t maxSize, unsigned long nowMillis) {
+    if (busy()) {
+      link.stop();
+      kept = false;
+    }
+    release();
+    code = 0;
+    failedPhase = afIdle;
+    phase = afIdle;
+    limit = maxSize;
+
+    // Take the URL apart
+    bool isSecure = strncasecmp(url, "https://", 8) == 0;
+    if (!isSecure && strncasecmp(url, "http://", 7) != 0) {
+      code = AF_ERR_URL;
+      return false;
+    }
+    const char *h = url + (isSecure ? 8 : 7);
+    size_t hostLen = strcspn(h, ":/");
+    const char *path = h + strcspn(h, "/");
+    uint16_t newPort = isSecure ? 443 : 80;
+    if (h[hostLen] == ':') {
+      newPort = (uint16_t)strtoul(h + hostLen + 1, nullptr, 10);
+    }
+    if (hostLen == 0 || hostLen >= AF_HOST_SIZE || newPort == 0) {
+      code = AF_ERR_URL;
+      return false;
+    }
+
+    // Keep the connection we have if it's to the same place and not too old
+    bool same = strncmp(host, h, hostLen) == 0 && host[hostLen] == '\0' && port == newPort && secure == isSecure;
+    if (kept && (!same || nowMillis - lastMillis > keepMillis)) {
+      link.stop();
+      kept = false;
+    }
+    memcpy(host, h, hostLen);
+    host[hostLen] = '\0';
+    port = newPort;
+    secure = isSecure;
+
+    int len = snprintf(request, sizeof(request),
+      "GET %s HTTP/1.1\r\nHost: %.*s\r\nUser-Agent: AsyncFetch/0.1.0\r\nAccept-Encoding: identity\r\nConnection: keep-alive\r\n\r\n",
+      *path == '\0' ? "/" : path, (int)(path - h), h);
+    if (len < 0 || (size_t)len >= sizeof(request)) {
+      code = AF_ERR_URL;
+      return false;
+    }
+    requestLen = len;
+    reused = kept;
+    kept = false;
+    enter(reused ? afSending : afResolving, nowMillis);
+    return true;
+  }
+
+  /**
+   * @brief Do the next slice of work
+   *
+   * @param nowMillis The current time (millis())
+   */
+  void run(unsigned long nowMillis) {
+    int8_t r;
+    switch (phase) {
+      case afIdle:
+        return;
+      case afResolving:
+        r = link.resolve(host);
+        if (r == AF_LINK_DONE) {
+          enter(afConnecting, nowMillis);
+        } else if (r == AF_LINK_FAILED) {
+          fail(AF_ERR_RESOLVE, nowMillis);
+        }
+        break;
+      case afConnecting:
+        r = link.connect(port);
+        if (r == AF_LINK_DONE) {
+          enter(secure ? afHandshaking : afSending, nowMillis);
+        } else if (r == AF_LINK_FAILED) {
+          fail(AF_ERR_CONNECT, nowMillis);
+        }
+        break;
+      case afHandshaking:
+        r = link.handshake(host);
+        if (r == AF_LINK_DONE) {
+          nHandshakes++;
+          enter(afSending, nowMillis);
+        } else if (r == AF_LINK_FAILED) {
+          fail(AF_ERR_HANDSHAKE, nowMillis);
+        }
+        break;
+      case afSending:
+        send(nowMillis);
+        break;
+      case afReadingHeaders:
+      case afReadingBody:
+        receive(nowMillis);
+        break;
+      default:
+        break;
+    }
+    if (phase != afIdle && nowMillis - phaseMillis > timeouts[phase]) {
+      fail(AF_ERR_TIMEOUT, nowMillis);
+    }
+  }
+
+  /**
+   * @brief Whether a fetch is under way, i.e., whether run() should be called again soon
+   */
+  bool busy() {
+    return phase != afIdle;
+  }
+
+  /**
+   * @brief Abandon the fetch under way, if any, closing its connection. status() becomes
+   *        AF_ERR_CANCELLED.
+   */
+  void cancel() {
+    if (busy()) {
+      link.stop();
+      kept = false;
+      failedPhase = phase;
+      phase = afIdle;
+      code = AF_ERR_CANCELLED;
+      release();
+    }
+  }
+
+  /**
+   * @brief Close the connection kept for the next fetch, if there is one, e.g., because a
+   *        batch of fetches is done. Doesn't affect a fetch under way.
+   */
+  void close() {
+    if (!busy() && kept) {
+      link.stop();
+      kept = false;
+    }
+  }
+
+  /**
+   * @brief Free the body of the last fetch
+   */
+  void release() {
+    free(body);
+    body = nullptr;
+    bodyCap = 0;
+    bodyLen = 0;
+  }
+
+  /**
+   * @brief How the last fetch went: its HTTP status code if it got a whole response; one of the
+   *        AF_ERR_* values if it didn't; 0 while it's under way or if there's been none
+   */
+  int16_t status() {
+    return code;
+  }
+
+  /**
+   * @brief For a fetch that failed, the phase it failed in
+   */
+  af_phase_t failedIn() {
+    return failedPhase;
+  }
+
+  /**
+   * @brief The body of the last fetch, NUL-terminated; "" if there's none
+   */
+  const uint8_t *data() {
+    return body == nullptr ? (const uint8_t *)"" : body;
+  }
+
+  /**
+   * @brief The body of the last fetch as text
+   */
+  const char *text() {
+    return (const char *)data();
+  }
+
+  /**
+   * @brief The size of the body of the last fetch
+   */
+  size_t size() {
+    return bodyLen;
+  }
+
+  /**
+   * @brief The number of TLS handshakes done so far
+   */
+  uint32_t handshakes() {
+    return nHandshakes;
+  }
+
+  /**
+   * @brief Set the timeout for a phase of a fetch
+   *
+   * @param p         The phase
+   * @param millis    The timeout (millis())
+   */
+  void setTimeout(af_phase_t p, unsigned long millis) {
+    if (p != afIdle && p < afPhases) {
+      timeouts[p] = millis;
+    }
+  }
+
+  /**
+   * @brief Set how long after a fetch to keep its connection for the next one (millis()); 0
+   *        means don't
+   */
+  void setKeep(unsigned long millis) {
+    keepMillis = millis;
+  }
+
+  /**
+   * @brief A few words about a status() value
+   */
+  static const char *statusToString(int16_t status) {
+    static const char *errs[] = {"ok", "bad URL", "name didn't resolve", "couldn't connect", "TLS handshake failed",
+      "connection lost", "not HTTP", "body too big", "out of memory", "timed out", "cancelled"};
+    return status > 0 ? "HTTP response" : status < AF_ERR_CANCELLED ? "unknown" : errs[-status];
+  }
+
+  /**
+   * @brief The name of a phase
+   */
+  static const char *phaseToString(af_phase_t p) {
+    static const char *names[afPhases] =
+      {"idle", "resolving", "connecting", "handshaking", "sending", "reading headers", "reading body"};
+    return p < afPhases ? names[p] : "unknown";
+  }
+
+private:
+  enum af_body_t : uint8_t {afbLength, afbChunkSize, afbChunkData, afbChunkEnd, afbTrailer, afbToClose};
+  Link &link;                               // What supplies the connection
+  af_phase_t phase;                         // What the fetch is doing
+  af_phase_t failedPhase;                   // What it was doing when it failed
+  unsigned long phaseMillis;                // When the phase started or, reading the response, last made progress (millis())
+  unsigned long timeouts[afPhases];         // The timeout for each phase (millis())
+  unsigned long keepMillis;                 // How long to keep a connection for the next fetch
+  unsigned long lastMillis;                 // When the last fetch finished (millis())
+  char host[AF_HOST_SIZE];                  // The server
+  uint16_t port;                            //   its port
+  bool secure;                              //   and whether it's https
+  bool kept;                                // Whether the connection is open and can be used for the next fetch
+  bool reused;                              // Whether the fetch under way is on a kept connection
+  bool gotAny;                              // Whether any of the response has arrived
+  bool closeAfter;                          // Whether the server will close the connection after the response
+  char request[AF_REQUEST_SIZE];            // The request
+  uint16_t requestLen;                      //   its length
+  uint16_t sent;                            //   and how much of it has been written
+  char line[AF_LINE_SIZE];                  // The response header (or chunk size or trailer) line being read
+  uint8_t lineLen;                          //   its length so far
+  bool statusLine;                          // Whether line is the status line
+  int16_t httpStatus;                       // The response's status code
+  bool chunked;                             // Whether the body is chunked
+  bool haveLength;                          // Whether there's a Content-Length
+  size_t contentLength;                     //   and what it is
+  af_body_t bodyMode;                       // Where we are in reading the body
+  size_t remaining;                         // The body (or chunk) bytes yet to come
+  size_t limit;                             // The most body bytes to accept
+  uint8_t *body;                            // The body
+  size_t bodyCap;                           //   the size of its buffer
+  size_t bodyLen;                           //   and its length so far
+  int16_t code;                             // status()
+  uint32_t nHandshakes;                     // handshakes()
+  uint8_t in[AF_READ_SIZE];                 // What's been read from the connection
+
+  /**
+   * @brief Go on to the next phase
+   */
+  void enter(af_phase_t p, unsigned long nowMillis) {
+    phase = p;
+    phaseMillis = nowMillis;
+    if (p == afSending) {
+      sent = 0;
+      gotAny = false;
+      lineLen = 0;
+      statusLine = true;
+      httpStatus = 0;
+      chunked = false;
+      haveLength = false;
+      closeAfter = false;
+    }
+  }
+
+  /**
+   * @brief The fetch failed; unless it was on a kept connection that the server had closed, in
+   *        which case try again on a new one
+   */
+  void fail(int16_t err, unsigned long nowMillis) {
+    link.stop();
+    kept = false;
+    if (reused && !gotAny && (err == AF_ERR_LOST || err == AF_ERR_TIMEOUT)) {
+      reused = false;
+      enter(afResolving, nowMillis);
+      return;
+    }
+    failedPhase = phase;
+    phase = afIdle;
+    code = err;
+    lastMillis = nowMillis;
+    release();
+  }
+
+  /**
+   * @brief The whole response is in
+   */
+  void finish(unsigned long nowMillis) {
+    phase = afIdle;
+    code = httpStatus;
+    lastMillis = nowMillis;
+    kept = !closeAfter && keepMillis > 0;
+    if (!kept) {
+      link.stop();
+    }
+  }
+
+  /**
+   * @brief Write what the connection will take of the request
+   */
+  void send(unsigned long nowMillis) {
+    int n = link.write((const uint8_t *)request + sent, requestLen - sent);
+    if (n < 0) {
+      fail(AF_ERR_LOST, nowMillis);
+      return;
+    }
+    sent += n;
+    if (sent == requestLen) {
+      enter(afReadingHeaders, nowMillis);
+    }
+  }
+
+  /**
+   * @brief Deal with what's arrived of the response
+   */
+  void receive(unsigned long nowMillis) {
+    int n = link.read(in, sizeof(in));
+    if (n == 0) {
+      return;
+    }
+    if (n < 0) {
+      if (phase == afReadingBody && bodyMode == afbToClose) {
+        finish(nowMillis);
+      } else {
+        fail(AF_ERR_LOST, nowMillis);
+      }
+      return;
+    }
+    gotAny = true;
+    phaseMillis = nowMillis;
+    int i = 0;
+    while (i < n && phase == afReadingHeaders) {
+      headerByte(in[i++], nowMillis);
+    }
+    while (i < n && phase == afReadingBody) {
+      i += bodyBytes(in + i, n - i, nowMillis);
+    }
+    if (i < n && phase == afIdle && kept) {
+      link.stop();                          // There's more than the response; don't trust the connection
+      kept = false;
+    }
+  }
+
+  /**
+   * @brief Add c to the line being read
+   *
+   * @return true   It ended the line
+   * @return false  It didn't
+   */
+  bool lineByte(uint8_t c) {
+    if (c == '\n') {
+      while (lineLen > 0 && line[lineLen - 1] == '\r') {
+        lineLen--;
+      }
+      line[lineLen] = '\0';
+      return true;
+    }
+    if (lineLen < AF_LINE_SIZE - 1) {
+      line[lineLen++] = (char)c;
+    }
+    return false;
+  }
+
+  /**
+   * @brief Deal with the next byte of the response header
+   */
+  void headerByte(uint8_t c, unsigned long nowMillis) {
+    if (!lineByte(c)) {
+      return;
+    }
+    uint8_t len = lineLen;
+    lineLen = 0;
+    if (statusLine) {
+      int minor, status;
+      if (sscanf(line, "HTTP/1.%d %d", &minor, &status) != 2 || status < 100 || status > 999) {
+        fail(AF_ERR_RESPONSE, nowMillis);
+        return;
+      }
+      httpStatus = status;
+      closeAfter = minor == 0;
+      statusLine = false;
+      return;
+    }
+    if (len > 0) {
+      if (strncasecmp(line, "Content-Length:", 15) == 0) {
+        haveLength = true;
+        contentLength = strtoul(line + 15, nullptr, 10);
+      } else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0) {
+        chunked = strstr(line + 18, "chunked") != nullptr;
+      } else if (strncasecmp(line, "Connection:", 11) == 0) {
+        closeAfter = strstr(line + 11, "close") != nullptr || strstr(line + 11, "Close") != nullptr;
+      }
+      return;
+    }
+
+    // The blank line at the end of the header
+    if (httpStatus < 200) {                 // 1xx: the real response follows
+      statusLine = true;
+      return;
+    }
+    enter(afReadingBody, nowMillis);
+    if (httpStatus == 204 || httpStatus == 304) {
+      finish(nowMillis);
+    } else if (chunked) {
+      bodyMode = afbChunkSize;
+    } else if (haveLength) {
+      if (contentLength > limit) {
+        fail(AF_ERR_TOO_BIG, nowMillis);
+      } else if (grow(contentLength + 1, nowMillis)) {
+        bodyMode = afbLength;
+        remaining = contentLength;
+        if (remaining == 0) {
+          finish(nowMillis);
+        }
+      }
+    } else {
+      bodyMode = afbToClose;
+      closeAfter = true;
+    }
+  }
+
+  /**
+   * @brief Deal with the next bytes of the response body
+   *
+   * @return int  The number of them dealt with
+   */
+  int bodyBytes(const uint8_t *p, int n, unsigned long nowMillis) {
+    size_t take;
+    switch (bodyMode) {
+      case afbLength:
+      case afbChunkData:
+        take = (size_t)n < remaining ? n : remaining;
+        if (!append(p, take, nowMillis)) {
+          return n;
+        }
+        remaining -= take;
+        if (remaining == 0) {
+          if (bodyMode == afbLength) {
+            finish(nowMillis);
+          } else {
+            bodyMode = afbChunkEnd;
+          }
+        }
+        return take;
+      case afbToClose:
+        append(p, n, nowMillis);
+        return n;
+      case afbChunkSize:
+        if (lineByte(*p)) {
+          lineLen = 0;
+          remaining = strtoul(line, nullptr, 16);
+          bodyMode = remaining == 0 ? afbTrailer : afbChunkData;
+        }
+        return 1;
+      case afbChunkEnd:
+        if (lineByte(*p)) {
+          lineLen = 0;
+          bodyMode = afbChunkSize;
+        }
+        return 1;
+      case afbTrailer:
+        if (lineByte(*p)) {
+          bool blank = lineLen == 0;
+          lineLen = 0;
+          if (blank) {
+            finish(nowMillis);
+          }
+        }
+        return 1;
+    }
+    return n;
+  }
+
+  /**
+   * @brief Add n bytes to the body, growing its buffer if need be
+   *
+   * @return true   Did it
+   * @return false  Didn't; the fetch has failed
+   */
+  bool append(const uint8_t *p, size_t n, unsigned long nowMillis) {
+    if (bodyLen + n > limit) {
+      fail(AF_ERR_TOO_BIG, nowMillis);
+      return false;
+    }
+    if (bodyLen + n + 1 > bodyCap) {
+      size_t cap = bodyCap + AF_GROW_SIZE;
+      cap = cap < bodyLen + n + 1 ? bodyLen + n + 1 : cap;
+      if (!grow(cap > limit + 1 ? limit + 1 : cap, nowMillis)) {
+        return false;
+      }
+    }
+    memcpy(body + bodyLen, p, n);
+    bodyLen += n;
+    body[bodyLen] = '\0';
+    return true;
+  }
+
+  /**
+   * @brief Make the body's buffer cap bytes
+   *
+   * @return true   Did it
+   * @return false  Couldn't; the fetch has failed
+   */
+  bool grow(size_t cap, unsigned long nowMillis) {
+    uint8_t *b = (uint8_t *)realloc(body, cap);
+    if (b == nullptr) {
+      fail(AF_ERR_MEMORY, nowMillis);
+      return false;
+    }
+    if (body == nullptr) {
+      b[0] = '\0';
+    }
+    body = b;
+    bodyCap = cap;
+    return true;
+  }
+};
@@ -0,0 +1,268 @@
+/****
+ *
+ *  EspLink.cpp
+ *  Part of the "AsyncFetch" library for Arduino. Version 0.1.0
+ *
+ * See EspLink.h for details
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ *
+ ****/
+
+#include <lwip/sockets.h>
+#include <lwip/dns.h>
+#include <lwip/tcpip.h>
+#include "esp_crt_bundle.h"
+#include "EspLink.h"
+
+struct el_dns_call_t {                      // What's handed to lwIP's task to start a lookup
+  struct tcpip_api_call_data call;          //   What tcpip_api_call() needs; must be first
+  const char *host;                         //   The host to look up
+  ip_addr_t *addr;                          //   Where the address goes if lwIP has it already
+  void *arg;                                //   The EspLink doing the lookup
+  dns_found_callback found;                 //   Its callback
+};
+
+/**
+ * @brief Start a lookup. lwIP's raw API isn't thread safe, so this is run in lwIP's task.
+ */
+static err_t dnsStart(struct tcpip_api_call_data *data) {
+  el_dns_call_t *c = (el_dns_call_t *)data;
+  return dns_gethostbyname(c->host, c->addr, c->found, c->arg);
+}
+
+/***
+ * EspLink()
+ ***/
+EspLink::EspLink() {
+  caBundle = nullptr;
+  dns = elDnsNone;
+  dnsHost[0] = '\0';
+  fd = -1;
+  tlsUp = false;
+  lastTlsError = 0;
+}
+
+/***
+ * ~EspLink()
+ ***/
+EspLink::~EspLink() {
+  stop();
+}
+
+/***
+ * setCACertBundle(bundle)
+ ***/
+void EspLink::setCACertBundle(const uint8_t *bundle) {
+  caBundle = bundle;
+}
+
+/***
+ * resolve(host)
+ ***/
+int8_t EspLink::resolve(const char *host) {
+  if (dns == elDnsNone) {
+    strncpy(dnsHost, host, sizeof(dnsHost) - 1);
+    dnsHost[sizeof(dnsHost) - 1] = '\0';
+    dns = elDnsWaiting;
+    el_dns_call_t c;
+    c.host = dnsHost;
+    c.addr = &addr;
+    c.arg = this;
+    c.found = dnsFound;
+    err_t err = tcpip_api_call(dnsStart, &c.call);
+    if (err == ERR_OK) {
+      dns = elDnsDone;                      // lwIP had it already
+    } else if (err != ERR_INPROGRESS) {
+      dns = elDnsFailed;
+    }
+  }
+  return dns == elDnsDone ? AF_LINK_DONE : dns == elDnsFailed ? AF_LINK_FAILED : AF_LINK_AGAIN;
+}
+
+/***
+ * connect(port)
+ ***/
+int8_t EspLink::connect(uint16_t port) {
+  if (fd < 0) {
+    if (dns != elDnsDone || !IP_IS_V4(&addr)) {
+      return AF_LINK_FAILED;
+    }
+    fd = lwip_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (fd < 0) {
+      return AF_LINK_FAILED;
+    }
+    int one = 1;
+    lwip_setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    lwip_fcntl(fd, F_SETFL, lwip_fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    sa.sin_addr.s_addr = ip_addr_get_ip4_u32(&addr);
+    if (lwip_connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 && errno != EINPROGRESS) {
+      stop();
+      return AF_LINK_FAILED;
+    }
+  }
+  fd_set wset;
+  FD_ZERO(&wset);
+  FD_SET(fd, &wset);
+  struct timeval tv = {0, 0};
+  int n = lwip_select(fd + 1, nullptr, &wset, nullptr, &tv);
+  if (n == 0) {
+    return AF_LINK_AGAIN;
+  }
+  int err = 0;
+  socklen_t len = sizeof(err);
+  if (n < 0 || lwip_getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+    stop();
+    return AF_LINK_FAILED;
+  }
+  return AF_LINK_DONE;
+}
+
+/***
+ * handshake(host)
+ ***/
+int8_t EspLink::handshake(const char *host) {
+  int ret;
+  if (!tlsUp) {
+    mbedtls_ssl_init(&ssl);
+    mbedtls_ssl_config_init(&conf);
+    mbedtls_ctr_drbg_init(&drbg);
+    mbedtls_entropy_init(&entropy);
+    tlsUp = true;
+    net.fd = fd;
+    if ((ret = mbedtls_ctr_drbg_seed(&drbg, mbedtls_entropy_func, &entropy, nullptr, 0)) != 0 ||
+      (ret = mbedtls_ssl_config_defaults(&conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT)) != 0) {
+      lastTlsError = ret;
+      stop();
+      return AF_LINK_FAILED;
+    }
+    mbedtls_ssl_conf_authmode(&conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+    mbedtls_ssl_conf_rng(&conf, mbedtls_ctr_drbg_random, &drbg);
+    arduino_esp_crt_bundle_set(caBundle);
+    if ((ret = arduino_esp_crt_bundle_attach(&conf)) != 0 ||
+      (ret = mbedtls_ssl_setup(&ssl, &conf)) != 0 ||
+      (ret = mbedtls_ssl_set_hostname(&ssl, host)) != 0) {
+      lastTlsError = ret;
+      stop();
+      return AF_LINK_FAILED;
+    }
+    mbedtls_ssl_set_bio(&ssl, &net, mbedtls_net_send, mbedtls_net_recv, nullptr);
+  }
+  if (ssl.state == MBEDTLS_SSL_HANDSHAKE_OVER) {
+    return AF_LINK_DONE;
+  }
+  ret = mbedtls_ssl_handshake_step(&ssl);
+  if (ret == 0) {
+    return ssl.state == MBEDTLS_SSL_HANDSHAKE_OVER ? AF_LINK_DONE : AF_LINK_AGAIN;
+  }
+  if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+    return AF_LINK_AGAIN;
+  }
+  lastTlsError = ret;
+  stop();
+  return AF_LINK_FAILED;
+}
+
+/***
+ * read(buf, len)
+ ***/
+int EspLink::read(uint8_t *buf, size_t len) {
+  if (fd < 0) {
+    return -1;
+  }
+  int n;
+  if (tlsUp) {
+    n = mbedtls_ssl_read(&ssl, buf, len);
+    if (n == MBEDTLS_ERR_SSL_WANT_READ || n == MBEDTLS_ERR_SSL_WANT_WRITE) {
+      return 0;
+    }
+  } else {
+    n = lwip_recv(fd, buf, len, MSG_DONTWAIT);
+    if (n < 0 && (errno == EWOULDBLOCK || errno == EAGAIN)) {
+      return 0;
+    }
+  }
+  return n > 0 ? n : -1;                    // 0 is the server closing the connection
+}
+
+/***
+ * write(buf, len)
+ ***/
+int EspLink::write(const uint8_t *buf, size_t len) {
+  if (fd < 0) {
+    return -1;
+  }
+  int n;
+  if (tlsUp) {
+    n = mbedtls_ssl_write(&ssl, buf, len);
+    if (n == MBEDTLS_ERR_SSL_WANT_READ || n == MBEDTLS_ERR_SSL_WANT_WRITE) {
+      return 0;
+    }
+  } else {
+    n = lwip_send(fd, buf, len, MSG_DONTWAIT);
+    if (n < 0 && (errno == EWOULDBLOCK || errno == EAGAIN)) {
+      return 0;
+    }
+  }
+  return n >= 0 ? n : -1;
+}
+
+/***
+ * stop()
+ ***/
+void EspLink::stop() {
+  freeTls();
+  if (fd >= 0) {
+    lwip_close(fd);
+    fd = -1;
+  }
+  dns = elDnsNone;                          // A late answer to the lookup will be ignored
+}
+
+/***
+ * tlsError()
+ ***/
+int EspLink::tlsError() {
+  return lastTlsError;
+}
+
+/***
+ * cipherSuite()
+ ***/
+const char *EspLink::cipherSuite() {
+  return tlsUp && ssl.state == MBEDTLS_SSL_HANDSHAKE_OVER ? mbedtls_ssl_get_ciphersuite(&ssl) : "none";
+}
+
+/***
+ * dnsFound(name, ipaddr, arg)
+ ***/
+void EspLink::dnsFound(const char *name, const ip_addr_t *ipaddr, void *arg) {
+  EspLink *link = (EspLink *)arg;
+  if (link->dns != elDnsWaiting || strcmp(name, link->dnsHost) != 0) {
+    return;                                 // An answer to a lookup that's been abandoned
+  }
+  if (ipaddr != nullptr) {
+    link->addr = *ipaddr;
+  }
+  link->dns = ipaddr == nullptr ? elDnsFailed : elDnsDone;
+}
+
+/***
+ * freeTls()
+ ***/
+void EspLink::freeTls() {
+  if (tlsUp) {
+    mbedtls_ssl_free(&ssl);
+    mbedtls_ssl_config_free(&conf);
+    mbedtls_ctr_drbg_free(&drbg);
+    mbedtls_entropy_free(&entropy);
+    tlsUp = false;
+  }
+}
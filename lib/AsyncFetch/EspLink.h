@@ -0,0 +1,85 @@
+/****
+ *
+ *  EspLink.h
+ *  Part of the "AsyncFetch" library for Arduino. Version 0.1.0
+ *
+ * An EspLink is the connection an AsyncFetch uses on the device: a TCP connection on a
+ * non-blocking lwIP socket, with mbedTLS on top of it for https. Nothing it does waits. The
+ * host name is looked up with lwIP's DNS client, which calls back when the answer comes; the
+ * connection is started and then polled with select() until it's made; and the TLS handshake is
+ * taken one step (one message, more or less) at a time, with mbedTLS reading and writing the
+ * socket without blocking. The server's certificate is checked against a CA bundle in the form
+ * WiFiClientSecure::setCACertBundle() takes (see tools/cabundle.cpp).
+ *
+ * One step of the handshake can't be split: the one in which the key exchange's arithmetic is
+ * done takes as long as it takes.
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#pragma once
+
+#include <Arduino.h>
+#include <lwip/ip_addr.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/entropy.h>
+#include "AsyncFetch.h"
+
+class EspLink {
+public:
+  /**
+   * @brief Construct a new EspLink object
+   */
+  EspLink();
+
+  ~EspLink();
+
+  /**
+   * @brief Set the CA bundle against which servers' certificates are checked
+   *
+   * @param bundle  The bundle; it must stay put for as long as the EspLink is used
+   */
+  void setCACertBundle(const uint8_t *bundle);
+
+  // The Link methods AsyncFetch uses (see AsyncFetch.h)
+  int8_t resolve(const char *host);
+  int8_t connect(uint16_t port);
+  int8_t handshake(const char *host);
+  int read(uint8_t *buf, size_t len);
+  int write(const uint8_t *buf, size_t len);
+  void stop();
+
+  /**
+   * @brief The mbedTLS error code from the last handshake that failed; 0 if none has
+   */
+  int tlsError();
+
+  /**
+   * @brief The cipher suite the server picked, e.g., "TLS-ECDHE-RSA-WITH-AES-128-GCM-SHA256";
+   *        "none" if there's no TLS connection
+   */
+  const char *cipherSuite();
+
+private:
+  enum el_dns_t : uint8_t {elDnsNone, elDnsWaiting, elDnsDone, elDnsFailed};
+  static void dnsFound(const char *name, const ip_addr_t *ipaddr, void *arg);
+  void freeTls();
+
+  const uint8_t *caBundle;                  // The CA bundle
+  volatile el_dns_t dns;                    // How the lookup is going; dnsFound() sets it from lwIP's task
+  char dnsHost[AF_HOST_SIZE];               // The host being looked up
+  ip_addr_t addr;                           //   and its address
+  int fd;                                   // The socket; -1 if none
+  bool tlsUp;                               // Whether the mbedTLS contexts are set up
+  int lastTlsError;                         // tlsError()
+  mbedtls_net_context net;                  // The socket, as mbedTLS sees it
+  mbedtls_ssl_context ssl;                  // The TLS session
+  mbedtls_ssl_config conf;                  //   its configuration
+  mbedtls_ctr_drbg_context drbg;            //   its random number generator
+  mbedtls_entropy_context entropy;          //   and its entropy source
+};
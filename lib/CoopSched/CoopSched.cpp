@@ -0,0 +1,137 @@
+/****
+ *
+ * CoopSched.cpp
+ * Part of the "CoopSched" library for Arduino. Version 0.1.0
+ *
+ * See CoopSched.h for details
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ * 
+ ****/
+
+#include "CoopSched.h"
+
+/***
+ * Constructor
+ ***/
+CoopSched::CoopSched() {
+  nTasks = 0;
+}
+
+/***
+ * addTask(name, task, periodMillis, budgetMicros)
+ ***/
+int8_t CoopSched::addTask(const char *name, cs_task_t task, uint32_t periodMillis, uint32_t budgetMicros) {
+  if (nTasks >= CS_MAX_TASKS) {
+    return CS_NO_TASK;
+  }
+  task_t &t = tasks[nTasks];
+  t.func = task;
+  t.release = millis();
+  t.stats = {name, periodMillis, budgetMicros, 0, 0, 0, 0};
+  return nTasks++;
+}
+
+/***
+ * setPeriod(id, periodMillis)
+ ***/
+void CoopSched::setPeriod(int8_t id, uint32_t periodMillis) {
+  if (id >= 0 && id < nTasks) {
+    tasks[id].stats.periodMillis = periodMillis;
+  }
+}
+
+/***
+ * runNow(id)
+ ***/
+void CoopSched::runNow(int8_t id) {
+  if (id >= 0 && id < nTasks) {
+    tasks[id].release = millis();
+  }
+}
+
+/***
+ * run()
+ ***/
+uint32_t CoopSched::run() {
+  // Each pass, pick the released task with the earliest deadline and run it. Each task runs at 
+  // most once per call, so a task with a period of 0 can't starve the others.
+  bool ran[CS_MAX_TASKS] = {false};
+  while (true) {
+    unsigned long now = millis();
+    int8_t next = CS_NO_TASK;
+    long nextSlack = 0;
+    for (uint8_t i = 0; i < nTasks; i++) {
+      // Compare by slack (time left until the deadline) so millis() rollover does no harm
+      long slack = (long)(tasks[i].release + tasks[i].stats.periodMillis - now);
+      if (!ran[i] && (long)(now - tasks[i].release) >= 0 && (next == CS_NO_TASK || slack < nextSlack)) {
+        next = i;
+        nextSlack = slack;
+      }
+    }
+    if (next == CS_NO_TASK) {
+      break;
+    }
+    task_t &t = tasks[next];
+    if (nextSlack < 0 && t.stats.periodMillis != 0) {
+      t.stats.late++;
+    }
+    unsigned long startMicros = micros();
+    (*t.func)();
+    uint32_t took = micros() - startMicros;
+    ran[next] = true;
+    t.stats.runs++;
+    if (took > t.stats.budgetMicros) {
+      t.stats.overruns++;
+    }
+    if (took > t.stats.maxMicros) {
+      t.stats.maxMicros = took;
+    }
+    // Next release is one period on. If we've fallen more than a period behind, don't try to 
+    // make up the missed releases; just start over from now.
+    t.release += t.stats.periodMillis;
+    if ((long)(millis() - t.release) > (long)t.stats.periodMillis) {
+      t.release = millis();
+    }
+  }
+
+  // Work out how long until the next release
+  unsigned long now = millis();
+  uint32_t idle = CS_MAX_IDLE_MILLIS;
+  for (uint8_t i = 0; i < nTasks; i++) {
+    long wait = (long)(tasks[i].release - now);
+    if (wait <= 0 || tasks[i].stats.periodMillis == 0) {
+      return 0;
+    }
+    if ((uint32_t)wait < idle) {
+      idle = wait;
+    }
+  }
+  return idle;
+}
+
+/***
+ * getStats(id, stats)
+ ***/
+bool CoopSched::getStats(int8_t id, cs_stats_t *stats) {
+  if (id < 0 || id >= nTasks) {
+    return false;
+  }
+  *stats = tasks[id].stats;
+  return true;
+}
+
+/***
+ * resetStats()
+ ***/
+void CoopSched::resetStats() {
+  for (uint8_t i = 0; i < nTasks; i++) {
+    tasks[i].stats.runs = 0;
+    tasks[i].stats.late = 0;
+    tasks[i].stats.overruns = 0;
+    tasks[i].stats.maxMicros = 0;
+  }
+}
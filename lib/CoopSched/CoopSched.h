@@ -0,0 +1,121 @@
+/****
+ *
+ *  CoopSched.h
+ *  Part of the "CoopSched" library for Arduino. Version 0.1.0
+ *
+ * A CoopSched is a small cooperative scheduler meant to replace an Arduino loop() that calls 
+ * everything on every pass whether it has anything to do or not. Each subsystem registers one or 
+ * more tasks, each with a period and a time budget. Every period, a task is "released" and its 
+ * deadline is the end of that period. Each call to run() runs the released tasks, earliest 
+ * deadline first, and then returns the number of millis until the next release so the caller 
+ * can idle -- delay() or sleep -- until then instead of spinning.
+ * 
+ * Tasks are plain functions and run to completion; nothing is preempted. So that trouble shows 
+ * up, each task keeps counts of the times it:
+ * 
+ *   started late     It was still waiting to run when its deadline passed
+ *   overran          It took longer than its budget
+ * 
+ * along with its run count and its longest run time.
+ * 
+ * A task whose period is 0 is released on every call to run() and keeps the scheduler from 
+ * idling. That's for things like a stepper that's moving and needs to be polled as often as 
+ * possible. A task can change its own (or any other task's) period with setPeriod().
+ * 
+ * The typical way to use it is to make a CoopSched a global variable, add the tasks in setup(), 
+ * and have loop() call run() and delay() for the time it returns.
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ * 
+ ****/
+#pragma once
+
+#include <Arduino.h>
+
+// Some constants
+#define CS_MAX_TASKS            (8)         // The maximum number of tasks
+#define CS_MAX_IDLE_MILLIS      (1000)      // The longest run() will ever tell its caller to idle (millis())
+#define CS_NO_TASK              (-1)        // The id returned by addTask() when there's no room
+
+extern "C" {
+// A task: void task(void)
+typedef void (*cs_task_t)(void);
+}
+
+struct cs_stats_t {                         // Statistics for a task
+  const char *name;                         //  The name of the task
+  uint32_t periodMillis;                    //  The task's current period (millis())
+  uint32_t budgetMicros;                    //  The task's budget (micros())
+  uint32_t runs;                            //  The number of times it's run
+  uint32_t late;                            //  The number of times it started after its deadline
+  uint32_t overruns;                        //  The number of times it ran longer than its budget
+  uint32_t maxMicros;                       //  The longest it's taken to run (micros())
+};
+
+class CoopSched {
+public:
+  /**
+   * @brief Construct a new CoopSched object with no tasks
+   */
+  CoopSched();
+
+  /**
+   * @brief Add a task. It's released for the first time right away.
+   * 
+   * @param name          The name of the task (for statistics)
+   * @param task          The function to run
+   * @param periodMillis  How often to run it (millis()); 0 means every call to run()
+   * @param budgetMicros  How long it's expected to take, at most (micros())
+   * @return int8_t       The task's id; CS_NO_TASK if there's no room for it
+   */
+  int8_t addTask(const char *name, cs_task_t task, uint32_t periodMillis, uint32_t budgetMicros);
+
+  /**
+   * @brief Change a task's period. Takes effect from the task's next release.
+   * 
+   * @param id            The task's id
+   * @param periodMillis  The new period (millis())
+   */
+  void setPeriod(int8_t id, uint32_t periodMillis);
+
+  /**
+   * @brief Release a task right away, regardless of its period
+   * 
+   * @param id  The task's id
+   */
+  void runNow(int8_t id);
+
+  /**
+   * @brief Run the tasks that have been released, earliest deadline first.
+   * 
+   * @return uint32_t The number of millis until the next task is released; 0 if one already has been
+   */
+  uint32_t run();
+
+  /**
+   * @brief Get the statistics for a task
+   * 
+   * @param id      The task's id
+   * @param stats   Where to put them
+   * @return true   Got them
+   * @return false  There's no such task
+   */
+  bool getStats(int8_t id, cs_stats_t *stats);
+
+  /**
+   * @brief Zero all the tasks' counters
+   */
+  void resetStats();
+
+private:
+  struct task_t {                           // What we know about a task
+    cs_task_t func;                         //  Its function
+    unsigned long release;                  //  millis() when it's next released
+    cs_stats_t stats;                       //  Its statistics, which include its period and budget
+  };
+  task_t tasks[CS_MAX_TASKS];               // The tasks
+  uint8_t nTasks;                           // How many there are
+};
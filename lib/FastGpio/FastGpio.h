@@ -0,0 +1,141 @@
+/****
+ *
+ *  FastGpio.h
+ *  Part of the "FastGpio" library for Arduino. Version 0.1.0
+ *
+ * digitalWrite() is convenient, but every call looks up the pin, checks it and works out which 
+ * register and bit to use before it does the one store that actually changes the pin. For pins 
+ * that get written over and over -- the tide clock's tick and tock pins, the water level display's 
+ * stepper phases -- that's wasted time. FastGpio does the lookup once, when the object is made, and 
+ * after that writing a pin is a single store to the ESP32's write-1-to-set or write-1-to-clear 
+ * output register.
+ * 
+ * There are two flavors:
+ * 
+ *   FastPin            One pin. The mask and register are worked out in the constructor.
+ *   FastPinGroup<n>    Up to eight pins that change together, like the phases of a stepper. All 
+ *                      2**n patterns are worked out in the constructor, so write(pattern) is one 
+ *                      store to clear the pins that should be off and one to set the ones that 
+ *                      should be on, no matter how many pins there are.
+ * 
+ * Neither does a pinMode(); do that once, as usual, before using them.
+ * 
+ * FastPinGroup's two stores aren't a single atomic update: for an instant the pins being turned off 
+ * are off and the ones being turned on aren't on yet. That's harmless for the half-step and 
+ * full-step stepper sequences, where each step changes one pin, or turns one off and one on.
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ * 
+ ****/
+#pragma once
+
+#include <Arduino.h>
+#include <soc/gpio_struct.h>  // The GPIO peripheral's registers (GPIO)
+
+class FastPin {
+public:
+  /**
+   * @brief Construct a new FastPin object
+   * 
+   * @param pin The GPIO pin number
+   */
+  constexpr FastPin(uint8_t pin) : mask(1UL << (pin & 0x1F)), bank(pin >> 5) {}
+
+  /**
+   * @brief Set the pin HIGH
+   */
+  inline void set() const {
+    if (bank == 0) {
+      GPIO.out_w1ts = mask;
+    } else {
+      GPIO.out1_w1ts.val = mask;
+    }
+  }
+
+  /**
+   * @brief Set the pin LOW
+   */
+  inline void clear() const {
+    if (bank == 0) {
+      GPIO.out_w1tc = mask;
+    } else {
+      GPIO.out1_w1tc.val = mask;
+    }
+  }
+
+  /**
+   * @brief Set the pin to the specified level
+   * 
+   * @param level HIGH (true) or LOW (false)
+   */
+  inline void write(bool level) const {
+    if (level) {
+      set();
+    } else {
+      clear();
+    }
+  }
+
+private:
+  uint32_t mask;                            // The pin's bit in its bank's registers
+  uint8_t bank;                             // 0 for pins 0..31, 1 for pins 32 and up
+};
+
+template <uint8_t N>
+class FastPinGroup {
+  static_assert(N > 0 && N <= 8, "A FastPinGroup has between 1 and 8 pins");
+public:
+  /**
+   * @brief Construct a new FastPinGroup object
+   * 
+   * @param pins The GPIO pin numbers. Bit i of the patterns passed to write() goes to pins[i].
+   */
+  FastPinGroup(const uint8_t (&pins)[N]) {
+    for (uint8_t i = 0; i < 2; i++) {
+      allMask[i] = 0;
+    }
+    for (uint8_t i = 0; i < N; i++) {
+      allMask[pins[i] >> 5] |= 1UL << (pins[i] & 0x1F);
+    }
+    for (uint16_t pattern = 0; pattern < (1U << N); pattern++) {
+      onMask[pattern][0] = 0;
+      onMask[pattern][1] = 0;
+      for (uint8_t i = 0; i < N; i++) {
+        if (pattern & (1U << i)) {
+          onMask[pattern][pins[i] >> 5] |= 1UL << (pins[i] & 0x1F);
+        }
+      }
+    }
+  }
+
+  /**
+   * @brief Set all the pins in the group at once
+   * 
+   * @param pattern The levels for the pins; bit i is the level for pins[i]
+   */
+  inline void write(uint8_t pattern) const {
+    const uint32_t *on = onMask[pattern & ((1U << N) - 1)];
+    if (allMask[0] != 0) {
+      GPIO.out_w1tc = allMask[0] & ~on[0];
+      GPIO.out_w1ts = on[0];
+    }
+    if (allMask[1] != 0) {
+      GPIO.out1_w1tc.val = allMask[1] & ~on[1];
+      GPIO.out1_w1ts.val = on[1];
+    }
+  }
+
+  /**
+   * @brief Set all the pins in the group LOW
+   */
+  inline void clear() const {
+    write(0);
+  }
+
+private:
+  uint32_t allMask[2];                      // All the group's pins, for each bank
+  uint32_t onMask[1 << N][2];               // For each pattern, the pins that are HIGH, for each bank
+};
@@ -0,0 +1,65 @@
+/****
+ *
+ *  EspFlash.cpp
+ *  Part of the "FlashLog" library for Arduino. Version 0.1.0
+ *
+ * See EspFlash.h for details
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ *
+ ****/
+
+#include "EspFlash.h"
+
+/***
+ * EspFlash()
+ ***/
+EspFlash::EspFlash() {
+  part = nullptr;
+}
+
+/***
+ * begin(label, subtype)
+ ***/
+bool EspFlash::begin(const char *label, uint8_t subtype) {
+  part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)subtype, label);
+  return part != nullptr;
+}
+
+/***
+ * size()
+ ***/
+uint32_t EspFlash::size() {
+  return part == nullptr ? 0 : part->size - part->size % FL_SECTOR_SIZE;
+}
+
+/***
+ * read(offset, buf, len)
+ ***/
+bool EspFlash::read(uint32_t offset, void *buf, size_t len) {
+  return part != nullptr && esp_partition_read(part, offset, buf, len) == ESP_OK;
+}
+
+/***
+ * write(offset, buf, len)
+ ***/
+bool EspFlash::write(uint32_t offset, const void *buf, size_t len) {
+  return part != nullptr && esp_partition_write(part, offset, buf, len) == ESP_OK;
+}
+
+/***
+ * erase(offset)
+ ***/
+bool EspFlash::erase(uint32_t offset) {
+  return part != nullptr && esp_partition_erase_range(part, offset, FL_SECTOR_SIZE) == ESP_OK;
+}
+
+/***
+ * micros()
+ ***/
+uint32_t EspFlash::micros() {
+  return ::micros();
+}
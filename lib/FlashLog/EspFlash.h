@@ -0,0 +1,49 @@
+/****
+ *
+ *  EspFlash.h
+ *  Part of the "FlashLog" library for Arduino. Version 0.1.0
+ *
+ * An EspFlash is the flash a FlashLog uses on the device: a data partition, read, written and
+ * erased through ESP-IDF's partition API. While the flash is being written or erased, the
+ * cache is off and nothing else runs, so a write of a page holds everything up for about a
+ * millisecond and erasing a sector for tens of milliseconds.
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#pragma once
+
+#include <Arduino.h>
+#include <esp_partition.h>
+#include "FlashLog.h"
+
+class EspFlash {
+public:
+  /**
+   * @brief Construct a new EspFlash object
+   */
+  EspFlash();
+
+  /**
+   * @brief Find the partition
+   *
+   * @param label   Its label
+   * @param subtype Its data subtype
+   * @return true   Found it
+   * @return false  There's no such partition
+   */
+  bool begin(const char *label, uint8_t subtype);
+
+  // The Flash methods FlashLog uses (see FlashLog.h)
+  uint32_t size();
+  bool read(uint32_t offset, void *buf, size_t len);
+  bool write(uint32_t offset, const void *buf, size_t len);
+  bool erase(uint32_t offset);
+  uint32_t micros();
+
+private:
+  const esp_partition_t *part;              // The partition; nullptr if begin() didn't find it
+};
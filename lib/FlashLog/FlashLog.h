@@ -0,0 +1,438 @@
+/****
+ *
+ *  FlashLog.h
+ *  Part of the "FlashLog" library for Arduino. Version 0.1.0
+ *
+ * A FlashLog is an append-only history of fixed-size binary records kept in a flash
+ * partition, for looking back at what a device has been doing after something's gone wrong.
+ * It's meant for a steady trickle of small records -- a few hundred a day -- kept for months
+ * without wearing the flash out or holding up everything else while it writes.
+ *
+ * The partition is a ring of 4 kB sectors, each with a 16-byte header and room for 255
+ * 16-byte records. Records are appended to the newest sector; when it's full, the oldest is
+ * erased and becomes the newest. So every sector is erased once each time round the ring, and
+ * the wear is spread evenly over the partition with no bookkeeping beyond each header's
+ * sequence number. Finding the newest sector at startup is a matter of reading the headers.
+ *
+ * Appended records are held in RAM until they fill the rest of the flash page (256 bytes) the
+ * next one goes in, and are then written with a single flash write. flush() writes them
+ * sooner, e.g., every so often, so no more than that much is lost if the power goes. Each
+ * record ends with a CRC-8 of the rest that's never 0xFF, so one a reset cut off part way
+ * through writing is recognized as damaged rather than believed, and so, all but one time in
+ * 256, is one garbled some other way.
+ *
+ * Records are read by their index, 0 being the oldest, whether they've been written yet or
+ * not. Finding a record is arithmetic, so reading the last few is as quick as reading any.
+ *
+ * What the records mean is up to the user: each has a kind, a time and three numbers.
+ *
+ * FlashLog is a template on the flash it uses, so the same code runs on the device (see
+ * EspFlash.h) and in tools/flashlog.cpp. A Flash has:
+ *
+ *   uint32_t size()                                    The size of the partition in bytes, a
+ *                                                      multiple of FL_SECTOR_SIZE
+ *   bool read(uint32_t offset, void *buf, size_t len)  Read len bytes at offset
+ *   bool write(uint32_t offset, const void *buf, size_t len)
+ *                                                      Write len bytes at offset, which have
+ *                                                      been erased since they were last written
+ *   bool erase(uint32_t offset)                        Erase the FL_SECTOR_SIZE bytes at offset
+ *                                                      (a multiple of FL_SECTOR_SIZE), making
+ *                                                      them all 0xFF
+ *   uint32_t micros()                                  A microsecond clock, for the statistics
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// Some constants
+#define FL_PARTITION_LABEL      "tatlog"        // The label of the flash partition holding the log
+#define FL_PARTITION_SUBTYPE    (0x41)          // The (custom) data subtype of that partition
+#define FL_MAGIC                (0x474C4654)    // "TFLG" as a little-endian uint32_t
+#define FL_SECTOR_SIZE          (4096)          // The unit of erasure
+#define FL_PAGE_SIZE            (256)           // The unit of writing
+#define FL_HEADER_SIZE          (16)            // sizeof(fl_header_t)
+#define FL_RECORD_SIZE          (16)            // sizeof(fl_record_t)
+#define FL_SECTOR_RECORDS       ((FL_SECTOR_SIZE - FL_HEADER_SIZE) / FL_RECORD_SIZE) // Records in a sector (255)
+#define FL_PAGE_RECORDS         (FL_PAGE_SIZE / FL_RECORD_SIZE) // The most records written at once (16)
+#define FL_RATED_ERASES         (100000)        // Erase cycles a sector of the flash is good for
+#define FL_UNWRITTEN            (0xFF)          // The kind of a record that hasn't been written (erased flash)
+
+struct fl_header_t {                            // The start of each sector
+  uint32_t magic;                               //  FL_MAGIC
+  uint32_t seq;                                 //  1 for the first sector the log used, and one more for each after
+  uint32_t reserved;                            //  0
+  uint32_t check;                               //  ~seq; a header torn by a reset doesn't have it
+};
+
+struct fl_record_t {                            // A record
+  uint32_t time;                                //  POSIX time
+  int32_t b;                                    //  What it says (up to the user)
+  int32_t c;
+  int16_t a;
+  uint8_t kind;                                 //  What it's about (up to the user); never FL_UNWRITTEN
+  uint8_t check;                                //  CRC-8 of the other 15 bytes, never 0xFF; written last
+};
+static_assert(sizeof(fl_header_t) == FL_HEADER_SIZE && sizeof(fl_record_t) == FL_RECORD_SIZE, "Layout");
+
+struct fl_stats_t {                             // How the log is doing
+  uint32_t sectors;                             //  Sectors in the partition
+  uint32_t records;                             //  Records in the log, the ones not yet written included
+  uint32_t capacity;                            //  The most it's sure to hold
+  uint32_t cycles;                              //  Times round the ring (about the erases each sector has had)
+  uint32_t written;                             //  Records written since begin()
+  uint32_t writes;                              //  Flash writes since begin()
+  uint32_t erases;                              //  Sectors erased since begin()
+  uint32_t dropped;                             //  Records lost since begin() because the flash failed
+  uint32_t writeMicros;                         //  Total time taken by the writes
+  uint32_t maxWriteMicros;                      //   and the longest one
+  uint32_t eraseMicros;                         //  Total time taken by the erases
+  uint32_t maxEraseMicros;                      //   and the longest one
+};
+
+template <typename Flash>
+class FlashLog {
+public:
+  /**
+   * @brief Construct a new FlashLog object
+   *
+   * @param flash   The flash it's kept in
+   */
+  FlashLog(Flash &flash) : flash(flash) {
+    valid = false;
+    nSectors = 0;
+    memset(&stats, 0, sizeof(stats));
+  }
+
+  /**
+   * @brief Find the log in the flash, or start one if there isn't one. Reads every sector's
+   *        header, and the newest sector.
+   *
+   * @return true   Ready to go
+   * @return false  The flash has fewer than two sectors or isn't working
+   */
+  bool begin() {
+    valid = false;
+    nBuffered = 0;
+    nSectors = flash.size() / FL_SECTOR_SIZE;
+    if (nSectors < 2) {
+      return false;
+    }
+    headSeq = 0;
+    uint32_t seq;
+    for (uint32_t s = 0; s < nSectors; s++) {
+      if (sectorSeq(s, &seq) && seq > headSeq) {
+        head = s;
+        headSeq = seq;
+      }
+    }
+    if (headSeq == 0) {                         // A new log
+      chain = 0;
+      if (!open(0, 1)) {
+        return false;
+      }
+    } else {
+      for (chain = 1; chain < nSectors; chain++) {
+        if (!sectorSeq(before(chain), &seq) || seq != headSeq - chain) {
+          break;
+        }
+      }
+      headCount = 0;                            // Just past the last record that isn't blank
+      fl_record_t recs[FL_PAGE_RECORDS];
+      for (uint16_t slot = 0; slot < FL_SECTOR_RECORDS; slot += FL_PAGE_RECORDS) {
+        uint16_t n = FL_SECTOR_RECORDS - slot < FL_PAGE_RECORDS ? FL_SECTOR_RECORDS - slot : FL_PAGE_RECORDS;
+        if (!flash.read(slotOffset(head, slot), recs, n * FL_RECORD_SIZE)) {
+          return false;
+        }
+        for (uint16_t i = 0; i < n; i++) {
+          if (!blank(recs[i])) {
+            headCount = slot + i + 1;
+          }
+        }
+      }
+    }
+    valid = true;
+    return true;
+  }
+
+  /**
+   * @brief Whether begin() has found or started the log
+   */
+  bool isValid() {
+    return valid;
+  }
+
+  /**
+   * @brief Add a record to the log. It's held in RAM until there's a flash page's worth or
+   *        until flush(); when that fills the page, it's written now.
+   *
+   * @param kind    What it's about; anything but FL_UNWRITTEN
+   * @param time    When it happened (POSIX time)
+   * @param a       What it says
+   * @param b
+   * @param c
+   * @return true   Added it
+   * @return false  Didn't: the log isn't valid, the kind is FL_UNWRITTEN, or the flash failed
+   */
+  bool append(uint8_t kind, uint32_t time, int16_t a, int32_t b = 0, int32_t c = 0) {
+    if (!valid || kind == FL_UNWRITTEN) {
+      return false;
+    }
+    if (nBuffered == pageRoom() && !flush()) {  // Left over from a flush that failed
+      stats.dropped++;
+      return false;
+    }
+    fl_record_t &rec = buffer[nBuffered];
+    rec.time = time;
+    rec.b = b;
+    rec.c = c;
+    rec.a = a;
+    rec.kind = kind;
+    rec.check = recordCheck(rec);
+    nBuffered++;
+    return nBuffered < pageRoom() || flush();
+  }
+
+  /**
+   * @brief Write the records held in RAM to the flash. If the newest sector is full, the
+   *        oldest is erased first, which takes tens of milliseconds; otherwise it takes about
+   *        a millisecond.
+   *
+   * @return true   Did it, or there weren't any
+   * @return false  The flash failed
+   */
+  bool flush() {
+    if (!valid || nBuffered == 0) {
+      return valid;
+    }
+    if (headCount == FL_SECTOR_RECORDS && !open(before(nSectors - 1), headSeq + 1)) {
+      return false;
+    }
+    uint32_t start = flash.micros();
+    bool ok = flash.write(slotOffset(head, headCount), buffer, nBuffered * FL_RECORD_SIZE);
+    uint32_t took = flash.micros() - start;
+    stats.writes++;
+    stats.writeMicros += took;
+    stats.maxWriteMicros = took > stats.maxWriteMicros ? took : stats.maxWriteMicros;
+    headCount += nBuffered;                     // If it failed, the slots may be part written; don't use them again
+    if (ok) {
+      stats.written += nBuffered;
+    } else {
+      stats.dropped += nBuffered;
+    }
+    nBuffered = 0;
+    return ok;
+  }
+
+  /**
+   * @brief The number of records held in RAM, waiting to be written
+   */
+  uint16_t buffered() {
+    return nBuffered;
+  }
+
+  /**
+   * @brief The time of the oldest record waiting to be written; 0 if there aren't any
+   */
+  uint32_t bufferedSince() {
+    return nBuffered == 0 ? 0 : buffer[0].time;
+  }
+
+  /**
+   * @brief A serial number for the oldest record, index 0. Record i's serial number is 
+   *        firstSerial() + i, and stays the same while the indices shift under it: each time 
+   *        the oldest sector is erased to make room, every index drops by FL_SECTOR_RECORDS and 
+   *        this goes up by as much. (Emptying the log makes it jump ahead past any record it had.) 
+   *        So something working through the log a bit at a time can keep its place by serial 
+   *        number, and tell which records went before it got to them.
+   */
+  uint32_t firstSerial() {
+    return valid && chain > 0 ? (headSeq - (chain - 1)) * FL_SECTOR_RECORDS : 0;
+  }
+
+  /**
+   * @brief The number of records in the log, the ones waiting to be written included
+   */
+  uint32_t size() {
+    return valid ? (chain - 1) * FL_SECTOR_RECORDS + headCount + nBuffered : 0;
+  }
+
+  /**
+   * @brief Read consecutive records, oldest first
+   *
+   * @param index     The index of the first, 0 being the oldest record in the log
+   * @param recs      Where to put them
+   * @param n         How many to read at most
+   * @return uint16_t How many were read: as many as are together in one place, up to n; 0 if
+   *                  index is past the newest, or if the flash failed. A record that's been
+   *                  damaged is read as it is; see intact().
+   */
+  uint16_t read(uint32_t index, fl_record_t *recs, uint16_t n) {
+    uint32_t count = size();
+    if (index >= count || n == 0) {
+      return 0;
+    }
+    uint32_t back = count - 1 - index;          // How far back from the newest it is
+    if (back < nBuffered) {
+      uint16_t at = nBuffered - 1 - back;
+      n = n < nBuffered - at ? n : nBuffered - at;
+      memcpy(recs, &buffer[at], n * FL_RECORD_SIZE);
+      return n;
+    }
+    back -= nBuffered;
+    uint32_t sector, slot, used;
+    if (back < headCount) {
+      sector = head;
+      slot = headCount - 1 - back;
+      used = headCount;
+    } else {
+      back -= headCount;
+      sector = before(back / FL_SECTOR_RECORDS + 1);
+      slot = FL_SECTOR_RECORDS - 1 - back % FL_SECTOR_RECORDS;
+      used = FL_SECTOR_RECORDS;
+    }
+    n = n < used - slot ? n : used - slot;
+    return flash.read(slotOffset(sector, slot), recs, n * FL_RECORD_SIZE) ? n : 0;
+  }
+
+  /**
+   * @brief Read a record
+   *
+   * @param index   Its index, 0 being the oldest record in the log
+   * @param rec     Where to put it
+   * @return true   Did it
+   * @return false  There's no such record, or the flash failed
+   */
+  bool read(uint32_t index, fl_record_t *rec) {
+    return read(index, rec, 1) == 1;
+  }
+
+  /**
+   * @brief Empty the log. The newest sector is moved on to a fresh one, and the sequence
+   *        skips ahead so the old sectors aren't taken to be part of the log any more. Only
+   *        the one sector is erased.
+   *
+   * @return true   Did it
+   * @return false  The flash failed
+   */
+  bool clear() {
+    if (!valid) {
+      return false;
+    }
+    nBuffered = 0;
+    chain = 0;
+    if (!open(before(nSectors - 1), headSeq + nSectors + 1)) {
+      valid = false;                            // begin() will find what's left
+      return false;
+    }
+    return true;
+  }
+
+  /**
+   * @brief How the log is doing
+   */
+  fl_stats_t getStats() {
+    fl_stats_t answer = stats;
+    answer.sectors = nSectors;
+    answer.records = size();
+    answer.capacity = nSectors < 2 ? 0 : (nSectors - 1) * FL_SECTOR_RECORDS;
+    answer.cycles = nSectors == 0 ? 0 : (headSeq + nSectors - 1) / nSectors;
+    return answer;
+  }
+
+  /**
+   * @brief Whether a record is as it was written: not damaged, e.g., by a reset part way
+   *        through writing it
+   */
+  static bool intact(const fl_record_t &rec) {
+    return rec.kind != FL_UNWRITTEN && rec.check == recordCheck(rec);
+  }
+
+private:
+  // The sector n before the newest, going back round the ring
+  uint32_t before(uint32_t n) {
+    return (head + nSectors - n % nSectors) % nSectors;
+  }
+
+  // Where a sector's record slot is in the flash
+  static uint32_t slotOffset(uint32_t sector, uint32_t slot) {
+    return sector * FL_SECTOR_SIZE + FL_HEADER_SIZE + slot * FL_RECORD_SIZE;
+  }
+
+  // The number of records that fit between the next one to be written and the end of its page
+  uint16_t pageRoom() {
+    uint32_t at = headCount == FL_SECTOR_RECORDS ? slotOffset(0, 0) : slotOffset(0, headCount);
+    return (FL_PAGE_SIZE - at % FL_PAGE_SIZE) / FL_RECORD_SIZE;
+  }
+
+  // The sequence number in a sector's header, if it has a good one
+  bool sectorSeq(uint32_t sector, uint32_t *seq) {
+    fl_header_t h;
+    if (!flash.read(sector * FL_SECTOR_SIZE, &h, sizeof(h)) || h.magic != FL_MAGIC || h.check != ~h.seq || h.seq == 0) {
+      return false;
+    }
+    *seq = h.seq;
+    return true;
+  }
+
+  // Erase a sector and make it the newest, with sequence number seq
+  bool open(uint32_t sector, uint32_t seq) {
+    uint32_t start = flash.micros();
+    bool ok = flash.erase(sector * FL_SECTOR_SIZE);
+    uint32_t took = flash.micros() - start;
+    stats.erases++;
+    stats.eraseMicros += took;
+    stats.maxEraseMicros = took > stats.maxEraseMicros ? took : stats.maxEraseMicros;
+    fl_header_t h {FL_MAGIC, seq, 0, ~seq};
+    if (!ok || !flash.write(sector * FL_SECTOR_SIZE, &h, sizeof(h))) {
+      return false;
+    }
+    head = sector;
+    headSeq = seq;
+    headCount = 0;
+    chain = chain < nSectors ? chain + 1 : nSectors;
+    return true;
+  }
+
+  // Whether a record slot is as erased
+  static bool blank(const fl_record_t &rec) {
+    const uint8_t *p = (const uint8_t *)&rec;
+    for (size_t i = 0; i < sizeof(rec); i++) {
+      if (p[i] != 0xFF) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // The CRC-8 (polynomial 0x07) of a record, its check byte left out, with 0xFF made 0xFE
+  static uint8_t recordCheck(const fl_record_t &rec) {
+    const uint8_t *p = (const uint8_t *)&rec;
+    uint8_t crc = 0;
+    for (size_t i = 0; i < offsetof(fl_record_t, check); i++) {
+      crc ^= p[i];
+      for (int b = 0; b < 8; b++) {
+        crc = crc & 0x80 ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+      }
+    }
+    return crc == 0xFF ? 0xFE : crc;
+  }
+
+  Flash &flash;                                 // The flash the log is in
+  bool valid;                                   // Whether begin() worked
+  uint32_t nSectors;                            // The number of sectors in the flash
+  uint32_t head;                                // The newest sector
+  uint32_t headSeq;                             //   its sequence number
+  uint16_t headCount;                           //   and the number of records in it
+  uint32_t chain;                               // The number of sectors in the log, the newest included
+  fl_record_t buffer[FL_PAGE_RECORDS];          // The records waiting to be written
+  uint16_t nBuffered;                           //   and how many there are
+  fl_stats_t stats;                             // getStats()
+};
@@ -0,0 +1,117 @@
+/****
+ *
+ *  Metrics.cpp
+ *  Part of the "Metrics" library for Arduino. Version 0.1.0
+ *
+ * See Metrics.h for details
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ * 
+ ****/
+#include "Metrics.h"
+#include <stdio.h>
+#include <string.h>
+
+/***
+ * Constructor
+ ***/
+Metrics::Metrics() {
+  nMetrics = 0;
+  nCollectors = 0;
+}
+
+/***
+ * add(name, help, type, labels)
+ ***/
+int8_t Metrics::add(const char *name, const char *help, mt_type_t type, const char *labels) {
+  if (nMetrics >= MT_MAX_METRICS) {
+    return MT_NO_METRIC;
+  }
+  metrics[nMetrics] = {name, help, labels, type, 0.0, 0};
+  return nMetrics++;
+}
+
+/***
+ * inc(id, by)
+ ***/
+void Metrics::inc(int8_t id, double by) {
+  if (id >= 0 && id < nMetrics) {
+    metrics[id].value += by;
+  }
+}
+
+/***
+ * set(id, value)
+ ***/
+void Metrics::set(int8_t id, double value) {
+  if (id >= 0 && id < nMetrics) {
+    metrics[id].value = value;
+  }
+}
+
+/***
+ * observe(id, value)
+ ***/
+void Metrics::observe(int8_t id, double value) {
+  if (id >= 0 && id < nMetrics) {
+    metrics[id].value += value;
+    metrics[id].count++;
+  }
+}
+
+/***
+ * get(id)
+ ***/
+double Metrics::get(int8_t id) {
+  return id >= 0 && id < nMetrics ? metrics[id].value : 0.0;
+}
+
+/***
+ * attachCollector(collector)
+ ***/
+bool Metrics::attachCollector(mt_collector_t collector) {
+  if (nCollectors >= MT_MAX_COLLECTORS) {
+    return false;
+  }
+  collectors[nCollectors++] = collector;
+  return true;
+}
+
+/***
+ * render(buffer, size)
+ ***/
+size_t Metrics::render(char *buffer, size_t size) {
+  static const char *typeName[] = {"counter", "gauge", "summary"};
+  for (uint8_t i = 0; i < nCollectors; i++) {
+    (*collectors[i])();
+  }
+  size_t len = 0;
+  buffer[0] = '\0';
+  // Append to buffer, keeping track of how long the text would be if there were room for all of it
+  auto put = [&](int n) {
+    if (n > 0) {
+      len += n;
+    }
+  };
+  auto room = [&]() -> size_t { return len < size ? size - len : 0; };
+  auto at = [&]() -> char * { return len < size ? buffer + len : buffer + size - 1; };
+  for (uint8_t i = 0; i < nMetrics; i++) {
+    const metric_t &m = metrics[i];
+    if (i == 0 || strcmp(m.name, metrics[i - 1].name) != 0) {
+      put(snprintf(at(), room(), "# HELP %s %s\n# TYPE %s %s\n", m.name, m.help, m.name, typeName[m.type]));
+    }
+    const char *open = m.labels == nullptr ? "" : "{";
+    const char *labels = m.labels == nullptr ? "" : m.labels;
+    const char *close = m.labels == nullptr ? "" : "}";
+    if (m.type == mtSummary) {
+      put(snprintf(at(), room(), "%s_sum%s%s%s %.9g\n%s_count%s%s%s %u\n", 
+        m.name, open, labels, close, m.value, m.name, open, labels, close, m.count));
+    } else {
+      put(snprintf(at(), room(), "%s%s%s%s %.15g\n", m.name, open, labels, close, m.value));
+    }
+  }
+  return len;
+}
@@ -0,0 +1,119 @@
+/****
+ *
+ *  Metrics.h
+ *  Part of the "Metrics" library for Arduino. Version 0.1.0
+ *
+ * A Metrics is a small registry of counters, gauges and summaries that can render itself in the 
+ * Prometheus text exposition format (version 0.0.4), so that a fleet of devices can be scraped 
+ * for their health. Something like
+ * 
+ *   Metrics metrics;
+ *   int8_t fetches = metrics.add("tat_fetch_seconds", "Time taken by fetches.", mtSummary);
+ *   ...
+ *   metrics.observe(fetches, 0.84);
+ *   ...
+ *   size_t len = metrics.render(buffer, sizeof(buffer));
+ * 
+ * Several metrics can share a name as long as they have different labels (e.g., 
+ * "task=\"clock\"") and are added one right after the other; they're rendered under a single 
+ * HELP and TYPE. Values that are only known by asking something else -- the free heap, say -- 
+ * can be brought up to date by collectors, functions that render() calls before it does 
+ * anything else.
+ * 
+ * There's nothing Arduino-specific here, so the same code can be built and tried out on a 
+ * host. See MetricsHttp.h for the (non-blocking) HTTP server that goes with it.
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ * 
+ ****/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Some constants
+#define MT_MAX_METRICS          (48)        // The maximum number of metrics
+#define MT_MAX_COLLECTORS       (4)         // The maximum number of collectors
+#define MT_NO_METRIC            (-1)        // The id returned by add() when there's no room
+
+enum mt_type_t : uint8_t {mtCounter, mtGauge, mtSummary};  // The kinds of metric
+
+extern "C" {
+// A collector: void collector(void). Brings the metrics it knows about up to date.
+typedef void (*mt_collector_t)(void);
+}
+
+class Metrics {
+public:
+  /**
+   * @brief Construct a new, empty, Metrics object
+   */
+  Metrics();
+
+  /**
+   * @brief Add a metric
+   * 
+   * @param name    The metric's name, e.g., "tat_fetch_seconds". By convention, counters' 
+   *                names end in "_total"
+   * @param help    A short description
+   * @param type    mtCounter, mtGauge or mtSummary
+   * @param labels  The labels that go with it, e.g., "task=\"clock\"", or nullptr for none
+   * @return int8_t The metric's id, or MT_NO_METRIC if there's no room. Using MT_NO_METRIC as 
+   *                an id does nothing, harmlessly.
+   */
+  int8_t add(const char *name, const char *help, mt_type_t type, const char *labels = nullptr);
+
+  /**
+   * @brief Add to a counter (or gauge)
+   */
+  void inc(int8_t id, double by = 1);
+
+  /**
+   * @brief Set the value of a gauge (or counter, when something else does the counting)
+   */
+  void set(int8_t id, double value);
+
+  /**
+   * @brief Record an observation in a summary: add to its sum and increment its count
+   */
+  void observe(int8_t id, double value);
+
+  /**
+   * @brief Get a metric's value (a summary's sum)
+   */
+  double get(int8_t id);
+
+  /**
+   * @brief Add a collector to be called at the start of each render()
+   * 
+   * @return true   Added
+   * @return false  No room; see MT_MAX_COLLECTORS
+   */
+  bool attachCollector(mt_collector_t collector);
+
+  /**
+   * @brief Call the collectors and then render all the metrics in Prometheus text format
+   * 
+   * @param buffer  Where to put the text. It's always '\0' terminated.
+   * @param size    The size of buffer
+   * @return size_t The length of the text. If it's size or more, the text was truncated.
+   */
+  size_t render(char *buffer, size_t size);
+
+private:
+  struct metric_t {                         // A metric
+    const char *name;                       //  Its name
+    const char *help;                       //  Its description
+    const char *labels;                     //  Its labels; nullptr if none
+    mt_type_t type;                         //  What kind of metric it is
+    double value;                           //  Its value or, for a summary, the sum of the observations
+    uint32_t count;                         //  For a summary, the number of observations
+  };
+  metric_t metrics[MT_MAX_METRICS];         // The metrics
+  uint8_t nMetrics;                         // The number of them
+  mt_collector_t collectors[MT_MAX_COLLECTORS]; // The collectors
+  uint8_t nCollectors;                      // The number of them
+};
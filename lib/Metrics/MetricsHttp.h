@@ -0,0 +1,205 @@
+/****
+ *
+ *  MetricsHttp.h
+ *  Part of the "Metrics" library for Arduino. Version 0.1.0
+ *
+ * A MetricsHttp is a minimal HTTP/1.0 server for a Metrics registry. GET /metrics gets the 
+ * metrics in Prometheus text format; anything else gets a 404. It serves one connection at a 
+ * time and never waits for anything: each call to run() does one small slice of work -- accept 
+ * a connection, read what's arrived of the request, or write the next chunk of the response -- 
+ * and returns, so it can share a cooperative scheduler with things like stepper motors that 
+ * mustn't be kept waiting. The response is rendered into the caller-supplied buffer all at once, 
+ * when the request is complete, so what's scraped is a consistent set of values.
+ * 
+ * It's a template so that it can be built with whatever supplies the sockets: WiFiServer and 
+ * WiFiClient on the device; something built on POSIX sockets on a host (see 
+ * tools/metricsloop.cpp). Server must have a non-blocking Client available() that returns a 
+ * client that tests false if there's no connection waiting. Client must have connected(), 
+ * available(), read(), write(const uint8_t *, size_t) and stop().
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ * 
+ ****/
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include "Metrics.h"
+
+// Some constants
+#define MH_TIMEOUT_MILLIS       (2000)      // Give up on a connection that's made no progress for this long (millis())
+#define MH_CHUNK_SIZE           (1024)      // The most response bytes written per call to run()
+#define MH_MAX_READ             (256)       // The most request bytes read per call to run()
+#define MH_PATH_SIZE            (32)        // Room for the start of the request line
+
+template <typename Server, typename Client>
+class MetricsHttp {
+public:
+  /**
+   * @brief Construct a new MetricsHttp object
+   * 
+   * @param server      The listening server
+   * @param metrics     The metrics to serve
+   * @param buffer      Where to render the response body
+   * @param bufferSize  Its size
+   */
+  MetricsHttp(Server &server, Metrics &metrics, char *buffer, size_t bufferSize) :
+    server(server), metrics(metrics), body(buffer), bodySize(bufferSize) {
+    state = mhIdle;
+    served = 0;
+  }
+
+  /**
+   * @brief Do the next slice of work
+   * 
+   * @param nowMillis The current time (millis())
+   */
+  void run(unsigned long nowMillis) {
+    switch (state) {
+      case mhIdle:
+        client = server.available();
+        if (client) {
+          state = mhReading;
+          lastMillis = nowMillis;
+          requestLen = 0;
+          endMatch = 0;
+        }
+        return;
+      case mhReading:
+        if (!readRequest()) {
+          if (nowMillis - lastMillis > MH_TIMEOUT_MILLIS || !client.connected()) {
+            close();
+          }
+          return;
+        }
+        respond();
+        state = mhWriting;
+        lastMillis = nowMillis;
+        return;
+      case mhWriting:
+        if (!writeResponse(nowMillis) && nowMillis - lastMillis > MH_TIMEOUT_MILLIS) {
+          close();
+        }
+        return;
+    }
+  }
+
+  /**
+   * @brief Whether a connection is being dealt with, i.e., whether run() should be called 
+   *        again soon
+   */
+  bool busy() {
+    return state != mhIdle;
+  }
+
+  /**
+   * @brief The number of responses completely written so far
+   */
+  uint32_t responses() {
+    return served;
+  }
+
+private:
+  enum mh_state_t : uint8_t {mhIdle, mhReading, mhWriting};
+  Server &server;                           // The listening server
+  Metrics &metrics;                         // The metrics to serve
+  char *body;                               // Where the response body is rendered
+  size_t bodySize;                          // The size of body
+  Client client;                            // The connection being dealt with
+  mh_state_t state;                         // What we're doing with it
+  unsigned long lastMillis;                 // When it last made progress (millis())
+  char path[MH_PATH_SIZE];                  // The start of the request line
+  uint16_t requestLen;                      // The number of request bytes read
+  uint8_t endMatch;                         // How much of "\r\n\r\n" we've seen at the end of what's been read
+  char header[96];                          // The response header
+  size_t headerLen;                         // Its length
+  size_t bodyLen;                           // The length of the response body
+  size_t sent;                              // How much of header + body has been written
+  uint32_t served;                          // The number of responses written
+
+  /**
+   * @brief Read what's arrived of the request
+   * 
+   * @return true   The whole request header is in
+   * @return false  Not yet
+   */
+  bool readRequest() {
+    static const char end[] = "\r\n\r\n";
+    for (uint16_t n = 0; n < MH_MAX_READ && client.available() > 0; n++) {
+      int c = client.read();
+      if (c < 0) {
+        break;
+      }
+      if (requestLen < MH_PATH_SIZE - 1) {
+        path[requestLen] = (char)c;
+        path[requestLen + 1] = '\0';
+      }
+      requestLen++;
+      endMatch = c == end[endMatch] ? endMatch + 1 : (c == '\r' ? 1 : 0);
+      if (endMatch == 4) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /**
+   * @brief Work out the response to the request that's been read
+   */
+  void respond() {
+    bool isMetrics = strncmp(path, "GET /metrics ", 13) == 0 || strncmp(path, "GET /metrics\r", 13) == 0;
+    if (isMetrics) {
+      bodyLen = metrics.render(body, bodySize);
+      if (bodyLen >= bodySize) {
+        bodyLen = bodySize - 1;             // Truncated; better than nothing
+      }
+      headerLen = snprintf(header, sizeof(header), 
+        "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %u\r\n\r\n", (unsigned)bodyLen);
+    } else {
+      bodyLen = 0;
+      headerLen = snprintf(header, sizeof(header), "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+    }
+    sent = 0;
+  }
+
+  /**
+   * @brief Write the next chunk of the response; close the connection when it's all gone
+   * 
+   * @return true   Made progress
+   * @return false  Didn't
+   */
+  bool writeResponse(unsigned long nowMillis) {
+    size_t total = headerLen + bodyLen;
+    if (!client.connected()) {
+      close();
+      return true;
+    }
+    const char *from = sent < headerLen ? header + sent : body + (sent - headerLen);
+    size_t len = sent < headerLen ? headerLen - sent : total - sent;
+    if (len > MH_CHUNK_SIZE) {
+      len = MH_CHUNK_SIZE;
+    }
+    size_t n = client.write((const uint8_t *)from, len);
+    if (n == 0) {
+      return false;
+    }
+    sent += n;
+    lastMillis = nowMillis;
+    if (sent >= total) {
+      served++;
+      close();
+    }
+    return true;
+  }
+
+  /**
+   * @brief Close the connection and go back to waiting for the next one
+   */
+  void close() {
+    client.stop();
+    state = mhIdle;
+  }
+};
@@ -0,0 +1,321 @@
+/****
+ *
+ *  Profiler.cpp
+ *  Part of the "Profiler" library for Arduino. Version 0.1.0
+ *
+ * See Profiler.h for details
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ *
+ ****/
+
+#include "Profiler.h"
+#include <esp_heap_caps.h>
+#include <esp_debug_helpers.h>
+#include <soc/soc_memory_layout.h>
+#include <hal/cpu_hal.h>
+#include <freertos/xtensa_context.h>
+
+#define PR_TIMER_DIVIDER        (80)        // The timer's prescaler: 80 MHz APB clock to 1 MHz ticks
+
+Profiler *Profiler::active = nullptr;
+
+/***
+ * Profiler()
+ ***/
+Profiler::Profiler() {
+  timer = nullptr;
+  table = nullptr;
+  hz = PR_DEFAULT_HZ;
+  depth = PR_DEFAULT_DEPTH;
+  samples = 0;
+  dropped = 0;
+  stacks = 0;
+  cycles = 0;
+  maxCycles = 0;
+  sampledMillis = 0;
+  startMillis = 0;
+  nTasks = 0;
+  dumpSlot = PR_TABLE_SIZE;
+  dumpResume = false;
+}
+
+/***
+ * start(hz, depth)
+ ***/
+bool Profiler::start(uint32_t hz, uint8_t depth) {
+  if (hz < PR_MIN_HZ || hz > PR_MAX_HZ || depth < 1 || depth > PR_MAX_DEPTH) {
+    return false;
+  }
+  if (active == this) {
+    pause();
+  }
+  if (active != nullptr) {
+    return false;
+  }
+  if (table != nullptr && depth != this->depth) {
+    clear();
+  }
+  if (table == nullptr) {
+    table = (uint32_t *)heap_caps_calloc(PR_TABLE_SIZE * (depth + 2), sizeof(uint32_t),
+      MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (table == nullptr) {
+      return false;
+    }
+    this->depth = depth;
+    samples = 0;
+    dropped = 0;
+    stacks = 0;
+    cycles = 0;
+    maxCycles = 0;
+    sampledMillis = 0;
+    nTasks = 0;
+  }
+  this->hz = hz;
+  resume();
+  return timer != nullptr;
+}
+
+/***
+ * stop()
+ ***/
+void Profiler::stop() {
+  if (active == this) {
+    pause();
+  }
+}
+
+/***
+ * clear()
+ ***/
+void Profiler::clear() {
+  stop();
+  heap_caps_free(table);
+  table = nullptr;
+}
+
+/***
+ * isRunning()
+ ***/
+bool Profiler::isRunning() {
+  return timer != nullptr;
+}
+
+/***
+ * getStats()
+ ***/
+pr_stats_t Profiler::getStats() {
+  pr_stats_t answer;
+  answer.running = isRunning();
+  answer.hz = hz;
+  answer.depth = depth;
+  answer.samples = samples;
+  answer.dropped = dropped;
+  answer.stacks = stacks;
+  answer.millis = sampledMillis + (answer.running ? millis() - startMillis : 0);
+  answer.cycles = cycles;
+  answer.maxCycles = maxCycles;
+  return answer;
+}
+
+/***
+ * dump(out)
+ ***/
+void Profiler::dump(Print &out) {
+  dumpBegin(out);
+  while (dumpPage(out)) {
+  }
+}
+
+/***
+ * dumpBegin(out)
+ ***/
+void Profiler::dumpBegin(Print &out) {
+  if (dumpSlot == PR_TABLE_SIZE) {
+    dumpResume = isRunning();
+  }
+  if (dumpResume) {
+    pause();
+  }
+  pr_stats_t stats = getStats();
+  out.printf("prof: begin hz=%u depth=%u samples=%u dropped=%u stacks=%u millis=%u cycles=%llu mhz=%u\n",
+    stats.hz, stats.depth, stats.samples, stats.dropped, stats.stacks, stats.millis, stats.cycles,
+    getCpuFrequencyMhz());
+  dumpSlot = 0;
+}
+
+/***
+ * dumpPage(out)
+ ***/
+bool Profiler::dumpPage(Print &out) {
+  uint32_t stride = depth + 2;
+  uint8_t lines = 0;
+  while (table != nullptr && dumpSlot < PR_TABLE_SIZE && lines < PR_DUMP_PAGE_LINES) {
+    uint32_t *slot = table + dumpSlot++ * stride;
+    if (slot[0] == 0) {
+      continue;
+    }
+    // Task names can have blanks in them ("Tmr Svc"); the line is blank-separated
+    char name[PR_TASK_NAME_LEN];
+    strcpy(name, slot[1] < nTasks ? taskNames[slot[1]] : "?");
+    for (char *c = name; *c != '\0'; c++) {
+      *c = *c == ' ' ? '_' : *c;
+    }
+    out.printf("prof: %u %s", slot[0], name);
+    for (uint8_t d = 0; d < depth && slot[d + 2] != 0; d++) {
+      out.printf(" 0x%08x", slot[d + 2]);
+    }
+    out.print('\n');
+    lines++;
+  }
+  if (table != nullptr && dumpSlot < PR_TABLE_SIZE) {
+    return true;
+  }
+  out.print("prof: end\n");
+  dumpSlot = PR_TABLE_SIZE;
+  if (dumpResume) {
+    dumpResume = false;
+    resume();
+  }
+  return false;
+}
+
+/***
+ * onTimer()
+ ***/
+void IRAM_ATTR Profiler::onTimer() {
+  if (active != nullptr) {
+    active->sample();
+  }
+}
+
+/***
+ * sample()
+ ***/
+void IRAM_ATTR Profiler::sample() {
+  uint32_t startCycles = cpu_hal_get_cycle_count();
+  TaskHandle_t task = xTaskGetCurrentTaskHandle();
+  if (task == nullptr) {
+    return;
+  }
+
+  // The key: the task, then the addresses, innermost first, padded with 0s. On entry to the
+  // interrupt, the port saved the interrupted task's registers in a frame on its stack, spilled
+  // its register windows below that, and pointed the first word of its TCB, pxTopOfStack, at
+  // the frame. Each call's return address and stack pointer are in the four words below the
+  // stack pointer of the function it called.
+  uint32_t key[PR_MAX_DEPTH + 1];
+  key[0] = taskIndex(task);
+  XtExcFrame *frame = *(XtExcFrame **)task;
+  esp_backtrace_frame_t f;
+  memset(&f, 0, sizeof(f));
+  f.pc = frame->pc;
+  f.sp = frame->a1;
+  f.next_pc = frame->a0;
+  uint8_t n = 0;
+  key[++n] = f.pc;
+  if (esp_stack_ptr_is_sane(f.sp)) {
+    while (n < depth && f.next_pc != 0 && esp_backtrace_get_next_frame(&f)) {
+      // A return address has the caller's window increment in its top two bits and is just past
+      // the 3-byte call instruction
+      key[++n] = ((f.pc & 0x3FFFFFFF) | 0x40000000) - 3;
+    }
+  }
+  while (n < depth) {
+    key[++n] = 0;
+  }
+
+  // Count it in its slot, or take an empty one for it; FNV-1a hash, linear probing
+  uint32_t hash = 2166136261u;
+  for (uint8_t i = 0; i <= depth; i++) {
+    hash = (hash ^ key[i]) * 16777619u;
+  }
+  uint32_t stride = depth + 2;
+  bool counted = false;
+  for (uint8_t probe = 0; !counted && probe < PR_MAX_PROBES; probe++) {
+    uint32_t *slot = table + ((hash + probe) & (PR_TABLE_SIZE - 1)) * stride;
+    if (slot[0] == 0) {
+      for (uint8_t i = 0; i <= depth; i++) {
+        slot[i + 1] = key[i];
+      }
+      slot[0] = 1;
+      stacks++;
+      counted = true;
+    } else {
+      uint8_t i = 0;
+      while (i <= depth && slot[i + 1] == key[i]) {
+        i++;
+      }
+      if (i > depth) {
+        slot[0]++;
+        counted = true;
+      }
+    }
+  }
+  if (!counted) {
+    dropped++;
+  }
+  samples++;
+  uint32_t took = cpu_hal_get_cycle_count() - startCycles;
+  cycles += took;
+  if (took > maxCycles) {
+    maxCycles = took;
+  }
+}
+
+/***
+ * taskIndex(task)
+ ***/
+uint8_t IRAM_ATTR Profiler::taskIndex(TaskHandle_t task) {
+  for (uint8_t i = 0; i < nTasks; i++) {
+    if (tasks[i] == task) {
+      return i;
+    }
+  }
+  if (nTasks == PR_MAX_TASKS) {
+    return PR_MAX_TASKS;
+  }
+  // A task's name is in its TCB, which goes away if the task is deleted; keep a copy
+  const char *name = pcTaskGetName(task);
+  uint8_t c = 0;
+  while (c < PR_TASK_NAME_LEN - 1 && name[c] != '\0') {
+    taskNames[nTasks][c] = name[c];
+    c++;
+  }
+  taskNames[nTasks][c] = '\0';
+  tasks[nTasks] = task;
+  return nTasks++;
+}
+
+/***
+ * resume()
+ ***/
+void Profiler::resume() {
+  timer = timerBegin(PR_TIMER, PR_TIMER_DIVIDER, true);
+  if (timer == nullptr) {
+    return;
+  }
+  active = this;
+  startMillis = millis();
+  timerAttachInterrupt(timer, onTimer, true);
+  timerAlarmWrite(timer, 1000000 / hz, true);
+  timerAlarmEnable(timer);
+}
+
+/***
+ * pause()
+ ***/
+void Profiler::pause() {
+  if (timer == nullptr) {
+    return;
+  }
+  timerAlarmDisable(timer);
+  timerDetachInterrupt(timer);
+  timerEnd(timer);
+  timer = nullptr;
+  active = nullptr;
+  sampledMillis += millis() - startMillis;
+}
@@ -0,0 +1,181 @@
+/****
+ *
+ *  Profiler.h
+ *  Part of the "Profiler" library for Arduino. Version 0.1.0
+ *
+ * A Profiler is a statistical profiler for the ESP32-S2. While it runs, a hardware timer
+ * interrupts the CPU hz times a second and the interrupt handler notes where the CPU was: the
+ * task it interrupted, the instruction it was about to execute and, walking back up the
+ * stack, the calls that got it there, up to depth of them. Each different stack it sees gets
+ * a slot in a hash table in RAM that counts how many times it's been seen. dump() prints the
+ * table as text, something like
+ *
+ *   prof: begin hz=1000 depth=8 samples=30000 dropped=0 stacks=412 millis=30004 cycles=... mhz=240
+ *   prof: 5071 IDLE 0x4002d6a2 0x40027f9b
+ *   prof: 211 loopTask 0x400832c5 0x40081be9 0x4008a1f0 0x400d3b2a ...
+ *   ...
+ *   prof: end
+ *
+ * with the innermost address first. tools/profsym.cpp turns that, with the firmware's ELF
+ * file, into a flat profile (the functions the time was spent in, and under) and the
+ * "folded" stacks flame graph tools take. Something like
+ *
+ *   Profiler profiler;
+ *   ...
+ *   profiler.start(1000, 8);
+ *   ...
+ *   profiler.stop();
+ *   profiler.dump(Serial);
+ *
+ * A full table is hundreds of lines. Where printing them all at once would hold things up too
+ * long, dumpBegin() and then dumpPage() until it returns false print them a page at a time.
+ *
+ * Sampling costs a few microseconds an interrupt, which is a fraction of a percent of the
+ * CPU at 1000 Hz; getStats() says how many CPU cycles the handler itself took. The table is
+ * allocated by start() and freed by clear(): PR_TABLE_SIZE * (depth + 2) * 4 bytes, 20kB at
+ * the default depth. Stacks that don't fit in it are counted as dropped.
+ *
+ * What it can and can't see:
+ *
+ *   - It finds the interrupted context where the ESP-IDF FreeRTOS port for Xtensa leaves it:
+ *     on entry to an interrupt, the port saves the interrupted task's registers on its stack,
+ *     spills the register windows there too, and points the task's TCB at them.
+ *   - The timer interrupt is at level 1, so it can't interrupt code that runs with interrupts
+ *     masked -- critical sections and other interrupt handlers. Their time shows up against
+ *     the instruction that unmasked them. Nor does it run while the flash cache is off (flash
+ *     writes and erases), so that time doesn't show up at all.
+ *   - Stack walks stop at the first frame that doesn't look right (e.g., hand-written
+ *     assembly or ROM code that doesn't use the windowed ABI) or at depth, whichever comes
+ *     first. The caller of a function interrupted before its first instruction ran can be
+ *     missing.
+ *
+ * Only one Profiler can run at a time; it uses hardware timer PR_TIMER.
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#pragma once
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+// Some constants
+#define PR_TIMER                (0)         // The hardware timer the sampling interrupt comes from
+#define PR_DEFAULT_HZ           (1000)      // The default sampling rate (samples per second)
+#define PR_MIN_HZ               (10)        // The lowest sampling rate
+#define PR_MAX_HZ               (10000)     // The highest sampling rate
+#define PR_DEFAULT_DEPTH        (8)         // The default number of addresses kept per stack
+#define PR_MAX_DEPTH            (16)        // The most addresses kept per stack
+#define PR_TABLE_SIZE           (512)       // The number of distinct stacks the table holds (a power of 2)
+#define PR_MAX_PROBES           (16)        // The most slots looked at for a stack before it's dropped
+#define PR_MAX_TASKS            (16)        // The number of distinct tasks it can tell apart
+#define PR_TASK_NAME_LEN        (16)        // The longest task name kept, including the terminating '\0'
+#define PR_DUMP_PAGE_LINES      (16)        // The most stack lines dumpPage() prints at a time
+
+struct pr_stats_t {                         // How profiling is going
+  bool running;                             //  Whether it's sampling
+  uint32_t hz;                              //  Samples a second
+  uint8_t depth;                            //  The most addresses kept per stack
+  uint32_t samples;                         //  Samples taken since the table was last cleared
+  uint32_t dropped;                         //  Samples that didn't fit in the table
+  uint16_t stacks;                          //  Distinct stacks in the table
+  uint32_t millis;                          //  Time spent sampling (millis())
+  uint64_t cycles;                          //  CPU cycles the interrupt handler took, in all
+  uint32_t maxCycles;                       //  The most CPU cycles it took for any one sample
+};
+
+class Profiler {
+public:
+  /**
+   * @brief Construct a new Profiler object. It's not sampling and has no table.
+   */
+  Profiler();
+
+  /**
+   * @brief Start (or resume) sampling. If there's a table from before with the same depth, the
+   *        samples are added to it; otherwise it starts from an empty table.
+   *
+   * @param hz      Samples a second, PR_MIN_HZ to PR_MAX_HZ
+   * @param depth   The most addresses to keep for each stack, 1 (just where the CPU was) to
+   *                PR_MAX_DEPTH
+   * @return true   It's sampling
+   * @return false  It couldn't: bad parameters, another Profiler is running, no memory for
+   *                the table or no timer
+   */
+  bool start(uint32_t hz = PR_DEFAULT_HZ, uint8_t depth = PR_DEFAULT_DEPTH);
+
+  /**
+   * @brief Stop sampling. The table stays for dump() or to be added to by start().
+   */
+  void stop();
+
+  /**
+   * @brief Stop sampling and free the table
+   */
+  void clear();
+
+  /**
+   * @brief Whether it's sampling
+   */
+  bool isRunning();
+
+  /**
+   * @brief Get the statistics
+   */
+  pr_stats_t getStats();
+
+  /**
+   * @brief Print the table as text, in the form described above. Sampling, if it's going on,
+   *        is paused while it prints.
+   *
+   * @param out     Where to print it, e.g., Serial
+   */
+  void dump(Print &out);
+
+  /**
+   * @brief Start printing the table a page at a time: print the first line and get ready for
+   *        dumpPage(). Sampling, if it's going on, is paused until the last page is printed.
+   *
+   * @param out     Where to print it, e.g., Serial
+   */
+  void dumpBegin(Print &out);
+
+  /**
+   * @brief Print the next PR_DUMP_PAGE_LINES stacks of the dump dumpBegin() started and, after
+   *        the last of them, the end line
+   *
+   * @param out     Where to print it; the same as was given to dumpBegin()
+   * @return true   There's more to print
+   * @return false  That was the end of it; sampling has been resumed if it was paused
+   */
+  bool dumpPage(Print &out);
+
+private:
+  static void onTimer();                    // The timer interrupt handler
+  void sample();                            // Take a sample
+  uint8_t taskIndex(TaskHandle_t task);     // The index in taskNames of a task, or PR_MAX_TASKS if there's no room
+  void resume();                            // Start the timer, with the table already set up
+  void pause();                             // Stop the timer, leaving the table be
+
+  static Profiler *active;                  // The running Profiler, if any
+  hw_timer_t *timer;                        // The timer; nullptr if none
+  uint32_t *table;                          // PR_TABLE_SIZE slots: count, task index, then depth addresses
+  uint32_t hz;                              // Samples a second
+  uint8_t depth;                            // Addresses per slot
+  volatile uint32_t samples;                // Samples taken
+  volatile uint32_t dropped;                // Samples that didn't fit
+  volatile uint16_t stacks;                 // Slots in use
+  volatile uint64_t cycles;                 // CPU cycles taken by sample()
+  volatile uint32_t maxCycles;              // Most cycles taken by one sample()
+  uint32_t sampledMillis;                   // Time spent sampling, not counting the current stretch
+  unsigned long startMillis;                // millis() when the current stretch of sampling started
+  uint8_t nTasks;                           // The number of tasks in tasks and taskNames
+  TaskHandle_t tasks[PR_MAX_TASKS];         // The tasks seen
+  char taskNames[PR_MAX_TASKS][PR_TASK_NAME_LEN];  // Their names, taken when first seen
+  uint16_t dumpSlot;                        // The slot the dump under way has got to; PR_TABLE_SIZE if none
+  bool dumpResume;                          // Whether to resume sampling once it's done
+};
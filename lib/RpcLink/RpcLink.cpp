@@ -0,0 +1,406 @@
+/****
+ *
+ *  RpcLink.cpp
+ *  Part of the "RpcLink" library for Arduino. Version 0.1.0
+ *
+ * See RpcLink.h for details
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ * 
+ ****/
+#include "RpcLink.h"
+
+/***
+ * Constructor
+ ***/
+RpcLink::RpcLink(Stream &port) : port(port) {
+  nMethods = 0;
+  nTopics = 0;
+  for (uint8_t i = 0; i < RL_MAX_SUBS; i++) {
+    subs[i].topic = -1;
+  }
+  rxHead = 0;
+  rxTail = 0;
+  intaking.clear();
+  active = false;
+  rxDropped = 0;
+  lineLen = 0;
+  lineTooLong = false;
+  exitRequested = false;
+}
+
+/***
+ * attachMethod(name, method)
+ ***/
+bool RpcLink::attachMethod(const char *name, rl_method_t method) {
+  if (nMethods >= RL_MAX_METHODS) {
+    return false;
+  }
+  methods[nMethods++] = {name, method};
+  return true;
+}
+
+/***
+ * attachTopic(name, topic)
+ ***/
+bool RpcLink::attachTopic(const char *name, rl_topic_t topic) {
+  if (nTopics >= RL_MAX_TOPICS) {
+    return false;
+  }
+  topics[nTopics++] = {name, topic};
+  return true;
+}
+
+/***
+ * begin()
+ ***/
+void RpcLink::begin() {
+  for (uint8_t i = 0; i < RL_MAX_SUBS; i++) {
+    subs[i].topic = -1;
+  }
+  rxTail.store(rxHead.load());
+  rxDropped = 0;
+  lineLen = 0;
+  lineTooLong = false;
+  exitRequested = false;
+  active = true;
+  port.print("{\"rpc\":\"ready\"}\n");
+}
+
+/***
+ * end()
+ ***/
+void RpcLink::end() {
+  active = false;
+  for (uint8_t i = 0; i < RL_MAX_SUBS; i++) {
+    subs[i].topic = -1;
+  }
+}
+
+/***
+ * isActive()
+ ***/
+bool RpcLink::isActive() {
+  return active;
+}
+
+/***
+ * intake()
+ ***/
+void RpcLink::intake() {
+  if (!active || intaking.test_and_set(std::memory_order_acquire)) {
+    return;
+  }
+  uint16_t head = rxHead.load(std::memory_order_relaxed);
+  while (port.available() > 0) {
+    int c = port.read();
+    if (c < 0) {
+      break;
+    }
+    if ((uint16_t)(head - rxTail.load(std::memory_order_acquire)) >= RL_RX_BUFFER_SIZE) {
+      rxDropped++;
+      continue;
+    }
+    rx[head & (RL_RX_BUFFER_SIZE - 1)] = (uint8_t)c;
+    head++;
+    rxHead.store(head, std::memory_order_release);
+  }
+  intaking.clear(std::memory_order_release);
+}
+
+/***
+ * run()
+ ***/
+void RpcLink::run() {
+  if (!active) {
+    return;
+  }
+  intake();
+
+  // Deal with the complete lines that have arrived
+  uint16_t tail = rxTail.load(std::memory_order_relaxed);
+  uint8_t nLines = 0;
+  while (nLines < RL_MAX_LINES_PER_RUN && tail != rxHead.load(std::memory_order_acquire)) {
+    char c = (char)rx[tail & (RL_RX_BUFFER_SIZE - 1)];
+    tail++;
+    rxTail.store(tail, std::memory_order_release);
+    if (c == '\r') {
+      continue;
+    }
+    if (c != '\n') {
+      if (lineLen < RL_MAX_LINE - 1) {
+        line[lineLen++] = c;
+      } else {
+        lineTooLong = true;
+      }
+      continue;
+    }
+    line[lineLen] = '\0';
+    if (lineTooLong) {
+      DynamicJsonDocument reply(RL_TOPIC_CAPACITY);
+      JsonObject r = reply.to<JsonObject>();
+      r["id"] = nullptr;
+      setError(r, RL_PARSE_ERROR, "Request too long");
+      send(reply);
+    } else if (lineLen > 0) {
+      handleLine();
+    }
+    lineLen = 0;
+    lineTooLong = false;
+    nLines++;
+    if (exitRequested) {
+      end();
+      return;
+    }
+  }
+
+  publish();
+}
+
+/***
+ * handleLine()
+ ***/
+void RpcLink::handleLine() {
+  DynamicJsonDocument request(RL_REQUEST_CAPACITY);
+  DynamicJsonDocument reply(RL_REPLY_CAPACITY);
+  DeserializationError err = deserializeJson(request, line, lineLen);
+  if (err) {
+    JsonObject r = reply.to<JsonObject>();
+    r["id"] = nullptr;
+    setError(r, RL_PARSE_ERROR, err == DeserializationError::NoMemory ? "Request too big" : "Parse error");
+    send(reply);
+    return;
+  }
+
+  // A batch gets a batch of replies, leaving out the ones for notifications
+  if (request.is<JsonArray>()) {
+    JsonArray replies = reply.to<JsonArray>();
+    bool anyReplies = false;
+    for (JsonVariantConst r : request.as<JsonArrayConst>()) {
+      JsonObject thisReply = replies.createNestedObject();
+      if (dispatch(r, thisReply)) {
+        anyReplies = true;
+      } else {
+        replies.remove(replies.size() - 1);
+      }
+    }
+    if (anyReplies) {
+      send(reply);
+    }
+    return;
+  }
+  if (dispatch(request.as<JsonVariantConst>(), reply.to<JsonObject>())) {
+    send(reply);
+  }
+}
+
+/***
+ * dispatch(request, reply)
+ ***/
+bool RpcLink::dispatch(JsonVariantConst request, JsonObject reply) {
+  if (!request.is<JsonObjectConst>() || !request["method"].is<const char *>()) {
+    reply["id"] = request["id"];
+    setError(reply, RL_INVALID_REQUEST, "Invalid request");
+    return true;
+  }
+  bool wantsReply = !request["id"].isNull();
+  reply["id"] = request["id"];
+  const char *name = request["method"];
+  JsonObjectConst params = request["params"];
+  if (builtIn(name, params, reply)) {
+    return wantsReply;
+  }
+  for (uint8_t i = 0; i < nMethods; i++) {
+    if (strcmp(name, methods[i].name) == 0) {
+      const char *msg = methods[i].fn(params, reply.createNestedObject("result"));
+      if (msg != nullptr) {
+        reply.remove("result");
+        setError(reply, RL_METHOD_FAILED, msg);
+      }
+      return wantsReply;
+    }
+  }
+  setError(reply, RL_METHOD_NOT_FOUND, "Method not found");
+  return wantsReply;
+}
+
+/***
+ * builtIn(name, params, reply)
+ ***/
+bool RpcLink::builtIn(const char *name, JsonObjectConst params, JsonObject reply) {
+  if (strncmp(name, "rpc.", 4) != 0) {
+    return false;
+  }
+  name += 4;
+  if (strcmp(name, "methods") == 0) {
+    JsonObject result = reply.createNestedObject("result");
+    JsonArray m = result.createNestedArray("methods");
+    for (uint8_t i = 0; i < nMethods; i++) {
+      m.add(methods[i].name);
+    }
+    JsonArray t = result.createNestedArray("topics");
+    for (uint8_t i = 0; i < nTopics; i++) {
+      t.add(topics[i].name);
+    }
+    return true;
+  }
+  if (strcmp(name, "subscribe") == 0) {
+    const char *topicName = params["topic"] | "";
+    uint32_t period = params["period"] | 1000;
+    int8_t topic = -1;
+    for (uint8_t i = 0; i < nTopics; i++) {
+      if (strcmp(topicName, topics[i].name) == 0) {
+        topic = i;
+      }
+    }
+    if (topic < 0 || period < RL_MIN_PERIOD_MILLIS) {
+      setError(reply, RL_INVALID_PARAMS, topic < 0 ? "No such topic" : "Period too short");
+      return true;
+    }
+    // Resubscribing to a topic changes its period; otherwise take a free slot
+    int8_t slot = -1;
+    for (uint8_t i = 0; i < RL_MAX_SUBS; i++) {
+      if (subs[i].topic == topic) {
+        slot = i;
+        break;
+      }
+      if (slot < 0 && subs[i].topic < 0) {
+        slot = i;
+      }
+    }
+    if (slot < 0) {
+      setError(reply, RL_METHOD_FAILED, "Too many subscriptions");
+      return true;
+    }
+    if (subs[slot].topic != topic) {
+      subs[slot] = {topic, period, millis() - period, 0};
+    } else {
+      subs[slot].periodMillis = period;
+    }
+    reply.createNestedObject("result");
+    return true;
+  }
+  if (strcmp(name, "unsubscribe") == 0) {
+    const char *topicName = params["topic"] | "*";
+    for (uint8_t i = 0; i < RL_MAX_SUBS; i++) {
+      if (subs[i].topic >= 0 && (strcmp(topicName, "*") == 0 || strcmp(topicName, topics[subs[i].topic].name) == 0)) {
+        subs[i].topic = -1;
+      }
+    }
+    reply.createNestedObject("result");
+    return true;
+  }
+  if (strcmp(name, "stats") == 0) {
+    JsonObject result = reply.createNestedObject("result");
+    result["dropped"] = rxDropped.load();
+    JsonArray s = result.createNestedArray("subscriptions");
+    for (uint8_t i = 0; i < RL_MAX_SUBS; i++) {
+      if (subs[i].topic >= 0) {
+        JsonObject sub = s.createNestedObject();
+        sub["topic"] = topics[subs[i].topic].name;
+        sub["period"] = subs[i].periodMillis;
+        sub["seq"] = subs[i].seq;
+      }
+    }
+    return true;
+  }
+  if (strcmp(name, "exit") == 0) {
+    exitRequested = true;
+    reply.createNestedObject("result");
+    return true;
+  }
+  return false;
+}
+
+/***
+ * publish()
+ ***/
+void RpcLink::publish() {
+  unsigned long curMillis = millis();
+  for (uint8_t i = 0; i < RL_MAX_SUBS; i++) {
+    sub_t &s = subs[i];
+    if (s.topic < 0 || curMillis - s.lastMillis < s.periodMillis) {
+      continue;
+    }
+    // Stay on the original cadence unless we've fallen a whole period behind
+    s.lastMillis = curMillis - s.lastMillis < 2 * s.periodMillis ? s.lastMillis + s.periodMillis : curMillis;
+    DynamicJsonDocument msg(RL_TOPIC_CAPACITY);
+    msg["topic"] = topics[s.topic].name;
+    msg["seq"] = s.seq++;
+    msg["millis"] = curMillis;
+    topics[s.topic].fn(msg.createNestedObject("data"));
+    send(msg);
+  }
+}
+
+/***
+ * setError(reply, code, message)
+ ***/
+void RpcLink::setError(JsonObject reply, int code, const char *message) {
+  JsonObject error = reply.createNestedObject("error");
+  error["code"] = code;
+  error["message"] = message;
+}
+
+/***
+ * send(doc)
+ ***/
+void RpcLink::send(const JsonDocument &doc) {
+  if (doc.overflowed()) {
+    port.print("{\"id\":null,\"error\":{\"code\":-32000,\"message\":\"Reply too big\"}}\n");
+    return;
+  }
+  serializeJson(doc, port);
+  port.write('\n');
+}
+
+/***
+ * log(text)
+ ***/
+void RpcLink::log(const char *text) {
+  StaticJsonDocument<RL_MAX_LOG_LINE + 64> doc;
+  doc["log"] = text;
+  send(doc);
+}
+
+/***
+ * RpcConsole constructor
+ ***/
+RpcConsole::RpcConsole(RpcLink &link, Print &out) : link(link), out(out) {
+  lineLen = 0;
+}
+
+/***
+ * write(c)
+ ***/
+size_t RpcConsole::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+/***
+ * write(buffer, size)
+ ***/
+size_t RpcConsole::write(const uint8_t *buffer, size_t size) {
+  if (!link.isActive()) {
+    return out.write(buffer, size);
+  }
+  std::lock_guard<std::mutex> hold(lock);
+  for (size_t i = 0; i < size; i++) {
+    // A line too long for one notification is sent in pieces
+    if (buffer[i] == '\n' || lineLen == RL_MAX_LOG_LINE - 1) {
+      line[lineLen] = '\0';
+      link.log(line);
+      lineLen = 0;
+      if (buffer[i] == '\n') {
+        continue;
+      }
+    }
+    if (buffer[i] != '\r') {
+      line[lineLen++] = buffer[i];
+    }
+  }
+  return size;
+}
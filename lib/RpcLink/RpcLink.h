@@ -0,0 +1,253 @@
+/****
+ *
+ *  RpcLink.h
+ *  Part of the "RpcLink" library for Arduino. Version 0.1.0
+ *
+ * An RpcLink is a machine-friendly alternative to a human-oriented command line on a serial 
+ * connection, meant for automated test rigs that need to drive and sample lots of devices 
+ * quickly. Once begin() is called, and until the link is told to exit, each line that arrives is 
+ * a JSON-RPC 2.0-style request (without the "jsonrpc" member) and each line sent back is a 
+ * single JSON reply:
+ * 
+ *   --> {"id":7,"method":"wl.set","params":{"level":3.5}}
+ *   <-- {"id":7,"result":{}}
+ *   --> {"id":8,"method":"nosuch"}
+ *   <-- {"id":8,"error":{"code":-32601,"message":"Method not found"}}
+ * 
+ * A request without an "id" is a notification: it's carried out, but there's no reply. A line 
+ * that's a JSON array is a batch; the replies come back as an array on one line, in the same 
+ * order.
+ * 
+ * The sketch supplies the methods -- attachMethod() -- and the telemetry topics that can be 
+ * subscribed to -- attachTopic(). These are built in:
+ * 
+ *   rpc.methods                    The result is {"methods":[...], "topics":[...]}
+ *   rpc.subscribe {topic, period}  Send the topic's data every period millis until unsubscribed
+ *   rpc.unsubscribe {topic}        Stop sending the topic's data ("*" for all topics)
+ *   rpc.stats                      The result is {"dropped":n, "subscriptions":[...]}, where n is the 
+ *                                  number of received bytes lost because the ring buffer was full
+ *   rpc.exit                       Leave RPC mode (after replying)
+ * 
+ * Telemetry arrives, unasked for, as
+ * 
+ *   <-- {"topic":"clock","seq":41,"millis":123456,"data":{...}}
+ * 
+ * where seq counts the messages sent for that subscription, so a rig can tell if it lost any.
+ * 
+ * The human-readable messages the sketch and its libraries print as they go don't belong on the 
+ * port in RPC mode. Printed to an RpcConsole rather than straight to the port, they go out as 
+ * usual when the link isn't in RPC mode and, when it is, each line arrives as a notification:
+ * 
+ *   <-- {"log":"[getNextTide] Next tide is a high at 14:32:00."}
+ * 
+ * Incoming bytes are taken off the serial port by intake(), which is meant to be called from the 
+ * serial port's receive callback (HardwareSerial::onReceive() or USBCDC's RX event) so that 
+ * nothing is lost while the sketch is busy. It puts them in a lock-free ring buffer that run() 
+ * empties. run() also calls intake() itself, so things still work without the callback, just 
+ * not as well.
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ * 
+ ****/
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <atomic>
+#include <mutex>
+
+// Some constants
+#define RL_RX_BUFFER_SIZE       (1024)      // Size of the receive ring buffer (bytes, must be a power of 2)
+#define RL_MAX_LINE             (1024)      // Longest request line accepted (bytes, including the '\0')
+#define RL_MAX_METHODS          (24)        // The maximum number of sketch-supplied methods
+#define RL_MAX_TOPICS           (4)         // The maximum number of sketch-supplied topics
+#define RL_MAX_SUBS             (4)         // The maximum number of simultaneous subscriptions
+#define RL_MIN_PERIOD_MILLIS    (20)        // The shortest subscription period allowed (millis())
+#define RL_MAX_LINES_PER_RUN    (8)         // The most request lines a single run() will deal with
+#define RL_REQUEST_CAPACITY     (2048)      // ArduinoJson capacity for a request (or batch of them)
+#define RL_REPLY_CAPACITY       (3072)      // ArduinoJson capacity for a reply (or batch of them)
+#define RL_TOPIC_CAPACITY       (512)       // ArduinoJson capacity for a telemetry message
+#define RL_MAX_LOG_LINE         (256)       // Longest log line sent as one notification (bytes, including the '\0')
+
+// JSON-RPC error codes
+#define RL_PARSE_ERROR          (-32700)    // The line isn't JSON (or is too long)
+#define RL_INVALID_REQUEST      (-32600)    // The JSON isn't a request
+#define RL_METHOD_NOT_FOUND     (-32601)    // No such method
+#define RL_INVALID_PARAMS       (-32602)    // The params don't make sense
+#define RL_METHOD_FAILED        (-32000)    // The method couldn't do what was asked
+
+extern "C" {
+// A method: const char *method(JsonObjectConst params, JsonObject result). Fill in result and 
+// return nullptr if all went well; otherwise return a (static) message saying what went wrong.
+typedef const char *(*rl_method_t)(JsonObjectConst params, JsonObject result);
+// A topic: void topic(JsonObject data). Fill in data with the topic's current values.
+typedef void (*rl_topic_t)(JsonObject data);
+}
+
+class RpcLink {
+public:
+  /**
+   * @brief Construct a new RpcLink object
+   * 
+   * @param port The Stream the link talks over, e.g., Serial
+   */
+  RpcLink(Stream &port);
+
+  /**
+   * @brief Add a method. Names are matched exactly.
+   * 
+   * @param name    The method's name
+   * @param method  The function that carries it out
+   * @return true   Added
+   * @return false  No room; see RL_MAX_METHODS
+   */
+  bool attachMethod(const char *name, rl_method_t method);
+
+  /**
+   * @brief Add a telemetry topic that can be subscribed to
+   * 
+   * @param name    The topic's name
+   * @param topic   The function that supplies its data
+   * @return true   Added
+   * @return false  No room; see RL_MAX_TOPICS
+   */
+  bool attachTopic(const char *name, rl_topic_t topic);
+
+  /**
+   * @brief Enter RPC mode. Drops any subscriptions and partial input and says {"rpc":"ready"}.
+   */
+  void begin();
+
+  /**
+   * @brief Leave RPC mode
+   */
+  void end();
+
+  /**
+   * @brief Whether the link is in RPC mode
+   */
+  bool isActive();
+
+  /**
+   * @brief Move whatever has arrived on the port into the ring buffer. Call this from the 
+   *        port's receive callback; it's safe to do so from another task. Does nothing when 
+   *        not in RPC mode (so the bytes are left for whatever else reads the port) or if 
+   *        another call to intake() is under way.
+   */
+  void intake();
+
+  /**
+   * @brief Let the link do its thing: deal with complete request lines and send any telemetry 
+   *        that's due. Call this often when in RPC mode.
+   */
+  void run();
+
+  /**
+   * @brief Send a line of human-readable text as a {"log":"..."} notification
+   * 
+   * @param text The text, without a trailing newline
+   */
+  void log(const char *text);
+
+private:
+  struct method_t {                         // A sketch-supplied method
+    const char *name;                       //  Its name
+    rl_method_t fn;                         //  What carries it out
+  };
+  struct topic_t {                          // A sketch-supplied telemetry topic
+    const char *name;                       //  Its name
+    rl_topic_t fn;                          //  What supplies its data
+  };
+  struct sub_t {                            // A subscription
+    int8_t topic;                           //  Index in topics of the topic subscribed to; -1 if slot unused
+    uint32_t periodMillis;                  //  How often to send it (millis())
+    unsigned long lastMillis;               //  millis() when it was last sent
+    uint32_t seq;                           //  The number of messages sent so far
+  };
+
+  Stream &port;                             // The port we talk over
+  method_t methods[RL_MAX_METHODS];         // The sketch-supplied methods
+  uint8_t nMethods;                         // The number of them
+  topic_t topics[RL_MAX_TOPICS];            // The sketch-supplied topics
+  uint8_t nTopics;                          // The number of them
+  sub_t subs[RL_MAX_SUBS];                  // The subscriptions
+  uint8_t rx[RL_RX_BUFFER_SIZE];            // The receive ring buffer
+  std::atomic<uint16_t> rxHead;             // Where intake() puts the next byte (mod RL_RX_BUFFER_SIZE); only intake() changes it
+  std::atomic<uint16_t> rxTail;             // Where run() gets the next byte (mod RL_RX_BUFFER_SIZE); only run() changes it
+  std::atomic_flag intaking;                // Set while an intake() is under way
+  std::atomic<bool> active;                 // True while in RPC mode
+  std::atomic<uint32_t> rxDropped;          // Bytes dropped because the ring buffer was full
+  char line[RL_MAX_LINE];                   // The request line being assembled
+  uint16_t lineLen;                         // Its length so far
+  bool lineTooLong;                         // True if it overflowed; we're discarding till the end of the line
+  bool exitRequested;                       // True when rpc.exit has been asked for
+
+  /**
+   * @brief Deal with one complete request line
+   */
+  void handleLine();
+
+  /**
+   * @brief Carry out one request, filling in its reply
+   * 
+   * @param request The request
+   * @param reply   Where to put the reply
+   * @return true   The request had an id; the reply should be sent
+   * @return false  It was a notification; don't send the reply
+   */
+  bool dispatch(JsonVariantConst request, JsonObject reply);
+
+  /**
+   * @brief Carry out the built-in methods
+   * 
+   * @param name    The method name
+   * @param params  Its params
+   * @param reply   The reply to fill in
+   * @return true   name was a built-in method
+   * @return false  It wasn't
+   */
+  bool builtIn(const char *name, JsonObjectConst params, JsonObject reply);
+
+  /**
+   * @brief Send the telemetry messages that are due
+   */
+  void publish();
+
+  /**
+   * @brief Turn reply into an error reply
+   */
+  void setError(JsonObject reply, int code, const char *message);
+
+  /**
+   * @brief Send doc as one line
+   */
+  void send(const JsonDocument &doc);
+};
+
+/**
+ * @brief A Print for human-readable messages: straight to out when link isn't in RPC mode, as a 
+ *        log notification for each line when it is. Safe to print to from more than one task.
+ */
+class RpcConsole : public Print {
+public:
+  /**
+   * @brief Construct a new RpcConsole object
+   * 
+   * @param link  The RpcLink whose mode decides where the text goes
+   * @param out   Where it goes otherwise, e.g., Serial
+   */
+  RpcConsole(RpcLink &link, Print &out);
+
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t *buffer, size_t size) override;
+
+private:
+  RpcLink &link;                            // The link
+  Print &out;                               // Where text goes when the link isn't in RPC mode
+  std::mutex lock;                          // Guards the line being assembled
+  char line[RL_MAX_LOG_LINE];               // The log line being assembled in RPC mode
+  uint16_t lineLen;                         // Its length so far
+};
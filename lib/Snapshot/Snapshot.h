@@ -0,0 +1,77 @@
+/****
+ *
+ *  Snapshot.h
+ *  Part of the "Snapshot" library for Arduino. Version 0.1.0
+ *
+ * A Snapshot<T> lets one task publish a value of type T -- typically a small struct describing 
+ * an object's state -- and any number of other tasks read consistent copies of it, without 
+ * either side ever taking a lock. The publisher is never held up by readers, which matters when 
+ * it's on a real-time path like stepping a motor.
+ * 
+ * It's a double buffer with a version counter. publish() writes the buffer that isn't current 
+ * and then bumps the version, which makes that buffer current. read() copies the current buffer 
+ * and then checks that the version didn't change while it was copying; if it did, the publisher 
+ * ran in the meantime, so it tries again. The reader only ever has to retry because the 
+ * publisher completed a publish() while the read was going on, so on a single core, where a 
+ * publish() that preempts a read runs to completion first, the retry always succeeds. (A seqlock 
+ * would have a high-priority reader spin forever waiting for a preempted low-priority writer to 
+ * finish.)
+ * 
+ * There must only be one publisher. T must be trivially copyable.
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ * 
+ ****/
+#pragma once
+
+#include <atomic>
+#include <type_traits>
+#include <stdint.h>
+
+template <typename T>
+class Snapshot {
+  static_assert(std::is_trivially_copyable<T>::value, "A Snapshot's type must be trivially copyable");
+public:
+  /**
+   * @brief Construct a new Snapshot object holding a default-constructed T
+   */
+  Snapshot() : version(0) {
+    buffer[0] = T();
+    buffer[1] = T();
+  }
+
+  /**
+   * @brief Publish a new value. Only ever call this from one task.
+   * 
+   * @param value The new value
+   */
+  void publish(const T &value) {
+    uint32_t v = version.load(std::memory_order_relaxed);
+    buffer[(v + 1) & 1] = value;
+    version.store(v + 1, std::memory_order_release);
+  }
+
+  /**
+   * @brief Get a consistent copy of the most recently published value. Never blocks.
+   * 
+   * @return T  The value
+   */
+  T read() const {
+    T value;
+    uint32_t before, after;
+    do {
+      before = version.load(std::memory_order_acquire);
+      value = buffer[before & 1];
+      std::atomic_thread_fence(std::memory_order_acquire);
+      after = version.load(std::memory_order_relaxed);
+    } while (before != after);
+    return value;
+  }
+
+private:
+  T buffer[2];                              // The two buffers; buffer[version & 1] is current
+  std::atomic<uint32_t> version;            // The number of times a value has been published
+};
@@ -1,7 +1,7 @@
 /****
  *
  * TideClock.cpp
- * Part of the "TideClock" library for Arduino. Version 0.6.1
+ * Part of the "TideClock" library for Arduino. Version 0.8.0
  *
  * See tideClock.h for details
  *
@@ -13,16 +13,24 @@
  ****/
 
 #include "TideClock.h"
+#include <PredFetch.h>   // pfJitter(), the same spreading the fetches use
 
 /***
  * Constructor
  ***/
-TideClock::TideClock(uint8_t iPin, uint8_t oPin) {
+TideClock::TideClock(uint8_t iPin, uint8_t oPin) : tickOut(iPin), tockOut(oPin), ledOut(LED_BUILTIN) {
   tickPin = iPin;
   tockPin = oPin;
+  console = &Serial;
   stepType = true;
   paused = false;
   stepsTaken = 0;
+  stepsNeeded = 0;
+  totalSteps = 0;
+  catchUps = 0;
+  askGapMillis = TC_ASK_TIDE_MILLIS;
+  jitterSeed = 0;
+  failedAsks = 0;
   nextTide.tideType = TC_UNAVAILABLE;
   nextTide.time = 0;
   pinMode(tickPin, OUTPUT);             // Set the tick pin of the clock's Lavet motor to OUTPUT,
@@ -47,16 +55,45 @@ void TideClock::begin(getNextTideHandler_t h, tc_scale_t type, tc_motor_t motor)
     minStepInterval = TC_SIXTEEN_MIN_STEP_INTERVAL;
     pulseDuration = TC_SIXTEEN_PULSE_DURATION;
   }
-  Serial.printf("[TideClock::begin] Using %s clock face with type %s motor.\n", 
+  console->printf("[TideClock::begin] Using %s clock face with type %s motor.\n", 
     faceType == tcLinear ? "linear" : "nonlinear", motorType == tcOne ? "one" : "sixteen");
   lastMillis = millis();
   gotTideMillis = lastMillis - TC_ASK_TIDE_MILLIS;
 }
 
+/***
+ * setConsole(out)
+ ***/
+void TideClock::setConsole(Print &out) {
+  console = &out;
+}
+
+/***
+ * resume(s)
+ ***/
+void TideClock::resume(tc_state_t s) {
+  nextTide = s.nextTide;
+  stepsTaken = s.stepsTaken;
+  stepsNeeded = s.stepsNeeded;
+  paused = s.paused;
+  totalSteps = s.totalSteps;
+  catchUps = s.catchUps;
+  stepType = s.stepType;
+  publish();
+}
+
 /***
  * run(t)
  ***/
 void TideClock::run(time_t t) {
+  update(t);
+  publish();
+}
+
+/***
+ * update(t)
+ ***/
+void TideClock::update(time_t t) {
   unsigned long curMillis = millis();
   // We only need to go as fast as the motor can.
   if (curMillis - lastMillis < minStepInterval) {
@@ -77,15 +114,18 @@ void TideClock::run(time_t t) {
 
   // If we're past the time of the next tide, deal with it
   if (t > nextTide.time) {
-    if (curMillis - gotTideMillis < TC_ASK_TIDE_MILLIS) {
+    if (curMillis - gotTideMillis < askGapMillis) {
       return;                                     // Don't try to get the new tide data too often
     }
     // Get the new tide data
     tc_tide_t newTide = (*handler)();
     gotTideMillis = curMillis;
     if (newTide.tideType == TC_UNAVAILABLE) {
+      askGapMillis = TC_ASK_TIDE_MILLIS + pfJitter(jitterSeed, ++failedAsks, TC_ASK_JITTER_MILLIS);
       return;
     }
+    askGapMillis = TC_ASK_TIDE_MILLIS;
+    failedAsks = 0;
     // Set up to start a new tide cycle
     missedCycle = nextTide.tideType == newTide.tideType;
     nextTide = newTide;                            
@@ -94,33 +134,30 @@ void TideClock::run(time_t t) {
   }
   // Calculate the new value for stepsNeeded
   int32_t secToNextTide = static_cast<int32_t>(nextTide.time - t);
-  float secFromCycleEnd;
-  if (faceType == tcNonlinear) {
-    secFromCycleEnd = static_cast<float>(TC_SECONDS_IN_18_HOURS - secToNextTide);
-    stepsNeeded = stepsPerTick * static_cast<int32_t>(TC_A_COEFFICIENT * (secFromCycleEnd * secFromCycleEnd));
-  } else {
-    secFromCycleEnd = static_cast<float>(TC_SECONDS_IN_SIX_HOURS - secToNextTide);
-    stepsNeeded = stepsPerTick * static_cast<int32_t>(secFromCycleEnd / TC_SECONDS_PER_TICK);
-  }
+  int32_t secFromCycleEnd = 
+    static_cast<int32_t>(faceType == tcNonlinear ? TC_SECONDS_IN_18_HOURS : TC_SECONDS_IN_SIX_HOURS) - secToNextTide;
+  stepsNeeded = stepsPerTick * tcTicksNeeded(faceType == tcNonlinear, secToNextTide);
   
   // Deal with starting a new tide cycle
   if (startingNewCycle) {
     if (missedCycle) {
+      catchUps++;
       stepsNeeded += stepsPerTick * TC_TICKS_IN_A_CYCLE;
-      Serial.printf("[TideClock::run %s] Missed at least a whole tide cycle, but now have data.\n", posixTimeToHHMMSS(t).c_str());
+      console->printf("[TideClock::run %s] Missed at least a whole tide cycle, but now have data.\n", posixTimeToHHMMSS(t).c_str());
     }
-    String highOrLow = nextTide.tideType == HIGH ? "high" : "low";
+    const char *highOrLow = nextTide.tideType == HIGH ? "high" : "low";
     if (secFromCycleEnd < 0 && !missedCycle) {
-      Serial.printf("[TideClock::run %s] New tide (%s) is %s away. Pausing for %d seconds.\n", 
-        posixTimeToHHMMSS(t).c_str(), highOrLow, secToHHMMSS(secToNextTide).c_str(), static_cast<int32_t>(-secFromCycleEnd));
+      console->printf("[TideClock::run %s] New tide (%s) is %s away. Pausing for %d seconds.\n", 
+        posixTimeToHHMMSS(t).c_str(), highOrLow, secToHHMMSS(secToNextTide).c_str(), -secFromCycleEnd);
       paused = true;
     } else {
       if (firstPass) {
-        Serial.printf("[TideClock::run %s] The next tide (%s) is %s away. Check that the clock is set correctly.\n",
+        console->printf("[TideClock::run %s] The next tide (%s) is %s away. Check that the clock is set correctly.\n",
         posixTimeToHHMMSS(t).c_str(), highOrLow, secToHHMMSS(secToNextTide).c_str());
         stepsTaken = stepsNeeded;       // Assume clock is set correctly.
       } else {
-        Serial.printf("[TideClock::run %s] New tide (%s) is %s away. Taking %d quick steps to get on target.\n",
+        catchUps++;
+        console->printf("[TideClock::run %s] New tide (%s) is %s away. Taking %d quick steps to get on target.\n",
           posixTimeToHHMMSS(t).c_str(), highOrLow, secToHHMMSS(secToNextTide).c_str(), stepsNeeded - stepsTaken);
       }
     }
@@ -129,7 +166,7 @@ void TideClock::run(time_t t) {
   // Deal with being paused
   if (paused) {
     if (secFromCycleEnd == 0) {
-      Serial.printf("[TideClock::run %s] The tide is %s (%d seconds) away. Starting clock.\n",
+      console->printf("[TideClock::run %s] The tide is %s (%d seconds) away. Starting clock.\n",
         posixTimeToHHMMSS(t).c_str(), secToHHMMSS(secToNextTide).c_str(), secToNextTide);
       paused = false;
     }
@@ -147,6 +184,7 @@ bool TideClock::test() {
   }
   lastMillis = curMillis;
   step();
+  publish();
   return true;
 }
 
@@ -154,7 +192,78 @@ bool TideClock::test() {
  * getNextTide()
  ***/
 tc_tide_t TideClock::getNextTide() {
-  return nextTide;
+  return state.read().nextTide;
+}
+
+/***
+ * getState()
+ ***/
+tc_state_t TideClock::getState() {
+  return state.read();
+}
+
+/***
+ * publish()
+ ***/
+void TideClock::publish() {
+  state.publish({nextTide, stepsTaken, stepsNeeded, paused, totalSteps, catchUps, stepType});
+}
+
+/***
+ * setJitter(seed)
+ ***/
+void TideClock::setJitter(uint32_t seed) {
+  jitterSeed = seed;
+}
+
+/***
+ * askAgain()
+ ***/
+void TideClock::askAgain() {
+  askGapMillis = 0;
+}
+
+/***
+ * setTiming(pulseMillis, stepMillis)
+ ***/
+void TideClock::setTiming(uint32_t pulseMillis, unsigned long stepMillis) {
+  pulseDuration = pulseMillis == 0 ? (motorType == tcOne ? TC_ONE_PULSE_DURATION : TC_SIXTEEN_PULSE_DURATION) : pulseMillis;
+  minStepInterval = stepMillis == 0 ? (motorType == tcOne ? TC_ONE_MIN_STEP_INTERVAL : TC_SIXTEEN_MIN_STEP_INTERVAL) : stepMillis;
+  if (minStepInterval <= pulseDuration) {         // The pulse has to finish before the next step can start
+    minStepInterval = pulseDuration + 1;
+  }
+}
+
+/***
+ * getPulseDuration()
+ ***/
+uint32_t TideClock::getPulseDuration() {
+  return pulseDuration;
+}
+
+/***
+ * getMinStepInterval()
+ ***/
+unsigned long TideClock::getMinStepInterval() {
+  return minStepInterval;
+}
+
+/***
+ * caughtUp()
+ ***/
+bool TideClock::caughtUp() {
+  return stepsNeeded <= stepsTaken;
+}
+
+/***
+ * buildSchedule(t, delays, maxTicks)
+ ***/
+uint16_t TideClock::buildSchedule(time_t t, uint16_t *delays, uint16_t maxTicks) {
+  if (nextTide.tideType == TC_UNAVAILABLE) {
+    return 0;
+  }
+  return tcBuildSchedule(faceType == tcNonlinear, stepsTaken / stepsPerTick, 
+    static_cast<int32_t>(nextTide.time - t), delays, maxTicks);
 }
 
 /***
@@ -162,17 +271,18 @@ tc_tide_t TideClock::getNextTide() {
  ***/
 void TideClock::step() {
   if (stepType) {
-    digitalWrite(LED_BUILTIN, HIGH);
-    digitalWrite(tickPin, HIGH);  // Issue a forward pulse
+    ledOut.set();
+    tickOut.set();                // Issue a forward pulse
     delay(pulseDuration);
-    digitalWrite(tickPin, LOW);
+    tickOut.clear();
   } else {
-    digitalWrite(LED_BUILTIN, LOW);
-    digitalWrite(tockPin, HIGH);  // Issue a backward pulse
+    ledOut.clear();
+    tockOut.set();                // Issue a backward pulse
     delay(pulseDuration);
-    digitalWrite(tockPin, LOW);
+    tockOut.clear();
   }
   stepType = ! stepType;          // Switch from forward pulse to backward or vice versa
+  totalSteps++;
 }
 
 /***
@@ -1,7 +1,7 @@
 /****
  *
  *  TideClock.h
- *  Part of the "TideClock" library for Arduino. Version 0.6.1
+ *  Part of the "TideClock" library for Arduino. Version 0.8.0
  *
  * The TideClock class uses a hacked Lavet motor quartz clock movement -- one of the ubiquitous, cheap
  * quartz mechanisms powered by a single AA cell to display the number of hours to the next tide. It 
@@ -73,7 +73,9 @@
  * passing the current POSIX time. Do this as often as possible.
  * 
  * TideClock assumes that the clock's position has been set manually at the time of the first call to 
- * run().
+ * run(). Unless, that is, the sketch saved the clock's state (see getState()) somewhere that survives a 
+ * reset and, after the reset, hands it to resume() just after begin(). Then the clock carries on from 
+ * where it was, taking whatever steps it missed in the meantime.
  *
  ****
  *
@@ -84,6 +86,9 @@
 #pragma once
 
 #include <Arduino.h>  // Arduino 1.0
+#include "TideSchedule.h" // The clock face math
+#include <FastGpio.h>     // Single-store pin writes for the step pulses
+#include <Snapshot.h>     // Lock-free publication of the clock's state to other tasks
 
 // Some constants
 #define TC_ONE_MIN_STEP_INTERVAL        (200)                   // For tcOne motors, minimum interval between steps (millis())
@@ -92,12 +97,8 @@
 #define TC_SIXTEEN_MIN_STEP_INTERVAL    (31)                    // For tcSixteen motors, minimum interval between steps (millis())
 #define TC_SIXTEEN_PULSE_DURATION       (31)                    // For tcSixteen motors, duration of the step pulses (millis())
 #define TC_SIXTEEN_STEPS_PER_TICK       (16)                    // For tcSixteen motors, steps per tick
-#define TC_SECONDS_PER_TICK             (12)                    // How many seconds there are in one (linear) clock tick
-#define TC_SECONDS_IN_SIX_HOURS         ((uint32_t)6 * 60 * 60) // Six hours in seconds
-#define TC_SECONDS_IN_18_HOURS          ((uint32_t)18 * 60 *60) // Eighteen hours in seconds
-#define TC_A_COEFFICIENT                (1800.0 / (TC_SECONDS_IN_18_HOURS * TC_SECONDS_IN_18_HOURS)) // a in ticks(t) = a * t**2
-#define TC_TICKS_IN_A_CYCLE             (60 * 30)               // Number of ticks between high and low (or low and high) tide
 #define TC_ASK_TIDE_MILLIS              (120000UL)              // Rate limit for asking for a tide prediction
+#define TC_ASK_JITTER_MILLIS            (60000UL)               // Up to this much longer after an ask that failed
 #define TC_UNAVAILABLE                  (3)                     // tc_tide_t.tideType when the next tide in not available
 
 typedef uint8_t sx_t;                               // Our unit of time i.e. six minutes -- 1/10th of an hour, 1/240th of a day
@@ -107,6 +108,15 @@ struct tc_tide_t {                                  // A tide event -- the type
     uint8_t tideType;                               //  The type of tide event, HIGH or LOW
     time_t time;                                    //  When the event happens
 };
+struct tc_state_t {                                 // A snapshot of the clock's state, for other tasks to look at
+    tc_tide_t nextTide;                             //  The next tide event
+    int32_t stepsTaken;                             //  The number of steps taken since the last tide
+    int32_t stepsNeeded;                            //  The number of steps needed since the last tide to indicate correctly
+    bool paused;                                    //  True if waiting to get close enough to the next tide to run
+    uint32_t totalSteps;                            //  The number of steps taken since the clock was constructed
+    uint32_t catchUps;                              //  The number of times the clock has had to take quick steps to catch up
+    bool stepType;                                  //  The direction of the next step pulse
+};
 extern "C" {
 // Sketch-supplied getNextTide handler: time_t handler(void); It should return a tc_tide_t for the tide extreme
 typedef tc_tide_t(*getNextTideHandler_t) (void);
@@ -131,6 +141,22 @@ TideClock(uint8_t iPin, uint8_t oPin);
  * @param motor (tc_motor_t) The type of motor the clock has
  */
 void begin(getNextTideHandler_t h, tc_scale_t type = tcNonlinear, tc_motor_t motor = tcOne);
+
+/**
+ * @brief Print the clock's messages to out rather than Serial, e.g., to keep them off the port 
+ *        while it's carrying JSON-lines RPC (see RpcConsole in RpcLink.h)
+ * 
+ * @param out   (Print &) Where they go
+ */
+void setConsole(Print &out);
+	
+/**
+ * @brief Carry on from a state published (see getState()) before a reset, instead of assuming 
+ *        the clock has been set by hand. Call just after begin().
+ * 
+ * @param s     (tc_state_t) The state to carry on from
+ */
+void resume(tc_state_t s);
 	
 /**
  *
@@ -151,11 +177,82 @@ void run(time_t t);
 bool test();
 
 /**
- * @brief Get the tide event for the next tide. 0 if none.
+ * @brief Get the tide event for the next tide. 0 if none. Safe to call from any task.
  * 
  * @return tc_tide_t 
  */
 tc_tide_t getNextTide();
+
+/**
+ * @brief Get a consistent snapshot of the clock's state as of the end of the last call to 
+ *        run() or test(). Safe to call from any task; never blocks the task calling run().
+ * 
+ * @return tc_state_t 
+ */
+tc_state_t getState();
+
+/**
+ * @brief Set the seed for spreading out retries. After the handler fails to come up with the next 
+ *        tide, the clock waits TC_ASK_TIDE_MILLIS plus a part of TC_ASK_JITTER_MILLIS that 
+ *        depends on the seed and the number of failures before asking again, so a fleet of 
+ *        clocks that all failed at once doesn't retry all at once. Without a seed (or with the 
+ *        same one everywhere) they do.
+ * 
+ * @param seed  (uint32_t) The seed, e.g., derived from the MAC address
+ */
+void setJitter(uint32_t seed);
+
+/**
+ * @brief Ask the handler for the next tide the next time run() is called, rather than waiting
+ *        out the gap after an ask that failed, e.g., because the data it was missing has since
+ *        arrived.
+ */
+void askAgain();
+
+/**
+ * @brief Override the motor's default step timing. Used to run the motor with tuned (usually 
+ *        shorter) pulses to save energy. A value of 0 for either parameter means use the 
+ *        motor type's default. Call after begin().
+ * 
+ * @param pulseMillis   (uint32_t) The duration of the step pulse (millis())
+ * @param stepMillis    (unsigned long) The minimum interval between steps (millis())
+ */
+void setTiming(uint32_t pulseMillis, unsigned long stepMillis);
+
+/**
+ * @brief Get the step pulse duration currently in use (millis())
+ * 
+ * @return uint32_t 
+ */
+uint32_t getPulseDuration();
+
+/**
+ * @brief Get the minimum step interval currently in use (millis())
+ * 
+ * @return unsigned long 
+ */
+unsigned long getMinStepInterval();
+
+/**
+ * @brief Whether the clock has taken all the steps it currently needs to, i.e., whether it's 
+ *        idle until the time of its next scheduled tick.
+ * 
+ * @return true   Nothing to do until the next scheduled tick
+ * @return false  The clock still has steps to take
+ */
+bool caughtUp();
+
+/**
+ * @brief Build the schedule of the remaining ticks in the current tide cycle. See 
+ *        tcBuildSchedule() in TideSchedule.h for the format. Returns 0 if the clock doesn't 
+ *        yet know when the next tide is.
+ * 
+ * @param t         (time_t) Current local time in POSIX time
+ * @param delays    (uint16_t *) Where to put the schedule
+ * @param maxTicks  (uint16_t) The number of entries delays has room for
+ * @return uint16_t The number of entries in the schedule
+ */
+uint16_t buildSchedule(time_t t, uint16_t *delays, uint16_t maxTicks);
   
 private:
 /***
@@ -165,6 +262,10 @@ private:
  ***/
 uint8_t tickPin;                        // The pin to pulse to tick the clock forward one second
 uint8_t tockPin;                        // The pin to pulse to tock the clock forward one second
+Print *console;                         // Where messages go; Serial unless setConsole() says otherwise
+FastPin tickOut;                        // Fast writer for tickPin
+FastPin tockOut;                        // Fast writer for tockPin
+FastPin ledOut;                         // Fast writer for LED_BUILTIN, which shows the step type
 bool stepType;                          // The direction of the pulse step() should use next
 bool paused;                            // True if we're waiting to get close enough to a tide to run
 tc_scale_t faceType;                    // The type of face the clock has; tcLinear or tcNonlinear
@@ -174,10 +275,28 @@ unsigned long minStepInterval;          // The minimum step interval for our mot
 uint32_t pulseDuration;                 // How long the step pulse is for our motor (millis())
 int32_t stepsTaken;                     // The number of steps taken by the clock since the last tide
 int32_t stepsNeeded;                    // Number of steps since the last tide needed to indicate correctly
+uint32_t totalSteps;                    // The number of steps taken since construction
+uint32_t catchUps;                      // The number of times we've had to take quick steps to catch up
 tc_tide_t nextTide;                     // The next tide event
 unsigned long gotTideMillis;            // millis() at the time we last asked for the next tide prediction
+unsigned long askGapMillis;             // How long after gotTideMillis we can ask again
+uint32_t jitterSeed;                    // Makes the retry timing this clock's own
+uint16_t failedAsks;                    // The number of asks in a row that didn't get the next tide
 unsigned long lastMillis;               // millis() the last time step() or test() was invoked
 getNextTideHandler_t handler;           // The handler to call for the time of the next high/low tide
+Snapshot<tc_state_t> state;             // The state as of the end of the last run() or test(), for other tasks
+
+/**
+ * @brief The body of run()
+ * 
+ * @param t (time_t) Current local time in POSIX time
+ */
+void update(time_t t);
+
+/**
+ * @brief Publish a snapshot of the current state
+ */
+void publish();
 
 /**
  * @brief   Member function invoked to cause the clock mechanism to make one step forward.
@@ -0,0 +1,84 @@
+/****
+ *
+ * TideSchedule.cpp
+ * Part of the "TideClock" library for Arduino. Version 0.8.0
+ *
+ * See TideSchedule.h for details
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ * 
+ ****/
+
+#include "TideSchedule.h"
+
+/***
+ * tcTicksNeeded(nonlinear, secToNextTide)
+ ***/
+int32_t tcTicksNeeded(bool nonlinear, int32_t secToNextTide) {
+  // N.B. Signed arithmetic: the next tide can be further away than a whole face's worth of time.
+  // Both divisions truncate toward zero, as the float versions' casts to int32_t did.
+  if (nonlinear) {
+    int64_t secFromCycleEnd = static_cast<int32_t>(TC_SECONDS_IN_18_HOURS) - static_cast<int64_t>(secToNextTide);
+    uint64_t mag = secFromCycleEnd < 0 ? -secFromCycleEnd : secFromCycleEnd;
+    // Within a cycle or so of the tide the square fits in 32 bits, and dividing that by a constant 
+    // is a multiply; a 64-bit division is a library call.
+    int32_t ticks = mag <= UINT16_MAX ? 
+      static_cast<int32_t>(static_cast<uint32_t>(mag * mag) / static_cast<uint32_t>(TC_A_DIVISOR)) : 
+      static_cast<int32_t>(mag * mag / TC_A_DIVISOR);
+    return secFromCycleEnd < 0 ? -ticks : ticks;
+  }
+  int32_t secFromCycleEnd = static_cast<int32_t>(TC_SECONDS_IN_SIX_HOURS) - secToNextTide;
+  return secFromCycleEnd / TC_SECONDS_PER_TICK;
+}
+
+/***
+ * tcSecToNextTideForTick(nonlinear, tick)
+ ***/
+int32_t tcSecToNextTideForTick(bool nonlinear, int32_t tick) {
+  int32_t sec;
+  if (nonlinear) {
+    // The smallest secFromCycleEnd whose square is at least tick * TC_A_DIVISOR, by Newton's method
+    int64_t n = static_cast<int64_t>(tick) * TC_A_DIVISOR;
+    int64_t root = n;
+    for (int64_t next = (root + 1) / 2; next < root; next = (root + n / root) / 2) {
+      root = next;
+    }
+    if (root * root < n) {
+      root++;
+    }
+    sec = static_cast<int32_t>(TC_SECONDS_IN_18_HOURS) - static_cast<int32_t>(root);
+  } else {
+    sec = static_cast<int32_t>(TC_SECONDS_IN_SIX_HOURS) - tick * TC_SECONDS_PER_TICK;
+  }
+  // Both are exact, but make sure of it with the real thing, so the schedule can never disagree with 
+  // what run() does.
+  while (tcTicksNeeded(nonlinear, sec) < tick) {
+    sec--;
+  }
+  while (tcTicksNeeded(nonlinear, sec + 1) >= tick) {
+    sec++;
+  }
+  return sec;
+}
+
+/***
+ * tcBuildSchedule(nonlinear, ticksTaken, secToNextTide, delays, maxTicks)
+ ***/
+uint16_t tcBuildSchedule(bool nonlinear, int32_t ticksTaken, int32_t secToNextTide, uint16_t *delays, uint16_t maxTicks) {
+  uint16_t n = 0;
+  int32_t prevSec = secToNextTide;
+  for (int32_t tick = ticksTaken + 1; tick <= TC_TICKS_IN_A_CYCLE && n < maxTicks; tick++) {
+    int32_t sec = tcSecToNextTideForTick(nonlinear, tick);
+    int32_t delay = prevSec - sec;
+    if (delay < 0) {
+      delay = 0;
+    } else {
+      prevSec = sec;
+    }
+    delays[n++] = delay > TC_SCHEDULE_MAX_DELAY ? TC_SCHEDULE_MAX_DELAY : static_cast<uint16_t>(delay);
+  }
+  return n;
+}
@@ -0,0 +1,75 @@
+/****
+ *
+ *  TideSchedule.h
+ *  Part of the "TideClock" library for Arduino. Version 0.8.0
+ *
+ * The clock face math used by TideClock, pulled out so that it has no Arduino dependencies and can 
+ * be compiled and checked on a host machine as well as on the device.
+ * 
+ * For both face designs, the hand's position is a function of how long it is until the next tide. 
+ * tcTicksNeeded() is that function: given the number of seconds to the next tide, it says how many 
+ * ticks past the previous tide the hand should be showing.
+ * 
+ * tcBuildSchedule() turns that around. Given where the hand is and how long it is to the next tide, 
+ * it produces the timeline of the remaining ticks in the current tide cycle as a list of delays (in 
+ * seconds) between one tick and the next. The list is compact enough (two bytes per tick) to be 
+ * kept in RTC memory so the firmware can sleep from one tick to the next while running on battery 
+ * instead of polling TideClock::run(). Each tick is stepsPerTick motor steps.
+ * 
+ * It's all integer arithmetic: the ESP32-S2 has no FPU, so float math is done in software, and the 
+ * integer versions are exact, which float wasn't quite, near the ends of the nonlinear face.
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ * 
+ ****/
+#pragma once
+
+#include <stdint.h>
+
+// The clock face math constants
+#define TC_SECONDS_PER_TICK             (12)                    // How many seconds there are in one (linear) clock tick
+#define TC_SECONDS_IN_SIX_HOURS         ((uint32_t)6 * 60 * 60) // Six hours in seconds
+#define TC_SECONDS_IN_18_HOURS          ((uint32_t)18 * 60 *60) // Eighteen hours in seconds
+#define TC_A_DIVISOR                    ((int64_t)TC_SECONDS_IN_18_HOURS * TC_SECONDS_IN_18_HOURS / 1800) // d in ticks(t) = t**2 / d
+#define TC_TICKS_IN_A_CYCLE             (60 * 30)               // Number of ticks between high and low (or low and high) tide
+#define TC_SCHEDULE_MAX_DELAY           (0xFFFF)                // The longest delay a schedule entry can hold (seconds)
+
+/**
+ * @brief The number of ticks past the previous tide the hand should be showing when the next 
+ *        tide is secToNextTide seconds away. Negative if the next tide is so far away that 
+ *        the clock should be paused.
+ * 
+ * @param nonlinear     (bool) True for the nonlinear face, false for the linear one
+ * @param secToNextTide (int32_t) Seconds from now to the next tide
+ * @return int32_t      The number of ticks
+ */
+int32_t tcTicksNeeded(bool nonlinear, int32_t secToNextTide);
+
+/**
+ * @brief The number of seconds before the next tide at which the hand first needs to be 
+ *        showing tick number tick, i.e., the largest secToNextTide for which 
+ *        tcTicksNeeded(nonlinear, secToNextTide) >= tick.
+ * 
+ * @param nonlinear (bool) True for the nonlinear face, false for the linear one
+ * @param tick      (int32_t) The tick number; 1 through TC_TICKS_IN_A_CYCLE
+ * @return int32_t  Seconds before the next tide
+ */
+int32_t tcSecToNextTideForTick(bool nonlinear, int32_t tick);
+
+/**
+ * @brief Build the schedule for the rest of the current tide cycle.
+ * 
+ * @param nonlinear     (bool) True for the nonlinear face, false for the linear one
+ * @param ticksTaken    (int32_t) The number of ticks the hand is showing past the previous tide
+ * @param secToNextTide (int32_t) Seconds from now to the next tide
+ * @param delays        (uint16_t *) Where to put the schedule. delays[0] is the number of seconds 
+ *                      from now to the next tick, delays[i] the number of seconds between tick 
+ *                      i - 1 and tick i. A tick that is already overdue has a delay of 0. Delays 
+ *                      longer than TC_SCHEDULE_MAX_DELAY are clipped to it.
+ * @param maxTicks      (uint16_t) The number of entries delays has room for
+ * @return uint16_t     The number of entries in the schedule
+ */
+uint16_t tcBuildSchedule(bool nonlinear, int32_t ticksTaken, int32_t secToNextTide, uint16_t *delays, uint16_t maxTicks);
@@ -0,0 +1,180 @@
+/****
+ * 
+ * PredFetch.cpp
+ * Part of the "TideData" library. Version 0.2.0
+ * 
+ * See PredFetch.h for details
+ * 
+ ****
+ * 
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ * 
+ ****/
+
+#include <string.h>
+#include "PredFetch.h"
+
+/***
+ * pfJitter(seed, salt, range)
+ ***/
+uint32_t pfJitter(uint32_t seed, uint32_t salt, uint32_t range) {
+  if (range == 0) {
+    return 0;
+  }
+  uint32_t h = seed ^ (salt * 0x9E3779B9);      // Mix well enough that neighboring seeds and
+  h ^= h >> 16;                                 //   salts give unrelated answers (the
+  h *= 0x85EBCA6B;                              //   MurmurHash3 finalizer)
+  h ^= h >> 13;
+  h *= 0xC2B2AE35;
+  h ^= h >> 16;
+  return h % range;
+}
+
+/***
+ * PredFetch constructor
+ ***/
+PredFetch::PredFetch() {
+  seed = 0;
+  clear();
+}
+
+/***
+ * PredFetch::begin(s)
+ ***/
+void PredFetch::begin(uint32_t s) {
+  seed = s;
+}
+
+/***
+ * PredFetch::clear()
+ ***/
+void PredFetch::clear() {
+  loaded[0] = loaded[1] = 0;
+  retryAt = 0;
+  retrySecs = PF_RETRY_MIN_SECS;
+  failures = 0;
+}
+
+/***
+ * PredFetch::due(t)
+ ***/
+time_t PredFetch::due(time_t t) {
+  if (t < retryAt) {
+    return 0;
+  }
+  time_t today = (t / PF_SECONDS_PER_DAY) * PF_SECONDS_PER_DAY;
+  if (loaded[pfSlot(today)] != today) {
+    return today;                               // Needed now
+  }
+  time_t tomorrow = today + PF_SECONDS_PER_DAY;
+  time_t fetchAt = tomorrow - PF_LOOKAHEAD_SECS +
+    pfJitter(seed, tomorrow / PF_SECONDS_PER_DAY, PF_LOOKAHEAD_SECS - PF_MARGIN_SECS);
+  if (loaded[pfSlot(tomorrow)] != tomorrow && t >= fetchAt) {
+    return tomorrow;                            // This device's time to look ahead
+  }
+  return 0;
+}
+
+/***
+ * PredFetch::fetched(t, day, ok)
+ ***/
+void PredFetch::fetched(time_t t, time_t day, bool ok) {
+  if (ok) {
+    loaded[pfSlot(day)] = day;
+    retryAt = 0;
+    retrySecs = PF_RETRY_MIN_SECS;
+    failures = 0;
+    return;
+  }
+  retryAt = t + retrySecs + pfJitter(seed, ++failures, retrySecs);
+  retrySecs = retrySecs * 2 > PF_RETRY_MAX_SECS ? PF_RETRY_MAX_SECS : retrySecs * 2;
+}
+
+/***
+ * PredFetch::have(t)
+ ***/
+bool PredFetch::have(time_t t) {
+  time_t day = (t / PF_SECONDS_PER_DAY) * PF_SECONDS_PER_DAY;
+  return loaded[pfSlot(day)] == day;
+}
+
+/***
+ * HiloFetch constructor
+ ***/
+HiloFetch::HiloFetch() {
+  seed = 0;
+  clear();
+}
+
+/***
+ * HiloFetch::begin(s)
+ ***/
+void HiloFetch::begin(uint32_t s) {
+  seed = s;
+}
+
+/***
+ * HiloFetch::clear()
+ ***/
+void HiloFetch::clear() {
+  nEvents = 0;
+  storedDay = 0;
+  retryAt = 0;
+  retrySecs = PF_RETRY_MIN_SECS;
+  failures = 0;
+}
+
+/***
+ * HiloFetch::nextEvent(t, event)
+ ***/
+bool HiloFetch::nextEvent(time_t t, tt_event_t *event) {
+  for (uint16_t i = 0; i < nEvents; i++) {
+    if (events[i].time > t) {
+      *event = events[i];
+      return true;
+    }
+  }
+  return false;
+}
+
+/***
+ * HiloFetch::refreshDue(t)
+ ***/
+bool HiloFetch::refreshDue(time_t t) {
+  if (nEvents == 0 || t < retryAt) {
+    return false;
+  }
+  // This device's time in the window before the cache runs out. The window doesn't open until
+  // the day after the last fetch; a fetch on the same day would just get the same tides again.
+  time_t runsOut = events[nEvents - 1].time;
+  time_t opens = runsOut - HF_LOOKAHEAD_SECS;
+  time_t closes = runsOut - HF_MARGIN_SECS;
+  if (opens < storedDay + PF_SECONDS_PER_DAY) {
+    opens = storedDay + PF_SECONDS_PER_DAY;
+  }
+  if (closes <= opens) {
+    return t >= opens;
+  }
+  return t >= opens + (time_t)pfJitter(seed, storedDay / PF_SECONDS_PER_DAY, closes - opens);
+}
+
+/***
+ * HiloFetch::store(t, events, n)
+ ***/
+void HiloFetch::store(time_t t, const tt_event_t *e, uint16_t n) {
+  nEvents = n > HF_MAX_EVENTS ? HF_MAX_EVENTS : n;
+  memcpy(events, e, nEvents * sizeof(tt_event_t));
+  storedDay = (t / PF_SECONDS_PER_DAY) * PF_SECONDS_PER_DAY;
+  retryAt = 0;
+  retrySecs = PF_RETRY_MIN_SECS;
+  failures = 0;
+}
+
+/***
+ * HiloFetch::failed(t)
+ ***/
+void HiloFetch::failed(time_t t) {
+  retryAt = t + retrySecs + pfJitter(seed, ++failures, retrySecs);
+  retrySecs = retrySecs * 2 > PF_RETRY_MAX_SECS ? PF_RETRY_MAX_SECS : retrySecs * 2;
+}
@@ -0,0 +1,187 @@
+/****
+ * 
+ *  PredFetch.h
+ *  Part of the "TideData" library. Version 0.2.0
+ * 
+ * The firmware's decisions about when to ask the server for tide predictions, pulled out of
+ * getPredWl() and getNextTide() so that they have no Arduino dependencies and can be run on a
+ * host -- thousands of copies at once, in tools/fleetsim.cpp -- as well as on the device.
+ * 
+ * A fleet of clocks all keeping NTP time would otherwise all ask at the same moment: every one
+ * of them wants the new day's water levels the second the day rolls over, and every clock on a
+ * station wants the next tide the second the last one passes. So both kinds of data are fetched
+ * ahead of when they're needed, at a time within a window that's different for each device,
+ * and failures are retried after a backoff that's different for each device and each attempt.
+ * The difference comes from a seed -- on the device, derived from its MAC address -- so a
+ * device's schedule is the same from one boot to the next.
+ * 
+ * PredFetch looks after the six-minute water levels, which are fetched a day at a time,
+ * midnight (UTC) to midnight. The caller keeps two days' worth, in the slot pfSlot(day) for
+ * each day, so today's and tomorrow's are never in the same one. If today's are missing (just
+ * booted, say) due() says to fetch them right away. Once they're there, it says to fetch
+ * tomorrow's at this device's time in the PF_LOOKAHEAD_SECS before midnight, leaving at least
+ * PF_MARGIN_SECS for retries. The caller reports how each fetch went with fetched().
+ * 
+ * HiloFetch caches the high and low tides from the last fetch, so getNextTide() only needs the
+ * server when the cache can't say what the next tide is. Before that happens, refreshDue()
+ * says to fetch afresh, at this device's time in the HF_LOOKAHEAD_SECS before the cache runs
+ * out, leaving at least HF_MARGIN_SECS for retries.
+ * 
+ ****
+ * 
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ * 
+ ****/
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+#include "TideTable.h"
+
+// Some constants
+#define PF_SECONDS_PER_DAY      (86400)         // Seconds in a day
+#define PF_LOOKAHEAD_SECS       (12 * 3600)     // Tomorrow's levels are fetched in this many seconds before midnight
+#define PF_MARGIN_SECS          (2 * 3600)      //   but no later than this many seconds before midnight
+#define PF_RETRY_MIN_SECS       (600)           // The shortest backoff after a failed fetch
+#define PF_RETRY_MAX_SECS       (3600)          // The longest backoff after a failed fetch
+#define HF_MAX_EVENTS           (16)            // The number of high and low tides HiloFetch caches
+#define HF_LOOKAHEAD_SECS       (24 * 3600)     // The cache is refreshed in this many seconds before it runs out
+#define HF_MARGIN_SECS          (6 * 3600)      //   but no later than this many seconds before it runs out
+
+/**
+ * @brief A number from 0 to range - 1 that depends on seed and salt but looks random
+ * 
+ * @param seed      The device's seed
+ * @param salt      What the number is for, e.g., the day or the attempt
+ * @param range     The number of possible values
+ * @return uint32_t The number
+ */
+uint32_t pfJitter(uint32_t seed, uint32_t salt, uint32_t range);
+
+/**
+ * @brief The slot a day's six-minute levels go in
+ * 
+ * @param day     00:00:00 UTC on the day
+ * @return uint8_t 0 or 1
+ */
+inline uint8_t pfSlot(time_t day) {
+  return (day / PF_SECONDS_PER_DAY) & 1;
+}
+
+class PredFetch {
+public:
+/**
+ * @brief Construct a new PredFetch object; no day's predictions have been fetched
+ */
+PredFetch();
+
+/**
+ * @brief Set the seed that makes this device's schedule different from other devices'
+ * 
+ * @param s The seed, e.g., derived from the MAC address
+ */
+void begin(uint32_t s);
+
+/**
+ * @brief Forget which days' predictions are in hand, e.g., because the station changed
+ */
+void clear();
+
+/**
+ * @brief Which day's predictions, if any, to fetch now
+ * 
+ * @param t       The current time (POSIX time)
+ * @return time_t 00:00:00 UTC on the day to fetch; 0 if there's nothing to fetch now
+ */
+time_t due(time_t t);
+
+/**
+ * @brief Report how fetching a day's predictions went
+ * 
+ * @param t     The current time (POSIX time)
+ * @param day   The day fetched, as returned by due()
+ * @param ok    Whether the fetch worked; if so, the levels are in slot pfSlot(day)
+ */
+void fetched(time_t t, time_t day, bool ok);
+
+/**
+ * @brief Whether the predictions for the day containing t are in hand
+ * 
+ * @param t       The time (POSIX time)
+ * @return true   They are, in slot pfSlot() of t's day
+ * @return false  They aren't
+ */
+bool have(time_t t);
+
+private:
+uint32_t seed;                          // Makes the device's schedule its own
+time_t loaded[2];                       // The day whose predictions are in each slot; 0 if none
+time_t retryAt;                         // No fetching before this time
+uint32_t retrySecs;                     // The backoff after the next failure
+uint16_t failures;                      // The number of failures in a row
+};
+
+class HiloFetch {
+public:
+/**
+ * @brief Construct a new HiloFetch object with nothing in the cache
+ */
+HiloFetch();
+
+/**
+ * @brief Set the seed that makes this device's schedule different from other devices'
+ * 
+ * @param s The seed, e.g., derived from the MAC address
+ */
+void begin(uint32_t s);
+
+/**
+ * @brief Forget what's in the cache, e.g., because the station changed
+ */
+void clear();
+
+/**
+ * @brief Get the next high or low tide after time t from the cache
+ * 
+ * @param t       The time (POSIX time)
+ * @param event   Where to put it
+ * @return true   Got it
+ * @return false  The cache doesn't know; fetch
+ */
+bool nextEvent(time_t t, tt_event_t *event);
+
+/**
+ * @brief Whether to fetch the tides afresh now, before the cache runs out
+ * 
+ * @param t       The current time (POSIX time)
+ * @return true   Fetch and store() (or failed())
+ * @return false  Not yet
+ */
+bool refreshDue(time_t t);
+
+/**
+ * @brief Replace what's in the cache with freshly fetched tides
+ * 
+ * @param t       The current time (POSIX time)
+ * @param events  The tides, in time order; only the first HF_MAX_EVENTS are kept
+ * @param n       How many there are
+ */
+void store(time_t t, const tt_event_t *events, uint16_t n);
+
+/**
+ * @brief Report that a refresh didn't work
+ * 
+ * @param t The current time (POSIX time)
+ */
+void failed(time_t t);
+
+private:
+uint32_t seed;                          // Makes the device's schedule its own
+tt_event_t events[HF_MAX_EVENTS];       // The cached tides, in time order
+uint16_t nEvents;                       // How many there are
+time_t storedDay;                       // 00:00:00 UTC on the day they were fetched
+time_t retryAt;                         // No refreshing before this time
+uint32_t retrySecs;                     // The backoff after the next failure
+uint16_t failures;                      // The number of failures in a row
+};
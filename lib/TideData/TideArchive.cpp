@@ -0,0 +1,226 @@
+/****
+ *
+ * TideArchive.cpp
+ * Part of the "TideData" library. Version 0.1.0
+ *
+ * See TideArchive.h for details
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ * 
+ ****/
+
+#include <string.h>
+#include "TideArchive.h"
+
+/***
+ * Append the varint encoding of v to out at *pos, if there's room. Return false if there isn't.
+ ***/
+static bool putVarint(uint32_t v, uint8_t *out, size_t outSize, size_t *pos) {
+  do {
+    if (*pos >= outSize) {
+      return false;
+    }
+    uint8_t b = v & 0x7F;
+    v >>= 7;
+    out[(*pos)++] = v != 0 ? (b | 0x80) : b;
+  } while (v != 0);
+  return true;
+}
+
+/***
+ * Decode the varint at *p, not going past end. Return false if it's malformed.
+ ***/
+static bool getVarint(const uint8_t **p, const uint8_t *end, uint32_t *v) {
+  *v = 0;
+  for (uint8_t shift = 0; shift < 35 && *p < end; shift += 7) {
+    uint8_t b = *(*p)++;
+    *v |= (uint32_t)(b & 0x7F) << shift;
+    if ((b & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/***
+ * Round level (hundredths of a foot) to the nearest multiple of quantum, in quanta
+ ***/
+static int32_t quantize(int16_t level, uint16_t quantum) {
+  int32_t l = level;
+  return l >= 0 ? (l + quantum / 2) / quantum : -((-l + quantum / 2) / quantum);
+}
+
+/***
+ * taEncode(station, events, nEvents, out, outSize, blockSize, levelQuantum)
+ ***/
+size_t taEncode(const char *station, const tt_event_t *events, size_t nEvents, uint8_t *out, size_t outSize,
+    uint16_t blockSize, uint16_t levelQuantum) {
+  if (blockSize == 0 || levelQuantum == 0) {
+    return 0;
+  }
+  uint32_t nBlocks = (nEvents + blockSize - 1) / blockSize;
+  size_t dataStart = sizeof(ta_header_t) + nBlocks * sizeof(ta_block_t);
+  if (dataStart > outSize) {
+    return 0;
+  }
+  ta_block_t *index = reinterpret_cast<ta_block_t *>(out + sizeof(ta_header_t));
+  size_t pos = dataStart;
+  uint32_t prevMinute = 0;
+  int32_t q[2] = {0, 0};                        // Quantized levels of the two events before this one in the block
+  for (size_t i = 0; i < nEvents; i++) {
+    uint32_t minute = events[i].time / 60;
+    if (i % blockSize == 0) {
+      index[i / blockSize].time = minute * 60;
+      index[i / blockSize].offset = pos - dataStart;
+      prevMinute = minute;
+      q[0] = q[1] = 0;
+    }
+    if (minute < prevMinute) {
+      return 0;
+    }
+    int32_t thisQ = quantize(events[i].level, levelQuantum);
+    int32_t delta = thisQ - q[0];
+    uint32_t zigzag = delta >= 0 ? (uint32_t)delta << 1 : ((uint32_t)(-delta) << 1) - 1;
+    if (!putVarint(minute - prevMinute, out, outSize, &pos) ||
+        !putVarint((zigzag << 1) | (events[i].type == TT_TYPE_HIGH ? 1 : 0), out, outSize, &pos)) {
+      return 0;
+    }
+    prevMinute = minute;
+    q[0] = q[1];
+    q[1] = thisQ;
+  }
+  ta_header_t h;
+  memset(&h, 0, sizeof(h));
+  h.magic = TA_MAGIC;
+  h.version = TA_VERSION;
+  h.headerSize = sizeof(ta_header_t);
+  strncpy(h.station, station, sizeof(h.station) - 1);
+  h.nEvents = nEvents;
+  h.blockSize = blockSize;
+  h.levelQuantum = levelQuantum;
+  h.nBlocks = nBlocks;
+  h.dataSize = pos - dataStart;
+  h.size = pos;
+  h.crc = ttCrc32(out + sizeof(ta_header_t), pos - sizeof(ta_header_t));
+  memcpy(out, &h, sizeof(h));
+  return pos;
+}
+
+/***
+ * Constructor
+ ***/
+TideArchive::TideArchive() {
+  header = nullptr;
+}
+
+/***
+ * attach(base, size)
+ ***/
+bool TideArchive::attach(const void *base, size_t size) {
+  header = nullptr;
+  const ta_header_t *h = static_cast<const ta_header_t *>(base);
+  if (base == nullptr || size < sizeof(ta_header_t) || h->magic != TA_MAGIC || h->version != TA_VERSION ||
+      h->headerSize != sizeof(ta_header_t) || h->size > size || h->blockSize == 0 || h->levelQuantum == 0 ||
+      h->nBlocks != (h->nEvents + h->blockSize - 1) / h->blockSize ||
+      sizeof(ta_header_t) + (uint64_t)h->nBlocks * sizeof(ta_block_t) + h->dataSize != h->size) {
+    return false;
+  }
+  const uint8_t *p = static_cast<const uint8_t *>(base);
+  if (ttCrc32(p + sizeof(ta_header_t), h->size - sizeof(ta_header_t)) != h->crc) {
+    return false;
+  }
+  header = h;
+  index = reinterpret_cast<const ta_block_t *>(p + sizeof(ta_header_t));
+  data = p + sizeof(ta_header_t) + h->nBlocks * sizeof(ta_block_t);
+  return true;
+}
+
+/***
+ * isValid()
+ ***/
+bool TideArchive::isValid() {
+  return header != nullptr;
+}
+
+/***
+ * station()
+ ***/
+const char *TideArchive::station() {
+  return header == nullptr ? "" : header->station;
+}
+
+/***
+ * size()
+ ***/
+uint32_t TideArchive::size() {
+  return header == nullptr ? 0 : header->nEvents;
+}
+
+/***
+ * nextEvent(t, event)
+ ***/
+bool TideArchive::nextEvent(time_t t, tt_event_t *event) {
+  if (header == nullptr || header->nBlocks == 0) {
+    return false;
+  }
+  // Find the last block starting at or before t. If there isn't one, the answer is the first event.
+  if (t < (time_t)index[0].time) {
+    return scanBlock(0, t, 0, event);
+  }
+  uint32_t lo = 0, hi = header->nBlocks;
+  while (hi - lo > 1) {
+    uint32_t mid = (lo + hi) / 2;
+    if ((time_t)index[mid].time <= t) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  if (scanBlock(lo, t, header->blockSize, event)) {
+    return true;
+  }
+  return lo + 1 < header->nBlocks && scanBlock(lo + 1, t, header->blockSize, event);
+}
+
+/***
+ * eventAt(ix, event)
+ ***/
+bool TideArchive::eventAt(uint32_t ix, tt_event_t *event) {
+  if (header == nullptr || ix >= header->nEvents) {
+    return false;
+  }
+  return scanBlock(ix / header->blockSize, (time_t)-1, ix % header->blockSize, event);
+}
+
+/***
+ * scanBlock(b, t, stopAt, event)
+ ***/
+bool TideArchive::scanBlock(uint32_t b, time_t t, uint32_t stopAt, tt_event_t *event) {
+  const uint8_t *p = data + index[b].offset;
+  const uint8_t *end = b + 1 < header->nBlocks ? data + index[b + 1].offset : data + header->dataSize;
+  uint32_t count = b + 1 < header->nBlocks ? header->blockSize : header->nEvents - b * header->blockSize;
+  uint32_t minute = index[b].time / 60;
+  int32_t q[2] = {0, 0};
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t delta, levelType;
+    if (!getVarint(&p, end, &delta) || !getVarint(&p, end, &levelType)) {
+      return false;
+    }
+    minute += delta;
+    uint32_t zigzag = levelType >> 1;
+    int32_t thisQ = q[0] + ((zigzag & 1) ? -(int32_t)((zigzag + 1) >> 1) : (int32_t)(zigzag >> 1));
+    q[0] = q[1];
+    q[1] = thisQ;
+    if (i == stopAt || (t != (time_t)-1 && (time_t)minute * 60 > t)) {
+      event->time = minute * 60;
+      event->level = (int16_t)(thisQ * header->levelQuantum);
+      event->type = (levelType & 1) ? TT_TYPE_HIGH : TT_TYPE_LOW;
+      event->reserved = 0;
+      return true;
+    }
+  }
+  return false;
+}
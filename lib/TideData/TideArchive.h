@@ -0,0 +1,154 @@
+/****
+ *
+ *  TideArchive.h
+ *  Part of the "TideData" library. Version 0.1.0
+ *
+ * A TideArchive is a compact, read-only list of high and low tide events for one station -- a 
+ * year's worth fits in about 4KB -- that can be searched where it sits, without being unpacked. 
+ * It's for when all that's needed is the tide clock's "when is the next tide" and a TideTable, 
+ * which also holds six-minute levels, would be overkill.
+ * 
+ * The layout, all little-endian, is:
+ * 
+ *   ta_header_t                  Identifies the archive, says what's in it
+ *   ta_block_t index[nBlocks]    For each block of blockSize events, the time of its first event 
+ *                                and where its data starts
+ *   uint8_t data[dataSize]       The events, block after block
+ * 
+ * Within a block, each event is two varints (7 bits per byte, low-order first, high bit set on 
+ * all but the last byte):
+ * 
+ *   minutes        Minutes since the previous event in the block (0 for the block's first event, 
+ *                  whose time is in the index)
+ *   level/type     (zigzag(q) << 1) | isHigh, where q is the event's level in units of the 
+ *                  header's levelQuantum hundredths of a foot, less that of the event two before 
+ *                  it in the block (usually of the same type, so the difference is small)
+ * 
+ * Blocks decode independently, so finding the next event after a time is a binary search of the 
+ * index followed by decoding at most one or two blocks: O(log n).
+ * 
+ * The header's crc covers everything after the header. Archives are built on a host by the 
+ * mktidetable tool (see tools/), which compiles in TideArchive.cpp and calls taEncode(), so what 
+ * it writes is just what a TideArchive on the device reads.
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ * 
+ ****/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include "TideTable.h"
+
+// Some constants
+#define TA_MAGIC                (0x43524154)    // "TARC" as a little-endian uint32_t
+#define TA_VERSION              (1)             // The version of the layout described here
+#define TA_BLOCK_SIZE           (32)            // The default number of events in a block
+#define TA_LEVEL_QUANTUM        (5)             // The default level quantum (hundredths of a foot)
+
+struct ta_header_t {                            // The archive's header
+  uint32_t magic;                               //  TA_MAGIC
+  uint16_t version;                             //  TA_VERSION
+  uint16_t headerSize;                          //  sizeof(ta_header_t)
+  char station[8];                              //  The 7-digit NOAA station ID (null-padded)
+  uint32_t nEvents;                             //  Number of events
+  uint16_t blockSize;                           //  Events per block
+  uint16_t levelQuantum;                        //  Level quantum, hundredths of a foot
+  uint32_t nBlocks;                             //  Number of blocks
+  uint32_t dataSize;                            //  Size of the event data
+  uint32_t size;                                //  Size of the whole archive, header included
+  uint32_t crc;                                 //  CRC-32 of everything after the header
+};
+
+struct ta_block_t {                             // An index entry
+  uint32_t time;                                //  POSIX time of the block's first event
+  uint32_t offset;                              //  Offset of its data from the start of data
+};
+
+/**
+ * @brief Encode a list of events as a TideArchive. Event times are rounded down to the minute and 
+ *        levels are quantized to levelQuantum.
+ * 
+ * @param station       The 7-digit NOAA station ID
+ * @param events        The events, in time order
+ * @param nEvents       How many there are
+ * @param out           Where to put the archive
+ * @param outSize       How much room there is
+ * @param blockSize     Events per block
+ * @param levelQuantum  Level quantum, hundredths of a foot
+ * @return size_t       The size of the archive; 0 if it didn't fit or the events aren't in order
+ */
+size_t taEncode(const char *station, const tt_event_t *events, size_t nEvents, uint8_t *out, size_t outSize,
+  uint16_t blockSize = TA_BLOCK_SIZE, uint16_t levelQuantum = TA_LEVEL_QUANTUM);
+
+class TideArchive {
+public:
+  /**
+   * @brief Construct a new, empty, TideArchive
+   */
+  TideArchive();
+
+  /**
+   * @brief Attach the TideArchive to the archive at base, checking it as we go. Nothing is copied; 
+   *        base must stay valid for as long as the TideArchive is used.
+   * 
+   * @param base    Where the archive is
+   * @param size    The size of the space it's in
+   * @return true   The archive is good and attached
+   * @return false  No valid archive there; the TideArchive is empty
+   */
+  bool attach(const void *base, size_t size);
+
+  /**
+   * @brief Whether a valid archive is attached
+   */
+  bool isValid();
+
+  /**
+   * @brief The station the archive is for; "" if no archive is attached
+   */
+  const char *station();
+
+  /**
+   * @brief The number of events in the archive
+   */
+  uint32_t size();
+
+  /**
+   * @brief Get the first high or low tide event after time t
+   * 
+   * @param t       The time
+   * @param event   Where to put the event. Its level is quantized.
+   * @return true   Got it
+   * @return false  The archive has no event after t
+   */
+  bool nextEvent(time_t t, tt_event_t *event);
+
+  /**
+   * @brief Get event number ix (from 0) in the archive
+   * 
+   * @param ix      The event number
+   * @param event   Where to put the event. Its level is quantized.
+   * @return true   Got it
+   * @return false  There's no such event
+   */
+  bool eventAt(uint32_t ix, tt_event_t *event);
+
+private:
+  const ta_header_t *header;                    // The archive's header; nullptr if none attached
+  const ta_block_t *index;                      // The archive's block index
+  const uint8_t *data;                          // The archive's event data
+
+  /**
+   * @brief Decode block b, stopping at the first event after t or at event number stopAt within 
+   *        the block, whichever comes first.
+   * 
+   * @return true   Found such an event; it's in event
+   * @return false  Came to the end of the block
+   */
+  bool scanBlock(uint32_t b, time_t t, uint32_t stopAt, tt_event_t *event);
+};
@@ -0,0 +1,229 @@
+/****
+ *
+ *  TideCurve.cpp
+ *  Part of the "TideData" library. Version 0.1.0
+ *
+ * See TideCurve.h for details
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ *
+ ****/
+
+#include <string.h>
+#include "TideCurve.h"
+
+// Some constants
+#define TCV_Q                   (15)            // Bits after the binary point in the segment parameter
+#define TCV_ONE                 ((int32_t)1 << TCV_Q)
+#define TCV_MAX_SECS            ((uint32_t)1 << (32 - TCV_Q)) // A curve must be shorter than this, so sec << TCV_Q fits in 32 bits
+
+/**
+ * @brief n / d rounded to the nearest, halves away from zero; d > 0
+ */
+static int64_t roundDiv(int64_t n, int64_t d) {
+  return (n < 0 ? n - d / 2 : n + d / 2) / d;
+}
+
+/**
+ * @brief The slope of the levels at sample i (thousandths of a foot per hour): the central
+ *        difference, or the one-sided second-order difference at the ends
+ */
+static int16_t sampleSlope(const int16_t *levels, uint16_t n, uint16_t i, uint16_t interval) {
+  int32_t rise;                                 // Hundredths of a foot over two intervals
+  if (n < 3) {
+    rise = 2 * (levels[1] - levels[0]);
+  } else if (i == 0) {
+    rise = -3 * levels[0] + 4 * levels[1] - levels[2];
+  } else if (i == n - 1) {
+    rise = 3 * levels[n - 1] - 4 * levels[n - 2] + levels[n - 3];
+  } else {
+    rise = levels[i + 1] - levels[i - 1];
+  }
+  int64_t slope = roundDiv((int64_t)rise * 10 * 3600, 2 * interval);
+  return slope > INT16_MAX ? INT16_MAX : slope < INT16_MIN ? INT16_MIN : (int16_t)slope;
+}
+
+/***
+ * TideCurve()
+ ***/
+TideCurve::TideCurve() {
+  clear();
+}
+
+/***
+ * fit(start, interval, levels, n, maxError, knots)
+ ***/
+bool TideCurve::fit(time_t start, uint16_t interval, const int16_t *levels, uint16_t n, uint16_t maxError, tcv_knots_t knots) {
+  clear();
+  if (levels == nullptr || n < 2 || n > TCV_MAX_SAMPLES || interval == 0 || 
+    (uint32_t)(n - 1) * interval >= TCV_MAX_SECS) {
+    return false;
+  }
+  startTime = start;
+  this->interval = interval;
+  nSamples = n;
+
+  // The initial knots: the ends and either the highs and lows or every TCV_FIXED_KNOT_SAMPLES
+  bool isKnot[TCV_MAX_SAMPLES] = {};
+  isKnot[0] = isKnot[n - 1] = true;
+  for (uint16_t i = 1; i < n - 1; i++) {
+    if (knots == tcvFixed) {
+      isKnot[i] = i % TCV_FIXED_KNOT_SAMPLES == 0;
+    } else {
+      isKnot[i] = (levels[i] > levels[i - 1] && levels[i] >= levels[i + 1]) ||
+        (levels[i] < levels[i - 1] && levels[i] <= levels[i + 1]);
+    }
+  }
+
+  // Fit, then add a knot where the fit is worst, until it's good enough or we're out of knots
+  while (true) {
+    nKnots = 0;
+    for (uint16_t i = 0; i < n; i++) {
+      if (isKnot[i] && nKnots < TCV_MAX_KNOTS) {
+        knotSx[nKnots] = i;
+        knotLevel[nKnots] = levels[i];
+        knotSlope[nKnots] = sampleSlope(levels, n, i, interval);
+        nKnots++;
+      }
+    }
+    if (knotSx[nKnots - 1] != n - 1) {          // Can only happen with too many initial knots
+      knotSx[nKnots - 1] = n - 1;
+      knotLevel[nKnots - 1] = levels[n - 1];
+      knotSlope[nKnots - 1] = sampleSlope(levels, n, n - 1, interval);
+    }
+    buildIndex();
+    error = 0;
+    uint16_t worst = 0;
+    for (uint16_t i = 0; i < n; i++) {
+      int32_t diff = levelAtSample(i) - levels[i];
+      uint16_t absDiff = diff < 0 ? -diff : diff;
+      if (absDiff > error) {
+        error = absDiff;
+        worst = i;
+      }
+    }
+    if (error <= maxError || nKnots == TCV_MAX_KNOTS) {
+      return true;
+    }
+    isKnot[worst] = true;
+  }
+}
+
+/***
+ * clear()
+ ***/
+void TideCurve::clear() {
+  startTime = 0;
+  interval = 0;
+  nSamples = 0;
+  error = 0;
+  nKnots = 0;
+  memset(knotSx, 0, sizeof(knotSx));
+  memset(knotLevel, 0, sizeof(knotLevel));
+  memset(knotSlope, 0, sizeof(knotSlope));
+  memset(index, 0, sizeof(index));
+}
+
+/***
+ * levelAt(t, level)
+ ***/
+bool TideCurve::levelAt(time_t t, int16_t *level) const {
+  if (nSamples == 0 || t < (time_t)startTime || t > (time_t)startTime + (time_t)(nSamples - 1) * interval) {
+    return false;
+  }
+  int32_t sec = t - startTime;
+  uint8_t sx = sec / interval;
+  uint8_t k = index[sx / TCV_INDEX_SAMPLES];
+  while (k + 1 < nKnots && knotSx[k + 1] <= sx) {
+    k++;
+  }
+  *level = evaluate(k, sec - knotSx[k] * interval);
+  return true;
+}
+
+/***
+ * levelAtSample(sx)
+ ***/
+int16_t TideCurve::levelAtSample(uint8_t sx) const {
+  uint8_t k = index[sx / TCV_INDEX_SAMPLES];
+  while (k + 1 < nKnots && knotSx[k + 1] <= sx) {
+    k++;
+  }
+  return evaluate(k, (sx - knotSx[k]) * interval);
+}
+
+/***
+ * isValid()
+ ***/
+bool TideCurve::isValid() const {
+  return nSamples != 0;
+}
+
+/***
+ * knots()
+ ***/
+uint8_t TideCurve::knots() const {
+  return nKnots;
+}
+
+/***
+ * samples()
+ ***/
+uint16_t TideCurve::samples() const {
+  return nSamples;
+}
+
+/***
+ * maxError()
+ ***/
+uint16_t TideCurve::maxError() const {
+  return error;
+}
+
+/***
+ * packedSize()
+ ***/
+size_t TideCurve::packedSize() const {
+  size_t header = sizeof(startTime) + sizeof(interval) + sizeof(nSamples) + sizeof(error) + sizeof(nKnots);
+  size_t perKnot = sizeof(knotSx[0]) + sizeof(knotLevel[0]) + sizeof(knotSlope[0]);
+  return header + nKnots * perKnot + (nSamples == 0 ? 0 : (nSamples - 1) / TCV_INDEX_SAMPLES + 1);
+}
+
+/***
+ * evaluate(k, sec)
+ ***/
+int32_t TideCurve::evaluate(uint8_t k, int32_t sec) const {
+  if (sec == 0 || k + 1 >= nKnots) {
+    return knotLevel[k];
+  }
+  // The cubic Hermite basis functions of s = sec / segment length, in Q15
+  uint32_t segSecs = (knotSx[k + 1] - knotSx[k]) * interval;
+  int32_t s = ((uint32_t)sec << TCV_Q) / segSecs;
+  int32_t s2 = (s * s) >> TCV_Q;
+  int32_t s3 = (s2 * s) >> TCV_Q;
+  int32_t h00 = 2 * s3 - 3 * s2 + TCV_ONE;
+  int32_t h10 = s3 - 2 * s2 + s;
+  int32_t h01 = -2 * s3 + 3 * s2;
+  int32_t h11 = s3 - s2;
+  // Levels are hundredths of a foot; slopes, thousandths of a foot per hour, times the segment's
+  // length in seconds, are 36000 times that.
+  int64_t sum = ((int64_t)h00 * knotLevel[k] + (int64_t)h01 * knotLevel[k + 1]) * 36000 +
+    ((int64_t)h10 * knotSlope[k] + (int64_t)h11 * knotSlope[k + 1]) * segSecs;
+  return roundDiv(sum, (int64_t)36000 << TCV_Q);
+}
+
+/***
+ * buildIndex()
+ ***/
+void TideCurve::buildIndex() {
+  uint8_t k = 0;
+  for (uint16_t i = 0; i * TCV_INDEX_SAMPLES < nSamples; i++) {
+    while (k + 1 < nKnots && knotSx[k + 1] <= i * TCV_INDEX_SAMPLES) {
+      k++;
+    }
+    index[i] = k;
+  }
+}
@@ -0,0 +1,135 @@
+/****
+ *
+ *  TideCurve.h
+ *  Part of the "TideData" library. Version 0.1.0
+ *
+ * A TideCurve is a day's six-minute water level predictions squeezed into a piecewise cubic: a
+ * few dozen knots, each a sample time, a level and a slope, with a cubic Hermite segment between
+ * each knot and the next. Where a day of predictions takes 241 levels, a curve that stays within
+ * a hundredth of a foot of every one of them typically takes 15 to 25 knots, so several days for
+ * several stations fit in the RAM one day of raw samples used to.
+ *
+ * fit() places knots at the samples' highs and lows (where the tide turns and the slope is zero)
+ * or every TCV_FIXED_KNOT_SAMPLES samples, plus the first and last samples. Then, for as long as
+ * some sample is further from the curve than the error bound, it adds a knot at the sample that
+ * is furthest off. A knot's slope is the samples' central difference there.
+ *
+ * levelAt() takes constant time: an index says which knot is in effect at the start of each
+ * TCV_INDEX_SAMPLES samples, and there are at most that many knots to step over from there.
+ * Evaluation is all integer arithmetic, since the ESP32-S2 has no FPU; levels are in hundredths
+ * of a foot and slopes in thousandths of a foot per hour.
+ *
+ * A TideCurve is a plain block of memory, so it can be copied byte for byte (e.g., into RTC
+ * memory) and used where it's copied to.
+ *
+ * tools/tidecurve.cpp fits it to saved or made-up predictions to see how well it compresses them, 
+ * and tools/wldsim.cpp drives the simulated display from it, both with TideCurve.cpp as is.
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+// Some constants
+#define TCV_MAX_SAMPLES         (256)           // The most samples a curve can be fitted to (sample numbers are a byte)
+#define TCV_MAX_KNOTS           (48)            // The most knots a curve can have
+#define TCV_INDEX_SAMPLES       (10)            // The index has an entry for every this many samples
+#define TCV_INDEX_SIZE          ((TCV_MAX_SAMPLES + TCV_INDEX_SAMPLES - 1) / TCV_INDEX_SAMPLES)
+#define TCV_FIXED_KNOT_SAMPLES  (20)            // With tcvFixed, the samples between initial knots
+#define TCV_DEFAULT_MAX_ERROR   (1)             // The default error bound (hundredths of a foot)
+
+enum tcv_knots_t : uint8_t {tcvHiLo, tcvFixed}; // Where fit() puts its initial knots
+
+class TideCurve {
+public:
+  /**
+   * @brief Construct a new, empty, TideCurve
+   */
+  TideCurve();
+
+  /**
+   * @brief Fit the curve to a run of evenly spaced water levels, replacing whatever it held
+   *
+   * @param start     The time of levels[0]
+   * @param interval  The seconds between levels (NOAA's are 360)
+   * @param levels    The levels (hundredths of a foot MLLW)
+   * @param n         The number of levels; 2 to TCV_MAX_SAMPLES
+   * @param maxError  The error bound (hundredths of a foot)
+   * @param knots     Where to put the initial knots
+   * @return true     Fitted. The curve may not be within maxError of every level if it ran out
+   *                  of knots; maxError() says how close it came
+   * @return false    Nonsense arguments; the curve is empty
+   */
+  bool fit(time_t start, uint16_t interval, const int16_t *levels, uint16_t n,
+    uint16_t maxError = TCV_DEFAULT_MAX_ERROR, tcv_knots_t knots = tcvHiLo);
+
+  /**
+   * @brief Make the curve empty
+   */
+  void clear();
+
+  /**
+   * @brief Get the water level at time t, from the curve
+   *
+   * @param t         The time
+   * @param level     Where to put the level (hundredths of a foot MLLW)
+   * @return true     Got it
+   * @return false    The curve is empty or doesn't cover t
+   */
+  bool levelAt(time_t t, int16_t *level) const;
+
+  /**
+   * @brief Get the water level at sample sx, from the curve; levelAt() for a sample time
+   *
+   * @param sx        The sample number; less than samples()
+   * @return int16_t  The level (hundredths of a foot MLLW)
+   */
+  int16_t levelAtSample(uint8_t sx) const;
+
+  /**
+   * @brief Whether the curve has been fitted
+   */
+  bool isValid() const;
+
+  /**
+   * @brief The number of knots in the curve
+   */
+  uint8_t knots() const;
+
+  /**
+   * @brief The number of samples the curve was fitted to
+   */
+  uint16_t samples() const;
+
+  /**
+   * @brief The furthest any of the samples the curve was fitted to is from it (hundredths of a foot)
+   */
+  uint16_t maxError() const;
+
+  /**
+   * @brief The bytes it would take to store the curve, its knots and index packed: its size if
+   *        it were saved somewhere that cared, rather than sizeof(TideCurve)
+   */
+  size_t packedSize() const;
+
+private:
+  int32_t evaluate(uint8_t k, int32_t sec) const;   // Level (hundredths of a foot) sec seconds after knot k
+  void buildIndex();
+
+  uint32_t startTime;                       // The time of sample 0
+  uint16_t interval;                        // Seconds between samples
+  uint16_t nSamples;                        // The number of samples fitted to; 0 if the curve is empty
+  uint16_t error;                           // maxError()
+  uint8_t nKnots;                           // The number of knots
+  uint8_t knotSx[TCV_MAX_KNOTS];            // The sample each knot is at, in increasing order
+  int16_t knotLevel[TCV_MAX_KNOTS];         // The level at each knot (hundredths of a foot)
+  int16_t knotSlope[TCV_MAX_KNOTS];         // The slope at each knot (thousandths of a foot per hour)
+  uint8_t index[TCV_INDEX_SIZE];            // The last knot at or before sample TCV_INDEX_SAMPLES * i
+};
@@ -0,0 +1,127 @@
+/****
+ *
+ * TideTable.cpp
+ * Part of the "TideData" library. Version 0.1.0
+ *
+ * See TideTable.h for details
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ * 
+ ****/
+
+#include "TideTable.h"
+
+/***
+ * ttCrc32(data, len, crc)
+ ***/
+uint32_t ttCrc32(const void *data, size_t len, uint32_t crc) {
+  const uint8_t *p = static_cast<const uint8_t *>(data);
+  crc = ~crc;
+  while (len--) {
+    crc ^= *p++;
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+  }
+  return ~crc;
+}
+
+/***
+ * Constructor
+ ***/
+TideTable::TideTable() {
+  base = nullptr;
+  header = nullptr;
+}
+
+/***
+ * attach(base, size)
+ ***/
+bool TideTable::attach(const void *b, size_t size) {
+  base = nullptr;
+  const tt_header_t *h = static_cast<const tt_header_t *>(b);
+  if (b == nullptr || size < sizeof(tt_header_t) || h->magic != TT_MAGIC || h->version != TT_VERSION || 
+      h->headerSize != sizeof(tt_header_t) || h->size > size || h->levelInterval == 0) {
+    return false;
+  }
+  // Make sure each section is inside the table
+  if ((uint64_t)h->levelsOffset + (uint64_t)h->nLevels * sizeof(int16_t) > h->size ||
+      (uint64_t)h->eventsOffset + (uint64_t)h->nEvents * sizeof(tt_event_t) > h->size ||
+      (uint64_t)h->dayIndexOffset + (uint64_t)h->nDays * sizeof(uint32_t) > h->size ||
+      h->eventsOffset % 4 != 0 || h->dayIndexOffset % 4 != 0 || h->levelsOffset % 2 != 0) {
+    return false;
+  }
+  const uint8_t *p = static_cast<const uint8_t *>(b);
+  if (ttCrc32(p + sizeof(tt_header_t), h->size - sizeof(tt_header_t)) != h->crc) {
+    return false;
+  }
+  base = p;
+  header = h;
+  levels = reinterpret_cast<const int16_t *>(p + h->levelsOffset);
+  events = reinterpret_cast<const tt_event_t *>(p + h->eventsOffset);
+  dayIndex = reinterpret_cast<const uint32_t *>(p + h->dayIndexOffset);
+  return true;
+}
+
+/***
+ * isValid()
+ ***/
+bool TideTable::isValid() {
+  return base != nullptr;
+}
+
+/***
+ * station()
+ ***/
+const char *TideTable::station() {
+  return base == nullptr ? "" : header->station;
+}
+
+/***
+ * levelAt(t, level)
+ ***/
+bool TideTable::levelAt(time_t t, int16_t *level) {
+  if (base == nullptr || t < (time_t)header->firstLevelTime) {
+    return false;
+  }
+  uint64_t ix = (uint64_t)(t - header->firstLevelTime) / header->levelInterval;
+  if (ix >= header->nLevels) {
+    return false;
+  }
+  *level = levels[ix];
+  return true;
+}
+
+/***
+ * nextEvent(t, event)
+ ***/
+bool TideTable::nextEvent(time_t t, tt_event_t *event) {
+  if (base == nullptr || header->nDays == 0 || t < (time_t)header->firstDayTime) {
+    return false;
+  }
+  uint64_t day = (uint64_t)(t - header->firstDayTime) / TT_SECONDS_PER_DAY;
+  if (day >= header->nDays) {
+    return false;
+  }
+  // The day index gets us to the day's first event; from there it's only a few to look at.
+  for (uint32_t ix = dayIndex[day]; ix < header->nEvents; ix++) {
+    if ((time_t)events[ix].time > t) {
+      *event = events[ix];
+      return true;
+    }
+  }
+  return false;
+}
+
+/***
+ * levelsEnd()
+ ***/
+time_t TideTable::levelsEnd() {
+  if (base == nullptr || header->nLevels == 0) {
+    return 0;
+  }
+  return (time_t)header->firstLevelTime + (time_t)(header->nLevels - 1) * header->levelInterval;
+}
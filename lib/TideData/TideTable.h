@@ -0,0 +1,186 @@
+/****
+ *
+ *  TideTable.h
+ *  Part of the "TideData" library. Version 0.2.0
+ *
+ * A TideTable is a read-only view of a block of tide data for one station laid out so it can be 
+ * used right where it sits -- typically in a flash partition mapped into the address space -- 
+ * without being copied or parsed. It holds water levels at a fixed interval (normally NOAA's six 
+ * minutes) and the high and low tide events, potentially for years. On the device, getPredWl() 
+ * and the TideClock's get-next-tide handler consult it before asking NOAA.
+ * 
+ * The layout, all little-endian, is:
+ * 
+ *   tt_header_t                  Identifies the table, says what's in it and where
+ *   int16_t levels[nLevels]      Water levels in hundredths of a foot (MLLW), levelInterval 
+ *                                seconds apart starting at firstLevelTime
+ *   tt_event_t events[nEvents]   The high and low tides, in time order
+ *   uint32_t dayIndex[nDays]     For each day starting at the UTC midnight firstDayTime, the 
+ *                                index in events of the first event on or after its midnight
+ * 
+ * The header's crc covers everything after the header. Tables are built on a host by the 
+ * mktidetable tool (see tools/).
+ * 
+ * This file has no Arduino dependencies so the same code is used by the host tools.
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ * 
+ ****/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+// Some constants
+#define TT_MAGIC                (0x4C425454)    // "TTBL" as a little-endian uint32_t
+#define TT_VERSION              (1)             // The version of the layout described here
+#define TT_PARTITION_LABEL      "tides"         // The label of the flash partition holding the table
+#define TT_PARTITION_SUBTYPE    (0x40)          // The (custom) data subtype of that partition
+#define TT_SECONDS_PER_DAY      (86400)         // Seconds in a day
+#define TT_TYPE_LOW             (0)             // tt_event_t.type for a low tide
+#define TT_TYPE_HIGH            (1)             // tt_event_t.type for a high tide
+
+struct tt_header_t {                            // The table's header
+  uint32_t magic;                               //  TT_MAGIC
+  uint16_t version;                             //  TT_VERSION
+  uint16_t headerSize;                          //  sizeof(tt_header_t)
+  char station[8];                              //  The 7-digit NOAA station ID (null-padded)
+  uint32_t firstLevelTime;                      //  POSIX time of levels[0]
+  uint32_t levelInterval;                       //  Seconds between levels
+  uint32_t nLevels;                             //  Number of levels
+  uint32_t levelsOffset;                        //  Offset of levels from the start of the table
+  uint32_t nEvents;                             //  Number of events
+  uint32_t eventsOffset;                        //  Offset of events from the start of the table
+  uint32_t firstDayTime;                        //  POSIX time of the UTC midnight dayIndex[0] is for
+  uint32_t nDays;                               //  Number of entries in dayIndex
+  uint32_t dayIndexOffset;                      //  Offset of dayIndex from the start of the table
+  uint32_t size;                                //  Size of the whole table, header included
+  uint32_t crc;                                 //  CRC-32 of everything after the header
+};
+
+struct tt_event_t {                             // A high or low tide
+  uint32_t time;                                //  POSIX time of the event
+  int16_t level;                                //  Water level, hundredths of a foot (MLLW)
+  uint8_t type;                                 //  TT_TYPE_HIGH or TT_TYPE_LOW
+  uint8_t reserved;                             //  0
+};
+
+/**
+ * @brief Compute the (IEEE 802.3) CRC-32 of a block of data
+ * 
+ * @param data      The data
+ * @param len       Its length in bytes
+ * @param crc       The CRC of any preceding data, for doing the calculation in pieces
+ * @return uint32_t The CRC
+ */
+uint32_t ttCrc32(const void *data, size_t len, uint32_t crc = 0);
+
+/**
+ * @brief Parse a water level the way NOAA writes it (e.g., "2.426" or "-0.108" feet) into 
+ *        hundredths of a foot, rounded to the nearest (halves away from zero). Integer 
+ *        arithmetic only, so it's the same on the device, which has no FPU, as on a host.
+ * 
+ * @param s       The level as text
+ * @param level   Where to put the level (hundredths of a foot)
+ * @return true   Parsed OK
+ * @return false  s isn't a number of feet or it's out of range; level is unchanged
+ */
+inline bool ttParseLevel(const char *s, int16_t *level) {
+  if (s == nullptr) {
+    return false;
+  }
+  bool neg = *s == '-';
+  if (*s == '-' || *s == '+') {
+    s++;
+  }
+  int32_t milli = 0;                            // Thousandths of a foot
+  int digits = 0;
+  while (*s >= '0' && *s <= '9') {
+    milli = milli * 10 + (*s++ - '0');
+    if (++digits > 3) {                         // More than 327 feet
+      return false;
+    }
+  }
+  milli *= 1000;
+  if (*s == '.') {
+    s++;
+    for (int32_t place = 100; *s >= '0' && *s <= '9'; s++, digits++) {
+      milli += (*s - '0') * place;
+      place /= 10;
+    }
+  }
+  if (digits == 0 || *s != '\0') {
+    return false;
+  }
+  int32_t cft = (milli + 5) / 10;
+  if (cft > INT16_MAX) {
+    return false;
+  }
+  *level = (int16_t)(neg ? -cft : cft);
+  return true;
+}
+
+class TideTable {
+public:
+  /**
+   * @brief Construct a new, empty, TideTable
+   */
+  TideTable();
+
+  /**
+   * @brief Attach the TideTable to the table at base, checking it as we go. Nothing is copied; 
+   *        base must stay valid for as long as the TideTable is used.
+   * 
+   * @param base    Where the table is
+   * @param size    The size of the space it's in
+   * @return true   The table is good and attached
+   * @return false  No valid table there; the TideTable is empty
+   */
+  bool attach(const void *base, size_t size);
+
+  /**
+   * @brief Whether a valid table is attached
+   */
+  bool isValid();
+
+  /**
+   * @brief The station the table is for; "" if no table is attached
+   */
+  const char *station();
+
+  /**
+   * @brief Get the water level at time t: the level at the latest sample at or before t.
+   * 
+   * @param t       The time
+   * @param level   Where to put the level (hundredths of a foot MLLW)
+   * @return true   Got it
+   * @return false  t isn't covered by the table
+   */
+  bool levelAt(time_t t, int16_t *level);
+
+  /**
+   * @brief Get the first high or low tide event after time t
+   * 
+   * @param t       The time
+   * @param event   Where to put the event
+   * @return true   Got it
+   * @return false  The table has no event after t, or doesn't cover t
+   */
+  bool nextEvent(time_t t, tt_event_t *event);
+
+  /**
+   * @brief The time of the last level sample in the table; 0 if there is none
+   */
+  time_t levelsEnd();
+
+private:
+  const uint8_t *base;                          // Where the table is; nullptr if none attached
+  const tt_header_t *header;                    // The table's header
+  const int16_t *levels;                        // The table's levels
+  const tt_event_t *events;                     // The table's events
+  const uint32_t *dayIndex;                     // The table's day index
+};
@@ -0,0 +1,187 @@
+/****
+ *
+ * TideWire.cpp
+ * Part of the "TideData" library. Version 0.1.0
+ *
+ * See TideWire.h for details
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ * 
+ ****/
+
+#include "TideWire.h"
+#include <string.h>
+
+/***
+ * twSize(nLevels, nEvents)
+ ***/
+size_t twSize(uint16_t nLevels, uint16_t nEvents) {
+  return sizeof(tw_header_t) + nLevels * sizeof(int16_t) + nEvents * sizeof(tw_event_t) + (nEvents + 7) / 8 + sizeof(uint32_t);
+}
+
+/***
+ * twEncode(station, epoch, interval, levels, nLevels, events, nEvents, out, outSize)
+ ***/
+size_t twEncode(const char *station, uint32_t epoch, uint16_t interval, const int16_t *levels, uint16_t nLevels, 
+  const tt_event_t *events, uint16_t nEvents, uint8_t *out, size_t outSize) {
+  size_t size = twSize(nLevels, nEvents);
+  if (size > outSize) {
+    return 0;
+  }
+  tw_header_t h;
+  memset(&h, 0, sizeof(h));
+  h.magic = TW_MAGIC;
+  h.version = TW_VERSION;
+  h.headerSize = sizeof(tw_header_t);
+  h.interval = nLevels == 0 ? 0 : interval;
+  strncpy(h.station, station, sizeof(h.station) - 1);
+  h.epoch = epoch;
+  h.nLevels = nLevels;
+  h.nEvents = nEvents;
+  uint8_t *p = out;
+  memcpy(p, &h, sizeof(h));
+  p += sizeof(h);
+  if (nLevels > 0) {
+    memcpy(p, levels, nLevels * sizeof(int16_t));
+    p += nLevels * sizeof(int16_t);
+  }
+  uint8_t *high = p + nEvents * sizeof(tw_event_t);
+  memset(high, 0, (nEvents + 7) / 8);
+  for (uint16_t i = 0; i < nEvents; i++) {
+    int64_t minutes = ((int64_t)events[i].time - epoch) / 60;
+    if (minutes < 0 || minutes > UINT16_MAX) {
+      return 0;
+    }
+    tw_event_t e = {(uint16_t)minutes, events[i].level};
+    memcpy(p, &e, sizeof(e));
+    p += sizeof(e);
+    if (events[i].type == TT_TYPE_HIGH) {
+      high[i / 8] |= 1 << (i % 8);
+    }
+  }
+  p = high + (nEvents + 7) / 8;
+  uint32_t crc = ttCrc32(out, p - out);
+  memcpy(p, &crc, sizeof(crc));
+  return size;
+}
+
+/***
+ * Constructor
+ ***/
+TideWire::TideWire() {
+  base = nullptr;
+  stationId[0] = '\0';
+}
+
+/***
+ * attach(base, len)
+ ***/
+bool TideWire::attach(const void *b, size_t len) {
+  base = nullptr;
+  stationId[0] = '\0';
+  if (b == nullptr || len < sizeof(tw_header_t) + sizeof(uint32_t)) {
+    return false;
+  }
+  const uint8_t *p = static_cast<const uint8_t *>(b);
+  memcpy(&header, p, sizeof(header));
+  if (header.magic != TW_MAGIC || header.version != TW_VERSION || header.headerSize != sizeof(tw_header_t) || 
+      twSize(header.nLevels, header.nEvents) != len || (header.nLevels > 0 && header.interval == 0)) {
+    return false;
+  }
+  uint32_t crc;
+  memcpy(&crc, p + len - sizeof(crc), sizeof(crc));
+  if (ttCrc32(p, len - sizeof(crc)) != crc) {
+    return false;
+  }
+  base = p;
+  levels = p + sizeof(tw_header_t);
+  events = levels + header.nLevels * sizeof(int16_t);
+  high = events + header.nEvents * sizeof(tw_event_t);
+  memcpy(stationId, header.station, sizeof(header.station));
+  stationId[sizeof(header.station)] = '\0';
+  return true;
+}
+
+/***
+ * isValid()
+ ***/
+bool TideWire::isValid() {
+  return base != nullptr;
+}
+
+/***
+ * station()
+ ***/
+const char *TideWire::station() {
+  return stationId;
+}
+
+/***
+ * epoch()
+ ***/
+time_t TideWire::epoch() {
+  return base == nullptr ? 0 : (time_t)header.epoch;
+}
+
+/***
+ * interval()
+ ***/
+uint16_t TideWire::interval() {
+  return base == nullptr ? 0 : header.interval;
+}
+
+/***
+ * nLevels()
+ ***/
+uint16_t TideWire::nLevels() {
+  return base == nullptr ? 0 : header.nLevels;
+}
+
+/***
+ * level(i)
+ ***/
+int16_t TideWire::level(uint16_t i) {
+  int16_t answer = 0;
+  if (base != nullptr && i < header.nLevels) {
+    memcpy(&answer, levels + i * sizeof(int16_t), sizeof(answer));
+  }
+  return answer;
+}
+
+/***
+ * nEvents()
+ ***/
+uint16_t TideWire::nEvents() {
+  return base == nullptr ? 0 : header.nEvents;
+}
+
+/***
+ * event(i, event)
+ ***/
+bool TideWire::event(uint16_t i, tt_event_t *event) {
+  if (base == nullptr || i >= header.nEvents) {
+    return false;
+  }
+  tw_event_t e;
+  memcpy(&e, events + i * sizeof(tw_event_t), sizeof(e));
+  event->time = header.epoch + e.minutes * 60;
+  event->level = e.level;
+  event->type = (high[i / 8] >> (i % 8)) & 1 ? TT_TYPE_HIGH : TT_TYPE_LOW;
+  event->reserved = 0;
+  return true;
+}
+
+/***
+ * nextEvent(t, event)
+ ***/
+bool TideWire::nextEvent(time_t t, tt_event_t *event) {
+  for (uint16_t i = 0; base != nullptr && i < header.nEvents; i++) {
+    if (this->event(i, event) && (time_t)event->time > t) {
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,162 @@
+/****
+ *
+ *  TideWire.h
+ *  Part of the "TideData" library. Version 0.1.0
+ *
+ * TideWire is a compact binary format for sending a device the tide data it asks NOAA for -- a 
+ * day's six-minute water level predictions or the next couple of days' high and low tides -- in 
+ * place of NOAA's JSON. A message is a few hundred bytes instead of ten or so kilobytes, and a 
+ * device can check it and use it right where it was received, with no parsing into a 
+ * JsonDocument and no allocation. The tideproxy tool (see tools/) sends it when a request has 
+ * format=tatbin.
+ * 
+ * The layout, all little-endian, is:
+ * 
+ *   tw_header_t                  Identifies the message, says what's in it
+ *   int16_t levels[nLevels]      Water levels in hundredths of a foot (MLLW), interval seconds 
+ *                                apart starting at epoch
+ *   tw_event_t events[nEvents]   The high and low tides, in time order
+ *   uint8_t high[(nEvents+7)/8]  Bit i%8 of high[i/8] is set if event i is a high tide
+ *   uint32_t crc                 CRC-32 (see ttCrc32()) of everything before it
+ * 
+ * Nothing is aligned, so a message can be used wherever it lands in a receive buffer.
+ * 
+ * tools/tideproxy.cpp encodes the messages it serves with this header's twEncode(), and 
+ * tools/tidewire.cpp round-trips saved NOAA responses through it to check the format.
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ * 
+ ****/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include "TideTable.h"
+
+// Some constants
+#define TW_MAGIC                (0x57544154)    // "TATW" as a little-endian uint32_t
+#define TW_VERSION              (1)             // The version of the layout described here
+#define TW_FORMAT               "tatbin"        // The datagetter format= value that asks for it
+#define TW_MAX_SIZE             (1024)          // Big enough for a day of six-minute levels or a few days of tides
+
+#pragma pack(push, 1)
+struct tw_header_t {                            // The message's header
+  uint32_t magic;                               //  TW_MAGIC
+  uint8_t version;                              //  TW_VERSION
+  uint8_t headerSize;                           //  sizeof(tw_header_t)
+  uint16_t interval;                            //  Seconds between levels; 0 if there are none
+  char station[8];                              //  The 7-digit NOAA station ID (null-padded)
+  uint32_t epoch;                               //  POSIX time of levels[0]; events' times are relative to it
+  uint16_t nLevels;                             //  Number of levels
+  uint16_t nEvents;                             //  Number of events
+};
+
+struct tw_event_t {                             // A high or low tide
+  uint16_t minutes;                             //  Minutes after epoch
+  int16_t level;                                //  Water level, hundredths of a foot (MLLW)
+};
+#pragma pack(pop)
+
+/**
+ * @brief The size of the message for nLevels levels and nEvents events
+ */
+size_t twSize(uint16_t nLevels, uint16_t nEvents);
+
+/**
+ * @brief Encode a message
+ * 
+ * @param station   The station ID
+ * @param epoch     The time of levels[0] (or, if there are none, no later than events[0])
+ * @param interval  Seconds between levels
+ * @param levels    The levels (hundredths of a foot MLLW); may be nullptr if nLevels is 0
+ * @param nLevels   How many
+ * @param events    The high and low tides, in time order; may be nullptr if nEvents is 0
+ * @param nEvents   How many
+ * @param out       Where to put the message
+ * @param outSize   How much room there is
+ * @return size_t   The size of the message; 0 if it didn't fit or an event is out of range
+ */
+size_t twEncode(const char *station, uint32_t epoch, uint16_t interval, const int16_t *levels, uint16_t nLevels, 
+  const tt_event_t *events, uint16_t nEvents, uint8_t *out, size_t outSize);
+
+class TideWire {
+public:
+  /**
+   * @brief Construct a new, empty, TideWire
+   */
+  TideWire();
+
+  /**
+   * @brief Attach the TideWire to the message at base, checking it as we go. Nothing is copied; 
+   *        base must stay valid for as long as the TideWire is used.
+   * 
+   * @param base    Where the message is
+   * @param len     Its length
+   * @return true   The message is good and attached
+   * @return false  It's not a good message; the TideWire is empty
+   */
+  bool attach(const void *base, size_t len);
+
+  /**
+   * @brief Whether a valid message is attached
+   */
+  bool isValid();
+
+  /**
+   * @brief The station the message is for; "" if none is attached
+   */
+  const char *station();
+
+  /**
+   * @brief The time of the first level
+   */
+  time_t epoch();
+
+  /**
+   * @brief The seconds between levels; 0 if there are none
+   */
+  uint16_t interval();
+
+  /**
+   * @brief The number of levels in the message
+   */
+  uint16_t nLevels();
+
+  /**
+   * @brief Level i (hundredths of a foot MLLW); 0 if there's no such level
+   */
+  int16_t level(uint16_t i);
+
+  /**
+   * @brief The number of events in the message
+   */
+  uint16_t nEvents();
+
+  /**
+   * @brief Get event i
+   * 
+   * @return true   Got it
+   * @return false  There's no such event
+   */
+  bool event(uint16_t i, tt_event_t *event);
+
+  /**
+   * @brief Get the first high or low tide event after time t
+   * 
+   * @return true   Got it
+   * @return false  The message has no event after t
+   */
+  bool nextEvent(time_t t, tt_event_t *event);
+
+private:
+  const uint8_t *base;                          // Where the message is; nullptr if none attached
+  tw_header_t header;                           // A copy of its header
+  char stationId[9];                            // Its station ID, null-terminated
+  const uint8_t *levels;                        // Its levels
+  const uint8_t *events;                        // Its events
+  const uint8_t *high;                          // Its high tide bits
+};
@@ -0,0 +1,114 @@
+/****
+ *
+ * WlBias.cpp
+ * Part of the "WlBias" library for Arduino. Version 0.1.0
+ *
+ * See WlBias.h for details
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ * 
+ ****/
+
+#include <math.h>
+#include "WlBias.h"
+
+/***
+ * Constructor
+ ***/
+WlBias::WlBias() {
+  reset();
+}
+
+/***
+ * reset()
+ ***/
+void WlBias::reset() {
+  estimate = 0.0;
+  variance = -1.0;
+  lastUpdate = 0;
+  nextPoll = 0;
+  interval = WLB_MIN_POLL_SECS;
+}
+
+/***
+ * pollDue(t)
+ ***/
+bool WlBias::pollDue(time_t t) {
+  return t >= nextPoll;
+}
+
+/***
+ * update(t, observed, predicted)
+ ***/
+void WlBias::update(time_t t, float observed, float predicted) {
+  float offset = observed - predicted;
+  if (fabs(offset) > WLB_MAX_OFFSET) {
+    missed(t);
+    return;
+  }
+  bool quick;
+  if (variance < 0 || t - lastUpdate > WLB_STALE_SECS) {
+    // First observation (or first in a long time): take it as it comes and check again soon
+    estimate = offset;
+    variance = WLB_MEASUREMENT_NOISE;
+    quick = true;
+  } else {
+    // Predict: the offset may have wandered since the last observation
+    float minutes = (t - lastUpdate) / 60.0;
+    variance += WLB_PROCESS_NOISE * minutes;
+    // Correct
+    float innovation = offset - estimate;
+    float innovationVariance = variance + WLB_MEASUREMENT_NOISE;
+    float gain = variance / innovationVariance;
+    float oldEstimate = estimate;
+    estimate += gain * innovation;
+    variance *= 1.0 - gain;
+    float ftPerHour = minutes > 0 ? fabs(estimate - oldEstimate) * 60.0 / minutes : 0.0;
+    quick = ftPerHour > WLB_FAST_FT_PER_HOUR || 
+      innovation * innovation > WLB_SURPRISE_SIGMAS * WLB_SURPRISE_SIGMAS * innovationVariance;
+  }
+  lastUpdate = t;
+  interval = quick ? WLB_MIN_POLL_SECS : interval * 3 / 2;
+  if (interval > WLB_MAX_POLL_SECS) {
+    interval = WLB_MAX_POLL_SECS;
+  }
+  nextPoll = t + interval;
+}
+
+/***
+ * missed(t)
+ ***/
+void WlBias::missed(time_t t) {
+  interval *= 2;
+  if (interval > WLB_MAX_POLL_SECS) {
+    interval = WLB_MAX_POLL_SECS;
+  }
+  nextPoll = t + interval;
+}
+
+/***
+ * bias(t)
+ ***/
+float WlBias::bias(time_t t) {
+  if (variance < 0 || t - lastUpdate > WLB_STALE_SECS) {
+    return 0.0;
+  }
+  return estimate;
+}
+
+/***
+ * sigma()
+ ***/
+float WlBias::sigma() {
+  return variance < 0 ? -1.0 : sqrt(variance);
+}
+
+/***
+ * pollInterval()
+ ***/
+uint32_t WlBias::pollInterval() {
+  return interval;
+}
@@ -0,0 +1,110 @@
+/****
+ *
+ *  WlBias.h
+ *  Part of the "WlBias" library for Arduino. Version 0.1.0
+ *
+ * NOAA's water level predictions are astronomical: they know about the moon and the sun but not 
+ * the weather. A storm surge or a strong offshore wind can push the actual water level a foot or 
+ * more away from the prediction for hours or days at a time. NOAA also publishes what its tide 
+ * gauges actually measure, though, so the difference can be estimated and the prediction corrected.
+ * 
+ * A WlBias object keeps that estimate. Feed it observed and predicted levels with update() and it 
+ * runs a one-state Kalman filter on the offset between them, treating the offset as a slowly 
+ * wandering random walk. bias() gives the current estimate, which is added to the predictions 
+ * before they're displayed.
+ * 
+ * Observations cost a network request, so WlBias also decides when the next one is worth making: 
+ * when the offset is steady, it backs off toward WLB_MAX_POLL_SECS between observations; when the 
+ * offset is changing quickly or an observation surprises it, it comes back to WLB_MIN_POLL_SECS. 
+ * Failed observations (missed()) back off the same way a steady offset does, so a station without 
+ * a working gauge doesn't get asked every few minutes forever. If there hasn't been a good 
+ * observation for WLB_STALE_SECS, the estimate is no longer trusted and bias() is 0.
+ * 
+ * The typical way to use it is to make a WlBias a global variable, and whenever a new predicted 
+ * level is to be displayed, check pollDue(); if it is, get the observed level and pass both to 
+ * update() (or call missed() if the observation couldn't be had). Then display the prediction 
+ * plus bias().
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ * 
+ ****/
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+// Some constants
+#define WLB_PROCESS_NOISE       (0.0005)    // How fast the offset can wander: variance growth (ft**2 per minute)
+#define WLB_MEASUREMENT_NOISE   (0.01)      // Variance of an observation's error (ft**2)
+#define WLB_MIN_POLL_SECS       (360)       // The shortest interval between observations (sec)
+#define WLB_MAX_POLL_SECS       (4 * 3600)  // The longest interval between observations (sec)
+#define WLB_FAST_FT_PER_HOUR    (0.1)       // The offset is "changing quickly" if it changes faster than this (ft/hour)
+#define WLB_SURPRISE_SIGMAS     (3.0)       // An observation is "surprising" if it's this many std deviations off
+#define WLB_MAX_OFFSET          (6.0)       // Observations further than this from the prediction are bad data (ft)
+#define WLB_STALE_SECS          (12 * 3600) // How long an estimate is good for without a fresh observation (sec)
+
+class WlBias {
+public:
+  /**
+   * @brief Construct a new WlBias object with no estimate
+   */
+  WlBias();
+
+  /**
+   * @brief Forget the estimate, e.g., because the station changed
+   */
+  void reset();
+
+  /**
+   * @brief Whether it's time to get a new observation
+   * 
+   * @param t       The current time
+   * @return true   It is
+   * @return false  It isn't
+   */
+  bool pollDue(time_t t);
+
+  /**
+   * @brief Update the estimate with a new observation, and decide when the next one is due
+   * 
+   * @param t         The time of the observation
+   * @param observed  The observed water level (ft MLLW)
+   * @param predicted The predicted water level at time t (ft MLLW)
+   */
+  void update(time_t t, float observed, float predicted);
+
+  /**
+   * @brief Note that an attempt to get an observation failed, and decide when to try again
+   * 
+   * @param t The current time
+   */
+  void missed(time_t t);
+
+  /**
+   * @brief The estimated offset of the actual water level from the prediction
+   * 
+   * @param t       The current time
+   * @return float  The offset (ft); 0 if there's no trustworthy estimate
+   */
+  float bias(time_t t);
+
+  /**
+   * @brief The standard deviation of the estimate (ft); negative if there's no estimate
+   */
+  float sigma();
+
+  /**
+   * @brief The current interval between observations (sec)
+   */
+  uint32_t pollInterval();
+
+private:
+  float estimate;                           // The estimated offset (ft)
+  float variance;                           // The variance of the estimate (ft**2); < 0 if there's no estimate
+  time_t lastUpdate;                        // When the last good observation was
+  time_t nextPoll;                          // When the next observation is due
+  uint32_t interval;                        // The current interval between observations (sec)
+};
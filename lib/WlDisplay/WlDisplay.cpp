@@ -1,7 +1,7 @@
 /****
  *
  * WDisplay.cpp
- * Part of the "WlDisplay" library for Arduino. Version 0.5.0
+ * Part of the "WlDisplay" library for Arduino. Version 0.7.0
  *
  * See WlDisplay.h for details
  *
@@ -13,14 +13,30 @@
  ****/
 #include <WlDisplay.h>
 
+// The stepper's step and power handlers are plain functions, so they find the phase pins through 
+// this. There's only ever one water level display.
+static FastPinGroup<4> *thePhasePins = nullptr;
+
 /***
  * Constructor
  ***/
-WlDisplay::WlDisplay(uint8_t sp1, uint8_t sp2, uint8_t sp3, uint8_t sp4, uint8_t lp, uint8_t pp) {
-  stepper = new GStepper<STEPPER4WIRE_HALF>(WLD_STEPS_PER_TURN, sp1, sp2, sp3, sp4);
+WlDisplay::WlDisplay(uint8_t sp1, uint8_t sp2, uint8_t sp3, uint8_t sp4, uint8_t lp, uint8_t pp) : 
+  phasePins({sp1, sp2, sp3, sp4}) {
+  console = &Serial;
+  uint8_t sp[] = {sp1, sp2, sp3, sp4};
+  for (uint8_t i = 0; i < 4; i++) {
+    pinMode(sp[i], OUTPUT);
+  }
+  phasePins.clear();
+  thePhasePins = &phasePins;
+  stepper = new GStepper<STEPPER4WIRE_HALF, STEPPER_VIRTUAL>(WLD_STEPS_PER_TURN);
+  stepper->attachStep(writePhases);
+  stepper->attachPower(powerPhases);
   limitPin = lp;
   powerPin = pp;
   ready = false;
+  homings = 0;
+  homingMillis = 0;
 }
 
 /***
@@ -30,20 +46,49 @@ WlDisplay::~WlDisplay() {
   delete stepper;
 }
 
+/***
+ * writePhases(pattern)
+ ***/
+void WlDisplay::writePhases(uint8_t pattern) {
+  thePhasePins->write(pattern);
+}
+
+/***
+ * powerPhases(on)
+ ***/
+void WlDisplay::powerPhases(bool on) {
+  if (!on) {
+    thePhasePins->clear();
+  }
+}
+
+/***
+ * setConsole(out)
+ ***/
+void WlDisplay::setConsole(Print &out) {
+  console = &out;
+}
+
 /***
  * begin()
  ***/
 void WlDisplay::begin(float minL, float maxL) {
-  minLevel = minL;
-  maxLevel = maxL;
-  stepsPerFoot = (int32_t)((WLD_MIN_POS / maxL) - 0.5);
+  if (!wldLevelsOk(minL, maxL)) {
+    console->printf("[WlDisplay::begin] Can't display levels from %.2f to %.2f. Using %.2f to %.2f.\n",
+      minL, maxL, WLD_MIN_LEVEL, WLD_MAX_LEVEL);
+    minL = WLD_MIN_LEVEL;
+    maxL = WLD_MAX_LEVEL;
+  }
+  minLevel = (int16_t)lroundf(minL * 100);
+  maxLevel = (int16_t)lroundf(maxL * 100);
   pinMode(limitPin, INPUT_PULLUP);
   pinMode(powerPin, INPUT_PULLDOWN);
   powerIsOn = digitalRead(powerPin) == HIGH;
   powerUnstable = true;
+  becameUnstableMillis = millis();
   stepper->autoPower(true);
-  log_d("[WlDisplay::begin] Stepper parms - stepsPerFoot: %d, pos at minLevel: %d, pos at maxLevel: %d.\n",
-    stepsPerFoot, (int16_t)(minLevel * stepsPerFoot), (int16_t)(maxLevel * stepsPerFoot));
+  log_d("[WlDisplay::begin] Stepper parms - pos at minLevel: %d, pos at maxLevel: %d.\n",
+    wldPosition(minLevel, maxLevel), wldPosition(maxLevel, maxLevel));
 }
 
 /***
@@ -51,43 +96,102 @@ void WlDisplay::begin(float minL, float maxL) {
  ***/
 bool WlDisplay::home() {
   if (digitalRead(powerPin) == HIGH) {
+    unsigned long startMillis = millis();
     stepper->setRunMode(KEEP_SPEED);
     stepper->setSpeedDeg(WLD_HOMING_DEG_PER_SEC);
-    while (digitalRead(limitPin) == HIGH) {
+    while (digitalRead(limitPin) == HIGH && digitalRead(powerPin) == HIGH) {
       stepper->tick();
     }
     stepper->setRunMode(FOLLOW_POS);
     stepper->setMaxSpeed(600);
-    stepper->setCurrent(stepsPerFoot * minLevel);
+    if (digitalRead(limitPin) == HIGH) {
+      return false;                         // Pulled the plug half-way through; still don't know where we are
+    }
+    stepper->setCurrent(wldPosition(minLevel, maxLevel));
+    homings++;
+    homingMillis = millis() - startMillis;
   }
-  return digitalRead(powerPin) == HIGH;  // Could have pulled the plug half-way through
+  return digitalRead(powerPin) == HIGH;
+}
+
+/***
+ * resume(position)
+ ***/
+void WlDisplay::resume(int32_t position) {
+  if (!powerIsOn) {
+    return;
+  }
+  stepper->setRunMode(FOLLOW_POS);
+  stepper->setMaxSpeed(600);
+  stepper->setCurrent(position);
+  stepper->setTarget(position);
+  curLevel = wldLevel(position, maxLevel);
+  ready = true;
+  publish();
 }
 
 /***
  * setLevel(level)
  ***/
-void WlDisplay::setLevel(float level) {
+void WlDisplay::setLevel(int16_t level) {
   if (level > maxLevel || level < minLevel) {
-    Serial.printf("[WlDisplay::setLevel] Ignoring out-of-range water level: %f.\n", level);
+    console->printf("[WlDisplay::setLevel] Ignoring out-of-range water level: %d hundredths of a foot.\n", level);
     return;
   }
   curLevel = level;
-  long target = curLevel * stepsPerFoot;
+  int32_t target = wldPosition(curLevel, maxLevel);
   stepper->setTarget(target);
-  log_d("[WlDisplay::setLevel] Water level set to %f (stepper target %d).\n", curLevel, target);
+  publish();
+  log_d("[WlDisplay::setLevel] Water level set to %d hundredths of a foot (stepper target %d).\n", curLevel, target);
+}
+
+/***
+ * int16_t getLevel()
+ ***/
+int16_t WlDisplay::getLevel() {
+  return state.read().level;
 }
 
 /***
- * float getLevel()
+ * wld_state_t getState()
  ***/
-float WlDisplay::getLevel() {
-  return curLevel;
+wld_state_t WlDisplay::getState() {
+  return state.read();
+}
+
+/***
+ * publish()
+ ***/
+void WlDisplay::publish() {
+  state.publish({curLevel, (int32_t)stepper->getCurrent(), (int32_t)stepper->getTarget(), ready, powerIsOn, homings, homingMillis});
+}
+
+/***
+ * bool hasPower()
+ ***/
+bool WlDisplay::hasPower() {
+  return powerIsOn;
+}
+
+/***
+ * bool isMoving()
+ ***/
+bool WlDisplay::isMoving() {
+  return ready && powerIsOn && stepper->getState();
 }
 
 /***
  * run()
  ***/
 void WlDisplay::run() {
+  update();
+  publish();
+}
+
+/***
+ * update()
+ ***/
+void WlDisplay::update() {
   // Figure out what's going on with the USB power
   unsigned long curMillis = millis();
   bool powerCameOn = false;
@@ -109,8 +213,8 @@ void WlDisplay::run() {
 
   // If the power just came on, do a home() just to be on the safe side.
   if (powerCameOn) {
-    Serial.print("[WlDisplay::run] Homing the water level display.\n");
-    home();
+    console->print("[WlDisplay::run] Homing the water level display.\n");
+    ready = home();
   }
 
   if (powerIsOn) {
@@ -1,7 +1,7 @@
 /****
  *
  * WDisplay.h
- * Part of the "WlDisplay" library for Arduino. Version 0.5.0
+ * Part of the "WlDisplay" library for Arduino. Version 0.7.0
  *
  * A WlDisplay object is the software interface to a water level display that shows the current 
  * water level for a tide clock display device. It's powered by a 28BYJ-48 stepper via a 
@@ -13,6 +13,9 @@
  * ignores the request. Internally, the stepper position (in steps) corresponding to maxLevel 
  * corresponds to WLD_MIN_POS.
  * 
+ * Levels are in hundredths of a foot and the arithmetic is all integer: the ESP32-S2 has no FPU, 
+ * so float math is done in software. wldPosition() turns a level into a stepper position.
+ * 
  * The stepper runs on 5V from the USB input power, the ESP32-S2 we run on has a backup battery 
  * so it can keep going if unplugged for a while. But if there's no USB power, there's no 5V 
  * because the hardware doesn't include a boost converter, so we can't move the display. To 
@@ -32,6 +35,10 @@
  * member function at each pass through the Arduino loop function to give the stepper a chance to 
  * do its thing. Don't worry about USB power coming and going; the display will show the correct 
  * level whenever power is available but just remain still if it's not.
+ * 
+ * Homing takes a while, so after a reset that didn't take the power away (a watchdog or a software
+ * restart, say) there's no need for it if the position the display was standing still at was 
+ * saved beforehand: call resume() with it just after begin() and the display carries on from there.
  *
  ****
  *
@@ -43,6 +50,8 @@
 
 #include <Arduino.h>
 #include <GyverStepper.h>   // The header for the Gyver stepper driver library
+#include <FastGpio.h>       // Single-store pin writes for the stepper phases
+#include <Snapshot.h>       // Lock-free publication of the display's state to other tasks
 
 // Some constants
 #define WLD_MIN_POS             (-1200)     // Stepper position corresponding to water level == maxLevel
@@ -52,6 +61,61 @@
 #define WLD_HOMING_DEG_PER_SEC  (30)        // The speed (and direction) used to approach the limit switch (degrees/sec)
 #define WLD_ENOUGH_MILLIS       (100)       // This many millis must have elapsed before we believe the power state is stable
 
+/**
+ * @brief The stepper position at which the display shows a water level: level * WLD_MIN_POS / maxLevel 
+ *        steps, rounded to the nearest step. Working it out that way, rather than from a whole 
+ *        number of steps per foot, puts maxLevel at exactly WLD_MIN_POS.
+ * 
+ * @param level     The water level (hundredths of a foot MLLW)
+ * @param maxLevel  The highest level the display shows (hundredths of a foot MLLW)
+ * @return int32_t  The position (steps)
+ */
+inline int32_t wldPosition(int32_t level, int32_t maxLevel) {
+  int32_t n = level * WLD_MIN_POS;
+  return ((n < 0) == (maxLevel < 0) ? n + maxLevel / 2 : n - maxLevel / 2) / maxLevel;
+}
+
+/**
+ * @brief The water level the display shows at a stepper position; wldPosition() the other way
+ * 
+ * @param position  The position (steps)
+ * @param maxLevel  The highest level the display shows (hundredths of a foot MLLW)
+ * @return int32_t  The level (hundredths of a foot MLLW)
+ */
+inline int32_t wldLevel(int32_t position, int32_t maxLevel) {
+  int32_t n = position * maxLevel;
+  return ((n < 0) == (WLD_MIN_POS < 0) ? n + WLD_MIN_POS / 2 : n - WLD_MIN_POS / 2) / WLD_MIN_POS;
+}
+
+/**
+ * @brief Whether minL to maxL is a range of water levels the display can show: maxLevel has to 
+ *        be above 0 (wldPosition() divides by it) once it's rounded to hundredths of a foot, and 
+ *        minLevel below it. Both have to fit in an int16_t in hundredths of a foot.
+ * 
+ * @param minL      The lowest level to be displayed (feet MLLW)
+ * @param maxL      The highest level to be displayed (feet MLLW)
+ * @return true     It's a usable range
+ * @return false    It isn't
+ */
+inline bool wldLevelsOk(float minL, float maxL) {
+  if (!(minL >= INT16_MIN / 100.0f && maxL <= INT16_MAX / 100.0f)) {   // Also catches NaNs
+    return false;
+  }
+  long minLevel = lroundf(minL * 100);
+  long maxLevel = lroundf(maxL * 100);
+  return maxLevel > 0 && minLevel < maxLevel;
+}
+
+struct wld_state_t {                        // A snapshot of the display's state, for other tasks to look at
+  int16_t level;                            //  The level being displayed (or headed for) (hundredths of a foot MLLW)
+  int32_t position;                         //  The stepper's current position (steps)
+  int32_t target;                           //  The stepper's target position (steps)
+  bool homed;                               //  True if the display has been homed since power came on
+  bool powerIsOn;                           //  True if USB power is present
+  uint32_t homings;                         //  The number of times the display has been homed
+  uint32_t homingMillis;                    //  How long the last homing took (millis())
+};
+
 class WlDisplay {
 public:
   /**
@@ -68,6 +132,20 @@ public:
    */
   WlDisplay(uint8_t sp1, uint8_t sp2, uint8_t sp3, uint8_t sp4, uint8_t lp, uint8_t pp);
 
+  /**
+   * @brief Set the stepper's phase pins. Attached to the stepper as its step handler.
+   * 
+   * @param pattern The phase pattern; bit 0 is sp1, bit 1 sp2 and so on
+   */
+  static void writePhases(uint8_t pattern);
+
+  /**
+   * @brief Turn the stepper's coils on or off. Attached to the stepper as its power handler.
+   * 
+   * @param on Whether the coils are to be powered. When they aren't, all the phases are LOW
+   */
+  static void powerPhases(bool on);
+
   /**
    *
    *  @brief Destructor
@@ -85,6 +163,14 @@ public:
    */
   void begin(float minL = WLD_MIN_LEVEL, float maxL = WLD_MAX_LEVEL);
 
+  /**
+   * @brief Print the display's messages to out rather than Serial, e.g., to keep them off the 
+   *        port while it's carrying JSON-lines RPC (see RpcConsole in RpcLink.h)
+   * 
+   * @param out Where they go
+   */
+  void setConsole(Print &out);
+
   /**
    * @brief Recalibrate the WlDisplay by driving its position to the limit 
    *        switch. When done, the display shows the minimum displayable 
@@ -96,19 +182,56 @@ public:
    */
   bool home();
 
+  /**
+   * @brief Pick up where a previous incarnation left off: take the stepper to be at position 
+   *        (as it was, standing still, in the state last published before a reset) and the 
+   *        display to be homed. Call just after begin(). Does nothing if there's no USB power, 
+   *        since then there's no telling whether the display moved in the meantime.
+   * 
+   * @param position The stepper's position (steps)
+   */
+  void resume(int32_t position);
+
   /**
    * @brief Set the level of the water shown in the display
    * 
-   * @param level The water level the display is to show
+   * @param level The water level the display is to show (hundredths of a foot MLLW)
+   */
+  void setLevel(int16_t level);
+  void setLevel(float feet) = delete;       // Catch callers passing feet
+  void setLevel(double feet) = delete;
+
+  /**
+   * @brief Get the currently displayed water level. Safe to call from any task.
+   * 
+   * @return int16_t The current water level (hundredths of a foot MLLW)
+   */
+  int16_t getLevel();
+
+  /**
+   * @brief Get a consistent snapshot of the display's state as of the end of the last call to 
+   *        run() or setLevel(). Safe to call from any task; never blocks the task calling run().
+   * 
+   * @return wld_state_t 
    */
-  void setLevel(float level);
+  wld_state_t getState();
 
   /**
-   * @brief Get the currently displayed water level in feet MLLW
+   * @brief Whether USB power is present, as of the last time run() decided about it
    * 
-   * @return float The current water level
+   * @return true   Power is present; the display can move
+   * @return false  Running on battery; the display is still
    */
-  float getLevel();
+  bool hasPower();
+
+  /**
+   * @brief Whether the display is moving toward a new level and so needs run() called as 
+   *        often as possible
+   * 
+   * @return true   It's moving
+   * @return false  It's standing still
+   */
+  bool isMoving();
 
   /**
    *
@@ -118,17 +241,31 @@ public:
   void run();
 
 private:
-  GStepper<STEPPER4WIRE_HALF> *stepper;     // The stepper motor
+  GStepper<STEPPER4WIRE_HALF, STEPPER_VIRTUAL> *stepper; // The stepper motor; we drive its pins ourselves
+  FastPinGroup<4> phasePins;                // The stepper's IN4, IN2, IN3 and IN1 pins, written together
   uint8_t limitPin;                         // The GPIO pin to which the Hall-effect sensor is attached
   uint16_t powerPin;                        // The GPIO pin to which the "power present" signal is attached
+  Print *console;                           // Where messages go; Serial unless setConsole() says otherwise
   int32_t minPos;                           // Stepper position (steps) at minLevel
   int32_t maxPos;                           // Stepper position (steps) at maxLevel
-  int32_t stepsPerFoot;                     // The number of steps of the stepper per foot of water level
-  float minLevel;                           // The minimum displayable water level
-  float maxLevel;                           // The maximum displayable water level
-  float curLevel;                           // Currently displayed level (feet above MLLW)
+  int16_t minLevel;                         // The minimum displayable water level (hundredths of a foot MLLW)
+  int16_t maxLevel;                         // The maximum displayable water level (hundredths of a foot MLLW)
+  int16_t curLevel;                         // Currently displayed level (hundredths of a foot MLLW)
   bool ready;                               // True if ready to go: power is present and we did a home()
+  uint32_t homings;                         // The number of times home() has homed the display
+  uint32_t homingMillis;                    // How long the last homing took (millis())
   bool powerIsOn;                           // The state of the power the last time we decided about it
   bool powerUnstable;                       // Becomes true when power state is stable but changes, false WLD_ENOUGH_MILLIS later
   unsigned long becameUnstableMillis;       // millis() at the time powerUnstable last became true
+  Snapshot<wld_state_t> state;              // The state as of the end of the last run() or setLevel(), for other tasks
+
+  /**
+   * @brief The body of run()
+   */
+  void update();
+
+  /**
+   * @brief Publish a snapshot of the current state
+   */
+  void publish();
 };
\ No newline at end of file
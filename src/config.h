@@ -26,6 +26,51 @@
 // The tc_scale_t type of clock face the device has; linear or nonlinear
 #define TAT_FACE_TYPE           (tcNonlinear)
 
+// Pulse-width auto-tuning ("tune" command). Each trial steps the clock through TAT_TUNE_TICKS ticks, 
+// which is exactly one turn of the second hand, so a trial passes if the second hand ends up where 
+// it started. The tuned values get TAT_TUNE_MARGIN_PCT percent added to them to allow for a weaker 
+// battery and colder days than the ones we tuned on.
+#define TAT_TUNE_TICKS          (60)
+#define TAT_TUNE_MARGIN_PCT     (25)
+
+// The current (mA) that flows through the Lavet motor coil during a step pulse. Used to estimate 
+// the energy used by the clock. Typical coils are about 200 ohms, driven here from 3.3V.
+#define TAT_COIL_MA             (16.5)
+
+// When running on battery, we light-sleep between the tide clock's ticks. Don't bother going to sleep 
+// if the next tick is due in less than this many seconds.
+#define TAT_MIN_SLEEP_SECS      (2)
+
+// The periods (millis()) and budgets (micros()) of the tasks the firmware's scheduler runs. The 
+// display task runs as often as possible while the display is moving, and the fetch task while 
+// a fetch from the server is under way. A fetch takes seconds, but the fetch task takes it a 
+// slice at a time; the slices that do the TLS key exchange's arithmetic and fit the day's 
+// predictions are the long ones.
+#define TAT_CLOCK_TASK_MILLIS   (50)
+#define TAT_CLOCK_TASK_BUDGET   (100000)
+#define TAT_DISPLAY_TASK_MILLIS (20)
+#define TAT_DISPLAY_TASK_BUDGET (2000)
+#define TAT_UI_TASK_MILLIS      (20)
+#define TAT_UI_TASK_BUDGET      (10000)
+#define TAT_TEST_TASK_MILLIS    (10)
+#define TAT_TEST_TASK_BUDGET    (100000)
+#define TAT_LEVEL_TASK_BUDGET   (5000)
+#define TAT_FETCH_TASK_MILLIS   (1000)
+#define TAT_FETCH_TASK_BUDGET   (50000)
+#define TAT_METRICS_TASK_MILLIS (50)
+#define TAT_METRICS_TASK_BUDGET (5000)
+
+// The TCP port on which to serve health metrics in Prometheus text format at /metrics; 0 means 
+// don't. And the size of the buffer the metrics are rendered into. The minimal build (see the 
+// esp32s2_min environment in platformio.ini) doesn't serve them, leaving the heap to TLS.
+#ifdef TAT_MINIMAL
+#define TAT_METRICS_PORT        (0)
+#define TAT_METRICS_BUFFER      (1)
+#else
+#define TAT_METRICS_PORT        (9100)
+#define TAT_METRICS_BUFFER      (6144)
+#endif
+
 // The ESP32 non-volatile name space we use to store our config data
 #define TAT_NVS_NAMESPACE       "Tide and Time"
 // The ESP32 NVS key name for our signature
@@ -55,48 +100,49 @@
 // How often to update the water level display (sec)
 #define TAT_LEVEL_CHECK_SECS    (360)
 
-// The NOAA server that serves up tides and currents information in response to HTTPS GET requests 
+// The working set -- the time, the predictions, the tides and where the clock and display are --
+// is kept in RTC memory, which survives any reset but a power-on, so after a watchdog or software
+// reset the device resumes at once and gets WiFi and NTP going in the background. The value
+// marking a valid snapshot (change it when the snapshot's layout changes), the oldest
+// snapshot, in seconds, worth resuming from, and the most clock steps between snapshots. (In
+// between, only the clock's state is saved at each step; see saveResumeClock().)
+#define TAT_RESUME_MAGIC        (0x54615202)
+#define TAT_RESUME_MAX_SECS     (6 * 3600)
+#define TAT_RESUME_SAVE_STEPS   (64)
+
+// A history of what the device has done -- the levels it's displayed, the observations, the 
+// tides, the fetches, the homings and the resets -- is kept in the "tatlog" flash partition (see 
+// lib/FlashLog/FlashLog.h), for looking back at with "log dump" after something's gone wrong. 
+// Records are written a flash page (16 records) at a time; this is how long (sec) one waits in 
+// RAM before it's written anyway, i.e., the most history losing power can cost. About once a 
+// day, when a sector fills, writing one erases the next, which holds everything up for ~45 ms.
+#define TAT_LOG_FLUSH_SECS      (1800)
+
+// The NOAA server that serves up tides and currents information in response to HTTPS GET requests. 
+// This is the default; "config server" can point the device at a LAN caching proxy (see 
+// tools/tideproxy.cpp) instead.
 #define TAT_SERVER_URL          "https://api.tidesandcurrents.noaa.gov/api/prod/datagetter"
 
-// The pem for DigiCert Global Root CA, the CA that signed the server certifcate for 
-// api.tidesandcurrents.noaa.gov. It's valid until 29 Mar 2031.
-// 
-// We use this to verify that the site we connect to is really the one we want. Doing it this way 
-// is a little fragile since DigiCert is wont to update the cert before it expires, thus 
-// invalidating what we have here. But doing full cert management is a lot of work. 
+// The CA the device trusts when it connects to the server over HTTPS is in CaBundle.h, made 
+// by tools/cabundle.cpp. For NOAA that's DigiCert Global Root G2, valid until 15 Jan 2038. It's 
+// pre-parsed into the form WiFiClientSecure::setCACertBundle() takes and used straight from 
+// flash, rather than being parsed from PEM into RAM for every request. And since it's the root 
+// the chain NOAA sends leads to, rather than the intermediate CA that signs NOAA's certificate 
+// ("DigiCert Global G2 TLS RSA SHA256 2020 CA1", which we used to keep here), DigiCert 
+// replacing the intermediate, as it's wont to do, no longer breaks getting data from NOAA.
 //
-// When Digicert changes the cert, getting data from NOAA will fail with "connection 
-// refused". To get the new one go to https://www.digicert.com/kb/digicert-root-certificates.htm
-// and search for "DigiCert Global G2 TLS RSA SHA256 2020 CA1". There they have a link to 
-// download the current PEM.
-#define TAT_SERVER_ROOT_CA_PEM  "-----BEGIN CERTIFICATE-----\n"\
-                                "MIIEyDCCA7CgAwIBAgIQDPW9BitWAvR6uFAsI8zwZjANBgkqhkiG9w0BAQsFADBh\n"\
-                                "MQswCQYDVQQGEwJVUzEVMBMGA1UEChMMRGlnaUNlcnQgSW5jMRkwFwYDVQQLExB3\n"\
-                                "d3cuZGlnaWNlcnQuY29tMSAwHgYDVQQDExdEaWdpQ2VydCBHbG9iYWwgUm9vdCBH\n"\
-                                "MjAeFw0yMTAzMzAwMDAwMDBaFw0zMTAzMjkyMzU5NTlaMFkxCzAJBgNVBAYTAlVT\n"\
-                                "MRUwEwYDVQQKEwxEaWdpQ2VydCBJbmMxMzAxBgNVBAMTKkRpZ2lDZXJ0IEdsb2Jh\n"\
-                                "bCBHMiBUTFMgUlNBIFNIQTI1NiAyMDIwIENBMTCCASIwDQYJKoZIhvcNAQEBBQAD\n"\
-                                "ggEPADCCAQoCggEBAMz3EGJPprtjb+2QUlbFbSd7ehJWivH0+dbn4Y+9lavyYEEV\n"\
-                                "cNsSAPonCrVXOFt9slGTcZUOakGUWzUb+nv6u8W+JDD+Vu/E832X4xT1FE3LpxDy\n"\
-                                "FuqrIvAxIhFhaZAmunjZlx/jfWardUSVc8is/+9dCopZQ+GssjoP80j812s3wWPc\n"\
-                                "3kbW20X+fSP9kOhRBx5Ro1/tSUZUfyyIxfQTnJcVPAPooTncaQwywa8WV0yUR0J8\n"\
-                                "osicfebUTVSvQpmowQTCd5zWSOTOEeAqgJnwQ3DPP3Zr0UxJqyRewg2C/Uaoq2yT\n"\
-                                "zGJSQnWS+Jr6Xl6ysGHlHx+5fwmY6D36g39HaaECAwEAAaOCAYIwggF+MBIGA1Ud\n"\
-                                "EwEB/wQIMAYBAf8CAQAwHQYDVR0OBBYEFHSFgMBmx9833s+9KTeqAx2+7c0XMB8G\n"\
-                                "A1UdIwQYMBaAFE4iVCAYlebjbuYP+vq5Eu0GF485MA4GA1UdDwEB/wQEAwIBhjAd\n"\
-                                "BgNVHSUEFjAUBggrBgEFBQcDAQYIKwYBBQUHAwIwdgYIKwYBBQUHAQEEajBoMCQG\n"\
-                                "CCsGAQUFBzABhhhodHRwOi8vb2NzcC5kaWdpY2VydC5jb20wQAYIKwYBBQUHMAKG\n"\
-                                "NGh0dHA6Ly9jYWNlcnRzLmRpZ2ljZXJ0LmNvbS9EaWdpQ2VydEdsb2JhbFJvb3RH\n"\
-                                "Mi5jcnQwQgYDVR0fBDswOTA3oDWgM4YxaHR0cDovL2NybDMuZGlnaWNlcnQuY29t\n"\
-                                "L0RpZ2lDZXJ0R2xvYmFsUm9vdEcyLmNybDA9BgNVHSAENjA0MAsGCWCGSAGG/WwC\n"\
-                                "ATAHBgVngQwBATAIBgZngQwBAgEwCAYGZ4EMAQICMAgGBmeBDAECAzANBgkqhkiG\n"\
-                                "9w0BAQsFAAOCAQEAkPFwyyiXaZd8dP3A+iZ7U6utzWX9upwGnIrXWkOH7U1MVl+t\n"\
-                                "wcW1BSAuWdH/SvWgKtiwla3JLko716f2b4gp/DA/JIS7w7d7kwcsr4drdjPtAFVS\n"\
-                                "slme5LnQ89/nD/7d+MS5EHKBCQRfz5eeLjJ1js+aWNJXMX43AYGyZm0pGrFmCW3R\n"\
-                                "bpD0ufovARTFXFZkAdl9h6g4U5+LXUZtXMYnhIHUfoyMo5tS58aI7Dd8KvvwVVo4\n"\
-                                "chDYABPPTHPbqjc1qCmBaZx2vN4Ye5DUys/vZwP9BFohFrH/6j/f3IL16/RZkiMN\n"\
-                                "JCqVJUzKoZHm1Lesh3Sz8W2jmdv51b2EQJ8HmA==\n"\
-                                "-----END CERTIFICATE-----\n"
+// If the root does change, getting data from NOAA will fail with "connection refused". Get 
+// the new one's PEM from https://www.digicert.com/kb/digicert-root-certificates.htm and run 
+// cabundle on it (see tools/README.md).
+
+// How long (ms) to keep the connection to the server open after a fetch, in case another 
+// follows; fetches in a batch (e.g., by the level task) share one TLS handshake.
+#define TAT_FETCH_KEEP_MILLIS   (10000)
+
+// The biggest JSON response to accept from the server (bytes). A day of six-minute predictions 
+// is the biggest we ask for, at about 10k. (A TideWire message can be up to TW_MAX_SIZE.)
+#define TAT_FETCH_MAX_SIZE      (16384)
+
 /***
  * Dealing with the API's product=one_minute_water_level request asking for the latest data
  * 
@@ -219,5 +265,11 @@
 // Capacity for jsonDocument we'll use to deserialize the result of the above request
 #define TAT_JSON_CAPACITY_PRED  (24576)
 
-// Number of predictions expected from the above query
+// Number of predictions expected from the above query, and the seconds between them
 #define TAT_N_PRED_WL           (241)
+#define TAT_PRED_INTERVAL_SECS  (360)
+
+// Each day's predictions are kept as a curve fitted to them (see lib/TideData/TideCurve.h) rather 
+// than as they come. The most the curve may be off from any of them (hundredths of a foot); a 
+// step of the display is a little more than one.
+#define TAT_CURVE_MAX_ERROR     (1)
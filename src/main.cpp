@@ -19,7 +19,11 @@
  * USB. It has a command interpreter that can be used to change various runtime parameters such 
  * as the WiFi SSID and password to use and which tidal station to show the data for, among 
  * others. There are also various utility commands that may be of interest. The "h" command 
- * displays a list.
+ * displays a list. For automated test rigs, the "rpc" command switches the console to a 
+ * JSON-lines RPC protocol with request ids, batches and telemetry subscriptions; see RpcLink.h. 
+ * While it's in use, the messages the firmware prints as it goes arrive as log notifications.
+ * Health metrics (fetch times, heap, task timing, steps and so on) can be scraped in Prometheus 
+ * text format from http://<device>:TAT_METRICS_PORT/metrics.
  *  
  * Once the configuration is set, it can be stored in non-volatile memory using the "save" 
  * command. Once saved, the parameters are used whenever the power comes on or the device is 
@@ -33,6 +37,11 @@
  * This firmware was designed and tested to run on an Adafruit featheresp32-s2 using the Arduino 
  * framework; no effort was made to make it portable.
  * 
+ * Built with TAT_MINIMAL defined (the esp32s2_min environment in platformio.ini), it leaves out 
+ * what the device doesn't need to run: the test mode tick, tune and bench commands, the prof 
+ * command, the long help text, the metrics server and the framework's logging. tools/footprint.cpp says what 
+ * each part of the firmware costs in flash and RAM.
+ * 
  * The complete NOAA tides and currents api definition may be found at 
  * 
  *  https://api.tidesandcurrents.noaa.gov/api/prod/
@@ -55,14 +64,42 @@
 #include <WiFiMulti.h>
 #include <HTTPClient.h>
 #include <WiFiClientSecure.h>
+#include <mbedtls/platform.h>
+#include <mbedtls/ssl.h>
 #include <ArduinoJson.h>
 #include <UserInput.h>
 #include <nvs_flash.h>
 #include <nvs.h>
 #include <esp_sntp.h>
+#include <esp_sleep.h>
+#include <driver/gpio.h>
+#include <esp_partition.h>
+#include <esp_system.h>
+#include <esp_rom_crc.h>
+#include <sys/time.h>
+#include <type_traits>
 #include "config.h"                                   // Configuration definitions
+#include "CaBundle.h"                                 // The CA certificates trusted for HTTPS
 #include "TideClock.h"                                // Tide clock object
 #include "WlDisplay.h"                                // Water level display object
+#include "FastGpio.h"                                 // Fast GPIO writes (for the bench command)
+#include "TideTable.h"                                // Tide data in a flash partition
+#include "TideCurve.h"                                // A day's water level predictions as a compact curve
+#include "TideArchive.h"                              // Compact hi/lo tide data in a flash partition
+#include "TideWire.h"                                 // Compact binary tide data from a tideproxy
+#include "PredFetch.h"                                // When to fetch the day's water level predictions
+#include "WlBias.h"                                   // Observation-based correction of the predictions
+#include "CoopSched.h"                                // The cooperative scheduler that runs everything
+#include "RpcLink.h"                                  // The JSON-lines RPC mode for test rigs
+#include "Metrics.h"                                  // Health metrics, for scraping
+#include "MetricsHttp.h"                              // The HTTP server for the metrics
+#include "AsyncFetch.h"                               // Fetches from the server, a slice at a time
+#include "EspLink.h"                                  // The connection they're made on
+#include "FlashLog.h"                                 // The history kept in flash, for post-mortems
+#include "EspFlash.h"                                 // The flash partition it's kept in
+#ifndef TAT_MINIMAL
+#include "Profiler.h"                                 // The sampling profiler, for finding where the CPU time goes
+#endif
 
 // Misc constants
 #define BANNER                  F("Time and Tides v0.5.1")
@@ -70,7 +107,12 @@
 #define SECONDS_IN_NOMINAL_TIDE ((6*60+12)*60+30)     // Nominal time between high and low tide (sec)
 #define SECONDS_PER_DAY         (86400)               // How many seconds there are in a day
 #define MINUTES_PER_DAY         (1440)                // How many minutes there are in a day
-#define LEVEL_UNAVAILABLE       (-100.0)              // Value when water level unavailable
+#define LEVEL_UNAVAILABLE       (-10000)              // Value when water level unavailable (hundredths of a foot)
+#define RESUME_NO_POS           (INT32_MIN)           // resume_t.displayPos when the display wasn't standing still, homed
+#define BENCH_REPS              (1000)                // Number of repetitions the bench command times
+#define BENCH_TLS_REQUESTS      (4)                   // Number of requests "bench tls" makes each way
+#define TLS_ALLOC_HEADER        (8)                   // Bytes tlsCalloc() puts before each block to remember its size
+#define TASK_METRICS            (4)                   // Number of metrics kept for each scheduler task
 
 // Hardware pins
 #define TICK_PIN          (11)                        // The pin to which the TideClock's tick input is attached
@@ -84,7 +126,6 @@
 
 // Some useful macros
 #define timeToTimeOfDayUTC(t) (uint32_t)((t) % SECONDS_PER_DAY)       // Convert from time_t to seconds past midnight UTC
-#define timeToSx(t)       (sx_t)((((t) / 60) % MINUTES_PER_DAY) / 6)  // Convert from time_t to sx_t
 
 // Types
 typedef uint8_t sx_t;                                 // Sample index type i.e. six minutes -- 1/10th of an hour, 1/240th of a day
@@ -96,8 +137,63 @@ struct configData_t {                                 // The shape of the data w
   float maxLevel;                                     //   The highest tide to be displayed (feet above MLLW)
   tc_scale_t clockFace;                               //   The type of clock face; tcLinear or tcNonlinear
   tc_motor_t motor;                                   //   The type of lavet motor; tcOne or tcSixteen
+  uint32_t pulseMillis;                               //   Tuned step pulse duration (millis()); 0 means motor default
+  uint32_t stepMillis;                                //   Tuned minimum step interval (millis()); 0 means motor default
+  bool useObs;                                        //   Whether to correct the predictions using observed water levels
+  char server[96];                                    //   The datagetter URL to get tide data from: NOAA's or a LAN proxy's (null-padded)
 };
 enum opMode_t : uint8_t {notInit, run, test};         // The opMode type
+enum fetchFor_t : uint8_t {fetchNone, fetchHilo, fetchPred, fetchObs}; // What a fetch from the server is for
+enum logKind_t : uint8_t {                            // The kinds of flash log record. What a, b and c say:
+  logStart,                                           //   Started up: the reset reason, whether it resumed, opMode
+  logLevel,                                           //   Displayed a level: it and the prediction (hundredths of a foot)
+  logObs,                                             //   Got an observation: it and the prediction (hundredths of a foot)
+  logTide,                                            //   The clock's heading for a new tide: HIGH, LOW or TC_UNAVAILABLE, its time
+  logFetch,                                           //   A fetch finished: what it was for (fetchFor_t), its status, how long it took (ms)
+  logHoming,                                          //   Homed the display: whether it's homed, how long it took (ms), its position
+  logFault,                                           //   Started after a crash: the reset reason, when the working set was last saved
+  logBench,                                           //   Written by "bench log": the record's number
+  logKinds};
+enum tunePhase_t : uint8_t {tuneIdle, tunePulse, tuneInterval}; // What the pulse-width tuner is searching for
+struct tuneState_t {                                  // The state of the pulse-width tuner
+  tunePhase_t phase;                                  //   What we're searching for
+  uint32_t good;                                      //   Shortest value known to work (millis())
+  uint32_t bad;                                       //   Longest value known (or assumed) not to work (millis())
+  uint32_t trial;                                     //   The value being tried (millis())
+  uint32_t pulse;                                     //   The pulse duration chosen in the tunePulse phase (millis())
+  uint16_t stepsLeft;                                 //   Steps remaining in the current trial
+  bool awaitingVerdict;                               //   True if the trial is done and we're waiting for "tune ok" or "tune bad"
+};
+struct resume_t {                                     // The working set, as kept in RTC memory to resume from after a reset
+  uint32_t magic;                                     //   TAT_RESUME_MAGIC if what follows is a snapshot
+  time_t savedAt;                                     //   When the snapshot was taken
+  char station[8];                                    //   The station, face, motor and level range it was taken with; with 
+  tc_scale_t clockFace;                               //     any others, it doesn't apply
+  tc_motor_t motor;
+  float minLevel;
+  float maxLevel;
+  tc_state_t clock;                                   //   The tide clock's state
+  int32_t displayPos;                                 //   The display's stepper position (steps); RESUME_NO_POS if it wasn't still
+  uint8_t predFetch[sizeof(PredFetch)];               //   predFetch, hiloFetch and wlBias, byte for byte. (They have constructors, 
+  uint8_t hiloFetch[sizeof(HiloFetch)];               //     which would wipe them at every reset if they were in RTC memory 
+  uint8_t wlBias[sizeof(WlBias)];                     //     themselves.)
+  uint8_t predCurve[2][sizeof(TideCurve)];            //   predCurve
+  uint32_t crc;                                       //   The CRC-32 of all the above
+};
+struct resumeClock_t {                                // The tide clock's state, saved at every step, apart from the rest of the working set
+  tc_state_t clock;                                   //   The state
+  uint32_t snapshotCrc;                               //   The crc of the resume_t snapshot it goes with
+  uint32_t crc;                                       //   The CRC-32 of all the above
+};
+static_assert(std::is_trivially_copyable<PredFetch>::value && std::is_trivially_copyable<HiloFetch>::value && 
+  std::is_trivially_copyable<WlBias>::value && std::is_trivially_copyable<TideCurve>::value, 
+  "resume_t keeps copies of these as bytes");
+class TlsClient : public WiFiClientSecure {           // A WiFiClientSecure that can say which cipher suite the server picked
+public:
+  const char *cipherSuite() {                         //   E.g., "TLS-ECDHE-RSA-WITH-AES-128-GCM-SHA256"; "none" if not connected
+    return connected() ? mbedtls_ssl_get_ciphersuite(&sslclient->ssl_ctx) : "none";
+  }
+};
 
 /***
  * 
@@ -108,12 +204,82 @@ WiFiMulti WiFiMulti;                                  // The WiFi connection we'
 TideClock tc {TICK_PIN, TOCK_PIN};                    // The tide clock device
 WlDisplay wld {STEPPER_PIN_1, STEPPER_PIN_2, STEPPER_PIN_3, STEPPER_PIN_4, LIMIT_PIN, POWER_PIN}; // The water level display device
 UserInput ui {};                                      // User interface object -- cmd line processor
-float predWl[TAT_N_PRED_WL];                          // The today's predicted water levels, every six minutes from 00:00 to 24:00
+TideCurve predCurve[2];                               // Two days' predicted water levels, 00:00 to 24:00, as curves fitted to NOAA's six-minute levels
+PredFetch predFetch;                                  // Decides when each day's predCurve needs to be fetched, and where it goes
+HiloFetch hiloFetch;                                  // Recently fetched high and low tides, and when to fetch them afresh
 configData_t config;                                  // The configuration data stored in NVS
+TideTable tideTable;                                  // The tide table in the "tides" flash partition, if there is one
+TideArchive tideArchive;                              // Or the hi/lo archive in the "tides" flash partition, if that's what's there
+WlBias wlBias;                                        // The estimated offset of the observed water level from the prediction
+CoopSched sched;                                      // The scheduler that runs the tasks below
+RpcLink rpc {Serial};                                 // The RPC mode alternative to ui, for test rigs
+RpcConsole console {rpc, Serial};                     // Where human-readable messages go: Serial, or log notifications in RPC mode
+bool restartRequested;                                // Set by the RPC restart method; acted on once the reply is out
+Metrics metrics;                                      // The health metrics
+WiFiServer metricsServer {TAT_METRICS_PORT};          // The server the metrics are scraped from
+char metricsBuffer[TAT_METRICS_BUFFER];               // Where the metrics are rendered for a scrape
+MetricsHttp<WiFiServer, WiFiClient> metricsHttp {metricsServer, metrics, metricsBuffer, sizeof(metricsBuffer)};
+int8_t metricsTaskId;                                 // The scheduler's id for metricsTask()
+int8_t mFetchSeconds;                                 // Metric ids. Time taken by fetches from the server
+int8_t mFetchFailures;                                //   Fetches that failed
+int8_t mTlsHandshakes;                                //   TLS handshakes done
+int8_t mTlsHeapPeak;                                  //   The most memory mbedTLS has had allocated at once
+int8_t mHeapFree;                                     //   Free heap
+int8_t mHeapMinFree;                                  //   Low water mark of the free heap
+int8_t mHeapMaxAlloc;                                 //   Largest allocatable block
+int8_t mClockSteps;                                   //   Steps taken by the tide clock
+int8_t mClockCatchUps;                                //   Times the clock has had to catch up
+int8_t mDisplayHomings;                               //   Times the display has been homed
+int8_t mDisplayHomingSeconds;                         //   How long homing the display took
+int8_t mRadioSeconds;                                 //   Time the WiFi has been connected
+int8_t mUptimeSeconds;                                //   Time since startup
+int8_t mTaskBase;                                     //   The first of the per-task metrics, TASK_METRICS of them for each task
+int8_t metricTasks;                                   // The number of tasks mTaskBase has metrics for
+portMUX_TYPE radioMux = portMUX_INITIALIZER_UNLOCKED;  // Guards the two below; onWiFiEvent() runs in the Arduino event task
+unsigned long wifiUpMillis;                           // millis() when WiFi last connected (or was last counted); 0 if it isn't
+uint32_t radioMillisUncounted;                        // Time the WiFi was connected, from connections since closed, not yet in mRadioSeconds
+int8_t levelTaskId;                                   // The scheduler's id for levelTask()
+int8_t displayTaskId;                                 // The scheduler's id for displayTask()
 opMode_t opMode;                                      // Whether we're running normally or doing adjustments
+#ifndef TAT_MINIMAL
 uint16_t testTick;                                    // In test mode, the number of ticks to run the clock
 uint16_t testNsecs;                                   // In test mode, how many seconds between ticks
 uint16_t testTicksTaken;                              // In test mode, how many ticks are have been taken
+tuneState_t tune;                                     // In test mode, the state of the pulse-width tuner
+Profiler profiler;                                    // The sampling profiler the prof command runs
+bool profDumping;                                     // Set while a "prof dump" is under way; uiTask() prints it a page at a time
+#endif
+EspLink fetchLink;                                    // The connection to the server, kept open between fetches in a batch
+AsyncFetch<EspLink> fetcher {fetchLink};              // Fetches from the server, a slice at a time, in fetchTask()
+fetchFor_t fetchFor;                                  // What the fetch under way is for; fetchNone if there isn't one
+bool fetchWire;                                       //   Whether it asks the tideproxy for TideWire rather than JSON
+time_t fetchSecs;                                     //   When levelTask() started it
+time_t fetchDay;                                      //   For predictions, 00:00:00 UTC on the day they're for
+unsigned long fetchStartMillis;                       //   millis() when it started
+uint32_t handshakesSeen;                              // fetcher.handshakes() as of the last fetch to finish
+bool tidesNeeded;                                     // Set when getNextTide() found no tide to go on; levelTask() fetches them
+int8_t fetchTaskId;                                   // The scheduler's id for fetchTask()
+EspFlash logFlash;                                    // The "tatlog" flash partition
+FlashLog<EspFlash> flashLog {logFlash};               // The history kept in it
+uint32_t homingsLogged;                               // The display's homings as of the last one logged
+bool logDumping;                                      // Set while a "log dump" is under way; uiTask() prints it a page at a time
+uint32_t logDumpBase;                                 //   flashLog.firstSerial() when it started; records are labelled with their index then
+uint32_t logDumpNext;                                 //   The serial number (see FlashLog::firstSerial()) of the next record it prints
+uint32_t logDumpEnd;                                  //   One past the serial number of the last one
+uint32_t logDumpPrinted;                              //   The number of records it's printed
+uint32_t logDumpLost;                                 //   The number that went before it got to them
+unsigned long logDumpStartMillis;                     //   millis() when it started
+portMUX_TYPE tlsHeapMux = portMUX_INITIALIZER_UNLOCKED; // Guards the mbedTLS memory counts; the WiFi task's crypto uses mbedTLS too
+size_t tlsHeapNow;                                    // Bytes mbedTLS has allocated right now
+size_t tlsHeapPeak;                                   // The most it's had allocated at once since startup
+size_t tlsHeapMark;                                   // The most it's had allocated at once since "bench tls" last reset this
+RTC_DATA_ATTR uint16_t tickSchedule[TC_TICKS_IN_A_CYCLE]; // On battery, delays between the clock's remaining ticks (sec)
+RTC_DATA_ATTR uint16_t tickScheduleLen;               // The number of entries in tickSchedule
+RTC_DATA_ATTR uint16_t tickScheduleIx;                // The index in tickSchedule of the next tick
+RTC_DATA_ATTR time_t tickScheduleBase;                // When the tick before the one at tickScheduleIx was due
+RTC_DATA_ATTR time_t tickScheduleTide;                // The time of the tide tickSchedule leads up to; 0 if none
+RTC_NOINIT_ATTR resume_t resumeData;                  // The working set, saved as it changes, to resume from after a reset
+RTC_NOINIT_ATTR resumeClock_t resumeClock;            // The clock's part of it, saved at every step in between
 
 /***
  * 
@@ -134,19 +300,19 @@ uint16_t testTicksTaken;                              // In test mode, how many
 bool setClock() {
   configTzTime(TAT_POSIX_TZ, TAT_NTP_SERVER);
 
-  Serial.print(F("Waiting for NTP time sync..."));
+  console.print(F("Waiting for NTP time sync..."));
   sntp_sync_status_t status;
   for (uint8_t i = 0; i < (TAT_NTP_WAIT_MILLIS / TAT_NTP_CHECK_MILLIS) && (status = sntp_get_sync_status()) != SNTP_SYNC_STATUS_COMPLETED; i++) {
     delay(TAT_NTP_CHECK_MILLIS);
-    Serial.print(".");
+    console.print(".");
   }
   if (status != SNTP_SYNC_STATUS_COMPLETED) {
-    Serial.printf("sync not successful: %s\n", 
+    console.printf("sync not successful: %s\n", 
       status == SNTP_SYNC_STATUS_RESET ? "reset" : status == SNTP_SYNC_STATUS_IN_PROGRESS ? "in progress" : "completed");
       return false;
   }
   time_t nowSecs = time(nullptr);
-  Serial.printf("Sync successful. Current time: %s", ctime(&nowSecs)); // ctime() appends a "\n", just because.
+  console.printf("Sync successful. Current time: %s", ctime(&nowSecs)); // ctime() appends a "\n", just because.
   return true;
 }
 
@@ -226,141 +392,441 @@ void blinkLED(uint8_t n = 1) {
  * @return String The string representation of c
  */
 String configToString(configData_t c) {
-  char buffer[200];
-  sprintf(buffer, "Configuration: \n"
+  char buffer[400];
+  snprintf(buffer, sizeof(buffer), "Configuration: \n"
                   "  ssid:     \'%s\'\n"
                   "  pw:       \'%s\'\n"
                   "  station:  \'%s\'\n"
                   "  minLevel: %f\n"
                   "  maxLevel: %f\n"
                   "  face:     %s\n"
-                  "  motor:    %s\n",
+                  "  motor:    %s\n"
+                  "  pulse:    %u ms%s\n"
+                  "  interval: %u ms%s\n"
+                  "  obs:      %s\n"
+                  "  server:   \'%s\'\n",
                   c.ssid, c.pw, c.station, c.minLevel, c.maxLevel, 
-                  c.clockFace == tcLinear ? "linear" : "nonlinear", c.motor == tcOne ? "one" : "sixteen");
+                  c.clockFace == tcLinear ? "linear" : "nonlinear", c.motor == tcOne ? "one" : "sixteen",
+                  c.pulseMillis, c.pulseMillis == 0 ? " (motor default)" : "",
+                  c.stepMillis, c.stepMillis == 0 ? " (motor default)" : "",
+                  c.useObs ? "on" : "off", c.server);
   return String(buffer);
 }
 
 /**
+ * @brief Estimate the charge (mAh) the clock's motor uses in a day when its step pulses 
+ *        last pulseMillis. On average, the hand goes through TC_TICKS_IN_A_CYCLE ticks 
+ *        every SECONDS_IN_NOMINAL_TIDE seconds regardless of the face type.
+ * 
+ * @param pulseMillis The duration of a step pulse (millis())
+ * @return float      The estimated mAh per day
+ */
+float pulseMahPerDay(uint32_t pulseMillis) {
+  uint32_t stepsPerTick = config.motor == tcOne ? TC_ONE_STEPS_PER_TICK : TC_SIXTEEN_STEPS_PER_TICK;
+  float stepsPerDay = (float)(stepsPerTick * TC_TICKS_IN_A_CYCLE) * SECONDS_PER_DAY / SECONDS_IN_NOMINAL_TIDE;
+  return TAT_COIL_MA * pulseMillis * stepsPerDay / 3600000.0;
+}
+
+/**
+ * @brief The calloc() mbedTLS uses, installed in setup(). It's the usual one, except that it 
+ *        keeps track of how much memory mbedTLS has allocated, so we know how much a TLS 
+ *        connection costs.
+ */
+void *tlsCalloc(size_t n, size_t size) {
+  size_t bytes = n * size;
+  if (size != 0 && bytes / size != n) {
+    return nullptr;
+  }
+  uint8_t *block = (uint8_t *)calloc(1, bytes + TLS_ALLOC_HEADER);
+  if (block == nullptr) {
+    return nullptr;
+  }
+  *(size_t *)block = bytes;
+  portENTER_CRITICAL(&tlsHeapMux);
+  tlsHeapNow += bytes;
+  tlsHeapPeak = tlsHeapNow > tlsHeapPeak ? tlsHeapNow : tlsHeapPeak;
+  tlsHeapMark = tlsHeapNow > tlsHeapMark ? tlsHeapNow : tlsHeapMark;
+  portEXIT_CRITICAL(&tlsHeapMux);
+  return block + TLS_ALLOC_HEADER;
+}
+
+/**
+ * @brief The free() that goes with tlsCalloc()
+ */
+void tlsFree(void *ptr) {
+  if (ptr == nullptr) {
+    return;
+  }
+  uint8_t *block = (uint8_t *)ptr - TLS_ALLOC_HEADER;
+  portENTER_CRITICAL(&tlsHeapMux);
+  tlsHeapNow -= *(size_t *)block;
+  portEXIT_CRITICAL(&tlsHeapMux);
+  free(block);
+}
+
+/**
+ * @brief Close the connection the fetcher keeps open for the next fetch, freeing the memory 
+ *        TLS holds for it. Call it when a batch of fetches is done.
+ */
+void fetchesDone() {
+  fetcher.close();
+}
+
+/**
+ * @brief Add a record to the flash log. It's written with the rest of its flash page, or once 
+ *        it's been waiting TAT_LOG_FLUSH_SECS; a start or a fault is written straight away.
  * 
- * Get a payload from an https GET REST service
+ * @param kind    What it's about
+ * @param a       What it says (see logKind_t)
+ * @param b
+ * @param c
+ */
+void logEvent(logKind_t kind, int16_t a, int32_t b = 0, int32_t c = 0) {
+  flashLog.append(kind, time(nullptr), a, b, c);
+  if (kind == logStart || kind == logFault) {
+    flashLog.flush();
+  }
+}
+
+/**
+ * @brief Whether we're getting our tide data from a tideproxy, which can send it in TideWire 
+ *        format rather than JSON
+ */
+bool usingProxy() {
+  return strcmp(config.server, TAT_SERVER_URL) != 0;
+}
+
+/**
+ * @brief Start fetching something levelTask() needs from the server. The fetch is done by 
+ *        fetchTask(), a slice at a time, and what it gets is dealt with by fetchFinished().
  * 
- * N.B. The client must have previously established a secured connection 
- * with the server, i.e. gone through the setCACert() process.
+ * @param what    What it's for: the high and low tides, fetchDay's predictions or the latest 
+ *                observation
+ * @param wire    Whether to ask the tideproxy for TideWire rather than JSON
+ */
+void startFetch(fetchFor_t what, bool wire) {
+  String request;
+  if (what == fetchHilo) {
+    request = ((String(config.server) + "?" TAT_GET_PRED_TIDES) + toNOAAformat(fetchSecs, true)) + "&station=" + config.station;
+  } else if (what == fetchPred) {
+    request = ((String(config.server) + "?" TAT_GET_PRED_WL) + toNOAAformat(fetchDay, true)) + "&station=" + config.station;
+  } else {
+    request = (String(config.server) + "?" TAT_GET_WL) + String(config.station);
+  }
+  if (wire) {
+    request.replace("format=json", "format=" TW_FORMAT);
+  }
+  log_d("[startFetch] Request: \"%s\"\r", request.c_str());
+  fetchFor = what;
+  fetchWire = wire;
+  fetchStartMillis = millis();
+  fetcher.start(request.c_str(), wire ? TW_MAX_SIZE : TAT_FETCH_MAX_SIZE, fetchStartMillis); // If it won't, fetchTask() says so
+  sched.setPeriod(fetchTaskId, 0);
+}
+
+/**
+ * @brief Cancel the fetch under way, if any, e.g., because we're leaving run mode
+ */
+void cancelFetch() {
+  fetcher.cancel();
+  fetcher.release();
+  fetchFor = fetchNone;
+}
+
+/**
+ * @brief Attach wire to the TideWire message the fetcher got from the tideproxy
  * 
- * @param   (const char *) url: The url to use for the request
- * @return  (String) The payload from the server; empty String on error
+ * @param wire    The TideWire to attach to the message
+ * @return true   Got a valid message for the station we're configured for
+ * @return false  Didn't
+ */
+bool attachWire(TideWire &wire) {
+  if (!wire.attach(fetcher.data(), fetcher.size()) || strcmp(wire.station(), config.station) != 0) {
+    console.print("[attachWire] Didn't get a valid TideWire message.\n");
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Map the "tides" flash partition into our address space and attach tideTable to the 
+ *        tide table in it or, if it holds a hi/lo archive instead, attach tideArchive to that. 
+ *        The mapping stays in place for as long as we run.
  * 
+ * @return true   There's a valid tide table or archive
+ * @return false  There isn't; we'll get all our data from NOAA
  */
-String getPayload(const char *url) {
-  log_d("[getPayload] Request: \"%s\"\r", url);
-  String answer = "";
-  HTTPClient https;
-  WiFiClientSecure *client = new WiFiClientSecure; // Try to make a new client
-  if(client) {                                     // If that worked
-    client -> setCACert(TAT_SERVER_ROOT_CA_PEM);   //   Set things up to use a secure connection
-    if (https.begin(*client, url)) {
-      int httpCode = https.GET();                  //   Start connection and send HTTP header
-      if (httpCode > 0) {                          //   If HTTP header has been sent and response header has been handled  
-        if (httpCode == HTTP_CODE_OK || httpCode == HTTP_CODE_MOVED_PERMANENTLY) {
-                                                   //   If HTTPS GET succeeded
-          String payload = https.getString();       //    Retrieve the json payload and deserialize it into jsonDoc
-          log_d("Payload: \"%s\"\n", payload.c_str());
-          answer = payload;
-        } else {
-          Serial.printf("[getPayload] HTTPS GET unsuccessful. HTTP response code: %d\n", httpCode);
-          Serial.printf("[getPayload] Request URL was: %s\n", url);
-        }
-      } else {
-        Serial.printf("[getPayload] HTTPS GET failed, error: '%s'. WiFi status: %d\n", 
-          https.errorToString(httpCode).c_str(), WiFi.status());
-      }
-      https.end();
-    } else {
-      Serial.printf("[getPayload] Unable to connect.\n");
+bool mapTideTable() {
+  const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, 
+    (esp_partition_subtype_t)TT_PARTITION_SUBTYPE, TT_PARTITION_LABEL);
+  if (part == nullptr) {
+    console.print("[mapTideTable] There's no tide table partition.\n");
+    return false;
+  }
+  const void *mapped;
+  spi_flash_mmap_handle_t handle;
+  esp_err_t err = esp_partition_mmap(part, 0, part->size, SPI_FLASH_MMAP_DATA, &mapped, &handle);
+  if (err != ESP_OK) {
+    console.printf("[mapTideTable] Unable to map the tide table partition: 0x%x\n", err);
+    return false;
+  }
+  if (!tideTable.attach(mapped, part->size)) {
+    if (tideArchive.attach(mapped, part->size)) {
+      console.printf("[mapTideTable] Hi/lo archive for station %s has %u tides.\n", tideArchive.station(), tideArchive.size());
+      return true;
     }
-    delete client;
+    console.print("[mapTideTable] No valid tide table or archive in the tide table partition.\n");
+    spi_flash_munmap(handle);
+    return false;
   }
-  return answer;
+  time_t levelsEnd = tideTable.levelsEnd();
+  console.printf("[mapTideTable] Tide table for station %s has levels through %s", tideTable.station(), ctime(&levelsEnd));
+  return true;
+}
+
+/**
+ * @brief Whether the tide table is for the station we're configured for
+ */
+bool tideTableUsable() {
+  return tideTable.isValid() && strcmp(tideTable.station(), config.station) == 0;
 }
 
 /**
  * 
- * @brief Get the water level predictions for configured station on the specified date 
- *        and put them in the global predWl
+ * @brief Get the water level predictions out of the server's JSON response to a request for them
  * 
- * @param   yyyymmdd: The date for which to get the water level predictions
+ * @param   payload:  The response
+ * @param   levels:   Where to put them (hundredths of a foot); TAT_N_PRED_WL entries
  * @return  true if succeeded, false if something went wrong
  * 
  */
-bool getWlPredections(String yyyymmdd) {
-  String payload = getPayload((String(TAT_SERVER_URL "?" TAT_GET_PRED_WL) + 
-    yyyymmdd + "&station=" + config.station).c_str());
-
-  if (payload.length() > 0) {                                   //   If that worked, deserialize it
-    DynamicJsonDocument predictions(TAT_JSON_CAPACITY_PRED);    //     The deserialized predictions
-    DeserializationError err = deserializeJson(predictions, payload.c_str());
-    if (err == DeserializationError::Ok) {                      //     If deserialization went well
-      int sz = predictions["predictions"].size();               //       Check that we got more or less what was expected
-      log_d("Predictions deserialized into a %d element array.", sz);
-      if(sz == TAT_N_PRED_WL) {                                 //       If so, update wl with new data
-        for (sx_t sx = 0; sx < TAT_N_PRED_WL; sx++) {
-          predWl[sx] = predictions["predictions"][sx]["v"].as<const float>();
+bool parsePredictions(const char *payload, int16_t *levels) {
+  DynamicJsonDocument predictions(TAT_JSON_CAPACITY_PRED);      // The deserialized predictions
+  DeserializationError err = deserializeJson(predictions, payload);
+  if (err == DeserializationError::Ok) {                        // If deserialization went well
+    int sz = predictions["predictions"].size();                 //   Check that we got more or less what was expected
+    log_d("Predictions deserialized into a %d element array.", sz);
+    if(sz == TAT_N_PRED_WL) {                                   //   If so, update wl with new data
+      for (sx_t sx = 0; sx < TAT_N_PRED_WL; sx++) {
+        if (!ttParseLevel(predictions["predictions"][sx]["v"].as<const char *>(), &levels[sx])) {
+          console.printf("Prediction %d isn't a water level.\n", sx);
+          return false;
         }
-        return true;                                            //         And say we did good
-      } else {                                                  //       Otherwise, complain and indicate we have no predictions
-        Serial.printf("Didn't get the expected %d prediction values. Instead got %d\n", TAT_N_PRED_WL, sz);
-        log_d("Payload: \"%s\"\n", payload.c_str());
       }
-    } else {
-      Serial.printf("Json deserialization of water level predictions didn't work out. Error: %s\n", err.c_str());
+      return true;                                              //     And say we did good
+    } else {                                                    //   Otherwise, complain and indicate we have no predictions
+      console.printf("Didn't get the expected %d prediction values. Instead got %d\n", TAT_N_PRED_WL, sz);
+      log_d("Payload: \"%s\"\n", payload);
     }
+  } else {
+    console.printf("Json deserialization of water level predictions didn't work out. Error: %s\n", err.c_str());
   }
   return false;
 }
 
 /***
  * 
- * @brief  Return the most recent water level measurement.
+ * @brief  Get the water level measurement out of the server's JSON response to a request for 
+ *         the latest one.
  * 
- * @return (float) The water level in feet above MLLW, NAN if couldn't get a prediction
+ * @param  payload    The response
+ * @return (int32_t)  The water level in hundredths of a foot above MLLW, LEVEL_UNAVAILABLE if 
+ *                    there isn't one
  * 
  ***/
-float getActualWl() {
-  float answer = LEVEL_UNAVAILABLE;
-  String payload = getPayload((String(TAT_SERVER_URL "?" TAT_GET_WL) + String(config.station)).c_str());
-  if (payload.length() > 0) {
-    log_d("[getActualWl] Payload: \"%s\"\n", payload.c_str());
-    StaticJsonDocument<TAT_JSON_CAPACITY_WL> jsonDoc;
-    DeserializationError err = deserializeJson(jsonDoc, payload.c_str());
-    if (err == DeserializationError::Ok) {
-      answer = jsonDoc["data"][0]["v"].as<float>();
+int32_t parseActualWl(const char *payload) {
+  int32_t answer = LEVEL_UNAVAILABLE;
+  log_d("[parseActualWl] Payload: \"%s\"\n", payload);
+  StaticJsonDocument<TAT_JSON_CAPACITY_WL> jsonDoc;
+  DeserializationError err = deserializeJson(jsonDoc, payload);
+  if (err == DeserializationError::Ok) {
+    int16_t level;
+    if (jsonDoc["data"][0]["v"].isNull()) {               // E.g., the station has no working gauge
+      console.print("[parseActualWl] No water level measurement in the response.\n");
+    } else if (ttParseLevel(jsonDoc["data"][0]["v"].as<const char *>(), &level)) {
+      answer = level;
     } else {
-      Serial.printf("[getActualWl] Json deserialization of water level measurement didn't work out. error: ", err.c_str());
+      console.print("[parseActualWl] The water level measurement isn't a water level.\n");
     }
   } else {
-    Serial.print("[getActualWl] Couldn\'t get the water level.\n");
+    console.printf("[parseActualWl] Json deserialization of water level measurement didn't work out. error: %s\n", err.c_str());
   }
   return answer;
 }
 
+/**
+ * @brief Get the high and low tides out of the server's JSON response to a request for them
+ * 
+ * @param payload   The response
+ * @param events    Where to put them; HF_MAX_EVENTS entries
+ * @return uint16_t The number of tides; 0 if there weren't any
+ */
+uint16_t parseTides(const char *payload, tt_event_t *events) {
+  uint16_t n = 0;
+  String timeStamp = toNOAAformat(fetchSecs);
+  DynamicJsonDocument predictions(TAT_JSON_CAPACITY_TIDES);
+  DeserializationError err = deserializeJson(predictions, payload);
+  if (err == DeserializationError::Ok) {
+    for (JsonObjectConst p : predictions["predictions"].as<JsonArrayConst>()) {
+      if (n == HF_MAX_EVENTS) {
+        break;
+      }
+      events[n].time = fromNOAAformat(p["t"].as<String>());
+      if (!ttParseLevel(p["v"].as<const char *>(), &events[n].level)) {
+        continue;
+      }
+      events[n].type = p["type"].as<String>().equals("H") ? TT_TYPE_HIGH : TT_TYPE_LOW;
+      events[n].reserved = 0;
+      log_d("[parseTides %s] %s %s", timeStamp.c_str(), p["t"].as<const char *>(), p["type"].as<const char *>());
+      n++;
+    }
+    if (n == 0) {
+      console.printf("[parseTides %s] Didn't get any predicted tides.\n", timeStamp.c_str());
+      log_d("[parseTides] Payload: \"%s\"\n", payload);
+    }
+  } else {
+    console.printf("[parseTides %s] Json deserialization of tides didn't work out. Error: %s\n", 
+      timeStamp.c_str(), err.c_str());
+  }
+  return n;
+}
+
+/**
+ * @brief Fit the curve in a day's predCurve slot to its water level predictions. The curve is 
+ *        within TAT_CURVE_MAX_ERROR of every prediction, in a fraction of the space they take, 
+ *        unless it runs out of knots.
+ * 
+ * @param day     00:00:00 UTC on the day
+ * @param levels  The day's predictions (hundredths of a foot); TAT_N_PRED_WL entries
+ * @return true   Fitted it
+ * @return false  Didn't
+ */
+bool fitPredCurve(time_t day, const int16_t *levels) {
+  TideCurve &curve = predCurve[pfSlot(day)];
+  if (!curve.fit(day, TAT_PRED_INTERVAL_SECS, levels, TAT_N_PRED_WL, TAT_CURVE_MAX_ERROR)) {
+    return false;
+  }
+  if (curve.maxError() > TAT_CURVE_MAX_ERROR) {
+    console.printf("[fitPredCurve] The curve for %s is off by up to %u hundredths of a foot.\n", 
+      toNOAAformat(day, true).c_str(), curve.maxError());
+  }
+  log_d("[fitPredCurve] %u knots, off by up to %u hundredths of a foot.\n", curve.knots(), curve.maxError());
+  return true;
+}
+
 /***
  * 
- * @brief  Return the current water level prediction.
+ * @brief  Return the current water level prediction, from the tide table if it has it, or from 
+ *         the predictions levelTask() fetches.
  * 
- * @return (float) The water level in feet above MLLW, NAN if couldn't get a prediction
+ * @return (int32_t) The water level in hundredths of a foot above MLLW, LEVEL_UNAVAILABLE if 
+ *         there's no prediction
  * 
  ***/
-float getPredWl() {
-  static time_t dataMidnight = 0;   // 00:00:00 the date for which predWl is valid
+int32_t getPredWl() {
   time_t nowSecs = time(nullptr);
-  time_t midnightNow = (nowSecs / SECONDS_PER_DAY) * SECONDS_PER_DAY;
-  if (dataMidnight != midnightNow) {
-    dataMidnight = midnightNow;
-    if (!getWlPredections(toNOAAformat(dataMidnight, true))) {
-      return LEVEL_UNAVAILABLE;
+  int16_t level;
+  if (tideTableUsable() && tideTable.levelAt(nowSecs, &level)) {
+    return level;
+  }
+  if (!predFetch.have(nowSecs) || !predCurve[pfSlot(nowSecs)].levelAt(nowSecs, &level)) {
+    return LEVEL_UNAVAILABLE;
+  }
+  return level;
+}
+
+/**
+ * @brief Deal with the fetch fetchTask() has just finished: put what it got where it goes or 
+ *        note that it failed, and have levelTask() go on with whatever's next. If the tideproxy 
+ *        didn't come up with a usable TideWire message, ask it for JSON instead.
+ */
+void fetchFinished() {
+  fetchFor_t what = fetchFor;
+  fetchFor = fetchNone;
+  int16_t status = fetcher.status();
+  bool ok = status == HTTP_CODE_OK || status == HTTP_CODE_MOVED_PERMANENTLY;
+  metrics.observe(mFetchSeconds, (millis() - fetchStartMillis) / 1000.0);
+  logEvent(logFetch, what, status, millis() - fetchStartMillis);
+  metrics.inc(mTlsHandshakes, fetcher.handshakes() - handshakesSeen);
+  handshakesSeen = fetcher.handshakes();
+  if (status > 0 && !ok) {
+    console.printf("[fetchFinished] HTTPS GET unsuccessful. HTTP response code: %d\n", status);
+  } else if (status <= 0) {
+    console.printf("[fetchFinished] HTTPS GET failed while %s, error: '%s'. WiFi status: %d\n", 
+      fetcher.phaseToString(fetcher.failedIn()), fetcher.statusToString(status), WiFi.status());
+    if (status == AF_ERR_HANDSHAKE) {
+      console.printf("[fetchFinished] mbedTLS error: -0x%04x\n", -fetchLink.tlsError());
+    }
+  }
+
+  // Get what we asked for out of the payload
+  TideWire wire;
+  bool wireOk = ok && fetchWire && attachWire(wire);
+  tt_event_t events[HF_MAX_EVENTS];
+  uint16_t n = 0;
+  int16_t levels[TAT_N_PRED_WL];
+  int32_t observed = LEVEL_UNAVAILABLE;
+  bool got = false;
+  if (what == fetchHilo) {
+    if (wireOk) {
+      while (n < wire.nEvents() && n < HF_MAX_EVENTS && wire.event(n, &events[n])) {
+        n++;
+      }
+    } else if (ok && !fetchWire) {
+      n = parseTides(fetcher.text(), events);
+    }
+    got = n > 0;
+  } else if (what == fetchPred) {
+    if (wireOk && wire.nLevels() == TAT_N_PRED_WL && wire.epoch() == fetchDay && wire.interval() == TAT_PRED_INTERVAL_SECS) {
+      for (sx_t sx = 0; sx < TAT_N_PRED_WL; sx++) {
+        levels[sx] = wire.level(sx);
+      }
+      got = true;
+    } else if (wireOk && wire.nLevels() != TAT_N_PRED_WL) {
+      console.printf("Didn't get the expected %d prediction values. Instead got %d\n", TAT_N_PRED_WL, wire.nLevels());
+    } else if (wireOk) {
+      console.printf("[fetchFinished] Asked for predictions from %ld every %d s; got them from %ld every %d s.\n", 
+        (long)fetchDay, TAT_PRED_INTERVAL_SECS, (long)wire.epoch(), wire.interval());
+    } else if (ok && !fetchWire) {
+      got = parsePredictions(fetcher.text(), levels);
+    }
+  } else if (ok) {
+    observed = parseActualWl(fetcher.text());
+    got = observed != LEVEL_UNAVAILABLE;
+  }
+  fetcher.release();
+  if (!ok) {
+    metrics.inc(mFetchFailures);
+  }
+  if (!got && fetchWire) {
+    startFetch(what, false);
+    return;
+  }
+
+  // And put it where it goes
+  if (what == fetchHilo) {
+    if (got) {
+      hiloFetch.store(fetchSecs, events, n);
+      tc.askAgain();                                  // In case the clock's been waiting for them
+    } else {
+      hiloFetch.failed(fetchSecs);
+    }
+  } else if (what == fetchPred) {
+    predFetch.fetched(fetchSecs, fetchDay, got && fitPredCurve(fetchDay, levels));
+  } else if (what == fetchObs) {
+    // The filter works in feet, as floats; it runs once every few minutes, so the cost doesn't matter.
+    int32_t predicted = getPredWl();
+    if (!got) {
+      console.print("[fetchFinished] Couldn\'t get the water level.\n");
+      wlBias.missed(fetchSecs);
+    } else {
+      logEvent(logObs, observed, predicted);
+      if (predicted != LEVEL_UNAVAILABLE) {
+        wlBias.update(fetchSecs, observed / 100.0f, predicted / 100.0f);
+      }
     }
   }
-  return predWl[timeToSx(nowSecs)];
+  sched.runNow(levelTaskId);
 }
 
 /**
@@ -368,6 +834,11 @@ float getPredWl() {
  *        the next high or low tide. This function is intended as the handler 
  *        function for a TideClock
  * 
+ *        The tides come from the tide table in flash if there is one; otherwise from the 
+ *        tides last fetched from the server, which levelTask() keeps fresh. If they don't 
+ *        say, levelTask() is asked to fetch them, and the clock is asked to ask again once 
+ *        they're in.
+ * 
  * @return tc_tide_t 
  */
 tc_tide_t getNextTide() {
@@ -376,51 +847,192 @@ tc_tide_t getNextTide() {
   answer.tideType = TC_UNAVAILABLE;
   answer.time = 0;
   String timeStamp = toNOAAformat(nowSecs);
-  String payload = getPayload(((String(TAT_SERVER_URL "?" TAT_GET_PRED_TIDES) + 
-    toNOAAformat(nowSecs, true)) + String("&station=") + String(config.station)).c_str());
-  if (payload.length() > 0) {
-    DynamicJsonDocument predictions(TAT_JSON_CAPACITY_TIDES);
-    DeserializationError err = deserializeJson(predictions, payload.c_str());
-    if (err == DeserializationError::Ok) {
-      int sz = predictions["predictions"].size();
-      if(sz > 0) {
-        log_d("[getNextTide %s] Got %d tide predictions: ", timeStamp.c_str(), sz);
-        for (uint8_t ix = 0; ix < sz; ix++) {
-          log_d("%s%s", predictions["predictions"][ix]["t"].as<String>().c_str(), ix < sz -1 ? ", " : "\n");
-        }
-        for (uint8_t ix = 0; ix < sz; ix++) {
-          answer.time = fromNOAAformat(predictions["predictions"][ix]["t"].as<String>());
-          answer.tideType = predictions["predictions"][ix]["type"].as<String>().equals("H") ? HIGH : LOW;
-          if (answer.time > nowSecs) {
-            break;
-          }
-          if (ix == sz - 1) {
-            Serial.printf(". Didn't find a next tide after %s",
-              asctime(localtime(&nowSecs)));
-            answer.tideType = TC_UNAVAILABLE;
-            answer.time = 0;
-          }
-        }
-      } else {
-        Serial.printf("[getNextTide %s] Didn't get any predicted tides.\n", timeStamp.c_str());
-        log_d("[getNextTide] Payload: \"%s\"\n", payload.c_str());
-      }
-    } else {
-      Serial.printf("[getNextTide %s] Json deserialization of tides didn't work out. Error: %d\n", 
-        timeStamp.c_str(), err.c_str());
-    }
+  tt_event_t event;
+  bool gotEvent = (tideTableUsable() && tideTable.nextEvent(nowSecs, &event)) ||
+    (tideArchive.isValid() && strcmp(tideArchive.station(), config.station) == 0 && tideArchive.nextEvent(nowSecs, &event)) ||
+    hiloFetch.nextEvent(nowSecs, &event);
+  if (!gotEvent) {
+    tidesNeeded = true;
+    sched.runNow(levelTaskId);
+  }
+  if (gotEvent) {
+    answer.time = event.time;
+    answer.tideType = event.type == TT_TYPE_HIGH ? HIGH : LOW;
   }
   if (answer.tideType == TC_UNAVAILABLE) {
-    Serial.printf("[getNextTide %s] Next tide data unavailable.\n", timeStamp.c_str());
+    console.printf("[getNextTide %s] Next tide data unavailable.\n", timeStamp.c_str());
   } else {
     uint32_t fromNow = (uint32_t)(answer.time - nowSecs);
-    Serial.printf("[getNextTide %s] Next tide (%s) is %02d:%02d:%02d from now at %s\n", 
+    console.printf("[getNextTide %s] Next tide (%s) is %02d:%02d:%02d from now at %s\n", 
       timeStamp.c_str(), answer.tideType == HIGH ? "high" : "low", 
       fromNow / 3600, (fromNow % 3600) / 60, fromNow % 60, toHhmmss(answer.time).c_str());
   }
   return answer;
 }
 
+/**
+ * @brief Running on battery with the tide clock caught up, light-sleep until its next tick is 
+ *        due, the next tide arrives or USB power comes back, whichever is first.
+ * 
+ *        The schedule of the clock's ticks for the whole tide cycle is worked out once per 
+ *        cycle (see TideSchedule.h) and kept in RTC memory, so each wakeup is just a matter 
+ *        of stepping the clock and looking up how long to sleep next.
+ * 
+ * @param now   The current time
+ * @return true   Slept
+ * @return false  The next tick is too soon to be worth sleeping for
+ */
+bool sleepUntilNextTick(time_t now) {
+  time_t tideTime = tc.getNextTide().time;
+  if (tickScheduleTide != tideTime) {
+    tickScheduleLen = tc.buildSchedule(now, tickSchedule, TC_TICKS_IN_A_CYCLE);
+    tickScheduleIx = 0;
+    tickScheduleBase = now;
+    tickScheduleTide = tideTime;
+  }
+  while (tickScheduleIx < tickScheduleLen && tickScheduleBase + tickSchedule[tickScheduleIx] <= now) {
+    tickScheduleBase += tickSchedule[tickScheduleIx++];
+  }
+  time_t wakeTime;
+  if (tickScheduleIx < tickScheduleLen) {
+    wakeTime = tickScheduleBase + tickSchedule[tickScheduleIx];
+    if (tickSchedule[tickScheduleIx] == TC_SCHEDULE_MAX_DELAY) {
+      tickScheduleTide = 0;                           // Clipped entry; work out a fresh schedule next time
+    }
+  } else {
+    wakeTime = tideTime + 1;                          // Wake when it's time to ask about the tide after that
+    if (wakeTime <= now) {                            // Asked and didn't get an answer; wait to ask again
+      wakeTime = now + (TC_ASK_TIDE_MILLIS + TC_ASK_JITTER_MILLIS) / 1000;
+    }
+  }
+  if (wakeTime - now < TAT_MIN_SLEEP_SECS) {
+    return false;
+  }
+  log_d("[sleepUntilNextTick] Sleeping for %d seconds.\n", (int32_t)(wakeTime - now));
+  esp_sleep_enable_timer_wakeup((uint64_t)(wakeTime - now) * 1000000ULL);
+  gpio_wakeup_enable((gpio_num_t)POWER_PIN, GPIO_INTR_HIGH_LEVEL);
+  esp_sleep_enable_gpio_wakeup();
+  esp_light_sleep_start();
+  gpio_wakeup_disable((gpio_num_t)POWER_PIN);
+  return true;
+}
+
+/**
+ * @brief The position the water level display is standing still at, for resumeData.
+ *
+ * @return int32_t  The stepper position (steps); RESUME_NO_POS if the display isn't homed, is
+ *                  moving or is about to, or has no power
+ */
+int32_t stillDisplayPos() {
+  wld_state_t display = wld.getState();
+  if (!display.homed || !display.powerIsOn || wld.isMoving() || display.position != display.target) {
+    return RESUME_NO_POS;
+  }
+  return display.position;
+}
+
+/**
+ * @brief Save the tide clock's state in resumeClock, tied to the snapshot in resumeData. Called 
+ *        at each step, so that the hand's position is never out of date, without redoing the 
+ *        whole snapshot's CRC every time. A reset part way through writing it leaves a bad CRC, 
+ *        and means starting from scratch.
+ * 
+ * @param clock The clock's state
+ */
+void saveResumeClock(const tc_state_t &clock) {
+  resumeClock.clock = clock;
+  resumeClock.snapshotCrc = resumeData.crc;
+  resumeClock.crc = esp_rom_crc32_le(0, (const uint8_t *)&resumeClock, offsetof(resumeClock_t, crc));
+}
+
+/**
+ * @brief In run mode, save the working set in resumeData, for resumeSaved() to pick up after a
+ *        reset. Called whenever the clock changes which tide it's heading for or whether it's 
+ *        paused, or has taken TAT_RESUME_SAVE_STEPS steps since the last time, whenever the 
+ *        display comes to rest and whenever the level task has been and gone. There's only the 
+ *        one copy; it's marked invalid while it's being written, so a reset part way through 
+ *        just means starting from scratch.
+ */
+void saveResume() {
+  if (opMode != run) {
+    return;
+  }
+  resumeData.magic = 0;
+  resumeData.savedAt = time(nullptr);
+  memcpy(resumeData.station, config.station, sizeof(resumeData.station));
+  resumeData.clockFace = config.clockFace;
+  resumeData.motor = config.motor;
+  resumeData.minLevel = config.minLevel;
+  resumeData.maxLevel = config.maxLevel;
+  resumeData.clock = tc.getState();
+  resumeData.displayPos = stillDisplayPos();
+  memcpy(resumeData.predFetch, &predFetch, sizeof(predFetch));
+  memcpy(resumeData.hiloFetch, &hiloFetch, sizeof(hiloFetch));
+  memcpy(resumeData.wlBias, &wlBias, sizeof(wlBias));
+  memcpy(resumeData.predCurve, predCurve, sizeof(predCurve));
+  resumeData.crc = esp_rom_crc32_le(0, (const uint8_t *)&resumeData, offsetof(resume_t, crc));
+  resumeData.magic = TAT_RESUME_MAGIC;
+  saveResumeClock(resumeData.clock);
+}
+
+/**
+ * @brief Forget the saved working set, e.g., because test mode is about to move the clock's
+ *        hand in ways the saved state knows nothing about.
+ */
+void forgetResume() {
+  resumeData.magic = 0;
+}
+
+/**
+ * @brief At the very start of setup(), put back the working set saveResume() saved -- if the
+ *        reset wasn't a power-on (or anything else that might have moved the hands), the
+ *        snapshot is intact and it's no more than TAT_RESUME_MAX_SECS old. If the reset lost
+ *        the time, the time the snapshot was taken is the best guess there is until NTP says
+ *        otherwise. The clock's and display's states stay in resumeData for setup() to hand
+ *        to tc and wld once they've been begun, and for resumeFits() to check.
+ *
+ * @return true   Resumed
+ * @return false  Nothing to resume from; start from scratch
+ */
+bool resumeSaved() {
+  esp_reset_reason_t why = esp_reset_reason();
+  if (why != ESP_RST_SW && why != ESP_RST_PANIC && why != ESP_RST_INT_WDT && why != ESP_RST_TASK_WDT && why != ESP_RST_WDT) {
+    return false;
+  }
+  if (resumeData.magic != TAT_RESUME_MAGIC ||
+    resumeData.crc != esp_rom_crc32_le(0, (const uint8_t *)&resumeData, offsetof(resume_t, crc)) ||
+    resumeClock.crc != esp_rom_crc32_le(0, (const uint8_t *)&resumeClock, offsetof(resumeClock_t, crc)) ||
+    resumeClock.snapshotCrc != resumeData.crc) {
+    return false;
+  }
+  resumeData.clock = resumeClock.clock;               // The clock may have stepped since the snapshot
+  time_t nowSecs = time(nullptr);
+  if (nowSecs < resumeData.savedAt) {
+    timeval tv = {resumeData.savedAt, 0};
+    settimeofday(&tv, nullptr);
+  } else if (nowSecs - resumeData.savedAt > TAT_RESUME_MAX_SECS) {
+    return false;
+  }
+  memcpy(&predFetch, resumeData.predFetch, sizeof(predFetch));
+  memcpy(&hiloFetch, resumeData.hiloFetch, sizeof(hiloFetch));
+  memcpy(&wlBias, resumeData.wlBias, sizeof(wlBias));
+  memcpy(predCurve, resumeData.predCurve, sizeof(predCurve));
+  return true;
+}
+
+/**
+ * @brief Whether what resumeSaved() put back was saved with the configuration we have now.
+ *        If the station, the clock or the display has been changed, it doesn't apply.
+ *
+ * @return true   It was
+ * @return false  It wasn't; forget it
+ */
+bool resumeFits() {
+  return strncmp(resumeData.station, config.station, sizeof(resumeData.station)) == 0 &&
+    resumeData.clockFace == config.clockFace && resumeData.motor == config.motor &&
+    resumeData.minLevel == config.minLevel && resumeData.maxLevel == config.maxLevel;
+}
+
 /**
  * @brief Connect the global Wifi connection WiFiMulti to the WiFi using the given SSID and password
  * 
@@ -435,15 +1047,15 @@ bool connectWiFi(char * ssid, char * pass) {
   unsigned long startMillis = millis();
 
   // wait for WiFi connection
-  Serial.print("Waiting for WiFi to connect...");
+  console.print("Waiting for WiFi to connect...");
   while ((WiFiMulti.run() != WL_CONNECTED) && millis() - startMillis < TAT_WIFI_WAIT_MILLIS) {
-    Serial.print(".");
+    console.print(".");
   }
   if (WiFiMulti.run() == WL_CONNECTED) {
-    Serial.print("Connected.\n");
+    console.print("Connected.\n");
     return true;
   }
-  Serial.print("Unable to connect.\n");
+  console.print("Unable to connect.\n");
   return false;
 }
 
@@ -462,28 +1074,28 @@ bool putConfig(configData_t c) {
   // Open the our name space in the default NVS partition
   err = nvs_open(TAT_NVS_NAMESPACE, NVS_READWRITE, &handle);
   if (err != ESP_OK) {
-    Serial.printf("[putConfig] Unable to open NVS: 0x%x\n", err);
+    console.printf("[putConfig] Unable to open NVS: 0x%x\n", err);
     nvs_close(handle);
     return false;
   }
   // Store the config info
   err = nvs_set_blob(handle, TAT_NVS_DATA_NAME, &c, blobSize);
   if (err != ESP_OK) {
-    Serial.printf("[putConfig] Couldn\'t write config data to NVS: 0x%x\n", err);
+    console.printf("[putConfig] Couldn\'t write config data to NVS: 0x%x\n", err);
     nvs_close(handle);
     return false;
   }
   //Store the signature
   err = nvs_set_u16(handle, TAT_NVS_SIG_NAME, TAT_NVS_SIG);
   if (err != ESP_OK) {
-    Serial.printf("[putConfig] Couldn\'t write signature to NVS: 0x%x\n", err);
+    console.printf("[putConfig] Couldn\'t write signature to NVS: 0x%x\n", err);
     nvs_close(handle);
     return false;
   }
   //Commit what we stored
   err = nvs_commit(handle);
   if (err != ESP_OK) {
-    Serial.printf("[putConfig] Couldn\'t commit the configuration to NVS: 0x%x\n", err);
+    console.printf("[putConfig] Couldn\'t commit the configuration to NVS: 0x%x\n", err);
     nvs_close(handle);
     return false;
   }
@@ -513,11 +1125,16 @@ bool getConfig() {
   config.minLevel = TAT_STATION_MIN_LEVEL;
   config.maxLevel = TAT_STATION_MAX_LEVEL;
   config.clockFace = TAT_FACE_TYPE;
+  config.pulseMillis = 0;
+  config.stepMillis = 0;
+  config.useObs = true;
+  strcpy(config.server, TAT_SERVER_URL);
+  c = config;                   // So fields missing from a blob saved by an earlier version get defaults
 
   // Open the our name space in the default NVS partition
   err = nvs_open(TAT_NVS_NAMESPACE, NVS_READONLY, &handle);
   if (err != ESP_OK) {
-    Serial.printf("[getConfig] Unable to open NVS: 0x%x\n", err);
+    console.printf("[getConfig] Unable to open NVS: 0x%x\n", err);
     nvs_close(handle);
     return false;
   }
@@ -529,13 +1146,19 @@ bool getConfig() {
   if (err == ESP_OK && sig == TAT_NVS_SIG) {
     err = nvs_get_blob(handle, TAT_NVS_DATA_NAME, &c, &blobSize);
     if (err != ESP_OK) {
-      Serial.printf("[getConfig] Unable to get the configuration data from NVS: 0x%x\n", err);
+      console.printf("[getConfig] Unable to get the configuration data from NVS: 0x%x\n", err);
       nvs_close(handle);
       return false;
     }
+    if (!wldLevelsOk(c.minLevel, c.maxLevel)) {
+      console.printf("[getConfig] Stored minLevel %.2f and maxLevel %.2f unusable. Using defaults.\n",
+        c.minLevel, c.maxLevel);
+      c.minLevel = TAT_STATION_MIN_LEVEL;
+      c.maxLevel = TAT_STATION_MAX_LEVEL;
+    }
     config = c;
   } else {
-    Serial.printf("[getConfig] Unable to get a good signature: 0x%x; err: 0x%x\n", sig, err);
+    console.printf("[getConfig] Unable to get a good signature: 0x%x; err: 0x%x\n", sig, err);
     nvs_close(handle);
     return false;
   }
@@ -547,14 +1170,20 @@ bool getConfig() {
  * @brief The handler for unrecognized user commands.
  */
 void onCmdUnrecognized() {
-  Serial.printf("Command %s not recognized.\n", ui.getWord(0).c_str());
+  console.printf("Command %s not recognized.\n", ui.getWord(0).c_str());
 }
 
 /**
  * @brief The "help" and "h" command handler. Print a summary of the available commands.
  */
 void onHelp() {
-  Serial.print(
+#ifdef TAT_MINIMAL
+  console.print(
+    "Commands: help | h, mode run | test, tide, wl [<float>], sched [reset], log [dump [<n>] | clear], rpc, save,\n"
+    "restart, "
+    "config [ssid | pw | station | minlevel | maxlevel | face | motor | obs | server <value>]\n");
+#else
+  console.print(
     "help | h                       Print this summary of the commands\n"
     "mode run | test                Set the operating mode: run normally or enter test mode\n"
     "tick nTicks [nSecs]            In test mode, tick the clock for nTicks, once every nSecs seconds\n"
@@ -569,8 +1198,27 @@ void onHelp() {
     "config maxlevel <float>        Set the maximum displayable water level (ft MLLW)\n"
     "config face linear | nonlinear Set the type of clock face being used\n"
     "config motor one | sixteen     Set the type of motor the clock uses\n"
+    "config obs on | off            Set whether to correct predictions using observed water levels\n"
+    "config server <url>            Set the datagetter URL to get tide data from, e.g., a LAN tideproxy's\n"
+    "config server noaa             Go back to getting tide data straight from NOAA\n"
+    "tune                           In test mode, find the shortest reliable step pulse and interval\n"
+    "tune ok | bad                  Report whether the second hand made exactly one turn in the last trial\n"
+    "tune cancel | default          Stop tuning or go back to the motor's default step timing\n"
+    "bench gpio                     In test mode, measure CPU cycles per pin write and per stepper phase update\n"
+    "bench wire                     In test mode, measure decoding a day's predictions from JSON vs TideWire\n"
+    "bench level                    In test mode, measure CPU cycles per level parse, display target and clock update, float vs integer\n"
+    "bench tls [<url>]              In test mode, measure HTTPS handshakes and requests with a PEM CA, the CA bundle, and kept connections\n"
+    "bench log [<n>]                In test mode, measure the flash log's sustained write throughput, appending n records\n"
+    "sched [reset]                  Print (or reset) the scheduler's per-task statistics\n"
+    "prof [start [<hz> [<depth>]]]  Print the profiler's status, or start sampling where the CPU is (default 1000 Hz, 8 calls deep)\n"
+    "prof stop | dump | clear       Stop sampling, print the samples for tools/profsym, or free them\n"
+    "log                            Print the flash log's size, write costs, days of history and flash wear\n"
+    "log dump [<n>]                 Print the flash log's last n records (default all) as CSV\n"
+    "log clear                      Empty the flash log\n"
+    "rpc                            Switch to the JSON-lines RPC protocol for test rigs (rpc.exit to leave)\n"
     "save                           Save the current configuration\n"
     "restart                        Restart things using the saved configuration\n");
+#endif
 }
 
 /**
@@ -584,15 +1232,19 @@ void onMode() {
   String modeName = ui.getWord(1);
   if (modeName.equalsIgnoreCase("run")) {
     opMode = run;
-    Serial.print(F("Run mode.\n"));
+    sched.runNow(levelTaskId);
+    console.print(F("Run mode.\n"));
   } else if (modeName.equalsIgnoreCase("test")) {
-    Serial.print(F("Test mode. Displays not running.\n"));
+    console.print(F("Test mode. Displays not running.\n"));
     opMode = test;
+    cancelFetch();
+    forgetResume();
   } else {
-    Serial.printf("Unrecognized mode: %s.\n", ui.getWord(1).c_str());
+    console.printf("Unrecognized mode: %s.\n", ui.getWord(1).c_str());
   }
 }
 
+#ifndef TAT_MINIMAL
 /**
  * @brief The tick command handler. Test mode only. 
  * 
@@ -604,7 +1256,7 @@ void onMode() {
  */
 void onTick() {
   if (opMode != test) {
-    Serial.print(F("The tick command is only active in test mode.\n"));
+    console.print(F("The tick command is only active in test mode.\n"));
     return;
   }
   testTick = ui.getWord(1).toInt();
@@ -612,150 +1264,1400 @@ void onTick() {
   if (testNsecs < 1) {
     testNsecs = 6;
   }
-  Serial.printf("Ticking %d times at 1 tick every %d seconds.\n", testTick, testNsecs);
+  console.printf("Ticking %d times at 1 tick every %d seconds.\n", testTick, testNsecs);
   testTicksTaken = 0;
 }
 
 /**
- * @brief The tide command handler. Display information related to the next tide
+ * @brief Start a pulse-width tuning trial: set the clock's timing to what's being tried and 
+ *        arrange for loop() to take one second-hand turn's worth of steps.
  */
-void onTide() {
-  tc_tide_t nextTide = tc.getNextTide();
-  time_t t = time(nullptr);
-  Serial.printf("It is now %s UTC. ", toHhmmss(t).c_str());
-  if (nextTide.tideType == TC_UNAVAILABLE) {
-    Serial.print(" Next tide data is unavailable.\n");
-    return;
+void startTuneTrial() {
+  tune.trial = (tune.good + tune.bad) / 2;
+  uint32_t stepsPerTick = config.motor == tcOne ? TC_ONE_STEPS_PER_TICK : TC_SIXTEEN_STEPS_PER_TICK;
+  if (tune.phase == tunePulse) {
+    tc.setTiming(tune.trial, 0);
+  } else {
+    tc.setTiming(tune.pulse, tune.trial);
   }
-  int32_t secToNextTide = static_cast<int32_t>(nextTide.time) - static_cast<int32_t>(t);
-  Serial.printf("The next tide (%s) is %s from now at %s.\n",
-    nextTide.tideType == HIGH ? "high" : "low", toHhmmss(secToNextTide).c_str(), toHhmmss(nextTide.time).c_str());
+  tune.stepsLeft = TAT_TUNE_TICKS * stepsPerTick;
+  tune.awaitingVerdict = false;
+  console.printf("Trying %s of %u ms. Watch the second hand.\n", 
+    tune.phase == tunePulse ? "a step pulse" : "a step interval", tune.trial);
 }
 
 /**
- * @brief The wl command handler. Display information about the current water level or,
- *        in test mode, set the water level being displayed.
+ * @brief Narrow the tuner's search based on the result of the last trial. When the search 
+ *        for the pulse duration converges, start on the step interval. When that converges, 
+ *        put the results (plus a margin) in the configuration.
  * 
+ * @param worked Whether the last trial worked
  */
-void onWl() {
-  String wlString = ui.getWord(1);
-  time_t t = time(nullptr);
-  if (wlString.length() == 0) {
-    Serial.printf("It is now %s UTC. The water level currently displayed is %f feet MLLW.\n", 
-      toHhmmss(t).c_str(), wld.getLevel());
-      return;
-  }    
-  if (opMode != test) {
-    Serial.print(F("Can only set the water level in test mode.\n"));
+void advanceTune(bool worked) {
+  if (worked) {
+    tune.good = tune.trial;
+  } else {
+    tune.bad = tune.trial;
+  }
+  if (tune.good - tune.bad > 1) {
+    startTuneTrial();
     return;
   }
-  float wl = wlString.toFloat();
-  wld.setLevel(wl);
-  Serial.printf("Water level display set to %f\n", wl);
+  uint32_t result = tune.good + (tune.good * TAT_TUNE_MARGIN_PCT + 99) / 100;
+  if (tune.phase == tunePulse) {
+    tune.pulse = result;
+    tune.phase = tuneInterval;
+    tune.good = config.motor == tcOne ? TC_ONE_MIN_STEP_INTERVAL : TC_SIXTEEN_MIN_STEP_INTERVAL;
+    tune.bad = tune.pulse;
+    if (tune.good < tune.bad + 2) {
+      tune.good = tune.bad + 2;
+    }
+    console.printf("Step pulse tuned to %u ms (including margin). Now tuning the step interval.\n", tune.pulse);
+    startTuneTrial();
+    return;
+  }
+  tune.phase = tuneIdle;
+  config.pulseMillis = tune.pulse;
+  config.stepMillis = result;
+  tc.setTiming(config.pulseMillis, config.stepMillis);
+  uint32_t defaultPulse = config.motor == tcOne ? TC_ONE_PULSE_DURATION : TC_SIXTEEN_PULSE_DURATION;
+  console.printf("Tuning complete. Pulse: %u ms, interval: %u ms.\n", config.pulseMillis, config.stepMillis);
+  console.printf("Estimated motor use: %.2f mAh/day instead of %.2f mAh/day; saving %.2f mAh/day. "
+    "Use \"save\" to keep these settings.\n", pulseMahPerDay(config.pulseMillis), pulseMahPerDay(defaultPulse),
+    pulseMahPerDay(defaultPulse) - pulseMahPerDay(config.pulseMillis));
 }
 
 /**
- * @brief The config command handler. Set and display the available configuration 
- *        variables.
+ * @brief The tune command handler. Test mode only.
+ * 
+ *        tune                  Start tuning
+ *        tune ok | bad         Report on the last trial
+ *        tune cancel           Stop tuning; go back to the configured timing
+ *        tune default          Go back to the motor's default timing
+ * 
+ *        Tuning binary-searches for the shortest step pulse that reliably moves the clock, 
+ *        starting with the motor's default as the known-good upper bound, and then does the 
+ *        same for the step interval. Each trial takes one second-hand turn's worth of steps; 
+ *        the user reports whether the hand made it all the way around.
  */
-void onConfig() {
-  String subCmd = ui.getWord(1);
-  if (subCmd.equalsIgnoreCase("minLevel")) {
-    config.minLevel = ui.getWord(2).toFloat();
-    return;
-  }
-  if (subCmd.equalsIgnoreCase("maxLevel")) {
-    config.maxLevel = ui.getWord(2).toFloat();
+void onTune() {
+  if (opMode != test) {
+    console.print(F("The tune command is only active in test mode.\n"));
     return;
   }
+  String subCmd = ui.getWord(1);
   if (subCmd.length() == 0) {
-    Serial.print(configToString(config));
-    return;
-  }
-  String rest = ui.getCommandLine();
-  rest = rest.substring(rest.indexOf(subCmd) + subCmd.length());
-  rest.trim();
-  if (subCmd.equalsIgnoreCase("ssid")) {
-    if (rest.length() >= sizeof(config.ssid)) {
-      Serial.printf("SSID value \'%s\' too long. Max length is %d.\n", rest.c_str(), sizeof(config.ssid) - 1);
-      return;
-    }
-    strcpy(config.ssid, rest.c_str());
+    tune.phase = tunePulse;
+    tune.good = config.motor == tcOne ? TC_ONE_PULSE_DURATION : TC_SIXTEEN_PULSE_DURATION;
+    tune.bad = 0;
+    console.printf("Tuning. After each trial, say \"tune ok\" if the second hand made exactly one turn, "
+      "\"tune bad\" otherwise.\n");
+    startTuneTrial();
     return;
   }
-  if (subCmd.equalsIgnoreCase("pw")) {
-    if (rest.length() >= sizeof(config.pw)) {
-      Serial.printf("Password value \'%s\' too long. Max length is %d.\n", rest.c_str(), sizeof(config.pw) - 1);
-      return;
-    }
-    strcpy(config.pw, rest.c_str());
+  if (subCmd.equalsIgnoreCase("cancel")) {
+    tune.phase = tuneIdle;
+    tune.stepsLeft = 0;
+    tc.setTiming(config.pulseMillis, config.stepMillis);
+    console.print(F("Tuning cancelled.\n"));
     return;
   }
-  if (subCmd.equalsIgnoreCase("station")) {
-    if (rest.length() != 7 || rest.toInt() < 1000000) {
-      Serial.printf("Invalid station ID \'%s\'. Must be a 7-digit number.\n", rest.c_str());
-      return;
-    }
-    strcpy(config.station, rest.c_str());
+  if (subCmd.equalsIgnoreCase("default")) {
+    tune.phase = tuneIdle;
+    tune.stepsLeft = 0;
+    config.pulseMillis = 0;
+    config.stepMillis = 0;
+    tc.setTiming(0, 0);
+    console.print(F("Using the motor's default step timing. Use \"save\" to keep it.\n"));
     return;
   }
-  if (subCmd.equalsIgnoreCase("face")) {
-    String faceType = ui.getWord(2);
-    if (faceType.equalsIgnoreCase("linear")) {
-      config.clockFace = tcLinear;
-    } else if (faceType.equalsIgnoreCase("nonlinear")) {
-      config.clockFace = tcNonlinear;
-    } else {
-      Serial.printf("Invalid face type. \"%s\". Must be \"linear\" or \"nonlinear\".\n",
-        faceType);
-    }
+  bool worked = subCmd.equalsIgnoreCase("ok");
+  if (!worked && !subCmd.equalsIgnoreCase("bad")) {
+    console.printf("Unrecognized tune subcommand \'%s\'.\n", subCmd.c_str());
     return;
   }
-  if (subCmd.equalsIgnoreCase("motor")) {
-    String motorType = ui.getWord(2);
-    if (motorType.equalsIgnoreCase("one")) {
-      config.motor = tcOne;
-    } else if (motorType.equalsIgnoreCase("sixteen")) {
-      config.motor = tcSixteen;
-    } else {
-      Serial.printf("Invalid motor type. \"%s\". Must be \"one\" or \"sixteen\".\n",
-        motorType);
-    }
+  if (tune.phase == tuneIdle || !tune.awaitingVerdict) {
+    console.print(F("No tuning trial is waiting for a verdict.\n"));
     return;
   }
-  Serial.printf("Unrecognized configuration variable \'%s\'.\n", subCmd.c_str());
+  advanceTune(worked);
 }
 
 /**
- * @brief The save command handler. Save the current configuration in NVS
+ * @brief Measure the cost, in CPU cycles, of a pulse edge on one pin and a stepper phase update, 
+ *        done with digitalWrite() and with FastGpio.
  * 
+ *        The single-pin measurement uses the LED so the clock doesn't move; the phase update 
+ *        measurement writes the stepper's pins with the coils otherwise idle and leaves them off.
  */
-void onSave() {
-  if (putConfig(config)) {
-    Serial.print("Configuration saved.\n");
+void benchGpio() {
+  const uint8_t phasePinNumbers[] = {STEPPER_PIN_1, STEPPER_PIN_2, STEPPER_PIN_3, STEPPER_PIN_4};
+  const uint8_t halfSteps[] = {0b0001, 0b0011, 0b0010, 0b0110, 0b0100, 0b1100, 0b1000, 0b1001};
+  FastPin led {LED_BUILTIN};
+  FastPinGroup<4> phases {phasePinNumbers};
+  uint32_t start, pinSlow, pinFast, phaseSlow, phaseFast;
+
+  start = ESP.getCycleCount();
+  for (uint16_t i = 0; i < BENCH_REPS; i++) {
+    digitalWrite(LED_BUILTIN, i & 1);
   }
-}
-/**
- * @brief The restart command handler. Cause a software reset, restarting 
- *        things with the stored configuration.
+  pinSlow = ESP.getCycleCount() - start;
+  start = ESP.getCycleCount();
+  for (uint16_t i = 0; i < BENCH_REPS; i++) {
+    led.write(i & 1);
+  }
+  pinFast = ESP.getCycleCount() - start;
+
+  start = ESP.getCycleCount();
+  for (uint16_t i = 0; i < BENCH_REPS; i++) {
+    uint8_t pattern = halfSteps[i & 0x07];
+    for (uint8_t p = 0; p < 4; p++) {
+      digitalWrite(phasePinNumbers[p], (pattern >> p) & 1);
+    }
+  }
+  phaseSlow = ESP.getCycleCount() - start;
+  start = ESP.getCycleCount();
+  for (uint16_t i = 0; i < BENCH_REPS; i++) {
+    phases.write(halfSteps[i & 0x07]);
+  }
+  phaseFast = ESP.getCycleCount() - start;
+  phases.clear();
+  digitalWrite(LED_BUILTIN, LOW);
+
+  console.printf("Cycles per pin write:    digitalWrite %u, FastPin %u\n", pinSlow / BENCH_REPS, pinFast / BENCH_REPS);
+  console.printf("Cycles per phase update: digitalWrite x4 %u, FastPinGroup %u\n", phaseSlow / BENCH_REPS, phaseFast / BENCH_REPS);
+}
+
+/**
+ * @brief Measure the cost, in microseconds, of decoding a day's worth of water level predictions 
+ *        from NOAA's JSON and from the same data in TideWire format. The data is made up, but it 
+ *        has the size and shape of the real thing.
+ */
+void benchWire() {
+  static int16_t levels[TAT_N_PRED_WL];
+  static uint8_t wireBuffer[TW_MAX_SIZE];
+  String json = "{\"predictions\":[";
+  char item[48];
+  for (sx_t sx = 0; sx < TAT_N_PRED_WL; sx++) {
+    levels[sx] = (int16_t)lroundf(600.0 + 550.0 * sinf(sx * 2 * PI / 124.2));
+    snprintf(item, sizeof(item), "%s{\"t\":\"2023-06-01 %02d:%02d\",\"v\":\"%.3f\"}", 
+      sx == 0 ? "" : ",", (sx / 10) % 24, (sx % 10) * 6, levels[sx] / 100.0);
+    json += item;
+  }
+  json += "]}";
+  size_t wireLen = twEncode(config.station, 0, 6, levels, TAT_N_PRED_WL, nullptr, 0, wireBuffer, sizeof(wireBuffer));
+  if (wireLen == 0) {
+    console.print(F("[benchWire] Couldn't encode the TideWire message.\n"));
+    return;
+  }
+  int32_t sum = 0;
+  int16_t level;
+  uint32_t start = micros();
+  for (uint8_t i = 0; i < 10; i++) {
+    DynamicJsonDocument predictions(TAT_JSON_CAPACITY_PRED);
+    if (deserializeJson(predictions, json.c_str()) != DeserializationError::Ok) {
+      console.print(F("[benchWire] JSON deserialization failed.\n"));
+      return;
+    }
+    for (sx_t sx = 0; sx < TAT_N_PRED_WL; sx++) {
+      if (ttParseLevel(predictions["predictions"][sx]["v"].as<const char *>(), &level)) {
+        sum += level;
+      }
+    }
+  }
+  uint32_t jsonMicros = (micros() - start) / 10;
+  start = micros();
+  for (uint8_t i = 0; i < 10; i++) {
+    TideWire wire;
+    if (!wire.attach(wireBuffer, wireLen)) {
+      console.print(F("[benchWire] TideWire attach failed.\n"));
+      return;
+    }
+    for (sx_t sx = 0; sx < TAT_N_PRED_WL; sx++) {
+      sum -= wire.level(sx);
+    }
+  }
+  uint32_t wireMicros = (micros() - start) / 10;
+  console.printf("JSON:     %u bytes, %u us to decode\n", json.length(), jsonMicros);
+  console.printf("TideWire: %u bytes, %u us to decode (checksum %d)\n", wireLen, wireMicros, sum);
+}
+
+/**
+ * @brief Measure the cost, in CPU cycles, of each stage of getting from a water level prediction 
+ *        to the display's and the clock's steppers, done the way we used to, with (software) 
+ *        float arithmetic, and the way we do now, with integers: parsing NOAA's text, turning a 
+ *        level into a stepper position, and working out the clock face's ticks. The checksums 
+ *        keep the compiler from throwing the work away; each pair should match.
+ */
+void benchLevel() {
+  const char *texts[] = {"2.426", "-0.108", "8.081", "11.963"};
+  volatile int32_t secs = 20000;                      // volatile, so none of this gets done at compile time
+  volatile int32_t maxLevel = lroundf(config.maxLevel * 100);
+  int32_t stepsPerFoot = (int32_t)((WLD_MIN_POS / config.maxLevel) - 0.5);
+  int32_t floatSum, intSum;
+  uint32_t start, parseFloat, parseInt, posFloat, posInt, faceFloat, faceInt;
+
+  floatSum = 0;
+  start = ESP.getCycleCount();
+  for (uint16_t i = 0; i < BENCH_REPS; i++) {
+    floatSum += lroundf(atof(texts[i & 0x03]) * 100);
+  }
+  parseFloat = ESP.getCycleCount() - start;
+  intSum = 0;
+  start = ESP.getCycleCount();
+  for (uint16_t i = 0; i < BENCH_REPS; i++) {
+    int16_t level;
+    ttParseLevel(texts[i & 0x03], &level);
+    intSum += level;
+  }
+  parseInt = ESP.getCycleCount() - start;
+  console.printf("Cycles per level parse:   atof %u, ttParseLevel %u (checksums %d, %d)\n", 
+    parseFloat / BENCH_REPS, parseInt / BENCH_REPS, floatSum, intSum);
+
+  floatSum = 0;
+  start = ESP.getCycleCount();
+  for (uint16_t i = 0; i < BENCH_REPS; i++) {
+    floatSum += (long)((float)(int32_t)(i % maxLevel) / 100 * stepsPerFoot);
+  }
+  posFloat = ESP.getCycleCount() - start;
+  intSum = 0;
+  start = ESP.getCycleCount();
+  for (uint16_t i = 0; i < BENCH_REPS; i++) {
+    intSum += wldPosition(i % maxLevel, maxLevel);
+  }
+  posInt = ESP.getCycleCount() - start;
+  console.printf("Cycles per display target: float %u, wldPosition %u (checksums %d, %d)\n", 
+    posFloat / BENCH_REPS, posInt / BENCH_REPS, floatSum, intSum);
+
+  floatSum = 0;
+  start = ESP.getCycleCount();
+  for (uint16_t i = 0; i < BENCH_REPS; i++) {
+    float secFromCycleEnd = (float)(int32_t)(TC_SECONDS_IN_18_HOURS - (secs + i));
+    floatSum += (int32_t)(1800.0 / ((double)TC_SECONDS_IN_18_HOURS * TC_SECONDS_IN_18_HOURS) * (secFromCycleEnd * secFromCycleEnd));
+  }
+  faceFloat = ESP.getCycleCount() - start;
+  intSum = 0;
+  start = ESP.getCycleCount();
+  for (uint16_t i = 0; i < BENCH_REPS; i++) {
+    intSum += tcTicksNeeded(true, secs + i);
+  }
+  faceInt = ESP.getCycleCount() - start;
+  console.printf("Cycles per clock update:  float %u, tcTicksNeeded %u (checksums %d, %d)\n", 
+    faceFloat / BENCH_REPS, faceInt / BENCH_REPS, floatSum, intSum);
+}
+
+/**
+ * @brief Make one "bench tls" request: connect and do the TLS handshake if need be, then GET url
+ * 
+ * @param client      The client to use
+ * @param http        The HTTP client to use it with
+ * @param host        The server's host name or address
+ * @param port        Its port
+ * @param url         The request
+ * @param hsMillis    Add the time the handshake took, if there was one, to this
+ * @param handshakes  And count it here
+ * @param suite       Where to put the name of the cipher suite the server picked
+ * @return true       Got a 200 response
+ * @return false      Didn't
+ */
+bool benchTlsRequest(TlsClient &client, HTTPClient &http, const String &host, uint16_t port, const String &url, 
+  uint32_t &hsMillis, uint16_t &handshakes, String &suite) {
+  if (!client.connected()) {
+    uint32_t start = millis();
+    if (!client.connect(host.c_str(), port)) {
+      char err[80];
+      client.lastError(err, sizeof(err));
+      console.printf("[benchTls] Couldn't connect to %s:%u: %s\n", host.c_str(), port, err);
+      return false;
+    }
+    hsMillis += millis() - start;
+    handshakes++;
+    suite = client.cipherSuite();
+  }
+  bool ok = http.begin(client, url) && http.GET() == HTTP_CODE_OK && http.getString().length() > 0;
+  http.end();
+  return ok;
+}
+
+/**
+ * @brief Measure what it costs to make HTTPS requests, three ways: with the CA certificate as 
+ *        PEM, parsed for every connection (the way fetches used to work); with the 
+ *        pre-parsed CA bundle; and with the bundle and the connection kept open between 
+ *        requests (the way the fetcher works now, though it takes a slice at a time). For 
+ *        each, make BENCH_TLS_REQUESTS requests, blocking, and report the time per handshake 
+ *        and per request, the most memory mbedTLS had allocated at once, and the cipher suite 
+ *        the server picked.
+ * 
+ *        The cipher suite and curve are up to the server; the Arduino core doesn't let us set 
+ *        the client's preferences. To see what each costs, run it against a local stand-in 
+ *        server set to offer just the one (see tools/README.md).
+ * 
+ * @param url   The request to make; it must be https
+ */
+void benchTls(String url) {
+  static const char *wayNames[] = {"pem", "bundle", "reuse"};
+  if (!url.startsWith("https://")) {
+    console.printf("[benchTls] '%s' isn't an https URL.\n", url.c_str());
+    return;
+  }
+  int pathStart = url.indexOf('/', 8);
+  String host = url.substring(8, pathStart < 0 ? url.length() : pathStart);
+  uint16_t port = 443;
+  int colon = host.indexOf(':');
+  if (colon >= 0) {
+    port = host.substring(colon + 1).toInt();
+    host = host.substring(0, colon);
+  }
+  fetchesDone();                                      // So the kept connection doesn't count
+  console.printf("%u requests each way to %s:%u\n", BENCH_TLS_REQUESTS, host.c_str(), port);
+  console.print(F("Way     OK  Handshakes  ms/handshake  ms/request  Peak TLS heap  Cipher suite\n"));
+  for (uint8_t way = 0; way < 3; way++) {
+    uint32_t hsMillis = 0;
+    uint16_t handshakes = 0;
+    uint16_t ok = 0;
+    String suite = "none";
+    portENTER_CRITICAL(&tlsHeapMux);
+    size_t baseHeap = tlsHeapNow;
+    tlsHeapMark = tlsHeapNow;
+    portEXIT_CRITICAL(&tlsHeapMux);
+    uint32_t start = millis();
+    if (way == 2) {
+      TlsClient kept;                                 // Declared first so the HTTPClient goes first; it stops its client
+      HTTPClient keptHttp;
+      kept.setCACertBundle(tatCaBundle);
+      keptHttp.setReuse(true);
+      for (uint8_t r = 0; r < BENCH_TLS_REQUESTS; r++) {
+        ok += benchTlsRequest(kept, keptHttp, host, port, url, hsMillis, handshakes, suite) ? 1 : 0;
+      }
+      kept.stop();
+    } else {
+      for (uint8_t r = 0; r < BENCH_TLS_REQUESTS; r++) {
+        TlsClient fresh;
+        HTTPClient freshHttp;
+        if (way == 0) {
+          fresh.setCACert(tatCaPem);
+        } else {
+          fresh.setCACertBundle(tatCaBundle);
+        }
+        ok += benchTlsRequest(fresh, freshHttp, host, port, url, hsMillis, handshakes, suite) ? 1 : 0;
+        fresh.stop();
+      }
+    }
+    uint32_t totalMillis = millis() - start;
+    console.printf("%-7s %-3u %-11u %-13u %-11u %-14u %s\n", wayNames[way], ok, handshakes, 
+      handshakes == 0 ? 0 : hsMillis / handshakes, totalMillis / BENCH_TLS_REQUESTS, (unsigned)(tlsHeapMark - baseHeap), suite.c_str());
+  }
+}
+
+/**
+ * @brief Measure the flash log's sustained write throughput: append n records as fast as they 
+ *        go, the log writing each page as it fills and erasing a sector when one fills, and 
+ *        report the records a second, what the flash writes and erases took, and the longest 
+ *        any one append held things up. The records (logBench) stay in the log.
+ * 
+ * @param n   The number of records to append
+ */
+void benchLog(uint32_t n) {
+  if (!flashLog.isValid()) {
+    console.print(F("There's no flash log to measure.\n"));
+    return;
+  }
+  fl_stats_t before = flashLog.getStats();
+  uint32_t longest = 0;
+  uint32_t start = micros();
+  for (uint32_t i = 0; i < n; i++) {
+    uint32_t appendStart = micros();
+    flashLog.append(logBench, time(nullptr), 0, i);
+    uint32_t took = micros() - appendStart;
+    longest = took > longest ? took : longest;
+  }
+  flashLog.flush();
+  uint32_t took = micros() - start;
+  fl_stats_t after = flashLog.getStats();
+  uint32_t writes = after.writes - before.writes, erases = after.erases - before.erases;
+  console.printf("Appended %u records in %u ms: %.0f records/s (%.1f kB/s)\n", n, took / 1000, 
+    n * 1e6 / took, n * FL_RECORD_SIZE * 1e3 / took);
+  console.printf("Flash writes: %u, %.2f ms each; erases: %u, %.1f ms each; longest append %.1f ms\n", writes, 
+    writes == 0 ? 0.0 : (after.writeMicros - before.writeMicros) / 1000.0 / writes, erases, 
+    erases == 0 ? 0.0 : (after.eraseMicros - before.eraseMicros) / 1000.0 / erases, longest / 1000.0);
+}
+
+/**
+ * @brief The bench command handler. Test mode only. Measure the cost of the operations on the 
+ *        step and data paths.
+ * 
+ *        bench gpio      CPU cycles per pin write and per stepper phase update
+ *        bench wire      Microseconds to decode a day's water level predictions from JSON and 
+ *                        from TideWire
+ *        bench level     CPU cycles per level parse, display target and clock update, in float 
+ *                        and in integer arithmetic
+ *        bench tls [url] Milliseconds per TLS handshake and per request, and peak mbedTLS 
+ *                        memory, for each way of setting up HTTPS; url defaults to asking the 
+ *                        server for the latest water level
+ *        bench log [n]   Records a second the flash log can write, appending n of them 
+ *                        (default 1000)
+ */
+void onBench() {
+  if (opMode != test) {
+    console.print(F("The bench command is only active in test mode.\n"));
+    return;
+  }
+  String what = ui.getWord(1);
+  if (what.equalsIgnoreCase("gpio")) {
+    benchGpio();
+  } else if (what.equalsIgnoreCase("wire")) {
+    benchWire();
+  } else if (what.equalsIgnoreCase("level")) {
+    benchLevel();
+  } else if (what.equalsIgnoreCase("tls")) {
+    String url = ui.getWord(2);
+    benchTls(url.length() > 0 ? url : (String(config.server) + "?" TAT_GET_WL) + String(config.station));
+  } else if (what.equalsIgnoreCase("log")) {
+    String count = ui.getWord(2);
+    benchLog(count.length() > 0 ? (uint32_t)count.toInt() : 1000);
+  } else {
+    console.printf("Unrecognized bench \'%s\'.\n", what.c_str());
+  }
+}
+
+/**
+ * @brief The prof command handler. Run the sampling profiler, which notes where the CPU is, 
+ *        and how it got there, hz times a second. It works in either mode; in run mode it 
+ *        sees what the device spends its time on day to day. tools/profsym turns a dump into 
+ *        a flat profile and flame graph input.
+ * 
+ *        prof                      Whether it's sampling, how many samples it has and what 
+ *                                  taking them has cost
+ *        prof start [hz [depth]]   Start sampling hz times a second (default 1000), keeping 
+ *                                  up to depth calls (default 8) of each stack, adding to the 
+ *                                  samples already taken if depth is the same
+ *        prof stop                 Stop sampling, keeping the samples
+ *        prof dump                 Print the samples; see Profiler.h. uiTask() prints them a 
+ *                                  page at a time, as for "log dump"
+ *        prof clear                Stop sampling and free the samples' memory
+ */
+void onProf() {
+  String what = ui.getWord(1);
+  if (what.equalsIgnoreCase("start")) {
+    String hzWord = ui.getWord(2), depthWord = ui.getWord(3);
+    long hz = hzWord.length() > 0 ? hzWord.toInt() : PR_DEFAULT_HZ;
+    long depth = depthWord.length() > 0 ? depthWord.toInt() : PR_DEFAULT_DEPTH;
+    if (hz < PR_MIN_HZ || hz > PR_MAX_HZ || depth < 1 || depth > PR_MAX_DEPTH) {   // Before they're narrowed
+      console.printf("The rate is %u to %u Hz and the depth 1 to %u.\n", PR_MIN_HZ, PR_MAX_HZ, PR_MAX_DEPTH);
+      return;
+    }
+    if (!profiler.start((uint32_t)hz, (uint8_t)depth)) {
+      console.print(F("Couldn't start the profiler. There's no memory for the samples, or no timer.\n"));
+      return;
+    }
+    console.print(F("Profiler sampling.\n"));
+    return;
+  }
+  if (what.equalsIgnoreCase("stop")) {
+    profiler.stop();
+    console.print(F("Profiler stopped.\n"));
+    return;
+  }
+  if (what.equalsIgnoreCase("dump")) {
+    profiler.dumpBegin(console);
+    profDumping = true;
+    return;
+  }
+  if (what.equalsIgnoreCase("clear")) {
+    profiler.clear();
+    console.print(F("Profiler samples freed.\n"));
+    return;
+  }
+  if (what.length() > 0) {
+    console.printf("Unrecognized prof \'%s\'.\n", what.c_str());
+    return;
+  }
+  pr_stats_t stats = profiler.getStats();
+  console.printf("Profiler %s at %u Hz, %u deep: %u samples of %u stacks in %.1f s; %u didn't fit.\n", 
+    stats.running ? "sampling" : "stopped", stats.hz, stats.depth, stats.samples, stats.stacks, stats.millis / 1000.0, 
+    stats.dropped);
+  if (stats.samples > 0 && stats.millis > 0) {
+    console.printf("Sampling took %.0f cycles a sample (at most %u), %.2f%% of the CPU, not counting interrupt entry and exit.\n", 
+      (double)stats.cycles / stats.samples, stats.maxCycles, 
+      stats.cycles * 100.0 / ((double)stats.millis * 1000 * getCpuFrequencyMhz()));
+  }
+}
+#endif
+
+/**
+ * @brief The sched command handler. Print the scheduler's statistics for each task or, with 
+ *        "reset", zero them.
+ */
+void onSched() {
+  if (ui.getWord(1).equalsIgnoreCase("reset")) {
+    sched.resetStats();
+    console.print(F("Scheduler statistics reset.\n"));
+    return;
+  }
+  cs_stats_t stats;
+  console.print(F("Task      Period ms  Budget us  Runs       Late       Overruns   Max us\n"));
+  for (int8_t id = 0; sched.getStats(id, &stats); id++) {
+    console.printf("%-9s %-10u %-10u %-10u %-10u %-10u %u\n", stats.name, stats.periodMillis, stats.budgetMicros, 
+      stats.runs, stats.late, stats.overruns, stats.maxMicros);
+  }
+}
+
+/**
+ * @brief Start streaming the flash log's records out, oldest first, as CSV: their index, time 
+ *        (UTC), kind and what they say (see logKind_t). A full log is tens of thousands of 
+ *        records, too many to print in one go without holding up the ui task for seconds, so 
+ *        this just prints the heading; uiTask() prints the records a page at a time, with 
+ *        dumpLogPage(), until they're done. Commands typed meanwhile wait until then.
+ * 
+ * @param from  The index of the first record to print
+ */
+void dumpLog(uint32_t from) {
+  console.print(F("index,time,kind,a,b,c\n"));
+  logDumpBase = flashLog.firstSerial();
+  logDumpNext = logDumpBase + from;
+  logDumpEnd = logDumpBase + flashLog.size();
+  logDumpPrinted = 0;
+  logDumpLost = 0;
+  logDumpStartMillis = millis();
+  logDumping = true;
+}
+
+/**
+ * @brief Print the next page of the log dump dumpLog() started, and the summary once it's done.
+ *        The dump keeps its place by serial number, so if the log's oldest sector is recycled 
+ *        while it's under way, the records still get the indices they had when it started, and 
+ *        any that went before it got to them are reported as a gap rather than silently 
+ *        skipped.
+ */
+void dumpLogPage() {
+  static const char *kindName[logKinds] = {"start", "level", "obs", "tide", "fetch", "homing", "fault", "bench"};
+  fl_record_t recs[FL_PAGE_RECORDS];
+  char when[24];
+  uint32_t first = flashLog.firstSerial();
+  if ((int32_t)(first - logDumpNext) > 0) {
+    uint32_t gone = (int32_t)(first - logDumpEnd) > 0 ? logDumpEnd - logDumpNext : first - logDumpNext;
+    console.printf("[dumpLogPage] Records %u to %u were recycled before they could be dumped.\n", 
+      logDumpNext - logDumpBase, logDumpNext - logDumpBase + gone - 1);
+    logDumpLost += gone;
+    logDumpNext += gone;
+  }
+  uint32_t last = first + flashLog.size();
+  uint32_t end = (int32_t)(last - logDumpEnd) < 0 ? last : logDumpEnd;
+  if ((int32_t)(end - logDumpNext) > 0) {
+    uint32_t left = end - logDumpNext;
+    uint16_t got = flashLog.read(logDumpNext - first, recs, left < FL_PAGE_RECORDS ? left : FL_PAGE_RECORDS);
+    if (got == 0) {
+      console.printf("[dumpLogPage] Couldn't read record %u.\n", logDumpNext - logDumpBase);
+      end = logDumpNext;
+    }
+    for (uint16_t i = 0; i < got; i++) {
+      uint32_t index = logDumpNext - logDumpBase + i;
+      if (!FlashLog<EspFlash>::intact(recs[i])) {
+        console.printf("%u,,damaged,,,\n", index);
+        continue;
+      }
+      time_t t = recs[i].time;
+      strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%SZ", gmtime(&t));
+      console.printf("%u,%s,%s,%d,%d,%d\n", index, when, recs[i].kind < logKinds ? kindName[recs[i].kind] : "unknown", 
+        recs[i].a, recs[i].b, recs[i].c);
+    }
+    logDumpNext += got;
+    logDumpPrinted += got;
+  }
+  if ((int32_t)(end - logDumpNext) <= 0) {
+    console.printf("Dumped %u records in %lu ms.\n", logDumpPrinted, millis() - logDumpStartMillis);
+    if (logDumpLost > 0) {
+      console.printf("%u more were recycled before they could be.\n", logDumpLost);
+    }
+    logDumping = false;
+  }
+}
+
+/**
+ * @brief The log command handler. Report on the flash log, stream its records out or empty it.
+ * 
+ *        log           How many records it has and holds, what writing them has cost since 
+ *                      startup and, at the rate they're being written, how many days of 
+ *                      history it keeps and how long the flash will last
+ *        log dump [n]  The last n records (all of them by default) as CSV; see dumpLog()
+ *        log clear     Empty it
+ */
+void onLog() {
+  if (!flashLog.isValid()) {
+    console.print(F("There's no flash log.\n"));
+    return;
+  }
+  String what = ui.getWord(1);
+  if (what.equalsIgnoreCase("dump")) {
+    String count = ui.getWord(2);
+    uint32_t size = flashLog.size();
+    uint32_t n = count.length() > 0 ? (uint32_t)count.toInt() : size;
+    dumpLog(n < size ? size - n : 0);
+    return;
+  }
+  if (what.equalsIgnoreCase("clear")) {
+    console.print(flashLog.clear() ? F("Flash log emptied.\n") : F("Couldn't empty the flash log.\n"));
+    return;
+  }
+  if (what.length() > 0) {
+    console.printf("Unrecognized log \'%s\'.\n", what.c_str());
+    return;
+  }
+  fl_stats_t stats = flashLog.getStats();
+  console.printf("Flash log: %u records, holds at least %u in %u sectors; %u waiting to be written. %u times round so far.\n", 
+    stats.records, stats.capacity, stats.sectors, flashLog.buffered(), stats.cycles);
+  if (stats.writes > 0) {
+    console.printf("Since startup: %u records in %u writes, %.2f ms each (longest %.2f ms); %u erases, %.1f ms each "
+      "(longest %.1f ms); %u lost. Sustained: %.0f records/s.\n", stats.written, stats.writes, 
+      stats.writeMicros / 1000.0 / stats.writes, stats.maxWriteMicros / 1000.0, stats.erases, 
+      stats.erases == 0 ? 0.0 : stats.eraseMicros / 1000.0 / stats.erases, stats.maxEraseMicros / 1000.0, stats.dropped, 
+      stats.written * 1e6 / (stats.writeMicros + stats.eraseMicros));
+  }
+  fl_record_t oldest, newest;
+  if (stats.records > 1 && flashLog.read(0, &oldest) && flashLog.read(stats.records - 1, &newest) && 
+    FlashLog<EspFlash>::intact(oldest) && FlashLog<EspFlash>::intact(newest) && newest.time > oldest.time) {
+    double perDay = (stats.records - 1) * (double)SECONDS_PER_DAY / (newest.time - oldest.time);
+    double erasesPerYear = perDay * 365 / FL_SECTOR_RECORDS / stats.sectors;
+    console.printf("At %.0f records a day, it keeps %.0f days of history, and erases each sector %.1f times a year; "
+      "the flash is good for another %.0f years.\n", perDay, stats.capacity / perDay, erasesPerYear, 
+      (FL_RATED_ERASES - stats.cycles) / erasesPerYear);
+  }
+}
+
+/**
+ * @brief The tide command handler. Display information related to the next tide
+ */
+void onTide() {
+  tc_state_t clock = tc.getState();
+  tc_tide_t nextTide = clock.nextTide;
+  time_t t = time(nullptr);
+  console.printf("It is now %s UTC. ", toHhmmss(t).c_str());
+  if (nextTide.tideType == TC_UNAVAILABLE) {
+    console.print(" Next tide data is unavailable.\n");
+    return;
+  }
+  int32_t secToNextTide = static_cast<int32_t>(nextTide.time) - static_cast<int32_t>(t);
+  console.printf("The next tide (%s) is %s from now at %s.\n",
+    nextTide.tideType == HIGH ? "high" : "low", toHhmmss(secToNextTide).c_str(), toHhmmss(nextTide.time).c_str());
+  console.printf("Clock has taken %d of %d steps since the last tide%s.\n", 
+    clock.stepsTaken, clock.stepsNeeded, clock.paused ? " and is paused waiting for the next one" : "");
+}
+
+/**
+ * @brief The wl command handler. Display information about the current water level or,
+ *        in test mode, set the water level being displayed.
+ * 
+ */
+void onWl() {
+  String wlString = ui.getWord(1);
+  time_t t = time(nullptr);
+  if (wlString.length() == 0) {
+    wld_state_t display = wld.getState();
+    console.printf("It is now %s UTC. The water level currently displayed is %.2f feet MLLW.\n", 
+      toHhmmss(t).c_str(), display.level / 100.0);
+    if (!display.powerIsOn) {
+      console.print(F("The display is unpowered.\n"));
+    } else {
+      console.printf("The display is %s; stepper at %d heading for %d.\n", 
+        display.homed ? "homed" : "not homed", display.position, display.target);
+    }
+    if (config.useObs) {
+      console.printf("Observed offset from prediction: %+.2f feet (sigma %.2f); checking every %u minutes.\n",
+        wlBias.bias(t), wlBias.sigma(), wlBias.pollInterval() / 60);
+    }
+    return;
+  }    
+  if (opMode != test) {
+    console.print(F("Can only set the water level in test mode.\n"));
+    return;
+  }
+  int16_t wl;
+  if (!ttParseLevel(wlString.c_str(), &wl)) {
+    console.printf("\"%s\" isn't a water level in feet.\n", wlString.c_str());
+    return;
+  }
+  wld.setLevel(wl);
+  console.printf("Water level display set to %.2f\n", wl / 100.0);
+}
+
+/**
+ * @brief The config command handler. Set and display the available configuration 
+ *        variables.
+ */
+void onConfig() {
+  String subCmd = ui.getWord(1);
+  if (subCmd.equalsIgnoreCase("minLevel") || subCmd.equalsIgnoreCase("maxLevel")) {
+    float minL = config.minLevel;
+    float maxL = config.maxLevel;
+    if (subCmd.equalsIgnoreCase("minLevel")) {
+      minL = ui.getWord(2).toFloat();
+    } else {
+      maxL = ui.getWord(2).toFloat();
+    }
+    if (!wldLevelsOk(minL, maxL)) {
+      console.printf("Invalid %s \'%s\'. maxLevel must be above 0 and minLevel below maxLevel.\n",
+        subCmd.c_str(), ui.getWord(2).c_str());
+      return;
+    }
+    config.minLevel = minL;
+    config.maxLevel = maxL;
+    return;
+  }
+  if (subCmd.length() == 0) {
+    console.print(configToString(config));
+    return;
+  }
+  String rest = ui.getCommandLine();
+  rest = rest.substring(rest.indexOf(subCmd) + subCmd.length());
+  rest.trim();
+  if (subCmd.equalsIgnoreCase("ssid")) {
+    if (rest.length() >= sizeof(config.ssid)) {
+      console.printf("SSID value \'%s\' too long. Max length is %d.\n", rest.c_str(), sizeof(config.ssid) - 1);
+      return;
+    }
+    strcpy(config.ssid, rest.c_str());
+    return;
+  }
+  if (subCmd.equalsIgnoreCase("pw")) {
+    if (rest.length() >= sizeof(config.pw)) {
+      console.printf("Password value \'%s\' too long. Max length is %d.\n", rest.c_str(), sizeof(config.pw) - 1);
+      return;
+    }
+    strcpy(config.pw, rest.c_str());
+    return;
+  }
+  if (subCmd.equalsIgnoreCase("server")) {
+    if (rest.equalsIgnoreCase("noaa")) {
+      rest = TAT_SERVER_URL;
+    }
+    if (!rest.startsWith("http://") && !rest.startsWith("https://")) {
+      console.printf("Invalid server URL \'%s\'. Must start with http:// or https://.\n", rest.c_str());
+      return;
+    }
+    if (rest.length() >= sizeof(config.server)) {
+      console.printf("Server URL \'%s\' too long. Max length is %d.\n", rest.c_str(), sizeof(config.server) - 1);
+      return;
+    }
+    strcpy(config.server, rest.c_str());
+    return;
+  }
+  if (subCmd.equalsIgnoreCase("station")) {
+    if (rest.length() != 7 || rest.toInt() < 1000000) {
+      console.printf("Invalid station ID \'%s\'. Must be a 7-digit number.\n", rest.c_str());
+      return;
+    }
+    strcpy(config.station, rest.c_str());
+    wlBias.reset();
+    predFetch.clear();
+    hiloFetch.clear();
+    return;
+  }
+  if (subCmd.equalsIgnoreCase("face")) {
+    String faceType = ui.getWord(2);
+    if (faceType.equalsIgnoreCase("linear")) {
+      config.clockFace = tcLinear;
+    } else if (faceType.equalsIgnoreCase("nonlinear")) {
+      config.clockFace = tcNonlinear;
+    } else {
+      console.printf("Invalid face type. \"%s\". Must be \"linear\" or \"nonlinear\".\n",
+        faceType);
+    }
+    return;
+  }
+  if (subCmd.equalsIgnoreCase("obs")) {
+    String onOff = ui.getWord(2);
+    if (onOff.equalsIgnoreCase("on")) {
+      config.useObs = true;
+    } else if (onOff.equalsIgnoreCase("off")) {
+      config.useObs = false;
+      wlBias.reset();
+    } else {
+      console.printf("Invalid obs setting \"%s\". Must be \"on\" or \"off\".\n", onOff.c_str());
+    }
+    return;
+  }
+  if (subCmd.equalsIgnoreCase("motor")) {
+    String motorType = ui.getWord(2);
+    if (motorType.equalsIgnoreCase("one")) {
+      config.motor = tcOne;
+    } else if (motorType.equalsIgnoreCase("sixteen")) {
+      config.motor = tcSixteen;
+    } else {
+      console.printf("Invalid motor type. \"%s\". Must be \"one\" or \"sixteen\".\n",
+        motorType);
+    }
+    return;
+  }
+  console.printf("Unrecognized configuration variable \'%s\'.\n", subCmd.c_str());
+}
+
+/**
+ * @brief The save command handler. Save the current configuration in NVS
+ * 
+ */
+void onSave() {
+  if (putConfig(config)) {
+    console.print("Configuration saved.\n");
+  }
+}
+/**
+ * @brief The restart command handler. Cause a software reset, restarting 
+ *        things with the stored configuration.
  */
 void onRestart() {
+  flashLog.flush();
   ESP.restart();
 }
 
+/**
+ * @brief The rpc command handler. Switch the console over to the RPC protocol. See RpcLink.h 
+ *        for the protocol and the rpc methods below for what it can do.
+ */
+void onRpc() {
+  rpc.begin();
+}
+
+/**
+ * @brief The serial port's receive callback. In RPC mode, get the bytes that have arrived into 
+ *        the RpcLink's ring buffer while the loop task is busy with other things.
+ */
+#if ARDUINO_USB_CDC_ON_BOOT
+void onSerialRx(void *arg, esp_event_base_t base, int32_t id, void *data) {
+  rpc.intake();
+}
+#else
+void onSerialRx() {
+  rpc.intake();
+}
+#endif
+
+/**
+ * @brief The tide rpc method. The next tide and how the clock is doing.
+ */
+const char *rpcTide(JsonObjectConst params, JsonObject result) {
+  tc_state_t clock = tc.getState();
+  result["now"] = time(nullptr);
+  result["type"] = clock.nextTide.tideType == TC_UNAVAILABLE ? "unavailable" : clock.nextTide.tideType == HIGH ? "high" : "low";
+  result["time"] = clock.nextTide.time;
+  result["stepsTaken"] = clock.stepsTaken;
+  result["stepsNeeded"] = clock.stepsNeeded;
+  result["paused"] = clock.paused;
+  return nullptr;
+}
+
+/**
+ * @brief The wl rpc method. The displayed water level and how the display is doing.
+ */
+const char *rpcWl(JsonObjectConst params, JsonObject result) {
+  wld_state_t display = wld.getState();
+  time_t t = time(nullptr);
+  result["now"] = t;
+  result["level"] = display.level / 100.0;
+  result["position"] = display.position;
+  result["target"] = display.target;
+  result["homed"] = display.homed;
+  result["power"] = display.powerIsOn;
+  if (config.useObs) {
+    result["bias"] = wlBias.bias(t);
+    result["sigma"] = wlBias.sigma();
+  }
+  return nullptr;
+}
+
+/**
+ * @brief The wl.set rpc method. In test mode, set the displayed water level. {"level":feet}
+ */
+const char *rpcWlSet(JsonObjectConst params, JsonObject result) {
+  if (opMode != test) {
+    return "Only in test mode";
+  }
+  if (!params["level"].is<float>()) {
+    return "Need a level";
+  }
+  float level = params["level"].as<float>();
+  if (fabsf(level) > 300) {
+    return "Level out of range";
+  }
+  wld.setLevel((int16_t)lroundf(level * 100));
+  return nullptr;
+}
+
+/**
+ * @brief The mode rpc method. Optionally set the operating mode, {"mode":"run" | "test"}, and 
+ *        say what it is.
+ */
+const char *rpcMode(JsonObjectConst params, JsonObject result) {
+  const char *mode = params["mode"] | "";
+  if (strcmp(mode, "run") == 0) {
+    opMode = run;
+    sched.runNow(levelTaskId);
+  } else if (strcmp(mode, "test") == 0) {
+    opMode = test;
+    cancelFetch();
+    forgetResume();
+  } else if (mode[0] != '\0') {
+    return "Mode must be run or test";
+  }
+  result["mode"] = opMode == run ? "run" : opMode == test ? "test" : "notInit";
+  return nullptr;
+}
+
+#ifndef TAT_MINIMAL
+/**
+ * @brief The tick rpc method. In test mode, tick the clock. {"ticks":n, "secs":s}; secs 
+ *        defaults to 6. The result says how many ticks of the last request are still to go.
+ */
+const char *rpcTick(JsonObjectConst params, JsonObject result) {
+  if (opMode != test) {
+    return "Only in test mode";
+  }
+  if (!params["ticks"].isNull()) {
+    testTick = params["ticks"] | 0;
+    testNsecs = params["secs"] | 6;
+    if (testNsecs < 1) {
+      testNsecs = 6;
+    }
+    testTicksTaken = 0;
+  }
+  result["ticksLeft"] = testTick - testTicksTaken;
+  return nullptr;
+}
+#endif
+
+/**
+ * @brief The config rpc method. The current configuration, less the WiFi password.
+ */
+const char *rpcConfig(JsonObjectConst params, JsonObject result) {
+  result["ssid"] = config.ssid;
+  result["station"] = config.station;
+  result["minLevel"] = config.minLevel;
+  result["maxLevel"] = config.maxLevel;
+  result["face"] = config.clockFace == tcLinear ? "linear" : "nonlinear";
+  result["motor"] = config.motor == tcOne ? "one" : "sixteen";
+  result["pulseMillis"] = config.pulseMillis;
+  result["stepMillis"] = config.stepMillis;
+  result["obs"] = config.useObs;
+  result["server"] = config.server;
+  return nullptr;
+}
+
+/**
+ * @brief The config.set rpc method. Set any of the configuration variables named in params, 
+ *        which have the same names as in the config method's result, plus "pw". Either all of 
+ *        them are set or, if any is invalid, none are.
+ */
+const char *rpcConfigSet(JsonObjectConst params, JsonObject result) {
+  configData_t c = config;
+  if (!params["ssid"].isNull()) {
+    const char *ssid = params["ssid"] | "";
+    if (strlen(ssid) >= sizeof(c.ssid)) {
+      return "ssid too long";
+    }
+    strcpy(c.ssid, ssid);
+  }
+  if (!params["pw"].isNull()) {
+    const char *pw = params["pw"] | "";
+    if (strlen(pw) >= sizeof(c.pw)) {
+      return "pw too long";
+    }
+    strcpy(c.pw, pw);
+  }
+  if (!params["station"].isNull()) {
+    String station = params["station"] | "";
+    if (station.length() != 7 || station.toInt() < 1000000) {
+      return "station must be a 7-digit number";
+    }
+    strcpy(c.station, station.c_str());
+  }
+  if (!params["server"].isNull()) {
+    const char *server = params["server"] | "";
+    if (strncmp(server, "http://", 7) != 0 && strncmp(server, "https://", 8) != 0) {
+      return "server must start with http:// or https://";
+    }
+    if (strlen(server) >= sizeof(c.server)) {
+      return "server too long";
+    }
+    strcpy(c.server, server);
+  }
+  c.minLevel = params["minLevel"] | c.minLevel;
+  c.maxLevel = params["maxLevel"] | c.maxLevel;
+  if (!wldLevelsOk(c.minLevel, c.maxLevel)) {
+    return "maxLevel must be above 0 and minLevel below maxLevel";
+  }
+  if (!params["face"].isNull()) {
+    const char *face = params["face"] | "";
+    if (strcmp(face, "linear") != 0 && strcmp(face, "nonlinear") != 0) {
+      return "face must be linear or nonlinear";
+    }
+    c.clockFace = strcmp(face, "linear") == 0 ? tcLinear : tcNonlinear;
+  }
+  if (!params["motor"].isNull()) {
+    const char *motor = params["motor"] | "";
+    if (strcmp(motor, "one") != 0 && strcmp(motor, "sixteen") != 0) {
+      return "motor must be one or sixteen";
+    }
+    c.motor = strcmp(motor, "one") == 0 ? tcOne : tcSixteen;
+  }
+  c.useObs = params["obs"] | c.useObs;
+  if (strcmp(c.station, config.station) != 0 || !c.useObs) {
+    wlBias.reset();
+  }
+  if (strcmp(c.station, config.station) != 0) {
+    predFetch.clear();
+    hiloFetch.clear();
+  }
+  config = c;
+  return rpcConfig(params, result);
+}
+
+/**
+ * @brief The save rpc method. Save the current configuration in NVS.
+ */
+const char *rpcSave(JsonObjectConst params, JsonObject result) {
+  return putConfig(config) ? nullptr : "Couldn't save the configuration";
+}
+
+/**
+ * @brief The restart rpc method. Restart once the reply has been sent.
+ */
+const char *rpcRestart(JsonObjectConst params, JsonObject result) {
+  restartRequested = true;
+  return nullptr;
+}
+
+/**
+ * @brief The sched rpc method. The scheduler's per-task statistics; with {"reset":true}, zero 
+ *        them afterwards.
+ */
+const char *rpcSched(JsonObjectConst params, JsonObject result) {
+  JsonArray tasks = result.createNestedArray("tasks");
+  cs_stats_t stats;
+  for (int8_t id = 0; sched.getStats(id, &stats); id++) {
+    JsonObject task = tasks.createNestedObject();
+    task["name"] = stats.name;
+    task["period"] = stats.periodMillis;
+    task["budget"] = stats.budgetMicros;
+    task["runs"] = stats.runs;
+    task["late"] = stats.late;
+    task["overruns"] = stats.overruns;
+    task["maxMicros"] = stats.maxMicros;
+  }
+  if (params["reset"] | false) {
+    sched.resetStats();
+  }
+  return nullptr;
+}
+
+/**
+ * @brief The telemetry topics: the clock's state, the display's state, and the memory picture.
+ */
+void topicClock(JsonObject data) {
+  rpcTide(JsonObjectConst(), data);
+}
+void topicDisplay(JsonObject data) {
+  rpcWl(JsonObjectConst(), data);
+}
+void topicHeap(JsonObject data) {
+  data["free"] = ESP.getFreeHeap();
+  data["minFree"] = ESP.getMinFreeHeap();
+  data["maxAlloc"] = ESP.getMaxAllocHeap();
+}
+
+#ifndef TAT_MINIMAL
+/**
+ * @brief The test task. In test mode, take the steps needed for the tick command and the 
+ *        pulse-width tuner.
+ */
+void testTask() {
+  if (opMode != test) {
+    return;
+  }
+  static uint32_t stepsToTick = 0;
+  static unsigned long lastTickMillis = 0;
+  unsigned long curMillis = millis();
+  // Take a step towards taking testTeck ticks
+  if (testTick > testTicksTaken && curMillis - lastTickMillis >= testNsecs * 1000) {
+    if (tc.test()) {
+      stepsToTick++;
+    }
+    if (stepsToTick >= (config.motor == tcOne ? TC_ONE_STEPS_PER_TICK : TC_SIXTEEN_STEPS_PER_TICK)) {
+      stepsToTick = 0;
+      testTicksTaken++;
+      lastTickMillis = curMillis;
+    }
+    if (testTicksTaken >= testTick) {
+      testTick = 0;
+      testTicksTaken = 0;
+      console.print("Tick test complete.\n");
+    }
+  }
+  // Take a step in the current pulse-width tuning trial
+  if (tune.stepsLeft > 0 && tc.test()) {
+    tune.stepsLeft--;
+    if (tune.stepsLeft == 0) {
+      tune.awaitingVerdict = true;
+      console.print(F("Trial complete. Did the second hand make exactly one turn? (tune ok | tune bad)\n"));
+    }
+  }
+}
+#endif
+
+/**
+ * @brief The level task. In run mode, every TAT_LEVEL_CHECK_SECS, update the water level
+ *        display with the current (corrected) predicted water level. It's also when the 
+ *        tides the clock uses get fetched afresh, ahead of when they're needed, and when the 
+ *        day's predictions and the latest observation get fetched.
+ * 
+ *        A fetch is only started here; fetchTask() does it, a slice at a time, and runs this 
+ *        again when it's done. So a pass that needs several fetches takes them one at a time, 
+ *        with the clock and the display kept running in between.
+ * 
+ *        In any mode, it writes the flash log's records that have waited TAT_LOG_FLUSH_SECS.
+ */
+void levelTask() {
+  time_t curTime = time(nullptr);
+  if (flashLog.buffered() > 0 && curTime - flashLog.bufferedSince() >= TAT_LOG_FLUSH_SECS) {
+    flashLog.flush();
+  }
+  if (opMode != run || fetchFor != fetchNone) {
+    return;
+  }
+  fetchSecs = curTime;
+  if (tidesNeeded || hiloFetch.refreshDue(curTime)) {
+    tidesNeeded = false;
+    startFetch(fetchHilo, usingProxy());
+    return;
+  }
+  int16_t tableLevel;
+  fetchDay = tideTableUsable() && tideTable.levelAt(curTime, &tableLevel) ? 0 : 
+    predFetch.due(curTime);                           // Today's if they're missing, or tomorrow's, ahead of time
+  if (fetchDay != 0) {
+    startFetch(fetchPred, usingProxy());
+    return;
+  }
+  int32_t waterlevel = getPredWl();
+  if (waterlevel != LEVEL_UNAVAILABLE) {
+    // Correct the prediction for what the tide gauge is actually seeing.
+    if (config.useObs && wlBias.pollDue(curTime)) {
+      startFetch(fetchObs, false);
+      return;
+    }
+    int32_t predicted = waterlevel;
+    if (config.useObs) {
+      waterlevel += lroundf(wlBias.bias(curTime) * 100);
+    }
+    wld.setLevel((int16_t)waterlevel);
+    logEvent(logLevel, (int16_t)waterlevel, predicted);
+  }
+  fetchesDone();
+  saveResume();
+}
+
+/**
+ * @brief The fetch task. Do the next slice of the fetch levelTask() started, as often as 
+ *        possible while there is one, and deal with what it got when it's done.
+ */
+void fetchTask() {
+  fetcher.run(millis());
+  sched.setPeriod(fetchTaskId, fetcher.busy() ? 0 : TAT_FETCH_TASK_MILLIS);
+  if (!fetcher.busy() && fetchFor != fetchNone) {
+    fetchFinished();
+  }
+}
+
+/**
+ * @brief The clock task. In run mode, let the tide clock do its thing, saving the working set 
+ *        whenever that changes which tide it's heading for, and the clock's part of it whenever 
+ *        it moves the hand.
+ */
+void clockTask() {
+  if (opMode != run) {
+    return;
+  }
+  tc.run(time(nullptr));
+  tc_state_t clock = tc.getState();
+  if (clock.nextTide.time != resumeData.clock.nextTide.time) {
+    logEvent(logTide, clock.nextTide.tideType, clock.nextTide.time);
+  }
+  if (clock.nextTide.time != resumeData.clock.nextTide.time || clock.paused != resumeData.clock.paused || 
+    clock.totalSteps - resumeData.clock.totalSteps >= TAT_RESUME_SAVE_STEPS) {
+    saveResume();
+  } else if (clock.totalSteps != resumeClock.clock.totalSteps) {
+    saveResumeClock(clock);
+  }
+}
+
+/**
+ * @brief The display task. Let the water level display do its thing, as often as possible 
+ *        while it's moving, saving the working set whenever it comes to rest or sets off, and 
+ *        logging each homing.
+ */
+void displayTask() {
+  wld.run();
+  sched.setPeriod(displayTaskId, wld.isMoving() ? 0 : TAT_DISPLAY_TASK_MILLIS);
+  if (stillDisplayPos() != resumeData.displayPos) {
+    saveResume();
+  }
+  wld_state_t display = wld.getState();
+  if (display.homings != homingsLogged) {
+    homingsLogged = display.homings;
+    logEvent(logHoming, display.homed, display.homingMillis, display.position);
+  }
+}
+
+/**
+ * @brief The ui task. Let the ui do its thing or, while a "log dump" or "prof dump" is under 
+ *        way, print the next page of it.
+ */
+void uiTask() {
+  if (rpc.isActive()) {
+    rpc.run();
+    if (restartRequested) {
+      Serial.flush();
+      flashLog.flush();
+      ESP.restart();
+    }
+    return;
+  }
+  if (logDumping) {
+    dumpLogPage();
+    return;
+  }
+#ifndef TAT_MINIMAL
+  if (profDumping) {
+    profDumping = profiler.dumpPage(console);
+    return;
+  }
+#endif
+  ui.run();
+}
+
+/**
+ * @brief The metrics task. Serve the metrics a slice at a time, as often as possible while 
+ *        there's a scrape under way.
+ */
+void metricsTask() {
+  metricsHttp.run(millis());
+  sched.setPeriod(metricsTaskId, metricsHttp.busy() ? 0 : TAT_METRICS_TASK_MILLIS);
+}
+
+/**
+ * @brief WiFi event handler. Keep track of how long the radio's been connected. This runs in 
+ *        the Arduino event task, so it leaves the metrics alone -- collectMetrics() counts the 
+ *        time it notes in mRadioSeconds.
+ */
+void onWiFiEvent(arduino_event_id_t event) {
+  portENTER_CRITICAL(&radioMux);
+  if (event == ARDUINO_EVENT_WIFI_STA_CONNECTED && wifiUpMillis == 0) {
+    wifiUpMillis = millis() | 1;
+  } else if (event == ARDUINO_EVENT_WIFI_STA_DISCONNECTED && wifiUpMillis != 0) {
+    radioMillisUncounted += millis() - wifiUpMillis;
+    wifiUpMillis = 0;
+  }
+  portEXIT_CRITICAL(&radioMux);
+}
+
+/**
+ * @brief The metrics collector. Bring the metrics that are kept elsewhere up to date just 
+ *        before they're rendered for a scrape.
+ */
+void collectMetrics() {
+  static uint32_t homingsSeen = 0;
+  metrics.set(mHeapFree, ESP.getFreeHeap());
+  metrics.set(mHeapMinFree, ESP.getMinFreeHeap());
+  metrics.set(mHeapMaxAlloc, ESP.getMaxAllocHeap());
+  metrics.set(mTlsHeapPeak, tlsHeapPeak);
+  tc_state_t clock = tc.getState();
+  metrics.set(mClockSteps, clock.totalSteps);
+  metrics.set(mClockCatchUps, clock.catchUps);
+  wld_state_t display = wld.getState();
+  if (display.homings != homingsSeen) {
+    homingsSeen = display.homings;
+    metrics.observe(mDisplayHomingSeconds, display.homingMillis / 1000.0);
+  }
+  metrics.set(mDisplayHomings, display.homings);
+  portENTER_CRITICAL(&radioMux);
+  uint32_t radioMillis = radioMillisUncounted;
+  radioMillisUncounted = 0;
+  if (wifiUpMillis != 0) {
+    unsigned long curMillis = millis() | 1;
+    radioMillis += curMillis - wifiUpMillis;
+    wifiUpMillis = curMillis;
+  }
+  portEXIT_CRITICAL(&radioMux);
+  metrics.inc(mRadioSeconds, radioMillis / 1000.0);
+  metrics.set(mUptimeSeconds, millis() / 1000.0);
+  cs_stats_t stats;
+  for (int8_t id = 0; mTaskBase != MT_NO_METRIC && id < metricTasks && sched.getStats(id, &stats); id++) {
+    metrics.set(mTaskBase + id, stats.runs);
+    metrics.set(mTaskBase + metricTasks + id, stats.late);
+    metrics.set(mTaskBase + 2 * metricTasks + id, stats.overruns);
+    metrics.set(mTaskBase + 3 * metricTasks + id, stats.maxMicros / 1000000.0);
+  }
+}
+
+/**
+ * @brief Register the metrics. Call after the scheduler's tasks have been added. The metrics 
+ *        for each task are grouped by metric name so each name gets a single HELP and TYPE.
+ */
+void setupMetrics() {
+  static char taskLabels[CS_MAX_TASKS][24];
+  mFetchSeconds = metrics.add("tat_fetch_seconds", "Time taken by fetches from the tide data server.", mtSummary);
+  mFetchFailures = metrics.add("tat_fetch_failures_total", "Fetches from the tide data server that failed.", mtCounter);
+  mTlsHandshakes = metrics.add("tat_tls_handshakes_total", "TLS handshakes done.", mtCounter);
+  mTlsHeapPeak = metrics.add("tat_tls_heap_peak_bytes", "The most memory mbedTLS has had allocated at once since startup.", mtGauge);
+  mHeapFree = metrics.add("tat_heap_free_bytes", "Free heap.", mtGauge);
+  mHeapMinFree = metrics.add("tat_heap_min_free_bytes", "Low water mark of the free heap since startup.", mtGauge);
+  mHeapMaxAlloc = metrics.add("tat_heap_max_alloc_bytes", "Largest block that can be allocated.", mtGauge);
+  mClockSteps = metrics.add("tat_clock_steps_total", "Steps taken by the tide clock.", mtCounter);
+  mClockCatchUps = metrics.add("tat_clock_catch_ups_total", "Times the tide clock has had to take quick steps to catch up.", mtCounter);
+  mDisplayHomings = metrics.add("tat_display_homings_total", "Times the water level display has been homed.", mtCounter);
+  mDisplayHomingSeconds = metrics.add("tat_display_homing_seconds", "Time taken to home the water level display.", mtSummary);
+  mRadioSeconds = metrics.add("tat_radio_on_seconds_total", "Time the WiFi has been connected.", mtCounter);
+  mUptimeSeconds = metrics.add("tat_uptime_seconds", "Time since startup.", mtGauge);
+  static const char *names[TASK_METRICS] = {"tat_task_runs_total", "tat_task_late_total", "tat_task_overruns_total", "tat_task_max_run_seconds"};
+  static const char *helps[TASK_METRICS] = {"Times each task has run.", "Times each task started after its deadline.", 
+    "Times each task ran longer than its budget.", "Longest each task has taken to run."};
+  static const mt_type_t types[TASK_METRICS] = {mtCounter, mtCounter, mtCounter, mtGauge};
+  cs_stats_t stats;
+  metricTasks = 0;
+  while (sched.getStats(metricTasks, &stats)) {
+    snprintf(taskLabels[metricTasks], sizeof(taskLabels[metricTasks]), "task=\"%s\"", stats.name);
+    metricTasks++;
+  }
+  int8_t mId = MT_NO_METRIC;
+  for (uint8_t m = 0; m < TASK_METRICS; m++) {
+    for (int8_t id = 0; id < metricTasks; id++) {
+      mId = metrics.add(names[m], helps[m], types[m], taskLabels[id]);
+      if (m == 0 && id == 0) {
+        mTaskBase = mId;
+      }
+    }
+  }
+  if (mId == MT_NO_METRIC || !metrics.attachCollector(collectMetrics)) {
+    mTaskBase = MT_NO_METRIC;
+    console.print(F("[setupMetrics] Need more metrics space.\n"));
+  }
+  WiFi.onEvent(onWiFiEvent);
+}
+
 /**
  * @brief Arduino setup function. Execute once upon startup or reset.
  */
 void setup() {
+  bool resuming = resumeSaved();                      // First, so that a reset costs milliseconds, not minutes
+  mbedtls_platform_set_calloc_free(tlsCalloc, tlsFree); // Before anything uses mbedTLS
+  fetchLink.setCACertBundle(tatCaBundle);
+  fetcher.setKeep(TAT_FETCH_KEEP_MILLIS);
   Serial.begin(9600);
+  tc.setConsole(console);                             // Their messages too become log notifications in RPC mode
+  wld.setConsole(console);
   pinMode(LED_BUILTIN, OUTPUT);
   unsigned long startMillis = millis();
-  unsigned long curMillis;
-  do {
+  while (!resuming && !Serial && millis() - startMillis < MAX_SERIAL_READY_MILLIS) {
     blinkLED();
-    curMillis = millis();
-  } while (!Serial && curMillis - startMillis < MAX_SERIAL_READY_MILLIS);
-  Serial.println(BANNER);
+  }
+  console.println(BANNER);
 
   // Attach the handlers for the ui
   ui.attachDefaultCmdHandler(onCmdUnrecognized);
@@ -768,81 +2670,133 @@ void setup() {
     ui.attachCmdHandler("config", onConfig) &&
     ui.attachCmdHandler("save", onSave) &&
     ui.attachCmdHandler("restart", onRestart) &&
-    ui.attachCmdHandler("tick", onTick))) {
-    Serial.print(F("[setup] Need more command space.\n"));
+#ifndef TAT_MINIMAL
+    ui.attachCmdHandler("tick", onTick) &&
+    ui.attachCmdHandler("tune", onTune) &&
+    ui.attachCmdHandler("bench", onBench) &&
+    ui.attachCmdHandler("prof", onProf) &&
+#endif
+    ui.attachCmdHandler("sched", onSched) &&
+    ui.attachCmdHandler("log", onLog) &&
+    ui.attachCmdHandler("rpc", onRpc))) {
+    console.print(F("[setup] Need more command space.\n"));
   }
 
+  // Attach the methods and topics for RPC mode and arrange to be told when bytes arrive
+  if (!(
+    rpc.attachMethod("tide", rpcTide) &&
+    rpc.attachMethod("wl", rpcWl) &&
+    rpc.attachMethod("wl.set", rpcWlSet) &&
+    rpc.attachMethod("mode", rpcMode) &&
+#ifndef TAT_MINIMAL
+    rpc.attachMethod("tick", rpcTick) &&
+#endif
+    rpc.attachMethod("config", rpcConfig) &&
+    rpc.attachMethod("config.set", rpcConfigSet) &&
+    rpc.attachMethod("save", rpcSave) &&
+    rpc.attachMethod("restart", rpcRestart) &&
+    rpc.attachMethod("sched", rpcSched) &&
+    rpc.attachTopic("clock", topicClock) &&
+    rpc.attachTopic("display", topicDisplay) &&
+    rpc.attachTopic("heap", topicHeap))) {
+    console.print(F("[setup] Need more rpc space.\n"));
+  }
+#if ARDUINO_USB_CDC_ON_BOOT
+  Serial.onEvent(ARDUINO_USB_CDC_RX_EVENT, onSerialRx);
+#else
+  Serial.onReceive(onSerialRx);
+#endif
+
+  // Set up the tasks
+  if (!(
+    sched.addTask("clock", clockTask, TAT_CLOCK_TASK_MILLIS, TAT_CLOCK_TASK_BUDGET) != CS_NO_TASK &&
+    (displayTaskId = sched.addTask("display", displayTask, TAT_DISPLAY_TASK_MILLIS, TAT_DISPLAY_TASK_BUDGET)) != CS_NO_TASK &&
+    (levelTaskId = sched.addTask("level", levelTask, TAT_LEVEL_CHECK_SECS * 1000, TAT_LEVEL_TASK_BUDGET)) != CS_NO_TASK &&
+    (fetchTaskId = sched.addTask("fetch", fetchTask, TAT_FETCH_TASK_MILLIS, TAT_FETCH_TASK_BUDGET)) != CS_NO_TASK &&
+    sched.addTask("ui", uiTask, TAT_UI_TASK_MILLIS, TAT_UI_TASK_BUDGET) != CS_NO_TASK &&
+#ifndef TAT_MINIMAL
+    sched.addTask("test", testTask, TAT_TEST_TASK_MILLIS, TAT_TEST_TASK_BUDGET) != CS_NO_TASK &&
+#endif
+    (TAT_METRICS_PORT == 0 ||
+      (metricsTaskId = sched.addTask("metrics", metricsTask, TAT_METRICS_TASK_MILLIS, TAT_METRICS_TASK_BUDGET)) != CS_NO_TASK))) {
+    console.print(F("[setup] Need more task space.\n"));
+  }
+  setupMetrics();
+
   // Try to get things going
   opMode = notInit;
+  mapTideTable();
+  if (!logFlash.begin(FL_PARTITION_LABEL, FL_PARTITION_SUBTYPE) || !flashLog.begin()) {
+    console.print("[setup] There's no working flash log partition. Not keeping a history.\n");
+  }
   if (getConfig()) {
-    if(connectWiFi(config.ssid, config.pw)) {
-      if(setClock()) {
-        opMode = run;
+    if (resuming && !resumeFits()) {
+      console.print("The configuration changed since the working set was saved. Starting from scratch.\n");
+      predFetch.clear();
+      hiloFetch.clear();
+      wlBias = WlBias();
+      resuming = false;
+    }
+    bool started = resuming;
+    if (resuming) {
+      WiFi.mode(WIFI_STA);                            // We have what we need to run; WiFi and NTP come up in the background
+      WiFi.begin(config.ssid, config.pw);
+      configTzTime(TAT_POSIX_TZ, TAT_NTP_SERVER);
+      opMode = run;
+    } else if ((started = connectWiFi(config.ssid, config.pw)) && setClock()) {
+      opMode = run;
+    }
+    if (started) {
+      if (TAT_METRICS_PORT != 0) {
+        metricsServer.begin();
+        console.printf("Serving metrics at http://%s:%d/metrics\n", WiFi.localIP().toString().c_str(), TAT_METRICS_PORT);
       }
       wld.begin(config.minLevel, config.maxLevel);
       tc.begin(getNextTide, config.clockFace, config.motor);
+      tc.setTiming(config.pulseMillis, config.stepMillis);
+      uint64_t mac = ESP.getEfuseMac();               // Spread this device's fetches out from the rest of the fleet's
+      uint32_t fetchSeed = (uint32_t)mac ^ (uint32_t)(mac >> 32);
+      predFetch.begin(fetchSeed);
+      hiloFetch.begin(fetchSeed);
+      tc.setJitter(fetchSeed);
+      if (resuming) {
+        tc.resume(resumeData.clock);
+        if (resumeData.displayPos != RESUME_NO_POS) {
+          wld.resume(resumeData.displayPos);
+        }
+      }
     }
   }
 
-  // Say how that worked out.
-  if (opMode == run) {
-    Serial.print("All set to run normally. Just need NOAA's cooperation.\n");
+  // Say how that worked out, in the log too.
+  esp_reset_reason_t why = esp_reset_reason();
+  if (why == ESP_RST_PANIC || why == ESP_RST_INT_WDT || why == ESP_RST_TASK_WDT || why == ESP_RST_WDT || why == ESP_RST_BROWNOUT) {
+    logEvent(logFault, why, resumeData.magic == TAT_RESUME_MAGIC ? resumeData.savedAt : 0);
+  }
+  logEvent(logStart, why, resuming, opMode);
+  if (resuming) {
+    console.printf("Resumed from the working set saved %ld seconds ago (reset reason %d).\n", 
+      (long)(time(nullptr) - resumeData.savedAt), (int)esp_reset_reason());
+  } else if (opMode == run) {
+    console.print("All set to run normally. Just need NOAA's cooperation.\n");
   } else {
-    Serial.print("Unable to start normally. Hopefully the reason is obvious.\n");
+    console.print("Unable to start normally. Hopefully the reason is obvious.\n");
   }
-  Serial.print(F("Type h or help for a list of commands.\n"));
+  console.print(F("Type h or help for a list of commands.\n"));
 }
 
 /**
- * @brief Arduino loop() function. Execute repeatedly after setup() completes.
+ * @brief Arduino loop() function. Execute repeatedly after setup() completes. Run whatever 
+ *        tasks are due and then idle until the next one is.
  */
 void loop() {
-  static time_t lastWlTime = 0;
-  time_t curTime = time(nullptr);
-  uint32_t curGmToD = timeToTimeOfDayUTC(curTime);
-
-  // Deal with test mode
-  if (opMode == test) {
-    static uint32_t stepsToTick = 0;
-    static unsigned long lastTickMillis = 0;
-    unsigned long curMillis = millis();
-    // Take a step towards taking testTeck ticks
-    if (testTick > testTicksTaken && curMillis - lastTickMillis >= testNsecs * 1000) {
-      if (tc.test()) {
-        stepsToTick++;
-      }
-      if (stepsToTick >= (config.motor == tcOne ? TC_ONE_STEPS_PER_TICK : TC_SIXTEEN_STEPS_PER_TICK)) {
-        stepsToTick = 0;
-        testTicksTaken++;
-        lastTickMillis = curMillis;
-      }
-      if (testTicksTaken >= testTick) {
-        testTick = 0;
-        testTicksTaken = 0;
-        Serial.print("Tick test complete.\n");
-      }
-    }
-  // Otherwise deal with run and not initialized modes
-  } else {
-    if (opMode != notInit) {
-
-      // If we're updating the water level display and enough time has passed, do the update
-      if (curTime - lastWlTime >= TAT_LEVEL_CHECK_SECS) {
-        float waterlevel = getPredWl();
-        lastWlTime = curTime;
-        if (waterlevel != LEVEL_UNAVAILABLE) {
-          wld.setLevel(waterlevel);
-        }
-      }
+  uint32_t idleMillis = sched.run();
 
-      // Let the tide clock do its thing
-      tc.run(curTime);
-    }
+  // On battery, there's nothing else to do until the clock's next tick, so sleep till then
+  if (opMode == run && !wld.hasPower() && tc.caughtUp() && !fetcher.busy() && sleepUntilNextTick(time(nullptr))) {
+    return;
   }
-
-  // Let the water level display do its thing
-  wld.run();
-
-  // Let the ui do its thing
-  ui.run();
-}
\ No newline at end of file
+  if (idleMillis > 0) {
+    delay(idleMillis);
+  }
+}
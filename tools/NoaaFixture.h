@@ -0,0 +1,279 @@
+/****
+ *
+ * NoaaFixture.h
+ * Shared code for the Time and Tides host tools.
+ * 
+ * Reading saved NOAA Tides and Currents api responses ("fixtures") and turning them into the 
+ * firmware's tide table format (see lib/TideData/TideTable.h). The responses are the ones the 
+ * firmware asks for -- product=predictions at the default six-minute interval and at 
+ * interval=hilo, with time_zone=gmt -- saved to files as-is, e.g. with curl.
+ * 
+ * Only the small part of JSON these responses use is understood: an array named "predictions" of 
+ * flat objects with string-valued members "t", "v" and (for hilo) "type".
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ * 
+ ****/
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include "TideTable.h"
+
+struct fx_sample_t {                            // A prediction from a fixture
+  time_t time;                                  //  When (POSIX time)
+  int16_t level;                                //  Water level, hundredths of a foot MLLW
+  int8_t type;                                  //  -1 for a six-minute level, else TT_TYPE_HIGH or TT_TYPE_LOW
+};
+
+/**
+ * @brief Convert "yyyy-mm-dd hh:mm" (UTC) to POSIX time; -1 if it's malformed
+ */
+inline time_t fxParseTime(const std::string &s) {
+  tm t = {};
+  if (sscanf(s.c_str(), "%d-%d-%d %d:%d", &t.tm_year, &t.tm_mon, &t.tm_mday, &t.tm_hour, &t.tm_min) != 5) {
+    return -1;
+  }
+  t.tm_year -= 1900;
+  t.tm_mon -= 1;
+  return timegm(&t);
+}
+
+/**
+ * @brief Get the string value of member name in the flat JSON object obj; "" if it's not there
+ */
+inline std::string fxMember(const std::string &obj, const char *name) {
+  std::string key = std::string("\"") + name + "\"";
+  size_t p = obj.find(key);
+  if (p == std::string::npos) {
+    return "";
+  }
+  p = obj.find(':', p + key.size());
+  if (p == std::string::npos) {
+    return "";
+  }
+  p = obj.find('"', p);
+  if (p == std::string::npos) {
+    return "";
+  }
+  size_t e = obj.find('"', p + 1);
+  return e == std::string::npos ? "" : obj.substr(p + 1, e - p - 1);
+}
+
+/**
+ * @brief Parse the predictions in a NOAA predictions response
+ * 
+ * @param json    The response
+ * @param out     Where to append the predictions
+ * @param err     Where to put a description of what went wrong
+ * @return true   Parsed okay
+ * @return false  Didn't; see err
+ */
+inline bool fxParse(const std::string &json, std::vector<fx_sample_t> &out, std::string &err) {
+  size_t p = json.find("\"predictions\"");
+  if (p == std::string::npos) {
+    err = "no \"predictions\" array";
+    return false;
+  }
+  p = json.find('[', p);
+  size_t end = json.find(']', p);
+  if (p == std::string::npos || end == std::string::npos) {
+    err = "malformed \"predictions\" array";
+    return false;
+  }
+  while ((p = json.find('{', p)) != std::string::npos && p < end) {
+    size_t e = json.find('}', p);
+    if (e == std::string::npos) {
+      err = "unterminated prediction";
+      return false;
+    }
+    std::string obj = json.substr(p, e - p + 1);
+    fx_sample_t s;
+    s.time = fxParseTime(fxMember(obj, "t"));
+    std::string v = fxMember(obj, "v");
+    if (s.time < 0 || v.empty()) {
+      err = "bad prediction " + obj;
+      return false;
+    }
+    if (!ttParseLevel(v.c_str(), &s.level)) {
+      err = "bad or out of range level " + obj;
+      return false;
+    }
+    std::string type = fxMember(obj, "type");
+    s.type = type.empty() ? -1 : type[0] == 'H' ? TT_TYPE_HIGH : TT_TYPE_LOW;
+    out.push_back(s);
+    p = e + 1;
+  }
+  return true;
+}
+
+/**
+ * @brief Check the predictions from one response the way the firmware checks what it fetches:
+ *        there have to be some, in time order, all of one kind. Six-minute levels have to be
+ *        evenly spaced and come in whole days, as parsePredictions() wants a day's worth
+ *        (midnight to midnight, both included) -- a response for several days may leave off
+ *        the last midnight. Hi/lo events have to alternate high and low, as getNextTide()
+ *        takes them to.
+ *
+ * @param response  The predictions from the response, as fxParse() gave them
+ * @param err       Where to put a description of what's wrong
+ * @return true     They check out
+ * @return false    They don't; see err
+ */
+inline bool fxCheck(const std::vector<fx_sample_t> &response, std::string &err) {
+  if (response.empty()) {
+    err = "no predictions";
+    return false;
+  }
+  bool levels = response[0].type < 0;
+  for (size_t i = 1; i < response.size(); i++) {
+    if ((response[i].type < 0) != levels) {
+      err = "mixes six-minute levels and hi/lo events";
+      return false;
+    }
+    if (response[i].time <= response[i - 1].time) {
+      err = "out of order at " + std::to_string((long long)response[i].time);
+      return false;
+    }
+    if (!levels && response[i].type == response[i - 1].type) {
+      err = "two " + std::string(response[i].type == TT_TYPE_HIGH ? "highs" : "lows") + " in a row at " +
+        std::to_string((long long)response[i].time);
+      return false;
+    }
+  }
+  if (!levels) {
+    return true;
+  }
+  if (response.size() < 2) {
+    err = "only one level";
+    return false;
+  }
+  time_t interval = response[1].time - response[0].time;
+  for (size_t i = 2; i < response.size(); i++) {
+    if (response[i].time - response[i - 1].time != interval) {
+      err = "levels not evenly spaced at " + std::to_string((long long)response[i].time);
+      return false;
+    }
+  }
+  size_t perDay = TT_SECONDS_PER_DAY / interval;
+  if (TT_SECONDS_PER_DAY % interval != 0 || response.size() < perDay || response.size() % perDay > 1) {
+    err = std::to_string(response.size()) + " levels " + std::to_string((long long)interval) +
+      " seconds apart isn't a whole number of days";
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Read a whole file into a string
+ */
+inline bool fxReadFile(const std::string &path, std::string &contents) {
+  std::ifstream f(path, std::ios::binary);
+  if (!f) {
+    return false;
+  }
+  std::stringstream ss;
+  ss << f.rdbuf();
+  contents = ss.str();
+  return true;
+}
+
+/**
+ * @brief Sort and merge the predictions, separating six-minute levels from hi/lo events and 
+ *        checking them the way the firmware does: the levels have to be evenly spaced with no 
+ *        gaps (overlapping responses have to agree) and there have to be some of each.
+ * 
+ * @param in        The predictions from all the fixtures for a station
+ * @param levels    Where to put the levels
+ * @param events    Where to put the events
+ * @param err       Where to put a description of what went wrong
+ * @return true     All good
+ * @return false    Not; see err
+ */
+inline bool fxMerge(std::vector<fx_sample_t> in, std::vector<fx_sample_t> &levels, std::vector<fx_sample_t> &events, std::string &err) {
+  std::stable_sort(in.begin(), in.end(), [](const fx_sample_t &a, const fx_sample_t &b) { return a.time < b.time; });
+  for (const fx_sample_t &s : in) {
+    std::vector<fx_sample_t> &v = s.type < 0 ? levels : events;
+    if (!v.empty() && v.back().time == s.time) {
+      if (v.back().level != s.level || v.back().type != s.type) {
+        err = "fixtures disagree at " + std::to_string((long long)s.time);
+        return false;
+      }
+      continue;
+    }
+    v.push_back(s);
+  }
+  if (levels.size() < 2 || events.empty()) {
+    err = "need both six-minute levels and hi/lo events";
+    return false;
+  }
+  time_t interval = levels[1].time - levels[0].time;
+  for (size_t i = 1; i < levels.size(); i++) {
+    if (levels[i].time - levels[i - 1].time != interval) {
+      err = "levels not evenly spaced at " + std::to_string((long long)levels[i].time);
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Build a tide table from merged levels and events
+ * 
+ * @param station   The 7-digit NOAA station ID
+ * @param levels    The levels, as produced by fxMerge()
+ * @param events    The events, as produced by fxMerge()
+ * @return std::vector<uint8_t> The table
+ */
+inline std::vector<uint8_t> fxBuildTable(const char *station, const std::vector<fx_sample_t> &levels, const std::vector<fx_sample_t> &events) {
+  tt_header_t h = {};
+  h.magic = TT_MAGIC;
+  h.version = TT_VERSION;
+  h.headerSize = sizeof(tt_header_t);
+  strncpy(h.station, station, sizeof(h.station) - 1);
+  h.firstLevelTime = (uint32_t)levels[0].time;
+  h.levelInterval = (uint32_t)(levels[1].time - levels[0].time);
+  h.nLevels = (uint32_t)levels.size();
+  h.levelsOffset = sizeof(tt_header_t);
+  h.nEvents = (uint32_t)events.size();
+  h.eventsOffset = (h.levelsOffset + h.nLevels * sizeof(int16_t) + 3) & ~3U;
+  h.firstDayTime = (uint32_t)(std::min(levels[0].time, events[0].time) / TT_SECONDS_PER_DAY * TT_SECONDS_PER_DAY);
+  time_t last = std::max(levels.back().time, events.back().time);
+  h.nDays = (uint32_t)((last - h.firstDayTime) / TT_SECONDS_PER_DAY + 1);
+  h.dayIndexOffset = h.eventsOffset + h.nEvents * sizeof(tt_event_t);
+  h.size = h.dayIndexOffset + h.nDays * sizeof(uint32_t);
+
+  std::vector<uint8_t> table(h.size, 0);
+  int16_t *l = reinterpret_cast<int16_t *>(&table[h.levelsOffset]);
+  for (size_t i = 0; i < levels.size(); i++) {
+    l[i] = levels[i].level;
+  }
+  tt_event_t *e = reinterpret_cast<tt_event_t *>(&table[h.eventsOffset]);
+  for (size_t i = 0; i < events.size(); i++) {
+    e[i].time = (uint32_t)events[i].time;
+    e[i].level = events[i].level;
+    e[i].type = (uint8_t)events[i].type;
+  }
+  uint32_t *d = reinterpret_cast<uint32_t *>(&table[h.dayIndexOffset]);
+  size_t ix = 0;
+  for (uint32_t day = 0; day < h.nDays; day++) {
+    time_t midnight = (time_t)h.firstDayTime + (time_t)day * TT_SECONDS_PER_DAY;
+    while (ix < events.size() && events[ix].time < midnight) {
+      ix++;
+    }
+    d[day] = (uint32_t)ix;
+  }
+  h.crc = ttCrc32(&table[sizeof(tt_header_t)], h.size - sizeof(tt_header_t));
+  memcpy(&table[0], &h, sizeof(h));
+  return table;
+}
@@ -0,0 +1,138 @@
+/****
+ *
+ * WorkPool.h
+ * Shared code for the Time and Tides host tools.
+ *
+ * A WorkPool runs a batch of independent jobs on a fixed set of threads, for tools that do the
+ * same thing for many stations. Something like
+ *
+ *   WorkPool pool(std::thread::hardware_concurrency());
+ *   pool.run(stations.size(), [&](size_t i) { build(stations[i]); });
+ *
+ * Each thread starts with its own share of the jobs, a contiguous run of them in a deque of its
+ * own, and works through it from the back. A thread that runs out steals from the front of
+ * another's -- the end its owner gets to last -- so that when some jobs take much longer than
+ * others (a station with ten years of fixtures among ones with a month), the threads still
+ * finish at about the same time. Nothing is shared but the deques, each behind its own lock,
+ * which is held only to take a job off; with jobs that take milliseconds, that's cheap enough
+ * that the pool scales with the cores.
+ *
+ * Jobs mustn't throw, and run() mustn't be called from a job.
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#pragma once
+
+#include <stddef.h>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkPool {
+public:
+  /**
+   * @brief Construct a new WorkPool object
+   *
+   * @param nThreads  The number of threads to run jobs on; 0 means 1
+   */
+  explicit WorkPool(unsigned nThreads) : nThreads(nThreads == 0 ? 1 : nThreads), steals(0) {}
+
+  /**
+   * @brief Run jobs 0 to nJobs - 1, returning once they're all done
+   *
+   * @param nJobs   The number of jobs
+   * @param job     Does job i: void job(size_t i)
+   */
+  void run(size_t nJobs, const std::function<void(size_t)> &job) {
+    queues.clear();
+    for (unsigned t = 0; t < nThreads; t++) {
+      queues.emplace_back(new queue_t);
+      for (size_t i = nJobs * t / nThreads; i < nJobs * (t + 1) / nThreads; i++) {
+        queues[t]->jobs.push_back(i);
+      }
+    }
+    std::vector<std::thread> threads;
+    for (unsigned t = 1; t < nThreads; t++) {
+      threads.emplace_back(&WorkPool::work, this, t, std::cref(job));
+    }
+    work(0, job);
+    for (std::thread &t : threads) {
+      t.join();
+    }
+  }
+
+  /**
+   * @brief The number of threads it runs jobs on
+   */
+  unsigned threads() const {
+    return nThreads;
+  }
+
+  /**
+   * @brief The number of jobs a thread has taken from another's share, in all
+   */
+  size_t stolen() const {
+    return steals;
+  }
+
+private:
+  struct queue_t {                              // A thread's share of the jobs
+    std::mutex lock;
+    std::deque<size_t> jobs;
+  };
+
+  /**
+   * @brief What each thread does: its own jobs, newest first, then other threads' oldest, until
+   *        there are none left anywhere. No job makes more jobs, so once every deque has been
+   *        found empty, they all stay that way.
+   */
+  void work(unsigned self, const std::function<void(size_t)> &job) {
+    size_t i;
+    while (true) {
+      if (take(self, false, i)) {
+        job(i);
+        continue;
+      }
+      bool found = false;
+      for (unsigned v = 1; !found && v < nThreads; v++) {
+        found = take((self + v) % nThreads, true, i);
+      }
+      if (!found) {
+        return;
+      }
+      steals++;
+      job(i);
+    }
+  }
+
+  /**
+   * @brief Take a job off a thread's deque: its owner from the back, a thief from the front
+   */
+  bool take(unsigned from, bool steal, size_t &i) {
+    queue_t &q = *queues[from];
+    std::lock_guard<std::mutex> hold(q.lock);
+    if (q.jobs.empty()) {
+      return false;
+    }
+    if (steal) {
+      i = q.jobs.front();
+      q.jobs.pop_front();
+    } else {
+      i = q.jobs.back();
+      q.jobs.pop_back();
+    }
+    return true;
+  }
+
+  unsigned nThreads;                            // The number of threads
+  std::vector<std::unique_ptr<queue_t>> queues; // Each thread's share of the jobs
+  std::atomic<size_t> steals;                   // The number of jobs stolen
+};
@@ -0,0 +1,357 @@
+/****
+ *
+ * cabundle.cpp
+ * Host tool for building the device's TLS trust anchors. Part of Time and Tides.
+ *
+ * Reads one or more CA certificates in PEM form -- plain .pem files, or C headers holding a PEM
+ * as a string literal, the way config.h used to -- and writes src/CaBundle.h, which holds them
+ * two ways:
+ *
+ *  tatCaBundle   The certificates pre-parsed into the x509 certificate bundle format the ESP32
+ *                Arduino core's WiFiClientSecure::setCACertBundle() takes: a two-byte big-endian
+ *                count, then for each certificate, sorted by subject, the two-byte lengths of
+ *                its subject name and its public key followed by the DER of each. That's all
+ *                the device needs to check the signature on the certificate the server sends
+ *                at the top of its chain, and it's used in place, straight from flash.
+ *  tatCaPem      The same certificates as PEM, for WiFiClientSecure::setCACert(), which parses
+ *                them into RAM on every connection. Only the "bench tls" command uses it, to
+ *                compare the two.
+ *
+ * The bundle is looked up by the issuer of the top certificate the server sends, so it needs
+ * the root CA, not the intermediate. For NOAA that's DigiCert Global Root G2. The tool says if
+ * a certificate isn't self-signed.
+ *
+ * Build and run (from the repository root):
+ *
+ *   g++ -std=c++17 -O2 -o cabundle tools/cabundle.cpp
+ *   ./cabundle -o src/CaBundle.h /etc/ssl/certs/DigiCert_Global_Root_G2.pem
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ *
+ ****/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#define PEM_BEGIN       "-----BEGIN CERTIFICATE-----"
+#define PEM_END         "-----END CERTIFICATE-----"
+
+typedef std::vector<uint8_t> bytes_t;
+
+// A DER element: where it starts, where its contents start and where it ends
+struct der_t {
+  size_t start, body, end;
+  uint8_t tag;
+};
+
+// A certificate, and the bits of it that go in the bundle
+struct cert_t {
+  std::string file;
+  std::string pem;
+  bytes_t der;
+  bytes_t subject;
+  bytes_t key;
+  std::string name;
+  std::string keyType;
+  bool selfSigned;
+};
+
+static bool readFile(const char *path, std::string &out) {
+  FILE *f = fopen(path, "rb");
+  if (f == nullptr) {
+    return false;
+  }
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    out.append(buf, n);
+  }
+  fclose(f);
+  return true;
+}
+
+// Pull the PEM blocks out of text. In a C header, the PEM is in string literals ending in \n
+// escapes; just the part inside the quotes is kept.
+static std::vector<std::string> pemBlocks(const std::string &text) {
+  std::string clean;
+  bool inQuotes = false;
+  bool quoted = text.find("\"" PEM_BEGIN) != std::string::npos;
+  for (size_t i = 0; i < text.size(); i++) {
+    char c = text[i];
+    if (!quoted) {
+      clean += c;
+    } else if (c == '"') {
+      inQuotes = !inQuotes;
+    } else if (inQuotes && c == '\\' && i + 1 < text.size() && text[i + 1] == 'n') {
+      clean += '\n';
+      i++;
+    } else if (inQuotes) {
+      clean += c;
+    }
+  }
+  std::vector<std::string> blocks;
+  size_t from = 0;
+  while ((from = clean.find(PEM_BEGIN, from)) != std::string::npos) {
+    size_t to = clean.find(PEM_END, from);
+    if (to == std::string::npos) {
+      break;
+    }
+    to += strlen(PEM_END);
+    blocks.push_back(clean.substr(from, to - from) + "\n");
+    from = to;
+  }
+  return blocks;
+}
+
+static bool base64Decode(const std::string &pem, bytes_t &out) {
+  size_t from = pem.find('\n', pem.find(PEM_BEGIN));
+  size_t to = pem.find(PEM_END);
+  uint32_t acc = 0;
+  int bits = 0;
+  for (size_t i = from; i < to; i++) {
+    char c = pem[i];
+    int v;
+    if (c >= 'A' && c <= 'Z') {
+      v = c - 'A';
+    } else if (c >= 'a' && c <= 'z') {
+      v = c - 'a' + 26;
+    } else if (c >= '0' && c <= '9') {
+      v = c - '0' + 52;
+    } else if (c == '+') {
+      v = 62;
+    } else if (c == '/') {
+      v = 63;
+    } else if (c == '=' || c == '\n' || c == '\r' || c == ' ') {
+      continue;
+    } else {
+      return false;
+    }
+    acc = (acc << 6) | v;
+    bits += 6;
+    if (bits >= 8) {
+      bits -= 8;
+      out.push_back((uint8_t)(acc >> bits));
+    }
+  }
+  return !out.empty();
+}
+
+// Read the DER element at pos, within limit
+static bool derRead(const bytes_t &d, size_t pos, size_t limit, der_t &e) {
+  if (pos + 2 > limit) {
+    return false;
+  }
+  e.start = pos;
+  e.tag = d[pos++];
+  size_t len = d[pos++];
+  if (len & 0x80) {
+    int n = len & 0x7F;
+    if (n == 0 || n > 4 || pos + n > limit) {
+      return false;
+    }
+    len = 0;
+    while (n-- > 0) {
+      len = (len << 8) | d[pos++];
+    }
+  }
+  if (pos + len > limit) {
+    return false;
+  }
+  e.body = pos;
+  e.end = pos + len;
+  return true;
+}
+
+// The text of the last attribute with the given OID in a Name, e.g., its common name
+static std::string nameAttribute(const bytes_t &d, const der_t &name, const uint8_t *oid, size_t oidLen) {
+  std::string answer;
+  der_t rdn, atv, type, value;
+  for (size_t p = name.body; p < name.end && derRead(d, p, name.end, rdn); p = rdn.end) {
+    for (size_t q = rdn.body; q < rdn.end && derRead(d, q, rdn.end, atv); q = atv.end) {
+      if (derRead(d, atv.body, atv.end, type) && derRead(d, type.end, atv.end, value) &&
+          type.end - type.body == oidLen && memcmp(&d[type.body], oid, oidLen) == 0) {
+        answer.assign((const char *)&d[value.body], value.end - value.body);
+      }
+    }
+  }
+  return answer;
+}
+
+// Take the certificate apart: Certificate ::= SEQUENCE { tbsCertificate SEQUENCE { [0] version,
+// serialNumber, signature, issuer, validity, subject, subjectPublicKeyInfo, ... }, ... }
+static bool parseCert(cert_t &c, std::string &err) {
+  static const uint8_t oidCn[] = {0x55, 0x04, 0x03};
+  static const uint8_t oidOu[] = {0x55, 0x04, 0x0B};
+  static const uint8_t oidRsa[] = {0x2A, 0x86, 0x48, 0x86, 0xF7, 0x0D, 0x01, 0x01, 0x01};
+  static const uint8_t oidEc[] = {0x2A, 0x86, 0x48, 0xCE, 0x3D, 0x02, 0x01};
+  static const uint8_t oidP256[] = {0x2A, 0x86, 0x48, 0xCE, 0x3D, 0x03, 0x01, 0x07};
+  static const uint8_t oidP384[] = {0x2B, 0x81, 0x04, 0x00, 0x22};
+  const bytes_t &d = c.der;
+  der_t cert, tbs, e, issuer, subject, spki;
+  if (!derRead(d, 0, d.size(), cert) || cert.tag != 0x30 || !derRead(d, cert.body, cert.end, tbs) || tbs.tag != 0x30) {
+    err = "not a certificate";
+    return false;
+  }
+  size_t p = tbs.body;
+  if (!derRead(d, p, tbs.end, e)) {
+    err = "truncated";
+    return false;
+  }
+  if (e.tag == 0xA0) {                                // Explicit version; skip it
+    p = e.end;
+  }
+  for (int skip = 0; skip < 2; skip++) {              // serialNumber and signature
+    if (!derRead(d, p, tbs.end, e)) {
+      err = "truncated";
+      return false;
+    }
+    p = e.end;
+  }
+  if (!derRead(d, p, tbs.end, issuer) || !derRead(d, issuer.end, tbs.end, e) ||
+      !derRead(d, e.end, tbs.end, subject) || !derRead(d, subject.end, tbs.end, spki) ||
+      issuer.tag != 0x30 || subject.tag != 0x30 || spki.tag != 0x30) {
+    err = "can't find the subject and public key";
+    return false;
+  }
+  c.subject.assign(d.begin() + subject.start, d.begin() + subject.end);
+  c.key.assign(d.begin() + spki.start, d.begin() + spki.end);
+  c.selfSigned = issuer.end - issuer.start == subject.end - subject.start &&
+    memcmp(&d[issuer.start], &d[subject.start], issuer.end - issuer.start) == 0;
+  c.name = nameAttribute(d, subject, oidCn, sizeof(oidCn));
+  if (c.name.empty()) {
+    c.name = nameAttribute(d, subject, oidOu, sizeof(oidOu));
+  }
+
+  // SubjectPublicKeyInfo ::= SEQUENCE { algorithm SEQUENCE { OID, parameters }, BIT STRING }
+  der_t alg, oid, param, bits, rsaKey, modulus;
+  c.keyType = "unknown key";
+  if (derRead(d, spki.body, spki.end, alg) && derRead(d, alg.body, alg.end, oid)) {
+    size_t oidLen = oid.end - oid.body;
+    if (oidLen == sizeof(oidRsa) && memcmp(&d[oid.body], oidRsa, oidLen) == 0 &&
+        derRead(d, alg.end, spki.end, bits) && derRead(d, bits.body + 1, bits.end, rsaKey) &&
+        derRead(d, rsaKey.body, rsaKey.end, modulus)) {
+      size_t m = modulus.body;
+      while (m < modulus.end && d[m] == 0) {
+        m++;
+      }
+      int nBits = (int)(modulus.end - m) * 8;
+      for (uint8_t top = m < modulus.end ? d[m] : 0; nBits > 0 && !(top & 0x80); top <<= 1) {
+        nBits--;
+      }
+      c.keyType = "RSA " + std::to_string(nBits);
+    } else if (oidLen == sizeof(oidEc) && memcmp(&d[oid.body], oidEc, oidLen) == 0 &&
+        derRead(d, oid.end, alg.end, param)) {
+      size_t pLen = param.end - param.body;
+      c.keyType = pLen == sizeof(oidP256) && memcmp(&d[param.body], oidP256, pLen) == 0 ? "ECDSA P-256" :
+        pLen == sizeof(oidP384) && memcmp(&d[param.body], oidP384, pLen) == 0 ? "ECDSA P-384" : "ECDSA";
+    }
+  }
+  return true;
+}
+
+static void writeBytes(FILE *out, const bytes_t &b) {
+  for (size_t i = 0; i < b.size(); i++) {
+    fprintf(out, "%s0x%02X,%s", i % 16 == 0 ? "  " : "", b[i], i % 16 == 15 || i == b.size() - 1 ? "\n" : " ");
+  }
+}
+
+int main(int argc, char **argv) {
+  const char *outPath = nullptr;
+  std::vector<cert_t> certs;
+  for (int a = 1; a < argc; a++) {
+    if (strcmp(argv[a], "-o") == 0 && a + 1 < argc) {
+      outPath = argv[++a];
+      continue;
+    }
+    std::string text;
+    if (!readFile(argv[a], text)) {
+      fprintf(stderr, "%s: can't read it\n", argv[a]);
+      return 1;
+    }
+    std::vector<std::string> blocks = pemBlocks(text);
+    if (blocks.empty()) {
+      fprintf(stderr, "%s: no PEM certificate in it\n", argv[a]);
+      return 1;
+    }
+    for (const std::string &pem : blocks) {
+      cert_t c;
+      std::string err;
+      c.file = argv[a];
+      c.pem = pem;
+      if (!base64Decode(pem, c.der) || !parseCert(c, err)) {
+        fprintf(stderr, "%s: %s\n", argv[a], err.empty() ? "bad base64" : err.c_str());
+        return 1;
+      }
+      certs.push_back(c);
+    }
+  }
+  if (certs.empty()) {
+    fprintf(stderr, "Usage: %s [-o <output header>] <PEM file or header>...\n", argv[0]);
+    return 2;
+  }
+
+  // The device binary-searches the bundle by subject name, so it must be in order
+  std::sort(certs.begin(), certs.end(), [](const cert_t &x, const cert_t &y) {
+    size_t n = std::min(x.subject.size(), y.subject.size());
+    int cmp = memcmp(x.subject.data(), y.subject.data(), n);
+    return cmp != 0 ? cmp < 0 : x.subject.size() < y.subject.size();
+  });
+  bytes_t bundle {(uint8_t)(certs.size() >> 8), (uint8_t)certs.size()};
+  size_t pemSize = 0;
+  for (const cert_t &c : certs) {
+    if (c.subject.size() > 0xFFFF || c.key.size() > 0xFFFF) {
+      fprintf(stderr, "%s: too big for the bundle\n", c.file.c_str());
+      return 1;
+    }
+    bundle.push_back((uint8_t)(c.subject.size() >> 8));
+    bundle.push_back((uint8_t)c.subject.size());
+    bundle.push_back((uint8_t)(c.key.size() >> 8));
+    bundle.push_back((uint8_t)c.key.size());
+    bundle.insert(bundle.end(), c.subject.begin(), c.subject.end());
+    bundle.insert(bundle.end(), c.key.begin(), c.key.end());
+    pemSize += c.pem.size();
+    fprintf(stderr, "%-40s %-12s %4zu bytes in the bundle (%4zu as PEM)%s\n", c.name.c_str(), c.keyType.c_str(),
+      4 + c.subject.size() + c.key.size(), c.pem.size(), c.selfSigned ? "" : "  NOT SELF-SIGNED: the bundle needs its root");
+  }
+  fprintf(stderr, "%zu certificate(s): bundle %zu bytes, PEM %zu bytes\n", certs.size(), bundle.size(), pemSize);
+
+  FILE *out = outPath == nullptr ? stdout : fopen(outPath, "w");
+  if (out == nullptr) {
+    fprintf(stderr, "%s: can't write it\n", outPath);
+    return 1;
+  }
+  fprintf(out, "/****\n * \n *  CaBundle.h\n * \n");
+  fprintf(out, " * The CA certificates the device trusts when it connects to the tide data server over \n");
+  fprintf(out, " * HTTPS. Generated by tools/cabundle.cpp; don't edit. To change them, run (from the \n");
+  fprintf(out, " * repository root)\n * \n *   ./cabundle -o src/CaBundle.h <PEM file>...\n * \n");
+  fprintf(out, " * with the PEM for each CA. They are:\n * \n");
+  for (const cert_t &c : certs) {
+    fprintf(out, " *   %s (%s)\n", c.name.c_str(), c.keyType.c_str());
+  }
+  fprintf(out, " * \n ****\n * \n *  Copyright 2023 by D.L. Ehnebuske\n");
+  fprintf(out, " *  License: GNU Lesser General Public License v2.1\n * \n ****/\n#pragma once\n\n#include <stdint.h>\n\n");
+  fprintf(out, "// The certificates in WiFiClientSecure::setCACertBundle() form, %zu bytes\n", bundle.size());
+  fprintf(out, "static const uint8_t tatCaBundle[] = {\n");
+  writeBytes(out, bundle);
+  fprintf(out, "};\n\n// The same certificates as PEM, for WiFiClientSecure::setCACert()\n");
+  fprintf(out, "static const char tatCaPem[] =\n");
+  for (const cert_t &c : certs) {
+    size_t from = 0, to;
+    while ((to = c.pem.find('\n', from)) != std::string::npos) {
+      fprintf(out, "  \"%s\\n\"\n", c.pem.substr(from, to - from).c_str());
+      from = to + 1;
+    }
+  }
+  fprintf(out, "  ;\n");
+  if (out != stdout) {
+    fclose(out);
+  }
+  return 0;
+}
@@ -0,0 +1,317 @@
+/****
+ *
+ * fetchloop.cpp
+ * Host tool for trying out the firmware's fetcher over loopback. Part of Time and Tides.
+ *
+ * Runs AsyncFetch (lib/AsyncFetch) on a host, with a POSIX socket standing in for EspLink, in
+ * a cooperative loop alongside a stand-in for the clock's step task that wants to run every
+ * millisecond. A second thread is the server. It answers each request the way the request's
+ * path asks: with a Content-Length, chunked (a piece at a time, with pauses in between), or
+ * HTTP/1.0-style, ending the body by closing the connection; by stalling partway through the
+ * body; or with a body bigger than the fetcher will take. And now and then it drops a kept
+ * connection without saying so, the way servers do when they tire of waiting for the next
+ * request. Each fetch's result is checked against what the server sent or, for the stalls and
+ * the too-big bodies, against the failure that should have been reported. At the end it
+ * reports how the fetches went and, to show that fetching doesn't get in the way of stepping,
+ * the longest single fetcher slice and the longest the step task was kept waiting.
+ *
+ * The stand-in connection is plain HTTP; TLS isn't tried. It resolves host names with
+ * getaddrinfo(), which blocks, so use 127.0.0.1, as the tool does.
+ *
+ * Build and run (from the repository root):
+ *
+ *   g++ -std=c++17 -O2 -pthread -Ilib/AsyncFetch -o fetchloop tools/fetchloop.cpp
+ *   ./fetchloop -n 500
+ *
+ * Usage: fetchloop [-n <fetches>] [-s <seed>]
+ *
+ *   -n   How many fetches to make (default 200)
+ *   -s   The seed for the random choices (default 1)
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ *
+ ****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <string>
+#include <algorithm>
+#include "AsyncFetch.h"
+
+// Some constants
+#define FL_MAX_SIZE             (16384)         // The most body bytes the fetcher takes, as TAT_FETCH_MAX_SIZE in src/config.h
+#define FL_BIG_SIZE             (40000)         // The size of the bodies that are too big
+#define FL_STALL_MILLIS         (300)           // The timeouts for reading the response, so a stall is found quickly
+#define FL_DROP_ONE_IN          (4)             // The server drops a kept connection after one response in this many
+
+enum fl_kind_t {flLength, flChunked, flClose, flStall, flBig, flKinds};
+static const char *kindNames[flKinds] = {"length", "chunked", "close", "stall", "big"};
+
+// An EspLink lookalike on a non-blocking POSIX socket, without TLS
+class PosixLink {
+public:
+  int8_t resolve(const char *host) {
+    addrinfo hints = {}, *res = nullptr;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, nullptr, &hints, &res) != 0 || res == nullptr) {
+      return AF_LINK_FAILED;
+    }
+    addr = *(sockaddr_in *)res->ai_addr;
+    freeaddrinfo(res);
+    return AF_LINK_DONE;
+  }
+  int8_t connect(uint16_t port) {
+    if (fd < 0) {
+      fd = socket(AF_INET, SOCK_STREAM, 0);
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      addr.sin_port = htons(port);
+      connects++;
+      if (::connect(fd, (sockaddr *)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+        stop();
+        return AF_LINK_FAILED;
+      }
+    }
+    fd_set wset;
+    FD_ZERO(&wset);
+    FD_SET(fd, &wset);
+    timeval tv = {0, 0};
+    int n = select(fd + 1, nullptr, &wset, nullptr, &tv);
+    if (n == 0) {
+      return AF_LINK_AGAIN;
+    }
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (n < 0 || getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+      stop();
+      return AF_LINK_FAILED;
+    }
+    return AF_LINK_DONE;
+  }
+  int8_t handshake(const char *) {
+    return AF_LINK_FAILED;
+  }
+  int read(uint8_t *buf, size_t len) {
+    ssize_t n = fd < 0 ? -1 : recv(fd, buf, len, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return 0;
+    }
+    return n > 0 ? n : -1;
+  }
+  int write(const uint8_t *buf, size_t len) {
+    ssize_t n = fd < 0 ? -1 : send(fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return 0;
+    }
+    return n >= 0 ? n : -1;
+  }
+  void stop() {
+    if (fd >= 0) {
+      close(fd);
+    }
+    fd = -1;
+  }
+  uint32_t connects = 0;                        // The connections made
+private:
+  int fd = -1;
+  sockaddr_in addr = {};
+};
+
+static double nowMicros() {
+  return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// The body for a request for size bytes with the given seed
+static std::string bodyFor(size_t size, uint32_t seed) {
+  std::string body(size, ' ');
+  for (size_t i = 0; i < size; i++) {
+    seed = seed * 1103515245 + 12345;
+    body[i] = "0123456789abcdefghijklmnopqrstuvwxyz{}[]\":,\n"[(seed >> 16) % 45];
+  }
+  return body;
+}
+
+static bool sendAll(int fd, const std::string &s) {
+  size_t sent = 0;
+  while (sent < s.size()) {
+    ssize_t n = send(fd, s.data() + sent, s.size() - sent, MSG_NOSIGNAL);
+    if (n <= 0) {
+      return false;
+    }
+    sent += n;
+  }
+  return true;
+}
+
+// Serve one connection: GET /<kind>/<size>/<seed>, as many as come
+static void serve(int fd, uint32_t seed) {
+  std::string in;
+  char buf[1024];
+  while (true) {
+    size_t end;
+    while ((end = in.find("\r\n\r\n")) == std::string::npos) {
+      ssize_t n = recv(fd, buf, sizeof(buf), 0);
+      if (n <= 0) {
+        close(fd);
+        return;
+      }
+      in.append(buf, n);
+    }
+    std::string request = in.substr(0, end);
+    in.erase(0, end + 4);
+    char kindName[16] = "";
+    unsigned long size = 0, bodySeed = 0;
+    sscanf(request.c_str(), "GET /%15[a-z]/%lu/%lu", kindName, &size, &bodySeed);
+    int kind = std::find_if(kindNames, kindNames + flKinds, [&](const char *k) { return strcmp(k, kindName) == 0; }) - kindNames;
+    std::string body = bodyFor(size, bodySeed);
+    bool ok = true;
+    switch (kind) {
+      case flLength:
+      case flBig:
+        ok = sendAll(fd, "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: " + std::to_string(size) + "\r\n\r\n" + body);
+        break;
+      case flChunked:
+        ok = sendAll(fd, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n");
+        for (size_t at = 0; ok && at < body.size(); ) {
+          seed = seed * 1103515245 + 12345;
+          size_t len = std::min(body.size() - at, (size_t)1 + (seed >> 16) % 3000);
+          char head[16];
+          snprintf(head, sizeof(head), "%zx\r\n", len);
+          ok = sendAll(fd, head + body.substr(at, len) + "\r\n");
+          at += len;
+          std::this_thread::sleep_for(std::chrono::microseconds((seed >> 8) % 2000));
+        }
+        ok = ok && sendAll(fd, "0\r\n\r\n");
+        break;
+      case flClose:
+        sendAll(fd, "HTTP/1.0 200 OK\r\n\r\n" + body);
+        ok = false;
+        break;
+      case flStall:
+        sendAll(fd, "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(size) + "\r\n\r\n" + body.substr(0, size / 2));
+        std::this_thread::sleep_for(std::chrono::milliseconds(FL_STALL_MILLIS * 3));
+        ok = false;
+        break;
+      default:
+        ok = sendAll(fd, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+        break;
+    }
+    seed = seed * 1103515245 + 12345;
+    if (!ok || (seed >> 16) % FL_DROP_ONE_IN == 0) {
+      close(fd);                                // Without saying so, for a kept connection
+      return;
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  int fetches = 200;
+  uint32_t seed = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      fetches = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      seed = strtoul(argv[++i], nullptr, 10);
+    } else {
+      fprintf(stderr, "Usage: %s [-n <fetches>] [-s <seed>]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  // The server
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t addrLen = sizeof(addr);
+  if (bind(listener, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(listener, 8) != 0 ||
+    getsockname(listener, (sockaddr *)&addr, &addrLen) != 0) {
+    fprintf(stderr, "Can't listen: %s\n", strerror(errno));
+    return 1;
+  }
+  uint16_t port = ntohs(addr.sin_port);
+  std::thread([=]() {
+    for (uint32_t n = 0; ; n++) {
+      int c = accept(listener, nullptr, nullptr);
+      if (c >= 0) {
+        std::thread(serve, c, seed ^ (n * 0x9E3779B9)).detach();
+      }
+    }
+  }).detach();
+
+  PosixLink link;
+  AsyncFetch<PosixLink> fetcher {link};
+  fetcher.setTimeout(afReadingHeaders, FL_STALL_MILLIS);
+  fetcher.setTimeout(afReadingBody, FL_STALL_MILLIS);
+
+  // The cooperative loop: a step task due every millisecond, and the fetcher, run as often as
+  // possible while there's a fetch under way
+  int good = 0, bad = 0, kindCounts[flKinds] = {};
+  double maxSlice = 0, maxGap = 0, busyMicros = 0;
+  double nextStep = nowMicros() + 1000;
+  for (int f = 0; f < fetches; f++) {
+    seed = seed * 1103515245 + 12345;
+    fl_kind_t kind = (fl_kind_t)((seed >> 16) % 10 < 3 ? flLength : (seed >> 16) % 10 < 6 ? flChunked :
+      (seed >> 16) % 10 < 8 ? flClose : (seed >> 16) % 10 < 9 ? flStall : flBig);
+    seed = seed * 1103515245 + 12345;
+    size_t size = kind == flBig ? FL_BIG_SIZE : (seed >> 16) % FL_MAX_SIZE;
+    uint32_t bodySeed = seed;
+    kindCounts[kind]++;
+    char url[96];
+    snprintf(url, sizeof(url), "http://127.0.0.1:%u/%s/%zu/%u", port, kindNames[kind], size, bodySeed);
+    double start = nowMicros();
+    fetcher.start(url, FL_MAX_SIZE, (unsigned long)(start / 1000));
+    while (fetcher.busy()) {
+      double now = nowMicros();
+      if (now >= nextStep) {
+        maxGap = std::max(maxGap, now - nextStep);
+        nextStep = now + 1000;
+      }
+      double before = nowMicros();
+      fetcher.run((unsigned long)(before / 1000));
+      maxSlice = std::max(maxSlice, nowMicros() - before);
+    }
+    busyMicros += nowMicros() - start;
+    int16_t status = fetcher.status();
+    bool right = kind == flStall ? status == AF_ERR_TIMEOUT && fetcher.failedIn() == afReadingBody :
+      kind == flBig ? status == AF_ERR_TOO_BIG :
+      status == 200 && fetcher.size() == size && std::string(fetcher.text(), fetcher.size()) == bodyFor(size, bodySeed);
+    if (right) {
+      good++;
+    } else {
+      bad++;
+      fprintf(stderr, "Fetch %d (%s, %zu bytes): status %d (%s while %s), %zu bytes\n", f, kindNames[kind], size, status,
+        fetcher.statusToString(status), fetcher.phaseToString(fetcher.failedIn()), fetcher.size());
+    }
+    fetcher.release();
+    nextStep = nowMicros() + 1000;              // Between fetches the step task has the loop to itself
+  }
+
+  printf("%d fetches (", fetches);
+  for (int k = 0; k < flKinds; k++) {
+    printf("%s%d %s", k == 0 ? "" : ", ", kindCounts[k], kindNames[k]);
+  }
+  printf("), %d as expected, %d not; %u connections made\n", good, bad, link.connects);
+  printf("Mean time per fetch: %.1f ms\n", busyMicros / fetches / 1000);
+  printf("Longest fetcher slice: %.0f us; longest step task wait: %.0f us\n", maxSlice, maxGap);
+  return bad == 0 ? 0 : 1;
+}
@@ -0,0 +1,343 @@
+/****
+ *
+ * flashlog.cpp
+ * Host tool for checking the flash log and working out how long the flash lasts. Part of Time
+ * and Tides.
+ *
+ * Runs the firmware's FlashLog (lib/FlashLog) on a model of the SPI NOR flash on the device:
+ * erasing a sector sets its bits, writing can only clear them (writing to bytes that aren't
+ * erased is counted as a fault), and each page written and each sector erased takes the
+ * flash's typical time on a simulated clock. Then it:
+ *
+ *   - Appends records to the log until it's been round the ring a few times, starting the log
+ *     afresh from the flash (as after a reset) every so often, and checks that what's in it is
+ *     always the newest records appended, oldest first, and that reading the newest is right.
+ *   - Cuts writes and erases off part way, as a reset would, and checks that a record torn
+ *     that way is recognized as damaged, that the log carries on after it, and that a sector
+ *     whose header didn't get written is passed over.
+ *   - Empties the log and checks that it stays empty after a restart.
+ *
+ * It reports the sustained write throughput (records a second, with the flash's time
+ * included), the longest the flash holds everything else up, how evenly the erases are spread
+ * over the sectors and, for the partition's size and a number of records a day, how many days
+ * of history the log keeps and how many years the flash lasts. Exit status 1 if a check fails.
+ *
+ * Build and run (from the repository root):
+ *
+ *   g++ -std=c++17 -O2 -Ilib/FlashLog -o flashlog tools/flashlog.cpp
+ *   ./flashlog
+ *
+ * Usage: flashlog [-k <partition bytes>] [-c <rings>] [-r <records a day>] [-s <seed>]
+ *
+ *   -k   The size of the log partition (default 0x70000, as in partitions.csv)
+ *   -c   How many times round the ring to go (default 3)
+ *   -r   The records the device logs a day, for the projections (default 260: a level every
+ *        six minutes plus tides, fetches and the odd homing)
+ *   -s   The seed for the random parts (default 1)
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ *
+ ****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <deque>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include "FlashLog.h"
+
+// Some constants
+#define FLT_PROGRAM_MICROS      (600)           // Typical time to program a page of the flash
+#define FLT_ERASE_MICROS        (45000)         // Typical time to erase a sector
+#define FLT_CALL_MICROS         (20)            // Overhead of each call through the partition API
+#define FLT_RESTART_EVERY       (997)           // Records between restarts
+
+/**
+ * @brief A model of the SPI NOR flash, with a simulated clock
+ */
+class NorFlash {
+public:
+  NorFlash(uint32_t bytes) : mem(bytes, 0xFF), sectorErases(bytes / FL_SECTOR_SIZE, 0) {}
+
+  uint32_t size() {
+    return mem.size();
+  }
+  bool read(uint32_t offset, void *buf, size_t len) {
+    if (offset + len > mem.size()) {
+      return false;
+    }
+    clock += FLT_CALL_MICROS;
+    memcpy(buf, &mem[offset], len);
+    return true;
+  }
+  bool write(uint32_t offset, const void *buf, size_t len) {
+    if (offset + len > mem.size()) {
+      return false;
+    }
+    const uint8_t *p = (const uint8_t *)buf;
+    size_t n = cut() ? std::min(len, (size_t)tearBytes) : len;
+    if (n < len) {
+      torn = true;
+      tornAt = offset;
+      tornLen = n;
+    }
+    for (size_t i = 0; i < n; i++) {
+      if (mem[offset + i] != 0xFF) {
+        faults++;
+      }
+      mem[offset + i] &= p[i];
+    }
+    clock += FLT_CALL_MICROS + FLT_PROGRAM_MICROS * ((offset + len - 1) / FL_PAGE_SIZE - offset / FL_PAGE_SIZE + 1);
+    return n == len;
+  }
+  bool erase(uint32_t offset) {
+    if (offset % FL_SECTOR_SIZE != 0 || offset >= mem.size()) {
+      return false;
+    }
+    clock += FLT_CALL_MICROS + FLT_ERASE_MICROS;
+    if (cut()) {                                // Left as it was
+      torn = true;
+      tornAt = offset;
+      tornLen = FL_SECTOR_SIZE;
+      return false;
+    }
+    memset(&mem[offset], 0xFF, FL_SECTOR_SIZE);
+    sectorErases[offset / FL_SECTOR_SIZE]++;
+    return true;
+  }
+  uint32_t micros() {
+    return (uint32_t)clock;
+  }
+
+  std::vector<uint8_t> mem;                     // What's in the flash
+  std::vector<uint32_t> sectorErases;           // How many times each sector's been erased
+  uint64_t clock = 0;                           // The simulated time (us)
+  uint64_t faults = 0;                          // Bytes written that weren't erased
+  int tearOp = -1;                              // If >= 0, the number of writes and erases to let through before a reset
+  size_t tearBytes = 0;                         //   which cuts a write off after this many bytes, or stops an erase
+  bool torn = false;                            // Whether the reset has cut a write or erase off
+  uint32_t tornAt = 0;                          //   where
+  size_t tornLen = 0;                           //   and how much it got done
+
+private:
+  // Whether this write or erase is the one the reset cuts off
+  bool cut() {
+    return tearOp >= 0 && tearOp-- == 0;
+  }
+};
+
+static int failures = 0;
+
+static void check(bool ok, const char *what, uint64_t at) {
+  if (!ok) {
+    if (failures < 20) {
+      printf("FAIL: %s (at record %llu)\n", what, (unsigned long long)at);
+    }
+    failures++;
+  }
+}
+
+static bool same(const fl_record_t &x, const fl_record_t &y) {
+  return x.time == y.time && x.kind == y.kind && x.a == y.a && x.b == y.b && x.c == y.c;
+}
+
+// Whether the log holds the newest of expected, oldest first, and as many as it should
+static void checkContents(FlashLog<NorFlash> &log, const std::deque<fl_record_t> &expected, uint64_t at) {
+  uint32_t n = log.size();
+  fl_stats_t stats = log.getStats();
+  check(n <= expected.size(), "the log has records that weren't appended", at);
+  check(n >= std::min((uint32_t)expected.size(), stats.capacity), "the log has lost records it should have", at);
+  if (n == 0 || n > expected.size()) {
+    return;
+  }
+  fl_record_t recs[FL_PAGE_RECORDS];
+  size_t base = expected.size() - n;
+  for (uint32_t i = 0; i < n;) {
+    uint16_t got = log.read(i, recs, FL_PAGE_RECORDS);
+    check(got > 0, "read() got nothing", at);
+    if (got == 0) {
+      return;
+    }
+    for (uint16_t j = 0; j < got; j++) {
+      check(FlashLog<NorFlash>::intact(recs[j]) && same(recs[j], expected[base + i + j]), "a record isn't what was appended", at);
+    }
+    i += got;
+  }
+  fl_record_t last;
+  check(log.read(n - 1, &last) && same(last, expected.back()), "the newest record isn't the last appended", at);
+}
+
+int main(int argc, char **argv) {
+  uint32_t partBytes = 0x70000;
+  int rings = 3;
+  double perDay = 260;
+  unsigned seed = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+      partBytes = strtoul(argv[++i], nullptr, 0);
+    } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+      rings = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+      perDay = atof(argv[++i]);
+    } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      seed = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "Usage: %s [-k <partition bytes>] [-c <rings>] [-r <records a day>] [-s <seed>]\n", argv[0]);
+      return 2;
+    }
+  }
+  std::mt19937 rng(seed);
+  auto between = [&](int lo, int hi) { return std::uniform_int_distribution<int>(lo, hi)(rng); };
+
+  // Round the ring a few times, restarting every so often
+  NorFlash flash(partBytes);
+  FlashLog<NorFlash> *log = new FlashLog<NorFlash>(flash);
+  if (!log->begin()) {
+    printf("FAIL: a %u-byte partition is too small for a log\n", partBytes);
+    return 1;
+  }
+  uint32_t sectors = log->getStats().sectors;
+  uint32_t endSerial = log->firstSerial() + log->size(); // The serial number the next record gets, less the records in expected
+  uint64_t total = (uint64_t)rings * sectors * FL_SECTOR_RECORDS;
+  std::deque<fl_record_t> expected;
+  uint32_t t = 1672531200;
+  uint64_t appendNanos = 0, lost = 0, restarts = 0;
+  uint64_t startClock = flash.clock;
+  fl_stats_t run {};
+  for (uint64_t i = 0; i < total; i++) {
+    fl_record_t rec {t += between(1, 600), between(-100000, 100000), (int32_t)i, (int16_t)between(-1000, 1500), (uint8_t)between(0, 7), 0};
+    auto start = std::chrono::steady_clock::now();
+    bool ok = log->append(rec.kind, rec.time, rec.a, rec.b, rec.c);
+    appendNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    check(ok, "append() failed", i);
+    expected.push_back(rec);
+    if (i % FLT_RESTART_EVERY == FLT_RESTART_EVERY - 1) {
+      if (between(0, 1) == 0) {                 // Flushed first, as before a restart
+        log->flush();
+      } else {                                  // Or not, as after a crash
+        lost += log->buffered();
+        expected.resize(expected.size() - log->buffered());
+      }
+      fl_stats_t s = log->getStats();
+      run.written += s.written;
+      run.writes += s.writes;
+      run.erases += s.erases;
+      run.maxWriteMicros = std::max(run.maxWriteMicros, s.maxWriteMicros);
+      run.maxEraseMicros = std::max(run.maxEraseMicros, s.maxEraseMicros);
+      delete log;
+      log = new FlashLog<NorFlash>(flash);
+      check(log->begin(), "begin() failed after a restart", i);
+      restarts++;
+      checkContents(*log, expected, i);
+      check(log->firstSerial() + log->size() - endSerial == expected.size(), "firstSerial() doesn't keep up with the records", i);
+    }
+  }
+  log->flush();
+  checkContents(*log, expected, total);
+  fl_stats_t s = log->getStats();
+  run.written += s.written;
+  run.writes += s.writes;
+  run.erases += s.erases;
+  run.maxWriteMicros = std::max(run.maxWriteMicros, s.maxWriteMicros);
+  run.maxEraseMicros = std::max(run.maxEraseMicros, s.maxEraseMicros);
+  double flashSecs = (flash.clock - startClock) / 1e6;
+  uint32_t cycles = s.cycles;
+
+  // Cut writes and erases off part way. expected mirrors the log, with FL_UNWRITTEN standing
+  // for a record the reset damaged.
+  uint32_t tornTests = 0, damaged = 0, lostSectors = 0;
+  for (int round = 0; round < 500; round++) {
+    uint16_t more = between(1, FL_PAGE_RECORDS * 3);
+    for (uint16_t j = 0; j < more; j++) {
+      fl_record_t rec {t += 60, round, j, (int16_t)j, 1, 0};
+      log->append(rec.kind, rec.time, rec.a, rec.b, rec.c);
+      expected.push_back(rec);
+    }
+    uint16_t waiting = log->buffered();
+    if (waiting == 0) {
+      continue;
+    }
+    std::vector<fl_record_t> flushed(expected.end() - waiting, expected.end());
+    expected.resize(expected.size() - waiting);
+    uint32_t sizeBefore = log->size() - waiting;
+    flash.tearOp = between(0, 2);               // Opening a sector is an erase and a write before the records'
+    flash.tearBytes = between(0, 2) == 0 ? between(0, FL_HEADER_SIZE - 1) : between(0, waiting * FL_RECORD_SIZE - 1);
+    flash.torn = false;
+    log->flush();
+    flash.tearOp = -1;
+    if (!flash.torn) {                          // The flush finished before the reset
+      expected.insert(expected.end(), flushed.begin(), flushed.end());
+    } else if (flash.tornAt % FL_SECTOR_SIZE != 0) { // It cut the records off; the ones it got to the end of are there
+      expected.insert(expected.end(), flushed.begin(), flushed.begin() + flash.tornLen / FL_RECORD_SIZE);
+      const uint8_t *part = &flash.mem[flash.tornAt + flash.tornLen / FL_RECORD_SIZE * FL_RECORD_SIZE];
+      if (std::any_of(part, part + flash.tornLen % FL_RECORD_SIZE, [](uint8_t b) { return b != 0xFF; })) {
+        fl_record_t torn {};
+        torn.kind = FL_UNWRITTEN;
+        expected.push_back(torn);
+        damaged++;
+      }
+    } else if (flash.tornLen < FL_SECTOR_SIZE) { // It cut off the new sector's header: the sector's erased, so its records are gone
+      lostSectors++;
+    }
+    tornTests++;
+    delete log;
+    log = new FlashLog<NorFlash>(flash);
+    check(log->begin(), "begin() failed after a torn write", round);
+    uint32_t n = log->size();
+    check(n + FL_SECTOR_RECORDS >= sizeBefore, "a torn write lost more than a sector", round);
+    fl_record_t rec;
+    for (uint32_t k = 0; k < std::min(n, (uint32_t)FL_SECTOR_RECORDS * 2); k++) {
+      const fl_record_t &want = expected[expected.size() - 1 - k];
+      bool ok = log->read(n - 1 - k, &rec);
+      if (want.kind == FL_UNWRITTEN) {
+        check(ok && !FlashLog<NorFlash>::intact(rec), "a torn record was taken to be intact", round);
+      } else {
+        check(ok && FlashLog<NorFlash>::intact(rec) && same(rec, want), "a record before a torn write isn't right", round);
+      }
+    }
+    fl_record_t next {t += 60, round, -1, 7, 2, 0};
+    check(log->append(next.kind, next.time, next.a, next.b, next.c) && log->flush(), "the log didn't carry on after a torn write", round);
+    expected.push_back(next);
+    check(log->read(log->size() - 1, &rec) && same(rec, next), "the record after a torn write isn't readable", round);
+  }
+  check(flash.faults == 0, "the log wrote to flash that wasn't erased", 0);
+
+  // Empty it
+  check(log->clear(), "clear() failed", 0);
+  check(log->size() == 0, "the log isn't empty after clear()", 0);
+  delete log;
+  log = new FlashLog<NorFlash>(flash);
+  check(log->begin() && log->size() == 0, "the log isn't empty after clear() and a restart", 0);
+  delete log;
+
+  // The report
+  uint32_t minErases = *std::min_element(flash.sectorErases.begin(), flash.sectorErases.end());
+  uint32_t maxErases = *std::max_element(flash.sectorErases.begin(), flash.sectorErases.end());
+  double capacity = (double)(sectors - 1) * FL_SECTOR_RECORDS;
+  double erasesPerYear = perDay * 365 / FL_SECTOR_RECORDS / sectors;
+  printf("Partition: %u bytes, %u sectors, %.0f records (%u bytes each) at least\n", partBytes, sectors, capacity, FL_RECORD_SIZE);
+  printf("Appended %llu records, %u times round the ring, with %llu restarts (%llu unwritten records lost to crashes)\n",
+    (unsigned long long)total, cycles, (unsigned long long)restarts, (unsigned long long)lost);
+  printf("Flash writes: %.2f a record (%.1f records each); erases: %.2f per 1000 records\n",
+    (double)run.writes / run.written, (double)run.written / run.writes, 1000.0 * run.erases / run.written);
+  printf("Sustained: %.0f records/s (%.1f kB/s), flash time included; %.0f ns of CPU per append\n",
+    run.written / flashSecs, run.written * FL_RECORD_SIZE / flashSecs / 1000, (double)appendNanos / total);
+  printf("Longest hold-up: %.1f ms writing, %.1f ms erasing\n", run.maxWriteMicros / 1000.0, run.maxEraseMicros / 1000.0);
+  printf("Erases per sector: %u to %u\n", minErases, maxErases);
+  printf("Resets part way through a flush: %u (%u records found damaged, %u sectors lost with their headers)\n",
+    tornTests, damaged, lostSectors);
+  printf("\nAt %.0f records a day: %.0f days of history; each sector erased %.1f times a year; "
+    "%.0f years to %u erases\n", perDay, capacity / perDay, erasesPerYear, FL_RATED_ERASES / erasesPerYear, FL_RATED_ERASES);
+  if (failures > 0) {
+    printf("\n%d checks FAILED\n", failures);
+    return 1;
+  }
+  printf("\nPASS\n");
+  return 0;
+}
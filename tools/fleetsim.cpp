@@ -0,0 +1,476 @@
+/****
+ * 
+ * fleetsim.cpp
+ * Host tool for sizing the servers a fleet of clocks leans on. Part of Time and Tides.
+ * 
+ * Runs thousands of copies of the firmware's fetch scheduling -- the real TideClock, PredFetch,
+ * HiloFetch and WlBias code, compiled natively against the stand-in Arduino core in tools/host -- in simulated
+ * time against a stand-in for NOAA's server, and reports what the server sees and what the
+ * devices see:
+ * 
+ *   - The request rate over time, second by second, and its peaks. Bursts are what matter: every
+ *     device wanting the new day's predictions at midnight, every clock on a station wanting the
+ *     next tide when the last one passes, or everything retrying at once after an outage. The
+ *     firmware spreads its fetches out with a seed derived from each device's MAC address; -u
+ *     gives every device the same seed, to see what the fleet does without that.
+ *   - The peak concurrency: requests being served plus those queued for one of the server's
+ *     slots. Requests that would wait longer than the device's HTTP timeout fail.
+ *   - Per-device staleness: how long each device's water level display went without the day's
+ *     predictions, and how long after each tide its clock went without knowing the next one.
+ * 
+ * Each device boots at a random time in the first few minutes (-b), which sets the phase of its
+ * level task (every TAT_LEVEL_CHECK_SECS) and clock task. Its clock task runs once per simulated
+ * resolution step (-r), and as often as the motor allows while the clock has steps to take, as
+ * it would on the device. The server stand-in answers in simulated time, so a fetch takes no time
+ * as far as the device's logic is concerned; its latency only counts towards the concurrency.
+ * The stand-in's tides are a made-up mix of a semidiurnal and a diurnal constituent, different
+ * for each station. An outage (-x) makes every request in a window fail, to see what the retries
+ * afterwards look like.
+ * 
+ * Build and run (from the repository root):
+ * 
+ *   g++ -std=c++17 -O2 -Itools/host -Ilib/Snapshot -Ilib/FastGpio -Ilib/TideClock -Ilib/TideData -Ilib/WlBias -o fleetsim tools/fleetsim.cpp lib/TideClock/TideClock.cpp lib/TideClock/TideSchedule.cpp lib/TideData/PredFetch.cpp lib/WlBias/WlBias.cpp
+ *   ./fleetsim -n 2000 -d 3
+ * 
+ * Usage: fleetsim [-n <devices>] [-d <days>] [-s <stations>] [-b <minutes>] [-r <millis>]
+ *                 [-c <slots>] [-l <millis>] [-x <hour>:<minutes>] [-o] [-u] [-t <csv file>] [-v]
+ * 
+ *   -n   The number of devices (default 2000)
+ *   -d   The number of days to simulate (default 3)
+ *   -s   The number of stations the devices are spread over (default 20)
+ *   -b   Devices boot at random times in the first this many minutes (default 60)
+ *   -r   The simulation's resolution, i.e., the clock task's period (default 1000 ms)
+ *   -c   The number of requests the server can serve at once (default 32)
+ *   -l   The server's mean latency; predictions take twice as long (default 250 ms)
+ *   -x   Have the server fail every request for <minutes> starting at <hour> on the first day
+ *   -o   Turn off the observation-based correction (config obs off)
+ *   -u   Give every device the same seed, so nothing is spread out
+ *   -t   Write the per-second request count, failures and concurrency to a CSV file
+ *   -v   Let device 0 log what it's doing
+ * 
+ ****
+ * 
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ * 
+ ****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <vector>
+#include <queue>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include "TideClock.h"
+#include "PredFetch.h"
+#include "WlBias.h"
+
+// Some constants
+#define FS_START                (1672531200)    // Simulation starts 2023-01-01 00:00:00 UTC
+#define FS_SECONDS_PER_DAY      (86400)         // Seconds in a day
+#define FS_LEVEL_CHECK_SECS     (360)           // Level task period (TAT_LEVEL_CHECK_SECS in src/config.h)
+#define FS_HTTP_TIMEOUT_MILLIS  (5000)          // HTTPClient's default timeout
+#define FS_SEMIDIURNAL_SECS     (44714.0)       // Period of the stand-in's semidiurnal constituent (M2)
+#define FS_DIURNAL_SECS         (86164.0)       // Period of its diurnal constituent (K1)
+
+enum fs_kind_t : uint8_t {fsPredictions, fsHilo, fsLatest, fsKinds};    // The kinds of request
+static const char *kindNames[fsKinds] = {"predictions", "hilo", "latest"};
+
+struct fs_request_t {                           // A request, as the server saw it
+  uint64_t arrive;                              //  When it arrived (simulated millis)
+  uint64_t done;                                //  When the device got its answer or gave up
+  fs_kind_t kind;                               //  What it was for
+  bool ok;                                      //  Whether it was answered
+};
+
+/**
+ * @brief The stand-in for NOAA: the tides at each station, and a server with a fixed number of
+ *        slots that serves requests in the order they arrive.
+ */
+class StandIn {
+public:
+  StandIn(int stations, int days, int slots, uint32_t latency, uint64_t outageStart, uint64_t outageEnd) :
+    latency(latency), outageStart(outageStart), outageEnd(outageEnd), rng(1) {
+    for (int s = 0; s < slots; s++) {
+      slotFree.push(0);
+    }
+    // Find each station's high and low tides, minute by minute, from a day before the start to
+    // two days after the end
+    events.resize(stations);
+    for (int s = 0; s < stations; s++) {
+      time_t from = FS_START - FS_SECONDS_PER_DAY, to = FS_START + (days + 2) * FS_SECONDS_PER_DAY;
+      float prev = level(s, from - 60), cur = level(s, from);
+      for (time_t t = from; t < to; t += 60) {
+        float next = level(s, t + 60);
+        if ((cur > prev && cur >= next) || (cur < prev && cur <= next)) {
+          events[s].push_back({static_cast<uint32_t>(t), static_cast<int16_t>(lroundf(cur * 100)),
+            static_cast<uint8_t>(cur > prev ? TT_TYPE_HIGH : TT_TYPE_LOW), 0});
+        }
+        prev = cur;
+        cur = next;
+      }
+    }
+  }
+
+  // The predicted level at station s at time t (feet)
+  float level(int s, time_t t) {
+    double x = t - FS_START;
+    return 4.0 + 3.0 * cos(2 * PI * x / FS_SEMIDIURNAL_SECS + 0.7 * s) + 1.2 * cos(2 * PI * x / FS_DIURNAL_SECS + 1.3 * s);
+  }
+
+  // The observed level at station s at time t: the prediction with a slowly wandering offset
+  float observed(int s, time_t t) {
+    return level(s, t) + 0.3 + 0.2 * sin((t - FS_START) / 40000.0 + s);
+  }
+
+  // The high and low tides at station s in the range hours starting at midnight on t's day, as
+  // the firmware asks for them
+  uint16_t tides(int s, time_t t, uint16_t range, tt_event_t *out, uint16_t maxEvents) {
+    uint32_t from = (t / FS_SECONDS_PER_DAY) * FS_SECONDS_PER_DAY, to = from + range * 3600;
+    uint16_t n = 0;
+    for (const tt_event_t &e : events[s]) {
+      if (e.time >= from && e.time < to && n < maxEvents) {
+        out[n++] = e;
+      }
+    }
+    return n;
+  }
+
+  // A request of the given kind arrives at simulated time ms; whether it's answered
+  bool request(uint64_t ms, fs_kind_t kind) {
+    fs_request_t r {ms, ms, kind, false};
+    if (ms < outageStart || ms >= outageEnd) {
+      uint64_t service = static_cast<uint64_t>(latency * (kind == fsPredictions ? 2 : 1) *
+        std::uniform_real_distribution<double>(0.5, 1.5)(rng));
+      uint64_t start = std::max(ms, slotFree.top());
+      if (start + service - ms > FS_HTTP_TIMEOUT_MILLIS) {
+        r.done = ms + FS_HTTP_TIMEOUT_MILLIS;   // Gave up waiting; the server drops it
+      } else {
+        slotFree.pop();
+        slotFree.push(start + service);
+        r.done = start + service;
+        r.ok = true;
+      }
+    }
+    log.push_back(r);
+    return r.ok;
+  }
+
+  std::vector<fs_request_t> log;                // Every request, in the order they arrived
+
+private:
+  uint32_t latency;                             // Mean time to serve a request (millis)
+  uint64_t outageStart, outageEnd;              // When the server is down (simulated millis)
+  std::mt19937 rng;                             // For the service times
+  std::priority_queue<uint64_t, std::vector<uint64_t>, std::greater<uint64_t>> slotFree; // When each slot is next free
+  std::vector<std::vector<tt_event_t>> events;  // Each station's high and low tides
+};
+
+/**
+ * @brief One simulated device: the parts of the firmware that decide when to fetch, plus what
+ *        the simulation keeps track of about it.
+ */
+struct Device {
+  TideClock clock {0, 0};                       // The tide clock; the pins don't matter
+  PredFetch predFetch;                          // getPredWl()'s decisions about fetching
+  HiloFetch hiloFetch;                          // getNextTide()'s cache and decisions about fetching
+  WlBias wlBias;                                // The observation-based correction
+  int station;                                  // Which station it's showing
+  uint64_t bootMs;                              // When it boots (simulated millis)
+  uint32_t phase;                               // When its clock task runs in each resolution step
+  bool booted = false;                          // Whether it's booted yet
+  time_t nextLevel = 0;                         // When its level task runs next
+  uint32_t staleSecs = 0;                       // How long it has had no predictions for the day
+  uint32_t requests = 0;                        // The number of requests it has made
+  uint32_t failures = 0;                        // How many of them failed
+};
+
+static StandIn *standIn;                        // The server
+static Device *current;                         // The device whose code is running
+
+/**
+ * @brief The simulated devices' fetchTides(); the 48 hours of tides from midnight today
+ */
+static bool fetchTides(Device &d, time_t t) {
+  tt_event_t events[HF_MAX_EVENTS];
+  d.requests++;
+  uint16_t n = standIn->request(millis(), fsHilo) ? standIn->tides(d.station, t, 48, events, HF_MAX_EVENTS) : 0;
+  if (n == 0) {
+    d.failures++;
+    d.hiloFetch.failed(t);
+    return false;
+  }
+  d.hiloFetch.store(t, events, n);
+  return true;
+}
+
+/**
+ * @brief The simulated devices' get-next-tide handler; getNextTide() in src/main.cpp without a
+ *        tide table.
+ */
+static tc_tide_t simGetNextTide() {
+  time_t t = FS_START + millis() / 1000;
+  tt_event_t event;
+  if (current->hiloFetch.nextEvent(t, &event) || (fetchTides(*current, t) && current->hiloFetch.nextEvent(t, &event))) {
+    return {static_cast<uint8_t>(event.type == TT_TYPE_HIGH ? HIGH : LOW), static_cast<time_t>(event.time)};
+  }
+  return {TC_UNAVAILABLE, 0};
+}
+
+/**
+ * @brief The simulated devices' level task; levelTask() and getPredWl() in src/main.cpp without
+ *        a tide table, and with the display left out.
+ */
+static void levelTask(Device &d, time_t t, bool useObs) {
+  if (d.hiloFetch.refreshDue(t)) {
+    fetchTides(d, t);
+  }
+  time_t day = d.predFetch.due(t);
+  if (day != 0) {
+    d.requests++;
+    bool ok = standIn->request(millis(), fsPredictions);
+    d.failures += !ok;
+    d.predFetch.fetched(t, day, ok);
+  }
+  bool available = d.predFetch.have(t);
+  if (!available) {
+    d.staleSecs += FS_LEVEL_CHECK_SECS;
+  }
+  if (available && useObs && d.wlBias.pollDue(t)) {
+    d.requests++;
+    if (standIn->request(millis(), fsLatest)) {
+      d.wlBias.update(t, standIn->observed(d.station, t), standIn->level(d.station, t));
+    } else {
+      d.failures++;
+      d.wlBias.missed(t);
+    }
+  }
+}
+
+/**
+ * @brief The p'th percentile of v, which gets sorted
+ */
+static double percentile(std::vector<double> &v, double p) {
+  if (v.empty()) {
+    return 0;
+  }
+  std::sort(v.begin(), v.end());
+  return v[std::min(v.size() - 1, static_cast<size_t>(p / 100.0 * v.size()))];
+}
+
+int main(int argc, char **argv) {
+  int nDevices = 2000, days = 3, stations = 20, bootMinutes = 60, slots = 32;
+  uint32_t resolution = 1000, latency = 250;
+  int outageHour = -1, outageMinutes = 0;
+  bool useObs = true, spread = true, verbose = false;
+  const char *csvName = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      nDevices = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+      days = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      stations = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+      bootMinutes = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+      resolution = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+      slots = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+      latency = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-x") == 0 && i + 1 < argc && sscanf(argv[i + 1], "%d:%d", &outageHour, &outageMinutes) == 2) {
+      i++;
+    } else if (strcmp(argv[i], "-o") == 0) {
+      useObs = false;
+    } else if (strcmp(argv[i], "-u") == 0) {
+      spread = false;
+    } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+      csvName = argv[++i];
+    } else if (strcmp(argv[i], "-v") == 0) {
+      verbose = true;
+    } else {
+      fprintf(stderr, "Usage: %s [-n <devices>] [-d <days>] [-s <stations>] [-b <minutes>] [-r <millis>]\n"
+        "  [-c <slots>] [-l <millis>] [-x <hour>:<minutes>] [-o] [-u] [-t <csv file>] [-v]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (nDevices < 1 || days < 1 || stations < 1 || bootMinutes < 0 || resolution < 1 || slots < 1) {
+    fprintf(stderr, "The number of devices, days, stations and slots, and the resolution, must be positive.\n");
+    return 2;
+  }
+  uint64_t bootMillis = bootMinutes * 60000ULL;
+  uint64_t endMillis = days * FS_SECONDS_PER_DAY * 1000ULL;
+  uint64_t outageStart = outageHour < 0 ? endMillis : outageHour * 3600000ULL;
+  StandIn server {stations, days, slots, latency, outageStart, outageStart + outageMinutes * 60000ULL};
+  standIn = &server;
+
+  // Make the fleet, and the order in which the devices' tasks run in each resolution step
+  std::vector<Device> devices(nDevices);
+  std::mt19937 rng(42);
+  std::vector<int> order(nDevices);
+  for (int i = 0; i < nDevices; i++) {
+    devices[i].station = i % stations;
+    devices[i].bootMs = bootMillis == 0 ? 0 : std::uniform_int_distribution<uint64_t>(0, bootMillis - 1)(rng);
+    devices[i].phase = devices[i].bootMs % resolution;
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(), [&](int a, int b) { return devices[a].phase < devices[b].phase; });
+
+  // Run it
+  std::vector<double> tideLags;                 // Seconds from each tide until the clock knew the next one
+  auto startTime = std::chrono::steady_clock::now();
+  for (uint64_t base = 0; base < endMillis; base += resolution) {
+    for (int i : order) {
+      Device &d = devices[i];
+      uint64_t ms = base + d.phase;
+      if (ms < d.bootMs) {
+        continue;
+      }
+      current = &d;
+      hostMicros = ms * 1000;
+      Serial.quiet = !verbose || i != 0;
+      time_t t = FS_START + ms / 1000;
+      if (!d.booted) {
+        uint64_t mac = spread ? 0x240AC4000000ULL + i : 0x240AC4000000ULL;  // As in setup()
+        uint32_t seed = static_cast<uint32_t>(mac) ^ static_cast<uint32_t>(mac >> 32);
+        d.clock.begin(simGetNextTide, tcNonlinear, tcOne);
+        d.predFetch.begin(seed);
+        d.hiloFetch.begin(seed);
+        d.clock.setJitter(seed);
+        d.nextLevel = t;
+        d.booted = true;
+      }
+      if (t >= d.nextLevel) {
+        levelTask(d, t, useObs);
+        d.nextLevel += FS_LEVEL_CHECK_SECS;
+      }
+      time_t tideBefore = d.clock.getNextTide().time;
+      do {
+        d.clock.run(FS_START + millis() / 1000);
+        hostMicros += d.clock.getMinStepInterval() * 1000ULL;
+      } while (!d.clock.caughtUp() && millis() < ms + resolution);
+      time_t tideAfter = d.clock.getNextTide().time;
+      if (tideAfter != tideBefore && tideBefore != 0) {
+        tideLags.push_back(t - tideBefore);
+      }
+    }
+  }
+  double runSecs = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+  time_t endTime = FS_START + endMillis / 1000;
+  for (Device &d : devices) {                   // Clocks still waiting at the end
+    time_t tide = d.clock.getNextTide().time;
+    if (tide != 0 && tide < endTime) {
+      tideLags.push_back(endTime - tide);
+    }
+  }
+
+  // What the server saw: requests, failures and concurrency, second by second
+  size_t nSecs = endMillis / 1000 + FS_HTTP_TIMEOUT_MILLIS / 1000 + 1;
+  std::vector<uint32_t> perSec(nSecs), failPerSec(nSecs), concPerSec(nSecs);
+  std::vector<std::pair<uint64_t, int>> edges;
+  uint32_t byKind[fsKinds] = {}, failures = 0;
+  for (const fs_request_t &r : server.log) {
+    perSec[r.arrive / 1000]++;
+    byKind[r.kind]++;
+    if (!r.ok) {
+      failPerSec[r.arrive / 1000]++;
+      failures++;
+    }
+    if (r.done > r.arrive) {
+      edges.push_back({r.arrive, 1});
+      edges.push_back({r.done, -1});
+    }
+  }
+  std::sort(edges.begin(), edges.end());
+  uint32_t inFlight = 0;
+  size_t sec = 0;
+  for (auto &e : edges) {
+    while (sec < e.first / 1000) {              // Carry the level into the seconds until this change
+      sec++;
+      concPerSec[sec] = std::max(concPerSec[sec], inFlight);
+    }
+    inFlight += e.second;
+    concPerSec[sec] = std::max(concPerSec[sec], inFlight);
+  }
+
+  printf("Simulated %d devices on %d stations for %d days (booting over %d minutes, %u ms resolution) in %.1f s\n",
+    nDevices, stations, days, bootMinutes, resolution, runSecs);
+  printf("Requests: %zu (%s %u, %s %u, %s %u), %u failed\n", server.log.size(), kindNames[0], byKind[0],
+    kindNames[1], byKind[1], kindNames[2], byKind[2], failures);
+
+  // The peaks, once everything has booted
+  size_t from = (bootMillis + 999) / 1000;
+  uint32_t peakSec = 0, peakMin = 0, peakConc = 0, window = 0;
+  size_t peakSecAt = from, peakConcAt = from;
+  uint64_t total = 0;
+  for (size_t s = from; s < endMillis / 1000; s++) {
+    total += perSec[s];
+    window += perSec[s] - (s >= from + 60 ? perSec[s - 60] : 0);
+    peakMin = std::max(peakMin, window);
+    if (perSec[s] > peakSec) {
+      peakSec = perSec[s];
+      peakSecAt = s;
+    }
+    if (concPerSec[s] > peakConc) {
+      peakConc = concPerSec[s];
+      peakConcAt = s;
+    }
+  }
+  auto hhmmss = [](size_t s) {
+    static char buf[40];
+    snprintf(buf, sizeof(buf), "day %zu %02zu:%02zu:%02zu", s / FS_SECONDS_PER_DAY, (s / 3600) % 24, (s / 60) % 60, s % 60);
+    return buf;
+  };
+  printf("After boot:\n");
+  printf("  Mean rate          %.2f requests/s\n", total / static_cast<double>(endMillis / 1000 - from));
+  printf("  Peak rate          %u requests/s (at %s), %u requests/min\n", peakSec, hhmmss(peakSecAt), peakMin);
+  printf("  Peak concurrency   %u (at %s) with %d slots\n", peakConc, hhmmss(peakConcAt), slots);
+
+  // What the devices saw
+  std::vector<double> stale;
+  int staleDevices = 0;
+  for (Device &d : devices) {
+    stale.push_back(d.staleSecs / 3600.0);
+    staleDevices += d.staleSecs > 0;
+  }
+  size_t longLags = std::count_if(tideLags.begin(), tideLags.end(), [](double l) { return l > TC_ASK_TIDE_MILLIS / 1000; });
+  printf("Staleness:\n");
+  printf("  Water level        %d devices went without the day's predictions; p99 %.1f h, worst %.1f h\n",
+    staleDevices, percentile(stale, 99), percentile(stale, 100));
+  printf("  Tide clock         %zu tides; next tide known after p50 %.0f s, p99 %.0f s, worst %.0f s; %zu waits over %lu s\n",
+    tideLags.size(), percentile(tideLags, 50), percentile(tideLags, 99), percentile(tideLags, 100), longLags,
+    TC_ASK_TIDE_MILLIS / 1000);
+
+  // Hour by hour
+  printf("\n  UTC hour    requests  peak/s  peak concurrency  failed\n");
+  for (size_t h = 0; h < endMillis / 3600000; h++) {
+    uint32_t n = 0, pk = 0, pc = 0, f = 0;
+    for (size_t s = h * 3600; s < (h + 1) * 3600; s++) {
+      n += perSec[s];
+      f += failPerSec[s];
+      pk = std::max(pk, perSec[s]);
+      pc = std::max(pc, concPerSec[s]);
+    }
+    printf("  day %zu %02zu:00  %8u  %6u  %16u  %6u\n", h / 24, h % 24, n, pk, pc, f);
+  }
+
+  if (csvName != nullptr) {
+    FILE *csv = fopen(csvName, "w");
+    if (csv == nullptr) {
+      fprintf(stderr, "Can't write %s.\n", csvName);
+      return 1;
+    }
+    fprintf(csv, "second,requests,failed,concurrency\n");
+    for (size_t s = 0; s < endMillis / 1000; s++) {
+      fprintf(csv, "%zu,%u,%u,%u\n", s, perSec[s], failPerSec[s], concPerSec[s]);
+    }
+    fclose(csv);
+  }
+  return 0;
+}
@@ -0,0 +1,436 @@
+/****
+ *
+ * footprint.cpp
+ * Host tool reporting what each part of the firmware costs in flash and RAM. Part of Time and Tides.
+ *
+ * Reads the linker map PlatformIO leaves in .pio/build/<env>/firmware.map (platformio.ini asks
+ * for one) and adds up every input section the linker placed, by module: the tide clock, the
+ * water level display, fetching and parsing tide data, the network and TLS, the user interface
+ * and so on, down to the Arduino core and ESP-IDF. A section is put in a module by the library
+ * or object file it came from or, for the ones in main.cpp, by the function or variable it
+ * holds (the sketch is compiled with -ffunction-sections and -fdata-sections, so each gets its
+ * own). The rules are in moduleRules below; anything they don't catch is "other".
+ *
+ * Flash is what goes in the app image: code and constants run from flash, plus code run from
+ * IRAM and initialized data, which are copied out of it at boot. RAM is what's taken out of the
+ * internal SRAM the heap would otherwise have: IRAM code, data and bss. RTC is RTC memory.
+ *
+ * Given a second map (e.g., the full build's, with the first the minimal build's), it shows how
+ * each module changed. Given budgets (-b <module>:<flash bytes>:<RAM bytes>), it marks the modules
+ * that are over and exits with status 1 if any is. -t <n> lists the n biggest sections, to see
+ * what's in a module.
+ *
+ * Build and run (from the repository root):
+ *
+ *   g++ -std=c++17 -O2 -o footprint tools/footprint.cpp
+ *   ./footprint .pio/build/esp32s2_min/firmware.map .pio/build/esp32s2/firmware.map
+ *   ./footprint -b UI:40000:2000 -t 20 .pio/build/esp32s2_min/firmware.map
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ *
+ ****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+/**
+ * @brief Where the contents of an output section end up
+ */
+struct place_t {
+  const char *prefix;                           // The output section's name, or the start of it
+  bool flash;                                   // In the app image
+  bool ram;                                     // In internal SRAM
+  bool rtc;                                     // In RTC memory
+};
+static const place_t places[] = {
+  {".flash.",         true,   false,  false},   // .flash.text, .flash.rodata, .flash.appdesc, ...
+  {".iram0.bss",      false,  true,   false},
+  {".iram0.",         true,   true,   false},   // .iram0.vectors, .iram0.text, .iram0.data
+  {".dram0.bss",      false,  true,   false},
+  {".dram0.data",     true,   true,   false},
+  {".noinit",         false,  true,   false},
+  {".rtc.bss",        false,  false,  true},
+  {".rtc_noinit",     false,  false,  true},
+  {".rtc.",           true,   false,  true},    // .rtc.text, .rtc.data, .rtc.force_fast, ...
+};
+
+/**
+ * @brief Which module a section belongs to: one whose file's path contains one of files, or
+ *        that holds a function or variable named in names ("x*" for any starting with x).
+ *        The first rule that fits wins.
+ */
+struct rule_t {
+  const char *module;
+  const char *files;                            // Space-separated substrings of the path
+  const char *names;                            // Space-separated names
+};
+static const rule_t moduleRules[] = {
+  {"TideClock",     "libTideClock.a /TideClock/",
+                    "tc clockTask sleepUntilNextTick getNextTide tickSchedule*"},
+  {"WlDisplay",     "libWlDisplay.a /WlDisplay/ libFastGpio.a /FastGpio/",
+                    "wld displayTask stillDisplayPos GStepper* FastPin*"},
+  {"fetch/parse",   "libTideData.a /TideData/ libWlBias.a /WlBias/",
+                    "fetch* startFetch cancelFetch usingProxy attachWire parse* fitPredCurve getPredWl levelTask "
+                    "predCurve predFetch hiloFetch wlBias tidesNeeded handshakesSeen tideTable* tideArchive mapTideTable "
+                    "toNOAAformat fromNOAAformat toHhmmss AsyncFetch* TideWire* ArduinoJson*"},
+  {"resume",        "",
+                    "resume* saveResume saveResumeClock forgetResume"},
+  {"network/TLS",   "libWiFi.a libWiFiClientSecure.a libHTTPClient.a libmbed liblwip libesp_wifi libnet80211 "
+                    "libpp.a libwpa_supplicant libesp_netif libcoexist libphy libesp_phy libtcpip_adapter "
+                    "libesp-tls libesp_http /WiFi/ /WiFiClientSecure/ /HTTPClient/ libAsyncFetch.a /AsyncFetch/",
+                    "tls* connectWiFi setClock WiFiMulti onWiFiEvent tatCaBundle TlsClient* EspLink* wifiUpMillis"},
+  {"flash log",     "libFlashLog.a /FlashLog/",
+                    "flashLog logFlash logEvent dumpLog homingsLogged FlashLog* EspFlash*"},
+  {"profiler",      "libProfiler.a /Profiler/",
+                    "profiler Profiler*"},
+  {"UI",            "libUserInput.a /UserInput/ libRpcLink.a /RpcLink/",
+                    "ui rpc on* rpc* topic* uiTask configToString putConfig getConfig config restartRequested "
+                    "testTask test* tune* startTuneTrial advanceTune bench* pulseMahPerDay blinkLED UserInput* RpcLink*"},
+  {"metrics",       "libMetrics.a /Metrics/",
+                    "metrics* setupMetrics collectMetrics m[A-Z]* Metrics*"},
+  {"scheduler",     "libCoopSched.a /CoopSched/",
+                    "sched CoopSched*"},
+  {"main (other)",  "/src/main.cpp.o",
+                    ""},
+  {"Arduino core",  "libFrameworkArduino.a /FrameworkArduino/",
+                    ""},
+  {"C/C++ runtime", "libc.a libm.a libgcc.a libstdc++.a libsupc++.a libnewlib",
+                    ""},
+  {"ESP-IDF",       "framework-arduinoespressif32 esp-idf",
+                    ""},
+};
+#define N_MODULES   (sizeof(moduleRules) / sizeof(moduleRules[0]) + 2)  // Plus "(fill)" and "other"
+
+/**
+ * @brief A placed input section
+ */
+struct section_t {
+  std::string name;                             // The input section's name, e.g., ".text._Z9clockTaskv"
+  std::string symbol;                           // The first symbol the map lists in it, if any
+  std::string file;                             // The object file it came from
+  const place_t *place;                         // Where it ended up
+  unsigned long size;                           // Its size (bytes)
+  int module;                                   // The module it belongs to
+};
+
+/**
+ * @brief The bytes a module (or a section) costs
+ */
+struct cost_t {
+  long flash = 0;
+  long ram = 0;
+  long rtc = 0;
+};
+
+static const char *moduleName(int m) {
+  return m < (int)(N_MODULES - 2) ? moduleRules[m].module : m == (int)(N_MODULES - 2) ? "(fill)" : "other";
+}
+
+/**
+ * @brief The name of the function or variable a section name or symbol is about: for a C++
+ *        mangled name, the first part of it (a function's name, or the class or namespace it's
+ *        in); for a demangled one, the part before any "::" or "("; otherwise the name itself.
+ */
+static std::string baseName(const std::string &id) {
+  if (id.compare(0, 2, "_Z") == 0) {
+    size_t i = 2;
+    while (i < id.size() && strchr("LNKVr", id[i]) != nullptr) {
+      i++;
+    }
+    if (id.compare(i, 2, "St") == 0) {
+      return "std";
+    }
+    size_t len = 0;
+    while (i < id.size() && id[i] >= '0' && id[i] <= '9') {
+      len = len * 10 + (id[i++] - '0');
+    }
+    return len > 0 && i + len <= id.size() ? id.substr(i, len) : id;
+  }
+  size_t end = id.find_first_of(":( ");
+  return id.substr(0, end);
+}
+
+/**
+ * @brief Whether name fits pattern: the same, or, for "x*", starting with x. "m[A-Z]*" is the
+ *        sketch's metric ids: "m" followed by a capital.
+ */
+static bool nameFits(const std::string &name, const std::string &pattern) {
+  if (pattern == "m[A-Z]*") {
+    return name.size() > 1 && name[0] == 'm' && name[1] >= 'A' && name[1] <= 'Z';
+  }
+  if (!pattern.empty() && pattern.back() == '*') {
+    return name.compare(0, pattern.size() - 1, pattern, 0, pattern.size() - 1) == 0;
+  }
+  return name == pattern;
+}
+
+static bool anyFits(const char *list, const std::string &subject, bool isName) {
+  std::istringstream words(list);
+  std::string w;
+  while (words >> w) {
+    if (isName ? nameFits(subject, w) : subject.find(w) != std::string::npos) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Work out which module a section belongs to
+ */
+static int classify(const section_t &s) {
+  if (s.name == "*fill*") {
+    return N_MODULES - 2;
+  }
+  // The name in ".text._Z9clockTaskv" is "clockTask"; in ".bss.tc", "tc"; in ".iram1.5" or
+  // ".rodata.str1.1", none, so go by the symbol in it, if there is one
+  std::string id = baseName(s.name.substr(s.name.find_last_of('.') + 1));
+  if (id.empty() || isdigit((unsigned char)id[0])) {
+    id = baseName(s.symbol);
+  }
+  for (int m = 0; m < (int)(N_MODULES - 2); m++) {
+    if (anyFits(moduleRules[m].files, s.file, false)) {
+      return m;
+    }
+    if (!id.empty() && s.file.find("main.cpp") != std::string::npos && anyFits(moduleRules[m].names, id, true)) {
+      return m;
+    }
+  }
+  return N_MODULES - 1;
+}
+
+static const place_t *placeOf(const std::string &outSection) {
+  for (const place_t &p : places) {
+    if (outSection.compare(0, strlen(p.prefix), p.prefix) == 0) {
+      return &p;
+    }
+  }
+  return nullptr;
+}
+
+static cost_t costOf(const section_t &s) {
+  cost_t c;
+  c.flash = s.place->flash ? s.size : 0;
+  c.ram = s.place->ram ? s.size : 0;
+  c.rtc = s.place->rtc ? s.size : 0;
+  return c;
+}
+
+static bool isHex(const std::string &w) {
+  return w.size() > 2 && w[0] == '0' && w[1] == 'x';
+}
+
+/**
+ * @brief Read the placed input sections from a GNU ld map file
+ *
+ * @return false Couldn't read it, or it isn't a map
+ */
+static bool readMap(const char *path, std::vector<section_t> &sections) {
+  std::ifstream in(path);
+  if (!in) {
+    return false;
+  }
+  std::string line;
+  bool inMap = false;
+  const place_t *place = nullptr;               // Where the current output section goes; null if nowhere we count
+  std::string pending;                          // An input section name on a line of its own
+  bool wantSymbol = false;                      // Whether the last section still wants a symbol name
+  while (std::getline(in, line)) {
+    if (!inMap) {
+      inMap = line.rfind("Linker script and memory map", 0) == 0;
+      continue;
+    }
+    if (line.compare(0, 7, "OUTPUT(") == 0) {
+      break;
+    }
+    if (line.empty()) {
+      continue;
+    }
+    std::istringstream words(line);
+    std::vector<std::string> w;
+    std::string word;
+    while (words >> word) {
+      w.push_back(word);
+    }
+    if (line[0] != ' ') {                       // An output section (or LOAD, or some such)
+      place = line[0] == '.' ? placeOf(w[0]) : nullptr;
+      pending.clear();
+      wantSymbol = false;
+      continue;
+    }
+    if (place == nullptr) {
+      continue;
+    }
+    std::string name;
+    size_t at;                                  // Where the address is in w
+    if (!isHex(w[0]) && w[0][0] != '*') {       // " .text.foo 0x... 0x... file" or " .text.foo"
+      if (w.size() == 1) {
+        pending = w[0];
+        continue;
+      }
+      name = w[0];
+      at = 1;
+    } else if (w[0] == "*fill*") {
+      name = w[0];
+      at = 1;
+    } else if (isHex(w[0]) && !pending.empty()) {  // The rest of a pending section's line
+      name = pending;
+      at = 0;
+    } else {
+      if (isHex(w[0]) && w.size() >= 2 && !isHex(w[1]) && wantSymbol) {  // "0x... symbol"
+        sections.back().symbol = line.substr(line.find(w[1]));
+        wantSymbol = false;
+      }
+      continue;
+    }
+    pending.clear();
+    if (w.size() < at + 2 || !isHex(w[at]) || !isHex(w[at + 1])) {
+      continue;
+    }
+    unsigned long size = strtoul(w[at + 1].c_str(), nullptr, 16);
+    if (size == 0) {
+      continue;
+    }
+    section_t s;
+    s.name = name;
+    for (size_t i = at + 2; i < w.size(); i++) {
+      s.file += (i > at + 2 ? " " : "") + w[i];
+    }
+    s.place = place;
+    s.size = size;
+    sections.push_back(s);
+    wantSymbol = name != "*fill*";
+  }
+  for (section_t &s : sections) {
+    s.module = classify(s);
+  }
+  return inMap;
+}
+
+static void total(const std::vector<section_t> &sections, std::vector<cost_t> &byModule, cost_t &all) {
+  byModule.assign(N_MODULES, cost_t());
+  for (const section_t &s : sections) {
+    cost_t c = costOf(s);
+    byModule[s.module].flash += c.flash;
+    byModule[s.module].ram += c.ram;
+    byModule[s.module].rtc += c.rtc;
+    all.flash += c.flash;
+    all.ram += c.ram;
+    all.rtc += c.rtc;
+  }
+}
+
+int main(int argc, char **argv) {
+  std::map<std::string, cost_t> budgets;
+  int top = 0;
+  int opt = 1;
+  for (; opt < argc && argv[opt][0] == '-'; opt++) {
+    if (strcmp(argv[opt], "-b") == 0 && opt + 1 < argc) {
+      std::string b = argv[++opt];
+      size_t c1 = b.find(':'), c2 = b.find(':', c1 + 1);
+      if (c1 == std::string::npos || c2 == std::string::npos) {
+        fprintf(stderr, "Budgets look like <module>:<flash bytes>:<RAM bytes>, not %s\n", b.c_str());
+        return 2;
+      }
+      cost_t &budget = budgets[b.substr(0, c1)];
+      budget.flash = atol(b.substr(c1 + 1, c2 - c1 - 1).c_str());
+      budget.ram = atol(b.substr(c2 + 1).c_str());
+    } else if (strcmp(argv[opt], "-t") == 0 && opt + 1 < argc) {
+      top = atoi(argv[++opt]);
+    } else {
+      break;
+    }
+  }
+  if (argc - opt < 1 || argc - opt > 2) {
+    fprintf(stderr, "Usage: %s [-b <module>:<flash bytes>:<RAM bytes>]... [-t <n>] <firmware.map> [<baseline firmware.map>]\n", argv[0]);
+    return 2;
+  }
+  std::vector<section_t> sections, baseSections;
+  bool compare = argc - opt == 2;
+  if (!readMap(argv[opt], sections) || (compare && !readMap(argv[opt + 1], baseSections))) {
+    fprintf(stderr, "Can't read %s as a linker map.\n", compare && !sections.empty() ? argv[opt + 1] : argv[opt]);
+    return 2;
+  }
+  for (const auto &b : budgets) {
+    bool known = false;
+    for (size_t m = 0; m < N_MODULES; m++) {
+      known = known || b.first == moduleName(m);
+    }
+    if (!known) {
+      fprintf(stderr, "There's no module called %s.\n", b.first.c_str());
+      return 2;
+    }
+  }
+
+  std::vector<cost_t> byModule, baseByModule;
+  cost_t all, baseAll;
+  total(sections, byModule, all);
+  if (compare) {
+    total(baseSections, baseByModule, baseAll);
+  }
+
+  printf("%-16s %10s %10s %8s", "Module", "Flash", "RAM", "RTC");
+  if (compare) {
+    printf(" %10s %10s %8s", "+Flash", "+RAM", "+RTC");
+  }
+  printf("\n");
+  int over = 0;
+  for (size_t m = 0; m < N_MODULES; m++) {
+    const cost_t &c = byModule[m];
+    if (c.flash == 0 && c.ram == 0 && c.rtc == 0 && (!compare || (baseByModule[m].flash == 0 && baseByModule[m].ram == 0))) {
+      continue;
+    }
+    printf("%-16s %10ld %10ld %8ld", moduleName(m), c.flash, c.ram, c.rtc);
+    if (compare) {
+      const cost_t &b = baseByModule[m];
+      printf(" %+10ld %+10ld %+8ld", c.flash - b.flash, c.ram - b.ram, c.rtc - b.rtc);
+    }
+    auto budget = budgets.find(moduleName(m));
+    if (budget != budgets.end()) {
+      bool flashOver = c.flash > budget->second.flash, ramOver = c.ram > budget->second.ram;
+      printf("  %s", flashOver || ramOver ? "OVER BUDGET" : "within budget");
+      if (flashOver) {
+        printf(" flash by %ld", c.flash - budget->second.flash);
+      }
+      if (ramOver) {
+        printf(" RAM by %ld", c.ram - budget->second.ram);
+      }
+      over += flashOver || ramOver;
+    }
+    printf("\n");
+  }
+  printf("%-16s %10ld %10ld %8ld", "Total", all.flash, all.ram, all.rtc);
+  if (compare) {
+    printf(" %+10ld %+10ld %+8ld", all.flash - baseAll.flash, all.ram - baseAll.ram, all.rtc - baseAll.rtc);
+  }
+  printf("\n");
+
+  if (top > 0) {
+    std::vector<const section_t *> biggest;
+    for (const section_t &s : sections) {
+      biggest.push_back(&s);
+    }
+    std::sort(biggest.begin(), biggest.end(), [](const section_t *a, const section_t *b) {
+      return a->size > b->size;
+    });
+    printf("\n%-16s %8s %-5s %s\n", "Module", "Bytes", "Where", "Section (symbol) file");
+    for (int i = 0; i < top && i < (int)biggest.size(); i++) {
+      const section_t &s = *biggest[i];
+      const char *where = s.place->rtc ? "RTC" : s.place->ram ? (s.place->flash ? "both" : "RAM") : "flash";
+      std::string file = s.file.substr(s.file.find_last_of('/') == std::string::npos ? 0 : s.file.find_last_of('/') + 1);
+      printf("%-16s %8lu %-5s %s%s%s%s %s\n", moduleName(s.module), s.size, where, s.name.c_str(),
+        s.symbol.empty() ? "" : " (", s.symbol.c_str(), s.symbol.empty() ? "" : ")", file.c_str());
+    }
+  }
+  return over > 0 ? 1 : 0;
+}
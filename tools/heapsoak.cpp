@@ -0,0 +1,983 @@
+/****
+ *
+ * heapsoak.cpp
+ * Host tool for finding slow heap leaks and fragmentation. Part of Time and Tides.
+ *
+ * Devices run for months, so memory that leaks a few bytes a day, or a heap that gets a little
+ * more chopped up every time the String-heavy fetch code runs, takes months to show up on one.
+ * This runs a year of a device's life in a few seconds, on a model of the ESP32's heap, and
+ * says whether the heap is heading anywhere:
+ *
+ *   - The heap model (EspHeap) is a fixed arena managed like ESP-IDF's multi_heap: a TLSF
+ *     (two-level segregated fit) allocator with 4-byte alignment, a 4-byte header on every
+ *     block, a 12-byte minimum, immediate coalescing of neighbouring free blocks, and
+ *     realloc() that grows in place when the next block is free. The String in tools/host gets
+ *     and grows its buffers from it the way arduino-esp32's WString does.
+ *   - The firmware is the real TideClock, PredFetch, HiloFetch and WlBias code, compiled
+ *     natively, with the String-heavy parts of src/main.cpp -- toNOAAformat(), fromNOAAformat(),
+ *     toHhmmss(), configToString(), startFetch(), fetchFinished(), parseTides(),
+ *     parsePredictions() and getNextTide() -- carried over, along with what AsyncFetch,
+ *     ArduinoJson, mbedTLS and lwIP allocate. Those are approximations (see the HS_ constants):
+ *     the sizes and the order things are allocated and freed in, not the libraries' code.
+ *   - The rest of the device's life: UI commands (config, tide, wl) at random times (-c),
+ *     metrics scrapes (-m), WiFi reconnections (-r), which free and reallocate the WiFi
+ *     driver's state, and fetches that fail (-x), part way through the TLS handshake or with
+ *     an HTTP error.
+ *
+ * Each time the level task finishes, with nothing transient allocated, it samples the free
+ * heap and the largest free block. It reports each day's median of those, fits a line to them
+ * (leaving out the warm-up, -w) and fails -- exit status 1 -- if either is trending down by
+ * more than the limits (-l and -g, bytes per 30 days), or if an allocation ever failed. -j
+ * leaks some bytes every day, to check that the harness catches a leak.
+ *
+ * Build and run (from the repository root):
+ *
+ *   g++ -std=c++17 -O2 -Itools/host -Ilib/Snapshot -Ilib/FastGpio -Ilib/TideClock -Ilib/TideData -Ilib/WlBias -o heapsoak tools/heapsoak.cpp lib/TideClock/TideClock.cpp lib/TideClock/TideSchedule.cpp lib/TideData/PredFetch.cpp lib/WlBias/WlBias.cpp
+ *   ./heapsoak -d 365
+ *
+ * Usage: heapsoak [-d <days>] [-k <heap bytes>] [-c <per day>] [-m <secs>] [-r <per week>]
+ *                 [-x <percent>] [-w <days>] [-l <bytes>] [-g <bytes>] [-j <bytes>] [-s <seed>]
+ *                 [-t <csv file>] [-v]
+ *
+ *   -d   The number of days to simulate (default 365)
+ *   -k   The size of the heap, i.e., what's free once setup() is done (default 160000 bytes)
+ *   -c   UI commands a day, on average (default 20)
+ *   -m   Seconds between metrics scrapes; 0 for none (default 60)
+ *   -r   WiFi reconnections a week, on average (default 2)
+ *   -x   The percentage of fetches that fail (default 3)
+ *   -w   Days of warm-up to leave out of the trends (default 7)
+ *   -l   Fail if the free heap falls by more than this many bytes per 30 days (default 64)
+ *   -g   Fail if the largest free block falls by more than this many bytes per 30 days
+ *        (default 512)
+ *   -j   Leak this many bytes a day
+ *   -s   The seed for the random parts (default 1)
+ *   -t   Write each day's free heap and largest free block to a CSV file
+ *   -v   Let the firmware's Serial output through
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ *
+ ****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <vector>
+#include <deque>
+#include <map>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <string>
+#include "TideClock.h"
+#include "PredFetch.h"
+#include "WlBias.h"
+
+// Some constants
+#define HS_START                (1672531200)    // Simulation starts 2023-01-01 00:00:00 UTC
+#define HS_SECONDS_PER_DAY      (86400)         // Seconds in a day
+#define HS_SEMIDIURNAL_SECS     (44714.0)       // Period of the made-up tide's semidiurnal constituent (M2)
+#define HS_DIURNAL_SECS         (86164.0)       // Period of its diurnal constituent (K1)
+
+// The parts of src/config.h and src/main.cpp the firmware's stand-in uses
+#define TAT_LEVEL_CHECK_SECS    (360)
+#define TAT_FETCH_KEEP_MILLIS   (10000)
+#define TAT_SERVER_URL          "https://api.tidesandcurrents.noaa.gov/api/prod/datagetter"
+#define TAT_GET_WL              "application=David_Ehnebuske&"\
+                                "units=english&time_zone=gmt&datum=MLLW&format=json&"\
+                                "product=one_minute_water_level&date=latest&station="
+#define TAT_GET_PRED_TIDES      "application=David_Ehnebuske&units=english&"\
+                                "time_zone=gmt&datum=MLLW&format=json&"\
+                                "product=predictions&interval=hilo&range=48&begin_date="
+#define TAT_JSON_CAPACITY_TIDES (768)
+#define TAT_GET_PRED_WL         "application=David_Ehnebuske&"\
+                                "units=english&time_zone=gmt&datum=MLLW&format=json&"\
+                                "range=24&product=predictions&begin_date="
+#define TAT_JSON_CAPACITY_PRED  (24576)
+#define TAT_N_PRED_WL           (241)
+#define LEVEL_UNAVAILABLE       (-10000)
+#define TAT_FETCH_MAX_SIZE      (16384)
+#define AF_GROW_SIZE            (2048)
+enum fetchFor_t {fetchNone, fetchHilo, fetchPred, fetchObs};
+
+// What the libraries underneath allocate (approximately)
+#define HS_TCP_BUFFER           (1436)          // WiFiClient's read buffer, and a TCP segment's payload
+#define HS_PBUF                 (1600)          // A received TCP segment, in the WiFi driver and lwIP
+#define HS_PCB                  (200)           // An lwIP TCP connection (pcb, netconn and socket)
+#define HS_TIME_WAIT_SECS       (120)           // How long a closed connection's pcb lingers (2 * TCP_MSL)
+#define HS_TLS_IN_BUFFER        (16717)         // mbedTLS's record buffers
+#define HS_TLS_OUT_BUFFER       (4437)
+#define HS_TLS_CONTEXT          (1900)          //   and the rest of what it keeps for a connection
+#define HS_TLS_TEMPS            (140)           // Short-lived allocations during a handshake
+#define HS_TLS_CERTS            (3)             // Certificates in the server's chain, kept until the connection closes
+#define HS_SOCKET_HANDLE        (40)            // A WiFiClient's shared socket handle
+
+static const int hsWifiState[] = {2048, 1536, 1024, 640, 512, 256, 256, 128, 96, 64}; // The WiFi driver's and lwIP's connection state
+/**
+ * @brief A model of the ESP32's heap: ESP-IDF's multi_heap, which is a TLSF allocator
+ */
+class EspHeap {
+public:
+  EspHeap(size_t size) : arena(size) {
+    uint32_t payload = (size - HEADER) & ~(ALIGN - 1);
+    blocks[0] = {payload, true};
+    freeBytes = payload;
+    insert(0);
+  }
+
+  void *malloc(size_t size) {
+    if (size == 0) {
+      return nullptr;
+    }
+    uint32_t want = adjust(size);
+    int fl, sl;
+    mapSearch(want, fl, sl);
+    uint32_t at;
+    if (!take(fl, sl, at)) {
+      failures++;
+      return nullptr;
+    }
+    blocks[at].free = false;
+    freeBytes -= blocks[at].size;
+    trim(at, want);
+    note();
+    return arena.data() + at + HEADER;
+  }
+
+  void free(void *ptr) {
+    if (ptr == nullptr) {
+      return;
+    }
+    uint32_t at = offset(ptr);
+    blocks[at].free = true;
+    freeBytes += blocks[at].size;
+    insert(merge(at));
+  }
+
+  void *realloc(void *ptr, size_t size) {
+    if (ptr == nullptr) {
+      return malloc(size);
+    }
+    if (size == 0) {
+      free(ptr);
+      return nullptr;
+    }
+    uint32_t at = offset(ptr), want = adjust(size), cur = blocks[at].size;
+    auto next = blocks.find(at + HEADER + cur);
+    bool nextFree = next != blocks.end() && next->second.free;
+    if (want > cur && (!nextFree || want > cur + HEADER + next->second.size)) {
+      void *moved = malloc(size);               // Can't grow in place; move it
+      if (moved != nullptr) {
+        memcpy(moved, ptr, cur);
+        free(ptr);
+      }
+      return moved;
+    }
+    if (want > cur) {                           // Grow into the next block
+      remove(next->first);
+      freeBytes -= next->second.size;
+      blocks[at].size += HEADER + next->second.size;
+      blocks.erase(next);
+    }
+    trim(at, want);
+    note();
+    return ptr;
+  }
+
+  size_t freeSize() const {                     // Free bytes, as heap_caps_get_free_size() says
+    return freeBytes;
+  }
+  size_t largestFree() const {                  // The largest free block, as heap_caps_get_largest_free_block() says
+    for (int fl = FL_COUNT - 1; fl >= 0; fl--) {
+      for (int sl = SL_COUNT - 1; sl >= 0; sl--) {
+        if (!lists[fl][sl].empty()) {
+          uint32_t most = 0;
+          for (uint32_t at : lists[fl][sl]) {
+            most = std::max(most, blocks.at(at).size);
+          }
+          return most;
+        }
+      }
+    }
+    return 0;
+  }
+  size_t freeBlocks() const {                   // The number of free blocks
+    size_t n = 0;
+    for (int fl = 0; fl < FL_COUNT; fl++) {
+      for (int sl = 0; sl < SL_COUNT; sl++) {
+        n += lists[fl][sl].size();
+      }
+    }
+    return n;
+  }
+
+  size_t minFree = SIZE_MAX;                    // The low water mark of freeSize()
+  uint64_t failures = 0;                        // Allocations that couldn't be satisfied
+
+private:
+  static constexpr uint32_t ALIGN = 4;          // Everything's 4-byte aligned
+  static constexpr uint32_t HEADER = 4;         // The size of a used block's header
+  static constexpr uint32_t MIN_BLOCK = 12;     // The smallest block (payload)
+  static constexpr int SL_LOG2 = 5;             // log2 of the number of second-level lists per first-level one
+  static constexpr int SL_COUNT = 1 << SL_LOG2;
+  static constexpr int FL_SHIFT = SL_LOG2 + 2;  // Blocks smaller than 1 << FL_SHIFT are all first level 0
+  static constexpr int FL_COUNT = 32 - FL_SHIFT + 1;
+
+  struct Block {
+    uint32_t size;                              // Payload size
+    bool free;
+  };
+
+  static int fls(uint32_t x) {
+    return 31 - __builtin_clz(x);
+  }
+  static uint32_t adjust(size_t size) {
+    uint32_t a = (size + ALIGN - 1) & ~(ALIGN - 1);
+    return a < MIN_BLOCK ? MIN_BLOCK : a;
+  }
+  static void mapInsert(uint32_t size, int &fl, int &sl) {
+    if (size < (1u << FL_SHIFT)) {
+      fl = 0;
+      sl = size / ((1u << FL_SHIFT) / SL_COUNT);
+    } else {
+      int f = fls(size);
+      sl = (size >> (f - SL_LOG2)) ^ SL_COUNT;
+      fl = f - (FL_SHIFT - 1);
+    }
+  }
+  static void mapSearch(uint32_t size, int &fl, int &sl) {
+    if (size >= (1u << FL_SHIFT)) {
+      size += (1u << (fls(size) - SL_LOG2)) - 1; // Round up to the next list, so any block in it fits
+    }
+    mapInsert(size, fl, sl);
+  }
+
+  uint32_t offset(void *ptr) const {
+    return (uint8_t *)ptr - arena.data() - HEADER;
+  }
+  void insert(uint32_t at) {
+    int fl, sl;
+    mapInsert(blocks[at].size, fl, sl);
+    lists[fl][sl].push_back(at);                // The most recently freed block is used first
+  }
+  void remove(uint32_t at) {
+    int fl, sl;
+    mapInsert(blocks[at].size, fl, sl);
+    std::vector<uint32_t> &l = lists[fl][sl];
+    l.erase(std::find(l.begin(), l.end(), at));
+  }
+  bool take(int fl, int sl, uint32_t &at) {
+    for (; fl < FL_COUNT; fl++, sl = 0) {
+      for (; sl < SL_COUNT; sl++) {
+        if (!lists[fl][sl].empty()) {
+          at = lists[fl][sl].back();
+          lists[fl][sl].pop_back();
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+  // Split what's past want off the used block at at, if it's big enough to be a block
+  void trim(uint32_t at, uint32_t want) {
+    uint32_t size = blocks[at].size;
+    if (size - want < HEADER + MIN_BLOCK) {
+      return;
+    }
+    blocks[at].size = want;
+    uint32_t rest = at + HEADER + want;
+    blocks[rest] = {size - want - HEADER, true};
+    freeBytes += blocks[rest].size;
+    insert(merge(rest));
+  }
+  // Coalesce the free block at at with free neighbours; where the result starts
+  uint32_t merge(uint32_t at) {
+    auto next = blocks.find(at + HEADER + blocks[at].size);
+    if (next != blocks.end() && next->second.free) {
+      remove(next->first);
+      blocks[at].size += HEADER + next->second.size;
+      freeBytes += HEADER;
+      blocks.erase(next);
+    }
+    auto it = blocks.find(at);
+    if (it != blocks.begin() && std::prev(it)->second.free) {
+      auto prev = std::prev(it);
+      remove(prev->first);
+      prev->second.size += HEADER + it->second.size;
+      freeBytes += HEADER;
+      blocks.erase(it);
+      return prev->first;
+    }
+    return at;
+  }
+  void note() {
+    minFree = std::min(minFree, freeBytes);
+  }
+
+  std::vector<uint8_t> arena;                   // The memory
+  std::map<uint32_t, Block> blocks;             // Every block, by where it starts in arena
+  std::vector<uint32_t> lists[FL_COUNT][SL_COUNT]; // The free blocks, by size class
+  size_t freeBytes = 0;                         // The total payload of the free blocks
+};
+
+static EspHeap *heap;                           // The device's heap
+static std::mt19937 rng;                        // For the random parts
+static double failPct;                          // The percentage of fetches that fail
+static uint32_t fetches, fetchFailures;         // Fetches made, and how many failed
+
+static bool chance(double p) {
+  return std::uniform_real_distribution<double>(0, 1)(rng) < p;
+}
+static int between(int lo, int hi) {
+  return std::uniform_int_distribution<int>(lo, hi)(rng);
+}
+
+/**
+ * @brief What the libraries underneath the firmware allocate for a connection: the TLS session
+ *        and the lwIP pcb, whose memory outlives the connection by HS_TIME_WAIT_SECS.
+ */
+class Connection {
+public:
+  bool connected() {
+    return !kept.empty();
+  }
+
+  // Connect and do the TLS handshake; whether it worked
+  bool connect(bool fail) {
+    pcb = heap->malloc(HS_PCB);
+    kept.push_back(heap->malloc(HS_TLS_CONTEXT));
+    kept.push_back(heap->malloc(HS_TLS_IN_BUFFER));
+    kept.push_back(heap->malloc(HS_TLS_OUT_BUFFER));
+    std::vector<void *> temps;
+    int steps = fail ? between(1, HS_TLS_TEMPS) : HS_TLS_TEMPS;
+    for (int i = 0; i < steps; i++) {           // Bignums, hashes and the like come and go
+      if (!temps.empty() && chance(0.45)) {
+        size_t victim = between(0, temps.size() - 1);
+        heap->free(temps[victim]);
+        temps.erase(temps.begin() + victim);
+      } else {
+        temps.push_back(heap->malloc(between(16, 600)));
+      }
+      if (i == HS_TLS_TEMPS / 3) {              // The server's certificates arrive
+        void *pbuf = heap->malloc(HS_PBUF);
+        for (int c = 0; c < HS_TLS_CERTS; c++) {
+          kept.push_back(heap->malloc(between(1200, 1800)));
+          for (int s = 0; s < 12; s++) {
+            kept.push_back(heap->malloc(between(24, 160)));
+          }
+        }
+        heap->free(pbuf);
+      }
+    }
+    for (void *p : temps) {
+      heap->free(p);
+    }
+    if (fail) {
+      stop(0);
+    }
+    return !fail;
+  }
+
+  // Close it at time t
+  void stop(time_t t) {
+    for (void *p : kept) {
+      heap->free(p);
+    }
+    kept.clear();
+    if (pcb != nullptr) {
+      linger(t + HS_TIME_WAIT_SECS, pcb);
+      pcb = nullptr;
+    }
+  }
+
+  // Keep a closed connection's pcb until time t
+  static void linger(time_t t, void *pcb) {
+    timeWait.push_back({t, pcb});
+  }
+
+  // Let go of the pcbs whose TIME_WAIT is over at time t
+  static void expire(time_t t) {
+    while (!timeWait.empty() && timeWait.front().first <= t) {
+      heap->free(timeWait.front().second);
+      timeWait.pop_front();
+    }
+  }
+
+private:
+  std::vector<void *> kept;                     // What the TLS session keeps until it's closed
+  void *pcb = nullptr;                          // The lwIP connection
+  static inline std::deque<std::pair<time_t, void *>> timeWait; // Closed connections' pcbs and when they go
+};
+
+/**
+ * @brief What a fetch asks the stand-in for NOAA's server, and what it gets back
+ */
+class StandIn {
+public:
+  // The predicted level at time t (feet)
+  static float level(time_t t) {
+    double x = t - HS_START;
+    return 4.0 + 3.0 * cos(2 * PI * x / HS_SEMIDIURNAL_SECS) + 1.2 * cos(2 * PI * x / HS_DIURNAL_SECS);
+  }
+
+  // The response to url, made at time t; NOAA's JSON
+  static std::string respond(const char *url, time_t t) {
+    char buf[64];
+    std::string body;
+    if (strstr(url, "interval=hilo") != nullptr) {
+      time_t from = (t / HS_SECONDS_PER_DAY) * HS_SECONDS_PER_DAY;
+      body = "{ \"predictions\" : [";
+      float prev = level(from - 60), cur = level(from);
+      for (time_t m = from; m < from + 48 * 3600; m += 60) {
+        float next = level(m + 60);
+        if ((cur > prev && cur >= next) || (cur < prev && cur <= next)) {
+          tm *mt = gmtime(&m);
+          strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M", mt);
+          body += std::string(body.back() == '[' ? "\n" : ",\n") + "{\"t\":\"" + buf + "\", \"v\":\"" +
+            std::to_string(cur).substr(0, 5) + "\", \"type\":\"" + (cur > prev ? "H" : "L") + "\"}";
+        }
+        prev = cur;
+        cur = next;
+      }
+      return body + "\n]}\n";
+    }
+    if (strstr(url, "product=predictions") != nullptr) {
+      time_t from = (t / HS_SECONDS_PER_DAY) * HS_SECONDS_PER_DAY;
+      body = "{ \"predictions\" : [";
+      for (int i = 0; i < TAT_N_PRED_WL; i++) {
+        time_t m = from + i * 360;
+        strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M", gmtime(&m));
+        body += std::string(i == 0 ? "\n" : ",\n") + "{\"t\":\"" + buf + "\", \"v\":\"" + std::to_string(level(m)).substr(0, 5) + "\"}";
+      }
+      return body + "\n]}\n";
+    }
+    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M", gmtime(&t));
+    return std::string("{\"metadata\":{\"id\":\"9444900\",\"name\":\"Port Townsend\",\"lat\":\"48.1129\",\"lon\":\"-122.7595\"}, "
+      "\"data\": [{\"t\":\"") + buf + "\", \"v\":\"" + std::to_string(level(t) + 0.3).substr(0, 5) + "\", \"s\":\"0.013\", \"f\":\"0,0,0,0\", \"q\":\"p\"}]}\n";
+  }
+};
+
+/**
+ * @brief What AsyncFetch allocates for a fetch. The request goes out of its own buffer and the
+ *        response headers are read a line at a time into another, so the only heap it uses is
+ *        the body's, grown with realloc() AF_GROW_SIZE bytes at a time since the server sends
+ *        its responses chunked. Like the fetcher, it keeps the connection for the next fetch.
+ */
+class FetchModel {
+public:
+  // Fetch what url asks for at time t, failing if fail says to; the HTTP status, or a negative error
+  int fetch(const char *url, bool fail, time_t t) {
+    unsigned long startMillis = millis();
+    if (startMillis - lastMillis > TAT_FETCH_KEEP_MILLIS) {
+      close(t);
+    }
+    bool failConnecting = fail && chance(0.5);
+    if (!conn.connected() && !conn.connect(failConnecting)) {
+      return -4;                                // AF_ERR_HANDSHAKE
+    }
+    void *pbuf = heap->malloc(strlen(url) + 160); // The request on its way out
+    heap->free(pbuf);
+    std::string response = fail ? std::string("{\"error\": {\"message\": \"Internal Server Error\"}}") :
+      StandIn::respond(url, t);
+    for (size_t got = 0; got < response.size(); got += HS_TCP_BUFFER) {
+      pbuf = heap->malloc(HS_PBUF);             // A segment of it
+      size_t len = std::min((size_t)HS_TCP_BUFFER, response.size() - got);
+      if (bodyLen + len + 1 > bodyCap) {
+        bodyCap = std::min(std::max(bodyCap + AF_GROW_SIZE, bodyLen + len + 1), (size_t)TAT_FETCH_MAX_SIZE + 1);
+        body = (char *)heap->realloc(body, bodyCap);
+      }
+      memcpy(body + bodyLen, response.c_str() + got, len);
+      bodyLen += len;
+      body[bodyLen] = '\0';
+      heap->free(pbuf);
+    }
+    lastMillis = millis();
+    return fail ? 500 : 200;
+  }
+
+  // The body of the last fetch
+  const char *text() {
+    return body == nullptr ? "" : body;
+  }
+
+  // Free it
+  void release() {
+    heap->free(body);
+    body = nullptr;
+    bodyCap = bodyLen = 0;
+  }
+
+  // Close the kept connection at time t
+  void close(time_t t) {
+    conn.stop(t);
+  }
+
+private:
+  Connection conn;                              // The connection, kept for the next fetch
+  char *body = nullptr;                         // The body of the last fetch
+  size_t bodyCap = 0, bodyLen = 0;              //   its buffer's size and its length
+  unsigned long lastMillis = 0;                 // millis() when the last fetch finished
+};
+
+/**
+ * @brief The simulated device: the real fetch scheduling code plus the state the firmware's
+ *        fetches keep in src/main.cpp
+ */
+struct Device {
+  TideClock tc {0, 0};                          // The tide clock; the pins don't matter
+  PredFetch predFetch;                          // getPredWl()'s decisions about fetching
+  HiloFetch hiloFetch;                          // getNextTide()'s cache and decisions about fetching
+  WlBias wlBias;                                // The observation-based correction
+  FetchModel fetcher;                           // What the fetches use
+  time_t fetchSecs;                             // When levelTask() started the fetch
+  time_t fetchDay;                              //   For predictions, the day they're for
+  bool tidesNeeded = false;                     // Set when getNextTide() found no tide to go on
+  char station[8] = "9444900";                  // config.station
+  char server[96] = TAT_SERVER_URL;             // config.server
+  time_t now;                                   // The time
+};
+static Device *dev;
+
+// toHhmmss() in src/main.cpp
+static String toHhmmss(time_t t) {
+  return String(ctime(&t)).substring(11, 19);
+}
+
+// toNOAAformat() in src/main.cpp
+static String toNOAAformat(time_t t, bool urlEncode = false) {
+  tm *tAsTM = localtime(&t);
+  return String(1900 + tAsTM->tm_year) +
+    String(tAsTM->tm_mon < 9 ? "0" : "") + String(1 + tAsTM->tm_mon) +
+    String(tAsTM->tm_mday < 10 ? "0" : "") + String(tAsTM->tm_mday) + String(urlEncode ? "&20" : " ") +
+    String(tAsTM->tm_hour < 10 ? "0" : "") + String(tAsTM->tm_hour) + ":" +
+    String(tAsTM->tm_min < 10 ? "0" : "") + String(tAsTM->tm_min);
+}
+
+// fromNOAAformat() in src/main.cpp
+static time_t fromNOAAformat(String noaa) {
+  String dateTime = noaa;
+  tm tideTm;
+  tideTm.tm_year = dateTime.substring(0, 4).toInt() - 1900;
+  tideTm.tm_mon = dateTime.substring(5, 7).toInt() - 1;
+  tideTm.tm_mday = dateTime.substring(8, 10).toInt();
+  tideTm.tm_hour = dateTime.substring(11, 13).toInt();
+  tideTm.tm_min = dateTime.substring(14).toInt();
+  tideTm.tm_sec = 0;
+  tideTm.tm_isdst = -1;
+  return mktime(&tideTm);
+}
+
+// configToString() in src/main.cpp, for the default configuration
+static String configToString() {
+  char buffer[400];
+  snprintf(buffer, sizeof(buffer), "Configuration: \n  ssid:     '%s'\n  pw:       '%s'\n  station:  '%s'\n"
+    "  minLevel: %f\n  maxLevel: %f\n  face:     %s\n  motor:    %s\n  pulse:    %u ms%s\n  interval: %u ms%s\n"
+    "  obs:      %s\n  server:   '%s'\n", "Need ssid", "Need password", dev->station, -4.3, 12.1, "nonlinear", "one",
+    0, " (motor default)", 0, " (motor default)", "on", dev->server);
+  return String(buffer);
+}
+
+// fetchesDone() in src/main.cpp
+static void fetchesDone() {
+  dev->fetcher.close(dev->now);
+}
+
+// parseTides() in src/main.cpp; ArduinoJson's DynamicJsonDocument is one block of its capacity,
+// and p["t"] and p["type"] come out as Strings
+static uint16_t parseTides(const char *payload, tt_event_t *events) {
+  uint16_t n = 0;
+  String timeStamp = toNOAAformat(dev->fetchSecs);
+  void *predictions = heap->malloc(TAT_JSON_CAPACITY_TIDES);
+  for (const char *at = strstr(payload, "{\"t\":\""); predictions != nullptr && at != nullptr && n < HF_MAX_EVENTS;
+    at = strstr(at + 1, "{\"t\":\"")) {
+    const char *v = strstr(at, "\"v\":\"") + 5, *type = strstr(at, "\"type\":\"") + 8;
+    String t, level, tideType;
+    t.concat(at + 6, 16);
+    level.concat(v, strchr(v, '"') - v);
+    tideType.concat(type, 1);
+    events[n].time = fromNOAAformat(t);
+    if (!ttParseLevel(level.c_str(), &events[n].level)) {
+      continue;
+    }
+    events[n].type = tideType.equals("H") ? TT_TYPE_HIGH : TT_TYPE_LOW;
+    events[n].reserved = 0;
+    n++;
+  }
+  heap->free(predictions);
+  return n;
+}
+
+// parsePredictions() in src/main.cpp; the same, with a bigger document
+static bool parsePredictions(const char *payload) {
+  void *predictions = heap->malloc(TAT_JSON_CAPACITY_PRED);
+  heap->free(predictions);
+  return predictions != nullptr && strstr(payload, "\"predictions\"") != nullptr;
+}
+
+// startFetch(), fetchTask() and fetchFinished() in src/main.cpp, without the proxy. The fetch is
+// done all at once rather than a slice at a time, which allocates the same things in the same order.
+static void startFetch(fetchFor_t what) {
+  String request;
+  if (what == fetchHilo) {
+    request = ((String(dev->server) + "?" TAT_GET_PRED_TIDES) + toNOAAformat(dev->fetchSecs, true)) + "&station=" + dev->station;
+  } else if (what == fetchPred) {
+    request = ((String(dev->server) + "?" TAT_GET_PRED_WL) + toNOAAformat(dev->fetchDay, true)) + "&station=" + dev->station;
+  } else {
+    request = (String(dev->server) + "?" TAT_GET_WL) + String(dev->station);
+  }
+  fetches++;
+  int status = dev->fetcher.fetch(request.c_str(), chance(failPct / 100.0), dev->now);
+  bool ok = status == 200;
+  if (status > 0 && !ok) {
+    Serial.printf("[fetchFinished] HTTPS GET unsuccessful. HTTP response code: %d\n", status);
+  } else if (status <= 0) {
+    Serial.printf("[fetchFinished] HTTPS GET failed while %s, error: '%s'.\n", "handshaking", "TLS handshake failed");
+  }
+  tt_event_t events[HF_MAX_EVENTS];
+  uint16_t n = 0;
+  int32_t observed = LEVEL_UNAVAILABLE;
+  bool got = false;
+  if (what == fetchHilo) {
+    n = ok ? parseTides(dev->fetcher.text(), events) : 0;
+    got = n > 0;
+  } else if (what == fetchPred) {
+    got = ok && parsePredictions(dev->fetcher.text());
+  } else if (ok) {
+    observed = lroundf((StandIn::level(dev->fetchSecs) + 0.3) * 100);  // parseActualWl()'s JsonDocument is on the stack
+    got = true;
+  }
+  dev->fetcher.release();
+  if (!ok) {
+    fetchFailures++;
+  }
+  if (what == fetchHilo) {
+    if (got) {
+      dev->hiloFetch.store(dev->fetchSecs, events, n);
+      dev->tc.askAgain();
+    } else {
+      dev->hiloFetch.failed(dev->fetchSecs);
+    }
+  } else if (what == fetchPred) {
+    dev->predFetch.fetched(dev->fetchSecs, dev->fetchDay, got);
+  } else if (!got) {
+    dev->wlBias.missed(dev->fetchSecs);
+  } else {
+    dev->wlBias.update(dev->fetchSecs, observed / 100.0f, StandIn::level(dev->fetchSecs));
+  }
+}
+
+// getNextTide() in src/main.cpp, without a tide table; the TideClock's handler. If it has no
+// tide to go on, the level task fetches them (sched.runNow(levelTaskId)); see main().
+static tc_tide_t getNextTide() {
+  time_t nowSecs = dev->now;
+  tc_tide_t answer {TC_UNAVAILABLE, 0};
+  String timeStamp = toNOAAformat(nowSecs);
+  tt_event_t event;
+  bool gotEvent = dev->hiloFetch.nextEvent(nowSecs, &event);
+  if (!gotEvent) {
+    dev->tidesNeeded = true;
+  }
+  if (gotEvent) {
+    answer.time = event.time;
+    answer.tideType = event.type == TT_TYPE_HIGH ? HIGH : LOW;
+    Serial.printf("[getNextTide %s] Next tide (%s) at %s\n", timeStamp.c_str(), answer.tideType == HIGH ? "high" : "low",
+      toHhmmss(answer.time).c_str());
+  } else {
+    Serial.printf("[getNextTide %s] Next tide data unavailable.\n", timeStamp.c_str());
+  }
+  return answer;
+}
+
+// levelTask() in src/main.cpp, without a tide table, and with the display left out. On the
+// device each fetch is a pass of its own, with fetchFinished() running the task again; here the
+// passes follow one another.
+static void levelTask() {
+  time_t curTime = dev->now;
+  dev->fetchSecs = curTime;
+  for (;;) {
+    if (dev->tidesNeeded || dev->hiloFetch.refreshDue(curTime)) {
+      dev->tidesNeeded = false;
+      startFetch(fetchHilo);
+      continue;
+    }
+    dev->fetchDay = dev->predFetch.due(curTime);
+    if (dev->fetchDay != 0) {
+      startFetch(fetchPred);
+      continue;
+    }
+    if (dev->predFetch.have(curTime) && dev->wlBias.pollDue(curTime)) {
+      startFetch(fetchObs);
+      continue;
+    }
+    break;
+  }
+  fetchesDone();
+}
+
+// A UI command: onConfig(), onTide() or onWl() in src/main.cpp. UserInput's getWord() answers a String.
+static void uiCommand() {
+  switch (between(0, 2)) {
+    case 0: {
+      String subCmd = "";                       // ui.getWord(1)
+      Serial.print(configToString());
+      break;
+    }
+    case 1:
+      Serial.printf("It is now %s UTC. The next tide is %s from now at %s.\n", toHhmmss(dev->now).c_str(),
+        toHhmmss(dev->tc.getNextTide().time - dev->now).c_str(), toHhmmss(dev->tc.getNextTide().time).c_str());
+      break;
+    default: {
+      String wlString = "";                     // ui.getWord(1)
+      Serial.printf("It is now %s UTC.\n", toHhmmss(dev->now).c_str());
+      break;
+    }
+  }
+}
+
+// A metrics scrape: MetricsHttp renders into a static buffer, but WiFiServer and lwIP allocate
+static void scrape() {
+  void *pcb = heap->malloc(HS_PCB);
+  void *handle = heap->malloc(HS_SOCKET_HANDLE);
+  void *rxBuffer = heap->malloc(HS_TCP_BUFFER);
+  void *pbuf = heap->malloc(HS_PBUF);           // The request
+  heap->free(pbuf);
+  for (int i = 0; i < 5; i++) {                 // The response goes out a segment at a time
+    pbuf = heap->malloc(HS_PBUF);
+    heap->free(pbuf);
+  }
+  heap->free(rxBuffer);
+  heap->free(handle);
+  Connection::linger(dev->now + HS_TIME_WAIT_SECS, pcb);
+}
+
+/**
+ * @brief The median of v, which gets sorted
+ */
+static double median(std::vector<double> &v) {
+  if (v.empty()) {
+    return 0;
+  }
+  std::sort(v.begin(), v.end());
+  return v[v.size() / 2];
+}
+
+/**
+ * @brief The least-squares slope of y against x
+ */
+static double slope(const std::vector<double> &x, const std::vector<double> &y) {
+  double n = x.size(), sx = 0, sy = 0, sxx = 0, sxy = 0;
+  for (size_t i = 0; i < x.size(); i++) {
+    sx += x[i];
+    sy += y[i];
+    sxx += x[i] * x[i];
+    sxy += x[i] * y[i];
+  }
+  double d = n * sxx - sx * sx;
+  return d == 0 ? 0 : (n * sxy - sx * sy) / d;
+}
+
+int main(int argc, char **argv) {
+  int days = 365, warmup = 7, scrapeSecs = 60, leak = 0;
+  size_t heapBytes = 160000;
+  double commandsPerDay = 20, reconnectsPerWeek = 2, leakLimit = 64, fragLimit = 512;
+  uint32_t seed = 1;
+  bool verbose = false;
+  const char *csvName = nullptr;
+  failPct = 3;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+      days = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+      heapBytes = atol(argv[++i]);
+    } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+      commandsPerDay = atof(argv[++i]);
+    } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+      scrapeSecs = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+      reconnectsPerWeek = atof(argv[++i]);
+    } else if (strcmp(argv[i], "-x") == 0 && i + 1 < argc) {
+      failPct = atof(argv[++i]);
+    } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+      warmup = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+      leakLimit = atof(argv[++i]);
+    } else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+      fragLimit = atof(argv[++i]);
+    } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      leak = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      seed = strtoul(argv[++i], nullptr, 0);
+    } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+      csvName = argv[++i];
+    } else if (strcmp(argv[i], "-v") == 0) {
+      verbose = true;
+    } else {
+      fprintf(stderr, "Usage: %s [-d <days>] [-k <heap bytes>] [-c <per day>] [-m <secs>] [-r <per week>]\n"
+        "  [-x <percent>] [-w <days>] [-l <bytes>] [-g <bytes>] [-j <bytes>] [-s <seed>] [-t <csv file>] [-v]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (days < 2 || warmup < 0 || warmup + 2 > days || heapBytes < 65536 || scrapeSecs < 0 || leak < 0) {
+    fprintf(stderr, "Need at least two days after the warm-up, a heap of at least 64K, and no negative numbers.\n");
+    return 2;
+  }
+  FILE *csv = nullptr;
+  if (csvName != nullptr && (csv = fopen(csvName, "w")) == nullptr) {
+    fprintf(stderr, "Can't write %s\n", csvName);
+    return 2;
+  }
+  setenv("TZ", "GMT0", 1);                      // TAT_POSIX_TZ
+  tzset();
+  rng.seed(seed);
+  Serial.quiet = !verbose;
+
+  // The heap, with the WiFi up, and String getting its memory from it
+  EspHeap espHeap {heapBytes};
+  heap = &espHeap;
+  hostMalloc = [](size_t size) { return heap->malloc(size); };
+  hostRealloc = [](void *ptr, size_t size) { return heap->realloc(ptr, size); };
+  hostFree = [](void *ptr) { heap->free(ptr); };
+  std::vector<void *> wifi;
+  for (int size : hsWifiState) {
+    wifi.push_back(heap->malloc(size));
+  }
+  size_t bootFree = heap->freeSize();
+
+  // The device, booted at the start
+  Device device;
+  dev = &device;
+  dev->now = HS_START;
+  uint32_t devSeed = 0x240AC400 ^ seed;         // As setup() makes it from the MAC address
+  dev->tc.begin(getNextTide, tcNonlinear, tcOne);
+  dev->predFetch.begin(devSeed);
+  dev->hiloFetch.begin(devSeed);
+  dev->tc.setJitter(devSeed);
+
+  // Run it
+  std::exponential_distribution<double> commandGap(commandsPerDay / HS_SECONDS_PER_DAY);
+  std::exponential_distribution<double> reconnectGap(reconnectsPerWeek / (7.0 * HS_SECONDS_PER_DAY));
+  time_t end = HS_START + (time_t)days * HS_SECONDS_PER_DAY;
+  time_t nextLevel = HS_START, nextScrape = HS_START + scrapeSecs;
+  time_t nextCommand = commandsPerDay > 0 ? HS_START + (time_t)commandGap(rng) : end;
+  time_t nextReconnect = reconnectsPerWeek > 0 ? HS_START + (time_t)reconnectGap(rng) : end;
+  std::vector<std::vector<double>> freeSamples(days), largestSamples(days);
+  std::vector<size_t> dayLowLargest(days, SIZE_MAX);
+  uint32_t levelTasks = 0, tides = 0, commands = 0, scrapes = 0, reconnects = 0;
+  time_t lastTide = 0;
+  auto startTime = std::chrono::steady_clock::now();
+  for (time_t t = HS_START; t < end; t++) {
+    dev->now = t;
+    hostMicros = (uint64_t)(t - HS_START) * 1000000ULL;
+    int day = (t - HS_START) / HS_SECONDS_PER_DAY;
+    Connection::expire(t);
+    if (t >= nextReconnect) {                   // The WiFi drops and comes back
+      for (void *&p : wifi) {
+        heap->free(p);
+      }
+      for (size_t i = 0; i < wifi.size(); i++) {
+        wifi[i] = heap->malloc(hsWifiState[i]);
+      }
+      reconnects++;
+      nextReconnect = t + 1 + (time_t)reconnectGap(rng);
+    }
+    if (scrapeSecs > 0 && t >= nextScrape) {
+      scrape();
+      scrapes++;
+      nextScrape += scrapeSecs;
+    }
+    if (t >= nextCommand) {
+      uiCommand();
+      commands++;
+      nextCommand = t + 1 + (time_t)commandGap(rng);
+    }
+    if (leak > 0 && (t - HS_START) % HS_SECONDS_PER_DAY == 43200) {
+      heap->malloc(leak);
+    }
+    if (t >= nextLevel) {
+      levelTask();
+      levelTasks++;
+      nextLevel += TAT_LEVEL_CHECK_SECS;
+      freeSamples[day].push_back(heap->freeSize());
+      largestSamples[day].push_back(heap->largestFree());
+      dayLowLargest[day] = std::min(dayLowLargest[day], heap->largestFree());
+    }
+    time_t tide = dev->tc.getNextTide().time;
+    uint64_t ms = millis();
+    do {
+      dev->tc.run(t);
+      if (dev->tidesNeeded) {                   // getNextTide()'s sched.runNow(levelTaskId)
+        levelTask();
+      }
+      hostMicros += dev->tc.getMinStepInterval() * 1000ULL;
+    } while (!dev->tc.caughtUp() && millis() < ms + 1000);
+    if (tide != lastTide && tide != 0) {
+      tides++;
+      lastTide = tide;
+    }
+  }
+  double runSecs = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+  // The trends, after the warm-up, in bytes per 30 days
+  std::vector<double> x, freeMedian(days), largestMedian(days);
+  std::vector<double> fitFree, fitLargest;
+  for (int d = 0; d < days; d++) {
+    freeMedian[d] = median(freeSamples[d]);
+    largestMedian[d] = median(largestSamples[d]);
+    if (d >= warmup) {
+      x.push_back(d);
+      fitFree.push_back(freeMedian[d]);
+      fitLargest.push_back(largestMedian[d]);
+    }
+    if (csv != nullptr) {
+      fprintf(csv, "%s%d,%.0f,%.0f,%zu\n", d == 0 ? "day,free,largest,lowest largest\n" : "", d,
+        freeMedian[d], largestMedian[d], dayLowLargest[d]);
+    }
+  }
+  if (csv != nullptr) {
+    fclose(csv);
+  }
+  double freeTrend = slope(x, fitFree) * 30, largestTrend = slope(x, fitLargest) * 30;
+  auto average = [&](int from, int n, const std::vector<double> &v) {
+    double sum = 0;
+    for (int d = from; d < from + n; d++) {
+      sum += v[d];
+    }
+    return sum / n;
+  };
+  int week = std::min(7, days - warmup);
+  size_t lowest = *std::min_element(dayLowLargest.begin(), dayLowLargest.end());
+
+  printf("Simulated %d days in %.1f s: %u level checks, %u tides, %u fetches (%u failed), %u commands, %u scrapes, %u reconnections\n",
+    days, runSecs, levelTasks, tides, fetches, fetchFailures, commands, scrapes, reconnects);
+  printf("Heap: %zu bytes, %zu free after boot; low water mark %zu; lowest largest free block %zu\n",
+    heapBytes, bootFree, heap->minFree, lowest);
+  printf("\nIdle, bytes                 After warm-up   Last week   Trend/30 days   Limit\n");
+  printf("Free heap                   %13.0f %11.0f %15.1f %7.0f\n", average(warmup, week, freeMedian),
+    average(days - week, week, freeMedian), freeTrend, -leakLimit);
+  printf("Largest free block          %13.0f %11.0f %15.1f %7.0f\n", average(warmup, week, largestMedian),
+    average(days - week, week, largestMedian), largestTrend, -fragLimit);
+  printf("Free blocks now: %zu; fragmentation (1 - largest/free) %.1f%%\n\n", heap->freeBlocks(),
+    100.0 * (1.0 - (double)heap->largestFree() / heap->freeSize()));
+
+  bool pass = true;
+  if (heap->failures > 0) {
+    printf("FAIL: %llu allocations failed\n", (unsigned long long)heap->failures);
+    pass = false;
+  }
+  if (freeTrend < -leakLimit) {
+    printf("FAIL: the free heap is falling by %.0f bytes per 30 days\n", -freeTrend);
+    pass = false;
+  }
+  if (largestTrend < -fragLimit) {
+    printf("FAIL: the largest free block is shrinking by %.0f bytes per 30 days\n", -largestTrend);
+    pass = false;
+  }
+  if (pass) {
+    printf("PASS\n");
+  }
+  return pass ? 0 : 1;
+}
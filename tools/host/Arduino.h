@@ -0,0 +1,361 @@
+/****
+ * 
+ * Arduino.h
+ * Host stand-in for the Arduino core. Part of Time and Tides.
+ * 
+ * Just enough of the Arduino API for the firmware's libraries to be compiled and run natively 
+ * by the host tools (e.g., tools/fleetsim.cpp runs thousands of TideClocks). Put tools/host 
+ * ahead of the libraries on the include path.
+ * 
+ * Time is whatever the tool says it is: micros() returns hostMicros, which the tool sets, 
+ * millis() follows from it, and delay() returns at once without advancing it. Pins don't 
+ * exist, so pin writes do nothing (but see soc/gpio_struct.h), and digitalRead() returns LOW 
+ * unless the tool sets hostDigitalRead to a model of whatever is on the other end of the pins. 
+ * Serial writes to stdout unless Serial.quiet is set, which a tool running many copies of a
+ * library will usually want. String gets and grows its buffers the way the device's does,
+ * from hostMalloc() and friends, which a tool can point at a model of the device's heap (see
+ * tools/heapsoak.cpp).
+ * 
+ ****
+ * 
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ * 
+ ****/
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <string>
+
+#define HIGH            (1)
+#define LOW             (0)
+#define INPUT           (0x01)
+#define OUTPUT          (0x03)
+#define INPUT_PULLUP    (0x05)
+#define INPUT_PULLDOWN  (0x09)
+#define LED_BUILTIN     (15)
+#define PI              (3.1415926535897932384626433832795)
+#define F(s)            (s)
+#define log_d(...)      ((void)0)
+
+inline uint64_t hostMicros = 0;                 // The time; set by the tool
+inline int (*hostDigitalRead)(uint8_t pin) = nullptr; // What digitalRead() asks, if set
+
+inline unsigned long millis() {
+  return (unsigned long)(hostMicros / 1000);
+}
+inline unsigned long micros() {
+  return (unsigned long)hostMicros;
+}
+inline void delay(uint32_t) {}
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline int digitalRead(uint8_t pin) {
+  return hostDigitalRead == nullptr ? LOW : hostDigitalRead(pin);
+}
+
+inline void *(*hostMalloc)(size_t size) = malloc;                 // How String gets memory; a tool can model
+inline void *(*hostRealloc)(void *ptr, size_t size) = realloc;    //   the device's heap by setting these
+inline void (*hostFree)(void *ptr) = free;
+
+/**
+ * @brief The core's String, as arduino-esp32's WString does it, as far as memory goes: up to 
+ *        HOST_STRING_SSO characters are kept in the object; longer ones go in a buffer from 
+ *        hostMalloc() sized in multiples of 16 bytes and grown with hostRealloc(). A chain of 
+ *        +'s builds its result in a StringSumHelper, which is then copied.
+ */
+#define HOST_STRING_SSO (9)                     // The most characters kept in the object itself
+class String {
+public:
+  String(const char *s = "") {
+    copy(s == nullptr ? "" : s, s == nullptr ? 0 : strlen(s));
+  }
+  String(const String &o) {
+    copy(o.buffer(), o.len);
+  }
+  String(String &&o) {
+    move(o);
+  }
+  explicit String(char c) {
+    char buf[2] = {c, 0};
+    copy(buf, 1);
+  }
+  String(int v) : String((long)v) {}
+  String(unsigned int v) : String((unsigned long)v) {}
+  String(long v) {
+    char buf[24];
+    copy(buf, snprintf(buf, sizeof(buf), "%ld", v));
+  }
+  String(unsigned long v) {
+    char buf[24];
+    copy(buf, snprintf(buf, sizeof(buf), "%lu", v));
+  }
+  ~String() {
+    if (heap != nullptr) {
+      hostFree(heap);
+    }
+  }
+  String &operator=(const String &o) {
+    if (this != &o) {
+      copy(o.buffer(), o.len);
+    }
+    return *this;
+  }
+  String &operator=(String &&o) {
+    if (this != &o) {
+      if (heap != nullptr) {
+        hostFree(heap);
+        heap = nullptr;
+      }
+      move(o);
+    }
+    return *this;
+  }
+  String &operator=(const char *s) {
+    return copy(s == nullptr ? "" : s, s == nullptr ? 0 : strlen(s));
+  }
+  bool reserve(unsigned int size) {
+    if (size <= capacity()) {
+      return true;
+    }
+    size_t newSize = (size + 16) & ~0xf;
+    char *b = (char *)hostRealloc(heap, newSize);
+    if (b == nullptr) {
+      return false;
+    }
+    if (heap == nullptr) {
+      memcpy(b, sso, len + 1);
+    }
+    heap = b;
+    cap = newSize - 1;
+    return true;
+  }
+  bool concat(const char *s, unsigned int n) {
+    if (n == 0) {
+      return true;
+    }
+    if (!reserve(len + n)) {
+      return false;
+    }
+    memmove(wbuffer() + len, s, n);
+    len += n;
+    wbuffer()[len] = 0;
+    return true;
+  }
+  bool concat(const String &o) {
+    return concat(o.buffer(), o.len);
+  }
+  bool concat(const char *s) {
+    return s == nullptr ? false : concat(s, strlen(s));
+  }
+  bool concat(char c) {
+    return concat(&c, 1);
+  }
+  String &operator+=(const String &o) {
+    concat(o);
+    return *this;
+  }
+  String &operator+=(const char *s) {
+    concat(s);
+    return *this;
+  }
+  String &operator+=(char c) {
+    concat(c);
+    return *this;
+  }
+  const char *c_str() const {
+    return buffer();
+  }
+  unsigned int length() const {
+    return len;
+  }
+  char operator[](unsigned int i) const {
+    return i < len ? buffer()[i] : 0;
+  }
+  bool equals(const String &o) const {
+    return len == o.len && memcmp(buffer(), o.buffer(), len) == 0;
+  }
+  bool equals(const char *s) const {
+    return strcmp(buffer(), s == nullptr ? "" : s) == 0;
+  }
+  bool operator==(const String &o) const {
+    return equals(o);
+  }
+  bool operator==(const char *s) const {
+    return equals(s);
+  }
+  bool operator!=(const String &o) const {
+    return !equals(o);
+  }
+  bool operator!=(const char *s) const {
+    return !equals(s);
+  }
+  bool equalsIgnoreCase(const String &o) const {
+    return len == o.len && strcasecmp(buffer(), o.buffer()) == 0;
+  }
+  int indexOf(char c, unsigned int from = 0) const {
+    const char *p = from < len ? strchr(buffer() + from, c) : nullptr;
+    return p == nullptr ? -1 : p - buffer();
+  }
+  int indexOf(const String &s, unsigned int from = 0) const {
+    const char *p = from < len ? strstr(buffer() + from, s.buffer()) : nullptr;
+    return p == nullptr ? -1 : p - buffer();
+  }
+  String substring(unsigned int left) const {
+    return substring(left, len);
+  }
+  String substring(unsigned int left, unsigned int right) const {
+    if (left > right) {
+      unsigned int t = left;
+      left = right;
+      right = t;
+    }
+    String out;
+    if (left >= len) {
+      return out;
+    }
+    out.copy(buffer() + left, (right > len ? len : right) - left);
+    return out;
+  }
+  void replace(const String &find, const String &with) {
+    if (find.len == 0 || indexOf(find) < 0) {
+      return;
+    }
+    std::string s(buffer(), len);
+    for (size_t at = s.find(find.buffer()); at != std::string::npos; at = s.find(find.buffer(), at + with.len)) {
+      s.replace(at, find.len, with.buffer());
+    }
+    if (s.size() > len && !reserve(s.size())) { // Grows once, to the final size, as WString's does
+      return;
+    }
+    memcpy(wbuffer(), s.c_str(), s.size() + 1);
+    len = s.size();
+  }
+  long toInt() const {
+    return atol(buffer());
+  }
+  float toFloat() const {
+    return atof(buffer());
+  }
+private:
+  unsigned int capacity() const {
+    return heap == nullptr ? HOST_STRING_SSO : cap;
+  }
+  const char *buffer() const {
+    return heap == nullptr ? sso : heap;
+  }
+  char *wbuffer() {
+    return heap == nullptr ? sso : heap;
+  }
+  String &copy(const char *s, unsigned int n) {
+    if (!reserve(n)) {
+      if (heap != nullptr) {
+        hostFree(heap);
+        heap = nullptr;
+      }
+      len = 0;
+      sso[0] = 0;
+      return *this;
+    }
+    len = 0;
+    concat(s, n);
+    wbuffer()[len] = 0;
+    return *this;
+  }
+  void move(String &o) {
+    heap = o.heap;
+    cap = o.cap;
+    len = o.len;
+    memcpy(sso, o.sso, sizeof(sso));
+    o.heap = nullptr;
+    o.len = 0;
+    o.sso[0] = 0;
+  }
+
+  char *heap = nullptr;                         // The buffer, if it's not in sso
+  unsigned int cap = 0;                         // Its capacity
+  unsigned int len = 0;                         // The length
+  char sso[HOST_STRING_SSO + 2] = "";           // Short strings go here
+};
+
+/**
+ * @brief The temporary a chain of +'s builds its result in
+ */
+class StringSumHelper : public String {
+public:
+  StringSumHelper(const String &s) : String(s) {}
+  StringSumHelper(const char *s) : String(s) {}
+  StringSumHelper(int v) : String(v) {}
+  StringSumHelper(unsigned int v) : String(v) {}
+  StringSumHelper(long v) : String(v) {}
+  StringSumHelper(unsigned long v) : String(v) {}
+};
+inline StringSumHelper &operator+(const StringSumHelper &a, const String &b) {
+  StringSumHelper &sum = const_cast<StringSumHelper &>(a);
+  sum.concat(b);
+  return sum;
+}
+inline StringSumHelper &operator+(const StringSumHelper &a, const char *b) {
+  StringSumHelper &sum = const_cast<StringSumHelper &>(a);
+  sum.concat(b);
+  return sum;
+}
+inline StringSumHelper &operator+(const StringSumHelper &a, char b) {
+  StringSumHelper &sum = const_cast<StringSumHelper &>(a);
+  sum.concat(b);
+  return sum;
+}
+inline StringSumHelper &operator+(const StringSumHelper &a, int b) {
+  return a + String(b);
+}
+inline StringSumHelper &operator+(const StringSumHelper &a, long b) {
+  return a + String(b);
+}
+inline StringSumHelper &operator+(const StringSumHelper &a, unsigned long b) {
+  return a + String(b);
+}
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(const uint8_t *buffer, size_t size) = 0;
+  size_t write(uint8_t c) {
+    return write(&c, 1);
+  }
+  int printf(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (n < 0) {
+      return n;
+    }
+    write((const uint8_t *)buf, (size_t)n < sizeof(buf) ? n : sizeof(buf) - 1);
+    return n;
+  }
+  size_t print(const char *s) {
+    return write((const uint8_t *)s, strlen(s));
+  }
+  size_t print(const String &s) {
+    return print(s.c_str());
+  }
+};
+
+class HostSerial : public Print {
+public:
+  bool quiet = false;                           // Throw away everything written
+  size_t write(const uint8_t *buffer, size_t size) override {
+    if (!quiet) {
+      fwrite(buffer, 1, size, stdout);
+    }
+    return size;
+  }
+};
+inline HostSerial Serial;
@@ -0,0 +1,158 @@
+/****
+ *
+ * GyverStepper.h
+ * Host stand-in for the GyverStepper library. Part of Time and Tides.
+ *
+ * The part of GStepper's API WlDisplay uses, so that it can be compiled and run natively by
+ * the host tools (see tools/wldsim.cpp). It's a model of how the library drives a virtual
+ * four-wire half-stepper, not its code: tick() takes at most one step, when micros() says the
+ * next one is due, and hands the step handler the next phase pattern in the sequence. In
+ * FOLLOW_POS mode it moves to the target with a trapezoidal speed profile -- accelerating at
+ * GS_DEFAULT_ACCEL up to the maximum speed and decelerating so as to stop at the target,
+ * overshooting and coming back if the target moves behind it. In KEEP_SPEED mode it steps at
+ * the set speed. With autoPower on, the power handler turns the coils off whenever it stops
+ * and on again when it starts. setCurrent() changes the position but neither the target nor
+ * the phase pattern.
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#pragma once
+
+#include <Arduino.h>
+
+#define GS_DEFAULT_ACCEL        (300.0)         // The library's default acceleration (steps/sec^2)
+
+enum GS_driverType {STEPPER2WIRE, STEPPER4WIRE, STEPPER4WIRE_HALF};
+enum GS_driverMode {NORMAL, STEPPER_VIRTUAL};
+enum GS_runMode {FOLLOW_POS, KEEP_SPEED};
+
+template <GS_driverType TYPE, GS_driverMode MODE = NORMAL>
+class GStepper {
+  static_assert(TYPE == STEPPER4WIRE_HALF && MODE == STEPPER_VIRTUAL, "Only the virtual half-stepper is modeled");
+public:
+  GStepper(int stepsPerTurn) : stepsPerTurn(stepsPerTurn) {}
+
+  void attachStep(void (*handler)(uint8_t)) {
+    stepHandler = handler;
+  }
+  void attachPower(void (*handler)(bool)) {
+    powerHandler = handler;
+  }
+  void autoPower(bool on) {
+    autoPowerOn = on;
+  }
+  void setRunMode(GS_runMode m) {
+    mode = m;
+    speed = mode == KEEP_SPEED ? keepSpeed : 0;
+  }
+  void setSpeedDeg(float degPerSec) {
+    keepSpeed = degPerSec * stepsPerTurn / 360.0;
+    if (mode == KEEP_SPEED) {
+      speed = keepSpeed;
+    }
+  }
+  void setMaxSpeed(float stepsPerSec) {
+    maxSpeed = fabs(stepsPerSec);
+  }
+  void setAcceleration(float stepsPerSec2) {
+    accel = fabs(stepsPerSec2);
+  }
+  void setCurrent(long pos) {
+    current = pos;
+  }
+  long getCurrent() {
+    return current;
+  }
+  void setTarget(long pos) {
+    target = pos;
+  }
+  long getTarget() {
+    return target;
+  }
+  bool getState() {
+    return moving;
+  }
+
+  bool tick() {
+    uint64_t now = micros();
+    if (moving && now < nextStepMicros) {
+      return true;
+    }
+    int dir;
+    if (mode == KEEP_SPEED) {
+      if (speed == 0) {
+        return stop();
+      }
+      dir = speed > 0 ? 1 : -1;
+    } else {
+      long toGo = target - current;
+      float v = fabs(speed);
+      float minV = sqrtf(2 * accel);              // The speed of the first step from a standstill
+      if (speed == 0) {
+        if (toGo == 0) {
+          return stop();
+        }
+        dir = toGo > 0 ? 1 : -1;
+        v = minV;
+      } else {
+        dir = speed > 0 ? 1 : -1;
+        bool toward = toGo * dir > 0;
+        if (toward && labs(toGo) > v * v / (2 * accel)) {
+          v = fminf(maxSpeed, sqrtf(v * v + 2 * accel));
+        } else {
+          v = sqrtf(fmaxf(v * v - 2 * accel, 0));
+        }
+        if (toGo == 0 && v <= minV) {               // Arrived
+          speed = 0;
+          return stop();
+        }
+        if (v < minV) {                             // Stopped short, or stopped going the wrong way
+          speed = 0;
+          nextStepMicros = now;
+          return true;
+        }
+      }
+      speed = dir * v;
+    }
+    if (!moving && autoPowerOn && powerHandler != nullptr) {
+      powerHandler(true);
+    }
+    moving = true;
+    current += dir;
+    phase = (phase + dir) & 0x07;
+    if (stepHandler != nullptr) {
+      stepHandler(halfSteps[phase]);
+    }
+    nextStepMicros = now + (uint64_t)(1000000.0 / fabs(speed));
+    return true;
+  }
+
+private:
+  bool stop() {
+    if (moving && autoPowerOn && powerHandler != nullptr) {
+      powerHandler(false);
+    }
+    moving = false;
+    return false;
+  }
+
+  static constexpr uint8_t halfSteps[8] = {0b0001, 0b0011, 0b0010, 0b0110, 0b0100, 0b1100, 0b1000, 0b1001};
+  int stepsPerTurn;
+  void (*stepHandler)(uint8_t) = nullptr;
+  void (*powerHandler)(bool) = nullptr;
+  bool autoPowerOn = false;
+  GS_runMode mode = FOLLOW_POS;
+  float keepSpeed = 0;                          // KEEP_SPEED's speed (steps/sec, signed)
+  float maxSpeed = 300;                         // FOLLOW_POS's top speed (steps/sec)
+  float accel = GS_DEFAULT_ACCEL;               // FOLLOW_POS's acceleration (steps/sec^2)
+  float speed = 0;                              // The current speed (steps/sec, signed)
+  long current = 0;                             // The current position (steps)
+  long target = 0;                              // The target position (steps)
+  uint8_t phase = 0;                            // Where it is in halfSteps; unaffected by setCurrent()
+  bool moving = false;                          // Whether it's moving
+  uint64_t nextStepMicros = 0;                  // When the next step is due
+};
@@ -0,0 +1,40 @@
+/****
+ * 
+ * gpio_struct.h
+ * Host stand-in for the ESP32's GPIO registers. Part of Time and Tides.
+ * 
+ * The output set and clear registers FastGpio writes, so that it (and the libraries that use 
+ * it) can be compiled and run natively by the host tools. See tools/host/Arduino.h. Writing 
+ * them sets or clears bits in hostGpioOut, the levels of the output pins, so a tool can see 
+ * what's being driven, e.g., the stepper's phases (see tools/wldsim.cpp).
+ * 
+ ****
+ * 
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ * 
+ ****/
+#pragma once
+
+#include <stdint.h>
+
+inline uint32_t hostGpioOut[2];                 // The output levels of pins 0..31 and 32 and up
+
+struct host_gpio_w1_t {                         // A write-1-to-set or write-1-to-clear register
+  uint8_t bank;                                 //  The bank it's for
+  bool set;                                     //  Whether it sets (or clears) the bits written
+  host_gpio_w1_t &operator=(uint32_t mask) {
+    hostGpioOut[bank] = set ? hostGpioOut[bank] | mask : hostGpioOut[bank] & ~mask;
+    return *this;
+  }
+};
+struct host_gpio_reg_t {                        // A register that's accessed through .val
+  host_gpio_w1_t val;
+};
+struct host_gpio_dev_t {                        // The registers FastGpio uses
+  host_gpio_w1_t out_w1ts;                      //  Bank 0 write-1-to-set
+  host_gpio_w1_t out_w1tc;                      //  Bank 0 write-1-to-clear
+  host_gpio_reg_t out1_w1ts;                    //  Bank 1 write-1-to-set
+  host_gpio_reg_t out1_w1tc;                    //  Bank 1 write-1-to-clear
+};
+inline host_gpio_dev_t GPIO {{0, true}, {0, false}, {{1, true}}, {{1, false}}};
@@ -0,0 +1,183 @@
+/****
+ *
+ * levelbench.cpp
+ * Host tool for checking and timing the level and clock arithmetic. Part of Time and Tides.
+ *
+ * The water level and clock face pipelines used to be done in float, which the ESP32-S2, having
+ * no FPU, does in software. They're integer arithmetic now: ttParseLevel() turns NOAA's text
+ * into hundredths of a foot, wldPosition() turns that into a display stepper position, and
+ * tcTicksNeeded() works out the clock face's ticks. This checks each one against the float
+ * version over its whole range, saying how many answers differ and by how much, and times both,
+ * in nanoseconds and (on x86) TSC cycles per call. The device's "bench level" command does the
+ * timing there, in CPU cycles.
+ *
+ * Build and run (from the repository root):
+ *
+ *   g++ -std=c++17 -O2 -Itools/host -Ilib/Snapshot -Ilib/FastGpio -Ilib/WlDisplay -Ilib/TideClock -Ilib/TideData -o levelbench tools/levelbench.cpp lib/TideClock/TideSchedule.cpp
+ *   ./levelbench
+ *
+ * Usage: levelbench [-n <reps>] [-l <minLevel> <maxLevel>]
+ *
+ *   -n   How many calls to time for each (default 10000000)
+ *   -l   The display's range (feet MLLW; default WLD_MIN_LEVEL and WLD_MAX_LEVEL)
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ *
+ ****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "WlDisplay.h"
+#include "TideSchedule.h"
+#include "TideTable.h"
+
+// Some constants
+#define LB_FACE_RANGE           ((int32_t)(3 * TC_SECONDS_IN_18_HOURS)) // Check the face math from this far before to this far after a tide
+
+struct lb_check_t {                             // How a pipeline stage compares with its float version
+  uint32_t checked = 0;                         //  Inputs tried
+  uint32_t differ = 0;                          //  Inputs for which the answers differ
+  int32_t maxDiff = 0;                          //  The biggest difference
+  void add(int32_t a, int32_t b) {
+    checked++;
+    differ += a != b;
+    maxDiff = std::max(maxDiff, abs(a - b));
+  }
+};
+
+struct lb_time_t {                              // The cost of one call
+  double ns;                                    //  Nanoseconds
+  double cycles;                                //  TSC cycles; 0 if there's no TSC
+};
+
+// The float versions, as they were
+static int32_t floatTicksNeeded(bool nonlinear, int32_t secToNextTide) {
+  float secFromCycleEnd;
+  if (nonlinear) {
+    secFromCycleEnd = static_cast<float>(static_cast<int32_t>(TC_SECONDS_IN_18_HOURS) - secToNextTide);
+    int32_t ticks = static_cast<int32_t>(1800.0 / (TC_SECONDS_IN_18_HOURS * TC_SECONDS_IN_18_HOURS) * (secFromCycleEnd * secFromCycleEnd));
+    return secFromCycleEnd < 0 ? -ticks : ticks;
+  }
+  secFromCycleEnd = static_cast<float>(static_cast<int32_t>(TC_SECONDS_IN_SIX_HOURS) - secToNextTide);
+  return static_cast<int32_t>(secFromCycleEnd / TC_SECONDS_PER_TICK);
+}
+static int16_t floatParseLevel(const char *s) {
+  return (int16_t)lroundf(atof(s) * 100.0);
+}
+static int32_t floatPosition(float level, int32_t stepsPerFoot) {
+  return (long)(level * stepsPerFoot);
+}
+
+// The time per call of f(i) for i in [0, reps), which returns something to add up so it isn't optimized away
+template <typename F>
+static lb_time_t timeIt(uint32_t reps, F f) {
+  volatile int64_t sink = 0;
+  int64_t sum = 0;
+  auto start = std::chrono::steady_clock::now();
+#if defined(__x86_64__) || defined(__i386__)
+  uint64_t startTsc = __rdtsc();
+#endif
+  for (uint32_t i = 0; i < reps; i++) {
+    sum += f(i);
+  }
+#if defined(__x86_64__) || defined(__i386__)
+  double cycles = (double)(__rdtsc() - startTsc) / reps;
+#else
+  double cycles = 0;
+#endif
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / reps;
+  sink = sum;
+  (void)sink;
+  return {ns, cycles};
+}
+
+static void report(const char *what, const lb_check_t &check, const lb_time_t &floatTime, const lb_time_t &intTime) {
+  printf("%-22s %9u %9u %8d   %7.2f %7.1f   %7.2f %7.1f\n", what, check.checked, check.differ, check.maxDiff,
+    floatTime.ns, floatTime.cycles, intTime.ns, intTime.cycles);
+}
+
+int main(int argc, char **argv) {
+  uint32_t reps = 10000000;
+  float minL = WLD_MIN_LEVEL, maxL = WLD_MAX_LEVEL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      reps = atol(argv[++i]);
+    } else if (strcmp(argv[i], "-l") == 0 && i + 2 < argc) {
+      minL = atof(argv[++i]);
+      maxL = atof(argv[++i]);
+    } else {
+      fprintf(stderr, "Usage: %s [-n <reps>] [-l <minLevel> <maxLevel>]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (reps == 0 || maxL <= 0 || minL >= maxL) {
+    fprintf(stderr, "Need some reps and 0 < maxLevel, minLevel < maxLevel.\n");
+    return 2;
+  }
+  volatile int32_t maxLevel = lroundf(maxL * 100);  // volatile, so nothing gets done at compile time
+  int32_t minLevel = lroundf(minL * 100);
+  int32_t stepsPerFoot = (int32_t)((WLD_MIN_POS / maxL) - 0.5); // As WlDisplay::begin() used to work it out
+
+  printf("%-22s %9s %9s %8s   %15s   %15s\n", "", "", "", "", "float", "integer");
+  printf("%-22s %9s %9s %8s   %7s %7s   %7s %7s\n", "Stage", "Inputs", "Differ", "Max diff", "ns", "cycles", "ns", "cycles");
+
+  // Parsing: every level NOAA could send, to the thousandth of a foot
+  static char texts[65536][12];
+  lb_check_t parse;
+  for (int32_t milli = -327670; milli <= 327670; milli++) {
+    char text[12];
+    snprintf(text, sizeof(text), "%s%d.%03d", milli < 0 ? "-" : "", abs(milli) / 1000, abs(milli) % 1000);
+    int16_t level;
+    if (!ttParseLevel(text, &level)) {
+      fprintf(stderr, "ttParseLevel() failed on \"%s\"\n", text);
+      return 1;
+    }
+    parse.add(level, floatParseLevel(text));
+    strcpy(texts[milli & 0xffff], text);
+  }
+  report("Parse (cft)", parse,
+    timeIt(reps, [](uint32_t i) { return floatParseLevel(texts[i & 0xffff]); }),
+    timeIt(reps, [](uint32_t i) { int16_t level = 0; ttParseLevel(texts[i & 0xffff], &level); return level; }));
+
+  // Display target: every level in the display's range, against the exactly rounded position
+  // for the integer version and against what it used to be for the float one
+  lb_check_t intPos, floatPos;
+  for (int32_t level = minLevel; level <= maxLevel; level++) {
+    int32_t exact = lround((double)level * WLD_MIN_POS / maxLevel);
+    intPos.add(wldPosition(level, maxLevel), exact);
+    floatPos.add(floatPosition(level / 100.0f, stepsPerFoot), exact);
+  }
+  int32_t span = maxLevel - minLevel + 1;
+  lb_time_t floatPosTime = timeIt(reps, [&](uint32_t i) { return floatPosition((minLevel + (int32_t)(i % span)) / 100.0f, stepsPerFoot); });
+  lb_time_t intPosTime = timeIt(reps, [&](uint32_t i) { return wldPosition(minLevel + (int32_t)(i % span), maxLevel); });
+  report("Display target (steps)", intPos, floatPosTime, intPosTime);
+  printf("  The float version was off from the exact position by up to %d steps at %u of %u levels.\n",
+    floatPos.maxDiff, floatPos.differ, floatPos.checked);
+
+  // Clock face: every second from well before to well after a tide
+  lb_check_t face[2];
+  for (int32_t sec = -LB_FACE_RANGE; sec <= LB_FACE_RANGE; sec++) {
+    for (int nonlinear = 0; nonlinear < 2; nonlinear++) {
+      face[nonlinear].add(tcTicksNeeded(nonlinear, sec), floatTicksNeeded(nonlinear, sec));
+    }
+  }
+  int32_t faceSpan = 2 * LB_FACE_RANGE + 1;
+  for (int nonlinear = 0; nonlinear < 2; nonlinear++) {
+    report(nonlinear ? "Clock, nonlinear" : "Clock, linear", face[nonlinear],
+      timeIt(reps, [&](uint32_t i) { return floatTicksNeeded(nonlinear, (int32_t)(i % faceSpan) - LB_FACE_RANGE); }),
+      timeIt(reps, [&](uint32_t i) { return tcTicksNeeded(nonlinear, (int32_t)(i % faceSpan) - LB_FACE_RANGE); }));
+  }
+  printf("(\"Differ\" compares with the float version, except for the display target; the host has an FPU, "
+    "so its float timings are far better than the device's.)\n");
+  return intPos.differ == 0 ? 0 : 1;
+}
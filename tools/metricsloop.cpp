@@ -0,0 +1,283 @@
+/****
+ *
+ * metricsloop.cpp
+ * Host tool for trying out the metrics endpoint over loopback. Part of Time and Tides.
+ * 
+ * Runs the firmware's Metrics registry and MetricsHttp server (lib/Metrics) on a host, with 
+ * POSIX sockets standing in for WiFiServer and WiFiClient, in a cooperative loop alongside a 
+ * stand-in for the clock's step task that wants to run every millisecond. A second thread 
+ * scrapes /metrics over loopback again and again, checks that each response is well-formed 
+ * Prometheus text, and times it. At the end it reports the scrape latencies and, to show that 
+ * serving doesn't get in the way of stepping, the longest single server slice and the longest 
+ * the step task was kept waiting.
+ * 
+ * Build and run (from the repository root):
+ * 
+ *   g++ -std=c++17 -O2 -pthread -Ilib/Metrics -o metricsloop tools/metricsloop.cpp lib/Metrics/Metrics.cpp
+ *   ./metricsloop -n 2000
+ * 
+ * Usage: metricsloop [-n <scrapes>] [-p <port>] [-s]
+ * 
+ *   -n   How many times to scrape (default 1000)
+ *   -p   The port to listen on (default: any free one)
+ *   -s   Just serve, forever, e.g., for trying out with curl or a real Prometheus
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ * 
+ ****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include "Metrics.h"
+#include "MetricsHttp.h"
+
+// A WiFiClient lookalike on a non-blocking POSIX socket
+class PosixClient {
+public:
+  PosixClient(int fd = -1) : fd(fd) {}
+  explicit operator bool() const { return fd >= 0; }
+  bool connected() {
+    if (fd < 0) {
+      return false;
+    }
+    char c;
+    ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n > 0 || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+  }
+  int available() {
+    int n = 0;
+    return fd >= 0 && ioctl(fd, FIONREAD, &n) == 0 ? n : 0;
+  }
+  int read() {
+    unsigned char c;
+    return fd >= 0 && recv(fd, &c, 1, MSG_DONTWAIT) == 1 ? c : -1;
+  }
+  size_t write(const uint8_t *buf, size_t len) {
+    ssize_t n = fd >= 0 ? send(fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL) : -1;
+    return n > 0 ? n : 0;
+  }
+  void stop() {
+    if (fd >= 0) {
+      close(fd);
+    }
+    fd = -1;
+  }
+private:
+  int fd;
+};
+
+// A WiFiServer lookalike: a non-blocking listening socket on loopback
+class PosixServer {
+public:
+  bool begin(uint16_t port) {
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 8) != 0) {
+      return false;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return true;
+  }
+  uint16_t port() {
+    sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    getsockname(fd, (sockaddr *)&addr, &len);
+    return ntohs(addr.sin_port);
+  }
+  PosixClient available() {
+    int c = accept(fd, nullptr, nullptr);
+    if (c >= 0) {
+      fcntl(c, F_SETFL, fcntl(c, F_GETFL) | O_NONBLOCK);
+    }
+    return PosixClient(c);
+  }
+private:
+  int fd = -1;
+};
+
+static double nowMicros() {
+  return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Check that text is well-formed Prometheus text: every sample's metric has a TYPE before it
+static bool wellFormed(const std::string &text) {
+  std::vector<std::string> typed;
+  size_t pos = 0;
+  while (pos < text.size()) {
+    size_t eol = text.find('\n', pos);
+    if (eol == std::string::npos) {
+      return false;
+    }
+    std::string line = text.substr(pos, eol - pos);
+    pos = eol + 1;
+    if (line.compare(0, 7, "# TYPE ") == 0) {
+      typed.push_back(line.substr(7, line.find(' ', 7) - 7));
+      continue;
+    }
+    if (line.compare(0, 1, "#") == 0) {
+      continue;
+    }
+    size_t nameEnd = line.find_first_of("{ ");
+    size_t valueStart = line.rfind(' ');
+    if (nameEnd == std::string::npos || valueStart == std::string::npos || valueStart + 1 >= line.size()) {
+      return false;
+    }
+    std::string name = line.substr(0, nameEnd);
+    bool found = false;
+    for (const std::string &t : typed) {
+      found = found || name == t || name == t + "_sum" || name == t + "_count";
+    }
+    char *end;
+    strtod(line.c_str() + valueStart + 1, &end);
+    if (!found || *end != '\0') {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Scrape the server once; return the body or "" if something was wrong
+static std::string scrape(uint16_t port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  std::string response;
+  if (connect(fd, (sockaddr *)&addr, sizeof(addr)) == 0) {
+    const char *request = "GET /metrics HTTP/1.0\r\nHost: localhost\r\n\r\n";
+    send(fd, request, strlen(request), MSG_NOSIGNAL);
+    char buf[4096];
+    ssize_t n;
+    while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+      response.append(buf, n);
+    }
+  }
+  close(fd);
+  size_t bodyAt = response.find("\r\n\r\n");
+  size_t lengthAt = response.find("Content-Length: ");
+  if (response.compare(0, 15, "HTTP/1.0 200 OK") != 0 || bodyAt == std::string::npos || lengthAt == std::string::npos) {
+    return "";
+  }
+  std::string body = response.substr(bodyAt + 4);
+  return body.size() == strtoul(response.c_str() + lengthAt + 16, nullptr, 10) ? body : "";
+}
+
+// The stand-in for the firmware's metrics
+Metrics metrics;
+int8_t stepsId, stepGapId, sliceId, heapId;
+
+static void collect() {
+  metrics.set(heapId, 100000 + rand() % 1000);
+}
+
+int main(int argc, char **argv) {
+  int scrapes = 1000;
+  uint16_t port = 0;
+  bool serveOnly = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      scrapes = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+      port = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-s") == 0) {
+      serveOnly = true;
+    } else {
+      fprintf(stderr, "Usage: %s [-n <scrapes>] [-p <port>] [-s]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  stepsId = metrics.add("tat_clock_steps_total", "Steps taken by the tide clock.", mtCounter);
+  stepGapId = metrics.add("tat_step_gap_seconds", "Longest wait for the step task.", mtGauge);
+  sliceId = metrics.add("tat_metrics_slice_seconds", "Time spent in each metrics server slice.", mtSummary);
+  heapId = metrics.add("tat_heap_free_bytes", "Free heap.", mtGauge);
+  static const char *tasks[] = {"task=\"clock\"", "task=\"display\"", "task=\"level\"", "task=\"ui\""};
+  for (const char *t : tasks) {
+    metrics.add("tat_task_runs_total", "Times each task has run.", mtCounter, t);
+  }
+  metrics.attachCollector(collect);
+
+  PosixServer server;
+  if (!server.begin(port)) {
+    fprintf(stderr, "Can't listen on port %u: %s\n", port, strerror(errno));
+    return 1;
+  }
+  port = server.port();
+  static char body[6144];
+  MetricsHttp<PosixServer, PosixClient> http {server, metrics, body, sizeof(body)};
+  printf("Serving http://127.0.0.1:%u/metrics\n", port);
+
+  // The scraper
+  std::atomic<bool> done {false};
+  std::vector<double> latencies;
+  int bad = 0;
+  std::thread scraper;
+  if (!serveOnly) {
+    scraper = std::thread([&]() {
+      for (int i = 0; i < scrapes; i++) {
+        double start = nowMicros();
+        std::string text = scrape(port);
+        latencies.push_back(nowMicros() - start);
+        if (text.empty() || !wellFormed(text)) {
+          bad++;
+        }
+      }
+      done = true;
+    });
+  }
+
+  // The cooperative loop: a step task due every millisecond, and the server, run as often as possible
+  double start = nowMicros();
+  double nextStep = start + 1000;
+  double maxSlice = 0, maxGap = 0;
+  while (!done) {
+    double now = nowMicros();
+    if (now >= nextStep) {
+      maxGap = std::max(maxGap, now - nextStep);
+      metrics.inc(stepsId);
+      metrics.set(stepGapId, maxGap / 1e6);
+      nextStep += 1000;
+    }
+    double before = nowMicros();
+    http.run((unsigned long)(before / 1000));
+    double slice = nowMicros() - before;
+    maxSlice = std::max(maxSlice, slice);
+    if (http.busy()) {
+      metrics.observe(sliceId, slice / 1e6);
+    } else {
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+  }
+  scraper.join();
+
+  std::sort(latencies.begin(), latencies.end());
+  size_t n = latencies.size();
+  printf("%d scrapes, %d bad, %u responses served, %zu-byte body\n", scrapes, bad, http.responses(), strlen(body));
+  printf("Scrape latency: p50 %.0f us, p99 %.0f us, max %.0f us\n", latencies[n / 2], latencies[n * 99 / 100], latencies[n - 1]);
+  printf("Longest server slice: %.0f us; longest step task wait: %.0f us\n", maxSlice, maxGap);
+  return bad == 0 ? 0 : 1;
+}
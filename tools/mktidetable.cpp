@@ -0,0 +1,272 @@
+/****
+ *
+ * mktidetable.cpp
+ * Host tool for building tide table partition images. Part of Time and Tides.
+ * 
+ * Reads saved NOAA api responses for one station -- any number of six-minute predictions and 
+ * hi/lo predictions, in any order, overlapping is fine -- checks them and writes a tide table 
+ * (see lib/TideData/TideTable.h) ready to be flashed into the device's "tides" partition. With 
+ * a year's worth of responses, the device can show levels and run the clock for that year 
+ * without asking NOAA for anything.
+ * 
+ * With -a, it writes a hi/lo archive (see lib/TideData/TideArchive.h) instead. That needs only 
+ * hi/lo responses, and a year of them comes to about 4KB. The device uses it to run the clock; 
+ * water levels still come from NOAA.
+ * 
+ * Each response is checked the way the firmware checks what it fetches (see fxCheck() in 
+ * NoaaFixture.h) before they're merged, and the image is checked by attaching to it the way the 
+ * device does before it's written.
+ * 
+ * With -d <directory> instead of -s and -o, it builds an image for each of many stations -- to 
+ * load a batch of devices, or a LAN tideproxy's cache -- into <directory>/<station>.bin. Each 
+ * response's station is the 7 digits its file name starts with. The stations are built in 
+ * parallel on -j threads (by default, one per core) from a work-stealing pool (see WorkPool.h), 
+ * and it reports how many stations a second that came to.
+ * 
+ * Build and run (from the repository root):
+ * 
+ *   g++ -std=c++17 -O2 -pthread -Ilib/TideData -Itools -o mktidetable tools/mktidetable.cpp lib/TideData/TideTable.cpp lib/TideData/TideArchive.cpp
+ *   ./mktidetable -s 9444900 -o tides.bin responses/9444900-*.json
+ *   ./mktidetable -a -s 9444900 -o tides.bin responses/9444900-*-hilo.json
+ *   ./mktidetable -j 8 -d images responses/9*.json
+ * 
+ * Flash the result with esptool, at the "tides" partition's offset in partitions.csv:
+ * 
+ *   esptool.py --chip esp32s2 write_flash 0x290000 tides.bin
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ * 
+ ****/
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <map>
+#include "NoaaFixture.h"
+#include "TideArchive.h"
+#include "WorkPool.h"
+
+#define MTT_PARTITION_SIZE      (0x100000)      // The size of the "tides" partition in partitions.csv
+
+/**
+ * @brief A station to build an image for, and how that went
+ */
+struct station_t {
+  std::string station;                          // The 7-digit NOAA station ID
+  std::vector<std::string> paths;               // Its responses
+  std::string outPath;                          // Where to write the image
+  size_t bytesRead = 0;                         // The size of the responses
+  bool ok = false;                              // Whether the image was built and written
+  std::string report;                           // What was written, or what went wrong
+};
+
+/**
+ * @brief Write an image to s.outPath
+ */
+static bool writeImage(station_t &s, const uint8_t *image, size_t size) {
+  FILE *f = fopen(s.outPath.c_str(), "wb");
+  if (f == nullptr || fwrite(image, 1, size, f) != size || fclose(f) != 0) {
+    s.report = s.outPath + ": can't write";
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Write the hi/lo events among samples as a TideArchive, checking that it decodes to what 
+ *        went in (to within the level quantum).
+ */
+static bool buildArchive(station_t &s, const std::vector<fx_sample_t> &samples) {
+  const char *station = s.station.c_str();
+  std::vector<fx_sample_t> hilo;
+  for (const fx_sample_t &p : samples) {
+    if (p.type >= 0) {
+      hilo.push_back(p);
+    }
+  }
+  std::vector<fx_sample_t> levels, events;
+  std::string err;
+  fxMerge(hilo, levels, events, err);
+  if (events.empty()) {
+    s.report = s.station + ": no hi/lo events";
+    return false;
+  }
+  std::vector<tt_event_t> in(events.size());
+  for (size_t i = 0; i < events.size(); i++) {
+    in[i] = {(uint32_t)events[i].time, events[i].level, (uint8_t)events[i].type, 0};
+  }
+  std::vector<uint8_t> out(sizeof(ta_header_t) + in.size() * (sizeof(ta_block_t) + 10));
+  size_t size = taEncode(station, in.data(), in.size(), out.data(), out.size());
+  TideArchive check;
+  if (size == 0 || !check.attach(out.data(), size) || check.size() != in.size()) {
+    s.report = s.station + ": couldn't build the archive";
+    return false;
+  }
+  for (size_t i = 0; i < in.size(); i++) {
+    tt_event_t e, n;
+    time_t before = i == 0 ? in[0].time - 1 : in[i - 1].time;
+    if (!check.eventAt(i, &e) || !check.nextEvent(before, &n) || e.time != in[i].time || n.time != in[i].time ||
+        e.type != in[i].type || abs(e.level - in[i].level) > TA_LEVEL_QUANTUM / 2) {
+      s.report = s.station + ": archive doesn't decode correctly at event " + std::to_string(i);
+      return false;
+    }
+  }
+  if (!writeImage(s, out.data(), size)) {
+    return false;
+  }
+  time_t first = events.front().time, last = events.back().time;
+  char line[160];
+  snprintf(line, sizeof(line), "%s: %zu events over %.1f days; %zu bytes (%.2f bytes/event) written to %s",
+    station, events.size(), (last - first) / 86400.0, size, (double)size / events.size(), s.outPath.c_str());
+  s.report = line;
+  return true;
+}
+
+/**
+ * @brief Write the levels and events in samples as a TideTable, checking that the device will 
+ *        accept it
+ */
+static bool buildTable(station_t &s, const std::vector<fx_sample_t> &samples) {
+  const char *station = s.station.c_str();
+  std::vector<fx_sample_t> levels, events;
+  std::string err;
+  if (!fxMerge(samples, levels, events, err)) {
+    s.report = s.station + ": " + err;
+    return false;
+  }
+  std::vector<uint8_t> table = fxBuildTable(station, levels, events);
+  if (table.size() > MTT_PARTITION_SIZE) {
+    s.report = s.station + ": table is " + std::to_string(table.size()) + " bytes; the partition only holds " +
+      std::to_string(MTT_PARTITION_SIZE);
+    return false;
+  }
+  TideTable check;
+  if (!check.attach(table.data(), table.size())) {
+    s.report = s.station + ": built a table that doesn't check out";
+    return false;
+  }
+  if (!writeImage(s, table.data(), table.size())) {
+    return false;
+  }
+  time_t first = levels.front().time, last = levels.back().time;
+  char from[20], to[20], line[200];
+  tm t;                                         // gmtime() shares one tm among the threads; gmtime_r() doesn't
+  strftime(from, sizeof(from), "%Y-%m-%d %H:%M", gmtime_r(&first, &t));
+  strftime(to, sizeof(to), "%Y-%m-%d %H:%M", gmtime_r(&last, &t));
+  snprintf(line, sizeof(line), "%s: %zu levels and %zu events from %s to %s UTC; %zu bytes written to %s",
+    station, levels.size(), events.size(), from, to, table.size(), s.outPath.c_str());
+  s.report = line;
+  return true;
+}
+
+/**
+ * @brief Read and check a station's responses and build its image
+ */
+static void build(station_t &s, bool archive) {
+  std::vector<fx_sample_t> samples;
+  for (const std::string &path : s.paths) {
+    std::string json, err;
+    if (!fxReadFile(path, json)) {
+      s.report = path + ": can't read";
+      return;
+    }
+    s.bytesRead += json.size();
+    std::vector<fx_sample_t> response;
+    if (!fxParse(json, response, err) || !fxCheck(response, err)) {
+      s.report = path + ": " + err;
+      return;
+    }
+    samples.insert(samples.end(), response.begin(), response.end());
+  }
+  s.ok = archive ? buildArchive(s, samples) : buildTable(s, samples);
+}
+
+/**
+ * @brief The station a response is for: the 7 digits its file name starts with; "" if it 
+ *        doesn't
+ */
+static std::string stationOf(const std::string &path) {
+  size_t slash = path.find_last_of('/');
+  std::string name = path.substr(slash == std::string::npos ? 0 : slash + 1);
+  if (name.size() < 7 || name.find_first_not_of("0123456789") < 7) {
+    return "";
+  }
+  return name.substr(0, 7);
+}
+
+int main(int argc, char **argv) {
+  const char *station = nullptr;
+  const char *outPath = nullptr;
+  const char *outDir = nullptr;
+  unsigned nThreads = std::thread::hardware_concurrency();
+  bool archive = false;
+  std::vector<std::string> inPaths;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      station = argv[++i];
+    } else if (strcmp(argv[i], "-a") == 0) {
+      archive = true;
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      outPath = argv[++i];
+    } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+      outDir = argv[++i];
+    } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      nThreads = (unsigned)atoi(argv[++i]);
+    } else {
+      inPaths.push_back(argv[i]);
+    }
+  }
+  bool single = station != nullptr && outPath != nullptr && strlen(station) == 7 && outDir == nullptr;
+  if (inPaths.empty() || (!single && (outDir == nullptr || station != nullptr || outPath != nullptr))) {
+    fprintf(stderr, "Usage: %s [-a] -s <7-digit station> -o <image> <response.json>...\n"
+      "       %s [-a] [-j <threads>] -d <directory> <7-digit station>*.json...\n", argv[0], argv[0]);
+    return 2;
+  }
+
+  if (single) {
+    station_t s;
+    s.station = station;
+    s.paths = inPaths;
+    s.outPath = outPath;
+    build(s, archive);
+    fprintf(s.ok ? stdout : stderr, "%s\n", s.report.c_str());
+    return s.ok ? 0 : 1;
+  }
+
+  // Many stations: sort the responses out by station and build them all
+  std::map<std::string, std::vector<std::string>> byStation;
+  for (const std::string &path : inPaths) {
+    std::string id = stationOf(path);
+    if (id.empty()) {
+      fprintf(stderr, "%s: the file name doesn't start with a 7-digit station\n", path.c_str());
+      return 2;
+    }
+    byStation[id].push_back(path);
+  }
+  std::vector<station_t> stations;
+  for (const auto &st : byStation) {
+    station_t s;
+    s.station = st.first;
+    s.paths = st.second;
+    s.outPath = std::string(outDir) + "/" + st.first + ".bin";
+    stations.push_back(s);
+  }
+  WorkPool pool(nThreads);
+  auto start = std::chrono::steady_clock::now();
+  pool.run(stations.size(), [&](size_t i) { build(stations[i], archive); });
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  size_t failed = 0, bytesRead = 0;
+  for (const station_t &s : stations) {
+    fprintf(s.ok ? stdout : stderr, "%s\n", s.report.c_str());
+    failed += s.ok ? 0 : 1;
+    bytesRead += s.bytesRead;
+  }
+  printf("%zu stations (%zu failed), %.1f MB of responses, in %.2f s on %u threads: %.1f stations/s, %.1f MB/s; "
+    "%zu stolen\n", stations.size(), failed, bytesRead / 1e6, secs, pool.threads(), stations.size() / secs,
+    bytesRead / 1e6 / secs, pool.stolen());
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,425 @@
+/****
+ *
+ * profsym.cpp
+ * Host tool turning the device's profiler samples into a profile. Part of Time and Tides.
+ *
+ * Reads what "prof dump" printed (see lib/Profiler/Profiler.h) from a capture of the serial
+ * console -- anything else in the capture is ignored, and if there's more than one dump, the
+ * last one is used -- and looks the addresses up in the symbol table of the firmware's ELF file
+ * (PlatformIO leaves it in .pio/build/<env>/firmware.elf). Then it prints:
+ *
+ *   - The share of the samples each FreeRTOS task had (IDLE is the CPU with nothing to do)
+ *   - The share each area of the firmware had -- TLS, JSON parsing, the stepper and so on,
+ *     by the rules in areaRules below -- going by the innermost function in each sample that
+ *     belongs to one, so that a memcpy() done for ArduinoJson counts as JSON parsing
+ *   - A flat profile: for each function, the samples taken in it ("self") and in it or
+ *     anything it called ("total"), most self first
+ *
+ * With -f <file>, it also writes the samples as "folded" stacks, one line for each different
+ * stack: the task, then the functions from the outermost in, separated by ';', then the count.
+ * That's what flame graph tools take, e.g., Brendan Gregg's flamegraph.pl or speedscope.
+ *
+ * Functions are named without their parameter lists, so overloads are lumped together. ROM
+ * functions are named from the absolute symbols the ESP-IDF linker scripts give them. An
+ * address that's in no function the ELF file knows about is shown as itself.
+ *
+ * Build and run (from the repository root):
+ *
+ *   g++ -std=c++17 -O2 -o profsym tools/profsym.cpp
+ *   ./profsym -f tat.folded .pio/build/esp32s2/firmware.elf capture.txt
+ *   flamegraph.pl tat.folded > tat.svg
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ *
+ ****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <cxxabi.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+#define PS_MAX_GAP              (0x1000)    // The furthest past a symbol with no size an address is taken to be in it
+
+/**
+ * @brief An area of the firmware: the functions (and tasks) whose samples are its. Patterns
+ *        are names without their parameter lists; "x*" is anything starting with x. A task
+ *        pattern, "task:name", takes the samples in that task that no function pattern took.
+ *        The first rule that fits the innermost function it can wins.
+ */
+struct rule_t {
+  const char *area;
+  const char *patterns;                         // Space-separated patterns
+};
+static const rule_t areaRules[] = {
+  {"TLS",           "mbedtls_* esp_mbedtls_* ssl_* start_ssl_client stop_ssl_socket send_ssl_data get_ssl_receive "
+                    "esp_crt_* tatCaBundle* TlsClient* WiFiClientSecure::*"},
+  {"JSON parsing",  "ArduinoJson* deserializeJson*"},
+  {"TideWire",      "TideWire* tw*"},
+  {"stepper",       "GStepper* GyverStepper* Stepper* FastPin* WlDisplay::* displayTask"},
+  {"tide clock",    "TideClock::* tc* clockTask sleepUntilNextTick"},
+  {"fetch/parse",   "AsyncFetch* EspLink::* fetchTask levelTask startFetch fetchFinished parse* fitPredCurve "
+                    "TideCurve* WlBias::* PredFetch* HiloFetch*"},
+  {"flash log",     "FlashLog* EspFlash::* logEvent dumpLog"},
+  {"UI",            "UserInput::* RpcLink::* uiTask on*"},
+  {"metrics",       "Metrics* MetricsHttp* metricsTask collectMetrics"},
+  {"scheduler",     "CoopSched::* loop"},
+  {"network",       "lwip_* tcp_* udp_* ip4_* ip_* pbuf_* netconn_* netif_* etharp_* sys_arch_* "
+                    "esp_wifi_* ieee80211_* task:tiT task:wifi task:sys_evt task:arduino_events"},
+  {"idle",          "task:IDLE"},
+};
+#define N_AREAS     (sizeof(areaRules) / sizeof(areaRules[0]) + 1)  // Plus "other"
+
+/**
+ * @brief A function (or ROM routine) in the ELF file's symbol table
+ */
+struct symbol_t {
+  uint64_t addr;
+  uint64_t size;                                // 0 if the symbol table doesn't say
+  std::string name;                             // Demangled, without its parameter list
+  bool operator<(const symbol_t &other) const { return addr < other.addr; }
+};
+
+/**
+ * @brief A stack from the dump and the number of samples it was seen in
+ */
+struct sample_t {
+  uint32_t count;
+  std::string task;
+  std::vector<uint32_t> pcs;                    // Innermost first
+};
+
+/**
+ * @brief What the dump's "begin" line said
+ */
+struct header_t {
+  unsigned long hz = 0, depth = 0, samples = 0, dropped = 0, stacks = 0, millis = 0, mhz = 0;
+  unsigned long long cycles = 0;
+};
+
+/**
+ * @brief The name to show for a function: demangled, without its parameter list (or the
+ *        qualifiers after it)
+ */
+static std::string displayName(const char *mangled) {
+  int status = -1;
+  char *demangled = abi::__cxa_demangle(mangled, nullptr, nullptr, &status);
+  std::string name = status == 0 && demangled != nullptr ? demangled : mangled;
+  free(demangled);
+  int angles = 0;
+  for (size_t i = 0; i < name.size(); i++) {
+    if (name[i] == '<') {
+      angles++;
+    } else if (name[i] == '>') {
+      angles--;
+    } else if (name[i] == '(' && angles == 0) {
+      if (name.compare(i, 20, "(anonymous namespace") == 0) {
+        i = name.find(')', i);
+        if (i == std::string::npos) {
+          break;
+        }
+      } else if (i >= 8 && name.compare(i - 8, 8, "operator") == 0 && name.compare(i, 2, "()") == 0) {
+        i++;
+      } else {
+        return name.substr(0, i);
+      }
+    }
+  }
+  return name;
+}
+
+template <typename T> static T get(const std::vector<char> &elf, size_t at) {
+  T v = 0;
+  if (at + sizeof(T) <= elf.size()) {
+    memcpy(&v, elf.data() + at, sizeof(T));
+  }
+  return v;
+}
+
+/**
+ * @brief Read the functions, and the absolute symbols (ROM routines), from the symbol table of
+ *        a little-endian ELF file, 32-bit (the firmware's) or 64-bit
+ */
+static bool readElf(const char *path, std::vector<symbol_t> &symbols) {
+  std::ifstream in(path, std::ios::binary);
+  std::vector<char> elf((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  if (elf.size() < 64 || memcmp(elf.data(), "\177ELF", 4) != 0 || elf[5] != 1) {
+    return false;
+  }
+  bool is64 = elf[4] == 2;
+  uint64_t shoff = is64 ? get<uint64_t>(elf, 0x28) : get<uint32_t>(elf, 0x20);
+  uint16_t shentsize = get<uint16_t>(elf, is64 ? 0x3A : 0x2E);
+  uint16_t shnum = get<uint16_t>(elf, is64 ? 0x3C : 0x30);
+  for (uint16_t s = 0; s < shnum; s++) {
+    size_t sh = shoff + (size_t)s * shentsize;
+    if (get<uint32_t>(elf, sh + 4) != 2) {      // SHT_SYMTAB
+      continue;
+    }
+    uint32_t link = get<uint32_t>(elf, sh + (is64 ? 0x28 : 0x18));
+    uint64_t off = is64 ? get<uint64_t>(elf, sh + 0x18) : get<uint32_t>(elf, sh + 0x10);
+    uint64_t size = is64 ? get<uint64_t>(elf, sh + 0x20) : get<uint32_t>(elf, sh + 0x14);
+    uint64_t entsize = is64 ? get<uint64_t>(elf, sh + 0x38) : get<uint32_t>(elf, sh + 0x24);
+    size_t strsh = shoff + (size_t)link * shentsize;
+    uint64_t stroff = is64 ? get<uint64_t>(elf, strsh + 0x18) : get<uint32_t>(elf, strsh + 0x10);
+    for (uint64_t e = off; entsize > 0 && e + entsize <= off + size && e + entsize <= elf.size(); e += entsize) {
+      uint32_t nameOff = get<uint32_t>(elf, e);
+      uint8_t info = get<uint8_t>(elf, e + (is64 ? 4 : 12));
+      uint16_t shndx = get<uint16_t>(elf, e + (is64 ? 6 : 14));
+      uint64_t value = is64 ? get<uint64_t>(elf, e + 8) : get<uint32_t>(elf, e + 4);
+      uint64_t symSize = is64 ? get<uint64_t>(elf, e + 16) : get<uint32_t>(elf, e + 8);
+      bool func = (info & 0xF) == 2;            // STT_FUNC
+      bool rom = shndx == 0xFFF1 && value != 0; // SHN_ABS
+      if ((!func && !rom) || stroff + nameOff >= elf.size() || elf[stroff + nameOff] == '\0') {
+        continue;
+      }
+      symbols.push_back({value, symSize, displayName(elf.data() + stroff + nameOff)});
+    }
+  }
+  std::sort(symbols.begin(), symbols.end());
+  return !symbols.empty();
+}
+
+/**
+ * @brief The name of the function an address is in: the one with a size that covers it or,
+ *        failing that, the closest one before it that has no size, if that's close enough
+ */
+static std::string lookUp(const std::vector<symbol_t> &symbols, uint32_t pc) {
+  auto after = std::upper_bound(symbols.begin(), symbols.end(), symbol_t{pc, 0, ""});
+  const symbol_t *unsized = nullptr;
+  for (auto s = after; s != symbols.begin(); ) {
+    --s;
+    if (s->size > 0 && pc < s->addr + s->size) {
+      return s->name;
+    }
+    if (s->size == 0 && unsized == nullptr) {
+      unsized = &*s;
+    }
+    if (pc - s->addr > PS_MAX_GAP) {
+      break;
+    }
+  }
+  if (unsized != nullptr && pc - unsized->addr <= PS_MAX_GAP) {
+    return unsized->name;
+  }
+  char hex[16];
+  snprintf(hex, sizeof(hex), "0x%08x", pc);
+  return hex;
+}
+
+/**
+ * @brief Read the last dump in a capture of the serial console
+ */
+static bool readDump(std::istream &in, header_t &header, std::vector<sample_t> &stacks) {
+  std::string line;
+  bool begun = false, ended = false;
+  while (std::getline(in, line)) {
+    size_t at = line.find("prof: ");
+    if (at == std::string::npos) {
+      continue;
+    }
+    std::istringstream words(line.substr(at + 6));
+    std::string first;
+    words >> first;
+    if (first == "begin") {
+      begun = true;
+      ended = false;
+      stacks.clear();
+      header = header_t();
+      std::string kv;
+      while (words >> kv) {
+        size_t eq = kv.find('=');
+        std::string key = kv.substr(0, eq), value = eq == std::string::npos ? "" : kv.substr(eq + 1);
+        unsigned long long v = strtoull(value.c_str(), nullptr, 10);
+        if (key == "hz") header.hz = v;
+        else if (key == "depth") header.depth = v;
+        else if (key == "samples") header.samples = v;
+        else if (key == "dropped") header.dropped = v;
+        else if (key == "stacks") header.stacks = v;
+        else if (key == "millis") header.millis = v;
+        else if (key == "cycles") header.cycles = v;
+        else if (key == "mhz") header.mhz = v;
+      }
+    } else if (first == "end") {
+      ended = begun;
+    } else if (begun && !ended && isdigit((unsigned char)first[0])) {
+      sample_t stack;
+      stack.count = strtoul(first.c_str(), nullptr, 10);
+      words >> stack.task;
+      std::string pc;
+      while (words >> pc) {
+        stack.pcs.push_back(strtoul(pc.c_str(), nullptr, 16));
+      }
+      if (!stack.task.empty() && !stack.pcs.empty()) {
+        stacks.push_back(stack);
+      }
+    }
+  }
+  return ended;
+}
+
+/**
+ * @brief Whether name fits pattern: the same, or, for "x*", starting with x
+ */
+static bool nameFits(const std::string &name, const std::string &pattern) {
+  if (!pattern.empty() && pattern.back() == '*') {
+    return name.compare(0, pattern.size() - 1, pattern, 0, pattern.size() - 1) == 0;
+  }
+  return name == pattern;
+}
+
+/**
+ * @brief The area a stack's samples belong to (see areaRules)
+ */
+static size_t classify(const std::string &task, const std::vector<std::string> &names) {
+  for (const std::string &name : names) {
+    for (size_t a = 0; a < N_AREAS - 1; a++) {
+      std::istringstream patterns(areaRules[a].patterns);
+      std::string p;
+      while (patterns >> p) {
+        if (p.compare(0, 5, "task:") != 0 && nameFits(name, p)) {
+          return a;
+        }
+      }
+    }
+  }
+  for (size_t a = 0; a < N_AREAS - 1; a++) {
+    std::istringstream patterns(areaRules[a].patterns);
+    std::string p;
+    while (patterns >> p) {
+      if (p.compare(0, 5, "task:") == 0 && nameFits(task, p.substr(5))) {
+        return a;
+      }
+    }
+  }
+  return N_AREAS - 1;
+}
+
+static void printShares(const char *what, const std::vector<std::pair<std::string, uint64_t>> &shares, uint64_t all) {
+  printf("\n%-24s %10s %7s\n", what, "Samples", "%");
+  for (const auto &s : shares) {
+    printf("%-24s %10llu %6.1f%%\n", s.first.c_str(), (unsigned long long)s.second, 100.0 * s.second / all);
+  }
+}
+
+static std::vector<std::pair<std::string, uint64_t>> sorted(const std::map<std::string, uint64_t> &counts) {
+  std::vector<std::pair<std::string, uint64_t>> answer(counts.begin(), counts.end());
+  std::stable_sort(answer.begin(), answer.end(), [](const auto &a, const auto &b) { return a.second > b.second; });
+  return answer;
+}
+
+int main(int argc, char **argv) {
+  const char *foldedPath = nullptr;
+  int top = 40;
+  int opt = 1;
+  for (; opt < argc && argv[opt][0] == '-' && argv[opt][1] != '\0'; opt++) {
+    if (strcmp(argv[opt], "-f") == 0 && opt + 1 < argc) {
+      foldedPath = argv[++opt];
+    } else if (strcmp(argv[opt], "-n") == 0 && opt + 1 < argc) {
+      top = atoi(argv[++opt]);
+    } else {
+      break;
+    }
+  }
+  if (argc - opt < 1 || argc - opt > 2) {
+    fprintf(stderr, "Usage: %s [-f <folded stacks file>] [-n <functions>] <firmware.elf> [<capture> | -]\n", argv[0]);
+    return 2;
+  }
+  std::vector<symbol_t> symbols;
+  if (!readElf(argv[opt], symbols)) {
+    fprintf(stderr, "Can't read the symbols in %s.\n", argv[opt]);
+    return 2;
+  }
+  header_t header;
+  std::vector<sample_t> stacks;
+  bool fromFile = argc - opt == 2 && strcmp(argv[opt + 1], "-") != 0;
+  std::ifstream file;
+  if (fromFile) {
+    file.open(argv[opt + 1]);
+    if (!file) {
+      fprintf(stderr, "Can't open %s.\n", argv[opt + 1]);
+      return 2;
+    }
+  }
+  if (!readDump(fromFile ? file : std::cin, header, stacks)) {
+    fprintf(stderr, "There's no complete \"prof dump\" in %s.\n", fromFile ? argv[opt + 1] : "the input");
+    return 2;
+  }
+
+  // Add up the samples by task, area and function
+  std::map<std::string, uint64_t> byTask, byArea, self, total;
+  std::map<uint32_t, std::string> names;
+  uint64_t all = 0;
+  FILE *folded = foldedPath == nullptr ? nullptr : fopen(foldedPath, "w");
+  if (foldedPath != nullptr && folded == nullptr) {
+    fprintf(stderr, "Can't write %s.\n", foldedPath);
+    return 2;
+  }
+  for (const sample_t &s : stacks) {
+    std::vector<std::string> frames;
+    for (uint32_t pc : s.pcs) {
+      auto n = names.find(pc);
+      if (n == names.end()) {
+        n = names.emplace(pc, lookUp(symbols, pc)).first;
+      }
+      frames.push_back(n->second);
+    }
+    all += s.count;
+    byTask[s.task] += s.count;
+    size_t area = classify(s.task, frames);
+    byArea[area < N_AREAS - 1 ? areaRules[area].area : "other"] += s.count;
+    self[frames[0]] += s.count;
+    std::set<std::string> seen(frames.begin(), frames.end());
+    for (const std::string &f : seen) {
+      total[f] += s.count;
+    }
+    if (folded != nullptr) {
+      fprintf(folded, "%s", s.task.c_str());
+      for (auto f = frames.rbegin(); f != frames.rend(); ++f) {
+        fprintf(folded, ";%s", f->c_str());
+      }
+      fprintf(folded, " %u\n", s.count);
+    }
+  }
+  if (folded != nullptr) {
+    fclose(folded);
+  }
+  if (all == 0) {
+    printf("The dump has no samples.\n");
+    return 0;
+  }
+
+  printf("%llu samples at %lu Hz over %.1f s, up to %lu calls deep; %lu didn't fit in the device's table.\n",
+    (unsigned long long)all, header.hz, header.millis / 1000.0, header.depth, header.dropped);
+  if (header.samples > 0 && header.millis > 0 && header.mhz > 0) {
+    printf("Sampling took %.0f CPU cycles a sample, %.2f%% of the CPU, not counting interrupt entry and exit.\n",
+      (double)header.cycles / header.samples, header.cycles * 100.0 / ((double)header.millis * 1000 * header.mhz));
+  }
+  printShares("Task", sorted(byTask), all);
+  printShares("Area", sorted(byArea), all);
+
+  printf("\n%10s %7s %10s %7s  %s\n", "Self", "%", "Total", "%", "Function");
+  std::vector<std::string> functions;
+  for (const auto &f : total) {
+    functions.push_back(f.first);
+  }
+  std::stable_sort(functions.begin(), functions.end(), [&](const std::string &a, const std::string &b) {
+    return self[a] != self[b] ? self[a] > self[b] : total[a] > total[b];
+  });
+  for (int i = 0; i < top && i < (int)functions.size(); i++) {
+    const std::string &f = functions[i];
+    printf("%10llu %6.1f%% %10llu %6.1f%%  %s\n", (unsigned long long)self[f], 100.0 * self[f] / all,
+      (unsigned long long)total[f], 100.0 * total[f] / all, f.c_str());
+  }
+  return 0;
+}
@@ -0,0 +1,82 @@
+/****
+ *
+ * tcschedule.cpp
+ * Host tool for checking the tide clock's tick schedule. Part of Time and Tides.
+ * 
+ * Builds the tick schedule TideClock would sleep through on battery for a tide cycle and prints 
+ * the resulting pulse timeline. It also checks the schedule against the face math itself by 
+ * stepping through the cycle one second at a time, the way TideClock::run() would, and reports 
+ * any tick that the schedule has happening at a different second.
+ * 
+ * Build and run (from the repository root):
+ * 
+ *   g++ -std=c++17 -O2 -Ilib/TideClock -o tcschedule tools/tcschedule.cpp lib/TideClock/TideSchedule.cpp
+ *   ./tcschedule nonlinear 64800
+ * 
+ * Usage: tcschedule linear | nonlinear <secToNextTide> [<ticksTaken>] [-q]
+ * 
+ *   -q   Don't print the timeline, just the summary
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ * 
+ ****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "TideSchedule.h"
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    fprintf(stderr, "Usage: %s linear | nonlinear <secToNextTide> [<ticksTaken>] [-q]\n", argv[0]);
+    return 2;
+  }
+  bool nonlinear = strcmp(argv[1], "nonlinear") == 0;
+  int32_t secToNextTide = atol(argv[2]);
+  int32_t ticksTaken = argc > 3 && argv[3][0] != '-' ? atol(argv[3]) : 0;
+  bool quiet = strcmp(argv[argc - 1], "-q") == 0;
+
+  static uint16_t delays[TC_TICKS_IN_A_CYCLE];
+  uint16_t n = tcBuildSchedule(nonlinear, ticksTaken, secToNextTide, delays, TC_TICKS_IN_A_CYCLE);
+
+  // Print the timeline
+  int32_t at = 0;
+  uint16_t shortest = 0xFFFF, longest = 0;
+  for (uint16_t i = 0; i < n; i++) {
+    at += delays[i];
+    shortest = delays[i] < shortest ? delays[i] : shortest;
+    longest = delays[i] > longest ? delays[i] : longest;
+    if (!quiet) {
+      printf("tick %4d at +%6d s (delay %5u s, %6d s before the tide)\n", ticksTaken + i + 1, at, delays[i], secToNextTide - at);
+    }
+  }
+
+  // Check it against the face math, one second at a time
+  int32_t errors = 0;
+  int32_t shown = ticksTaken;
+  uint16_t ix = 0;
+  int32_t due = n > 0 ? delays[0] : 0;
+  for (int32_t t = 0; t <= secToNextTide && ix < n; t++) {
+    int32_t needed = tcTicksNeeded(nonlinear, secToNextTide - t);
+    while (shown < needed && ix < n) {
+      shown++;
+      if (t != due && !(delays[ix] == 0 && t == 0)) {
+        if (errors < 10) {
+          printf("MISMATCH: tick %d needed at +%d s, scheduled at +%d s\n", shown, t, due);
+        }
+        errors++;
+      }
+      ix++;
+      if (ix < n) {
+        due += delays[ix];
+      }
+    }
+  }
+  printf("%s face, %d s to the tide, %d ticks taken: %u ticks scheduled, %u bytes, delays %u..%u s, %d mismatches.\n",
+    nonlinear ? "nonlinear" : "linear", secToNextTide, ticksTaken, n, (unsigned)(n * sizeof(uint16_t)), 
+    n > 0 ? shortest : 0, longest, errors);
+  return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,186 @@
+/****
+ *
+ * tidecurve.cpp
+ * Host tool for seeing how well TideCurve compresses a day of tide predictions. Part of Time and Tides.
+ *
+ * Fits a TideCurve (see lib/TideData/TideCurve.h) to each day of six-minute predictions --
+ * midnight to midnight, 241 samples, as getPredWl() fetches them -- at each of the given error
+ * bounds, and reports, over all the days, how many knots the curves took, how big they are
+ * compared with the raw samples as the firmware used to keep them (241 floats) and as it does
+ * now (241 int16_t's), and how far they are from the raw samples: the largest and the RMS
+ * difference. It uses saved NOAA six-minute prediction responses if given, or a made-up tide.
+ *
+ * Build and run (from the repository root):
+ *
+ *   g++ -std=c++17 -O2 -Itools -Ilib/TideData -o tidecurve tools/tidecurve.cpp lib/TideData/TideCurve.cpp lib/TideData/TideTable.cpp
+ *   ./tidecurve -e 1,2,5 predictions-*.json
+ *
+ * Usage: tidecurve [-e <bound>[,<bound>...]] [-k hilo | fixed] [-d <days>] [<NOAA predictions response>...]
+ *
+ *   -e   The error bounds to try (hundredths of a foot; default 1)
+ *   -k   Where the initial knots go: at the highs and lows (the default) or at fixed intervals
+ *   -d   How many days of made-up tide to use if no responses are given (default 30)
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ *
+ ****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include "NoaaFixture.h"
+#include "TideCurve.h"
+
+// Some constants
+#define TV_START                (1672531200)    // The made-up tide starts 2023-01-01 00:00:00 UTC
+#define TV_SECONDS_PER_DAY      (86400)         // Seconds in a day
+#define TV_PRED_INTERVAL_SECS   (360)           // The interval between predictions
+#define TV_SAMPLES_PER_DAY      (241)           // Predictions in a day, midnight to midnight (TAT_N_PRED_WL in src/config.h)
+#define TV_SEMIDIURNAL_SECS     (44714.0)       // Period of the made-up tide's semidiurnal constituent (M2)
+#define TV_DIURNAL_SECS         (86164.0)       // Period of its diurnal constituent (K1)
+#define TV_SOLAR_SECS           (43200.0)       // Period of its solar semidiurnal constituent (S2)
+
+int main(int argc, char **argv) {
+  std::vector<uint16_t> bounds;
+  tcv_knots_t knots = tcvHiLo;
+  int days = 30;
+  std::vector<const char *> files;
+  for (int a = 1; a < argc; a++) {
+    bool more = a + 1 < argc;
+    if (strcmp(argv[a], "-e") == 0 && more) {
+      for (char *p = argv[++a]; *p != '\0'; p += *p == ',' ? 1 : 0) {
+        bounds.push_back((uint16_t)strtoul(p, &p, 10));
+      }
+    } else if (strcmp(argv[a], "-k") == 0 && more) {
+      knots = strcmp(argv[++a], "fixed") == 0 ? tcvFixed : tcvHiLo;
+    } else if (strcmp(argv[a], "-d") == 0 && more) {
+      days = atoi(argv[++a]);
+    } else if (argv[a][0] == '-') {
+      fprintf(stderr, "Usage: %s [-e <bound>[,<bound>...]] [-k hilo | fixed] [-d <days>] [<NOAA predictions response>...]\n", argv[0]);
+      return 2;
+    } else {
+      files.push_back(argv[a]);
+    }
+  }
+  if (bounds.empty()) {
+    bounds.push_back(TCV_DEFAULT_MAX_ERROR);
+  }
+
+  // The predictions: from the responses if there are any, else made up
+  std::vector<fx_sample_t> preds;
+  for (const char *f : files) {
+    std::string json, err;
+    std::vector<fx_sample_t> samples;
+    if (!fxReadFile(f, json) || !fxParse(json, samples, err)) {
+      fprintf(stderr, "%s: %s\n", f, err.empty() ? "can't read it" : err.c_str());
+      return 1;
+    }
+    for (const fx_sample_t &s : samples) {
+      if (s.type < 0) {
+        preds.push_back(s);
+      }
+    }
+  }
+  if (!files.empty()) {
+    std::sort(preds.begin(), preds.end(), [](const fx_sample_t &x, const fx_sample_t &y) { return x.time < y.time; });
+    preds.erase(std::unique(preds.begin(), preds.end(), [](const fx_sample_t &x, const fx_sample_t &y) { return x.time == y.time; }), preds.end());
+  } else {
+    for (time_t t = TV_START; t <= TV_START + days * TV_SECONDS_PER_DAY; t += TV_PRED_INTERVAL_SECS) {
+      double level = 4.0 + 4.5 * cos(2 * M_PI * (t - TV_START) / TV_SEMIDIURNAL_SECS) +
+        1.8 * cos(2 * M_PI * (t - TV_START) / TV_DIURNAL_SECS + 1.0) +
+        1.1 * cos(2 * M_PI * (t - TV_START) / TV_SOLAR_SECS + 2.0);
+      preds.push_back({t, (int16_t)lround(level * 100), -1});
+    }
+  }
+
+  // The days: runs of TV_SAMPLES_PER_DAY evenly spaced samples starting at a midnight
+  std::vector<std::vector<int16_t>> dayLevels;
+  std::vector<time_t> dayStarts;
+  for (size_t i = 0; i + TV_SAMPLES_PER_DAY <= preds.size(); i++) {
+    if (preds[i].time % TV_SECONDS_PER_DAY != 0 ||
+      preds[i + TV_SAMPLES_PER_DAY - 1].time - preds[i].time != TV_SECONDS_PER_DAY) {
+      continue;
+    }
+    std::vector<int16_t> levels;
+    for (size_t j = i; j < i + TV_SAMPLES_PER_DAY; j++) {
+      levels.push_back(preds[j].level);
+    }
+    dayLevels.push_back(levels);
+    dayStarts.push_back(preds[i].time);
+  }
+  if (dayLevels.empty()) {
+    fprintf(stderr, "No whole days (midnight to midnight UTC) of six-minute predictions.\n");
+    return 1;
+  }
+
+  printf("%zu days from %s", dayLevels.size(), asctime(gmtime(&dayStarts.front())));
+  printf("Initial knots at %s; a curve is %zu bytes in RAM. A day of raw samples is %zu bytes as floats, %zu as int16_t.\n\n",
+    knots == tcvFixed ? "fixed intervals" : "the highs and lows", sizeof(TideCurve),
+    TV_SAMPLES_PER_DAY * sizeof(float), TV_SAMPLES_PER_DAY * sizeof(int16_t));
+  printf("Bound  Knots (min/mean/max)  Packed bytes  Ratio vs float  vs int16  Max err  RMS err  Over  ns/levelAt\n");
+  int status = 0;
+  for (uint16_t bound : bounds) {
+    int minKnots = TCV_MAX_KNOTS, maxKnots = 0, over = 0;
+    uint16_t maxErr = 0;
+    double knotSum = 0, packedSum = 0, sqSum = 0;
+    size_t nSq = 0;
+    std::vector<TideCurve> curves(dayLevels.size());
+    for (size_t d = 0; d < dayLevels.size(); d++) {
+      TideCurve &curve = curves[d];
+      if (!curve.fit(dayStarts[d], TV_PRED_INTERVAL_SECS, dayLevels[d].data(), TV_SAMPLES_PER_DAY, bound, knots)) {
+        fprintf(stderr, "Couldn't fit the curve for %s", asctime(gmtime(&dayStarts[d])));
+        return 1;
+      }
+      minKnots = std::min(minKnots, (int)curve.knots());
+      maxKnots = std::max(maxKnots, (int)curve.knots());
+      knotSum += curve.knots();
+      packedSum += curve.packedSize();
+      over += curve.maxError() > bound;
+      for (uint16_t sx = 0; sx < TV_SAMPLES_PER_DAY; sx++) {
+        int16_t level;
+        if (!curve.levelAt(dayStarts[d] + sx * TV_PRED_INTERVAL_SECS, &level)) {
+          fprintf(stderr, "levelAt() failed inside the curve for %s", asctime(gmtime(&dayStarts[d])));
+          return 1;
+        }
+        int32_t diff = level - dayLevels[d][sx];
+        maxErr = std::max(maxErr, (uint16_t)abs(diff));
+        sqSum += (double)diff * diff;
+        nSq++;
+      }
+    }
+    status = over > 0 ? 1 : status;
+
+    // Time levelAt() at every seventh second of every day
+    volatile int64_t sink = 0;                  // So the calls aren't optimized away
+    int64_t sum = 0;
+    uint64_t calls = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t d = 0; d < curves.size(); d++) {
+      for (time_t t = dayStarts[d]; t < dayStarts[d] + TV_SECONDS_PER_DAY; t += 7) {
+        int16_t level = 0;
+        curves[d].levelAt(t, &level);
+        sum += level;
+        calls++;
+      }
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / calls;
+    sink = sum;
+    (void)sink;
+
+    double packed = packedSum / curves.size();
+    printf("%5u  %5d %6.1f %5d  %12.0f  %14.1f  %8.1f  %7u  %7.2f  %4d  %10.1f\n", bound, minKnots, knotSum / curves.size(), maxKnots,
+      packed, TV_SAMPLES_PER_DAY * sizeof(float) / packed, TV_SAMPLES_PER_DAY * sizeof(int16_t) / packed,
+      maxErr, sqrt(sqSum / nSq), over, ns);
+  }
+  printf("\nErrors are in hundredths of a foot, against the raw samples. \"Over\" is the days whose curve ran out of\n"
+    "knots (TCV_MAX_KNOTS) before it got within the bound.\n");
+  return status;
+}
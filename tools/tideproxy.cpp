@@ -0,0 +1,590 @@
+/****
+ *
+ * tideproxy.cpp
+ * LAN caching proxy for NOAA tide data. Part of Time and Tides.
+ * 
+ * Every Time and Tides device asks NOAA for the same few things -- the day's six-minute water 
+ * level predictions, the next couple of days' high and low tides and, if it's correcting for 
+ * observations, the latest observed water level -- for one of a handful of stations. With a 
+ * fleet of devices, that's the same request, and the same TLS handshake, over and over. This 
+ * service sits on the LAN and answers the devices' requests from a cache, going to NOAA only 
+ * the first time something's asked for. Point a device at it with
+ * 
+ *   config server http://<host>:<port>/api/prod/datagetter
+ * 
+ * It takes requests of the same shape as NOAA's datagetter. Each is cached by the query it 
+ * makes of NOAA, less the application name -- station, product and date, but also units, 
+ * datum, time zone and so on, so that a request in metric never gets an answer fetched in 
+ * feet. Predictions for a day are kept for TP_PRED_TTL_SECS, observations for TP_OBS_TTL_SECS. 
+ * The date is the date part of begin_date; if begin_date has a time of day too, the high and 
+ * low tides are fetched from midnight and the ones before the time are dropped from the 
+ * response, so requests made at different times of the same day share a cache entry. Requests 
+ * for the same thing that arrive while it's being fetched wait for that fetch instead of 
+ * making another one. Anything else is passed through uncached. Fetching from NOAA is done 
+ * with curl.
+ * 
+ * A predictions request with format=tatbin gets its answer as a TideWire message (see 
+ * lib/TideData/TideWire.h) instead of JSON: a fraction of the size, and something the device 
+ * can use without parsing it. (It's fetched from NOAA, and cached, as JSON.)
+ * 
+ * With --bench, it instead measures itself: it serves from a built-in stand-in for NOAA (with 
+ * a simulated upstream delay) and hammers itself over loopback with a simulated fleet of 
+ * devices, each making a day's worth of requests for one of the stations, and reports the 
+ * requests per second and the upstream calls saved.
+ * 
+ * Build and run (from the repository root):
+ * 
+ *   g++ -std=c++17 -O2 -pthread -Ilib/TideData -Itools -o tideproxy tools/tideproxy.cpp lib/TideData/TideWire.cpp lib/TideData/TideTable.cpp
+ *   ./tideproxy -p 8080
+ *   ./tideproxy --bench 500 5 3
+ * 
+ * Usage: tideproxy [-p <port>] [-u <upstream url>] [-v]
+ *        tideproxy --bench <devices> <stations> <days> [-c <concurrency>] [-d <upstream delay ms>] [-w]
+ * 
+ *   -w   In the bench, ask for format=tatbin
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ * 
+ ****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include "NoaaFixture.h"
+#include "TideWire.h"
+
+#define TP_DEFAULT_PORT     (8080)                  // The port to listen on by default
+#define TP_UPSTREAM_URL     "https://api.tidesandcurrents.noaa.gov/api/prod/datagetter"
+#define TP_PRED_TTL_SECS    (24 * 3600)             // How long to keep predictions (sec)
+#define TP_OBS_TTL_SECS     (60)                    // How long to keep observations (sec)
+#define TP_MAX_ENTRIES      (4096)                  // Purge expired entries when the cache gets this big
+#define TP_MAX_REQUEST      (4096)                  // The longest request header accepted (bytes)
+#define TP_HILO_RANGE_HOURS (72)                    // Range to fetch hilo predictions for when they're to be filtered
+
+// Upstream: given a datagetter query string, return the response body, or "" if it failed
+typedef std::function<std::string(const std::string &query)> upstream_t;
+
+struct Stats {                                      // What the proxy has done
+  std::atomic<uint64_t> requests {0};               //  Requests answered
+  std::atomic<uint64_t> hits {0};                   //  Answered from the cache
+  std::atomic<uint64_t> coalesced {0};              //  Answered by waiting for a fetch already under way
+  std::atomic<uint64_t> upstream {0};               //  Calls made upstream
+  std::atomic<uint64_t> failures {0};               //  Upstream calls that failed
+  std::atomic<uint64_t> passThrough {0};            //  Requests passed through uncached
+  std::atomic<uint64_t> tatbin {0};                 //  Requests answered in TideWire format
+};
+
+struct Entry {                                      // A cache entry
+  std::string body;                                 //  The response
+  time_t expires = 0;                               //  When it stops being good
+  bool ready = false;                               //  False while it's being fetched
+  bool ok = false;                                  //  Whether the fetch worked
+};
+
+class TideProxy {
+public:
+  TideProxy(upstream_t upstream, bool verbose) : upstream(upstream), verbose(verbose) {}
+
+  // Answer a datagetter query; return the HTTP status
+  int answer(const std::string &query, std::string &body, std::string &contentType) {
+    stats.requests++;
+    contentType = "application/json";
+    std::map<std::string, std::string> params = parse(query);
+    bool tatbin = params["format"] == TW_FORMAT;
+    if (tatbin) {
+      if (params["product"] != "predictions") {
+        return 400;
+      }
+      stats.tatbin++;
+      params["format"] = "json";
+    }
+    std::string station = params["station"], product = params["product"];
+    std::string begin = params["begin_date"], date = params["date"];
+    std::string key, upstreamQuery = unparse(params);
+    time_t ttl = 0;
+    std::string after;                              // Drop hilo events before this "yyyy-mm-dd hh:mm"
+    int afterHours = atoi(params["range"].c_str()); //   and from this many hours after it on
+    if (product == "predictions" && begin.size() >= 8 && isDigits(begin.substr(0, 8))) {
+      std::string day = begin.substr(0, 8);
+      std::string range = params["range"];
+      if (params["interval"] == "hilo" && begin.size() > 8) {
+        after = day.substr(0, 4) + "-" + day.substr(4, 2) + "-" + day.substr(6, 2) + begin.substr(8);
+        range = std::to_string(TP_HILO_RANGE_HOURS);
+      }
+      params["begin_date"] = day;
+      params["range"] = range;
+      ttl = TP_PRED_TTL_SECS;
+      upstreamQuery = unparse(params);
+      key = cacheKey(params);
+    } else if (date == "latest") {
+      ttl = TP_OBS_TTL_SECS;
+      key = cacheKey(params);
+    }
+    if (station.empty() || key.empty()) {
+      stats.passThrough++;
+      body = fetch(tatbin ? upstreamQuery : query);
+      return body.empty() ? 502 : tatbin ? toWire(station, body, contentType) : 200;
+    }
+    std::shared_ptr<Entry> e = lookup(key, upstreamQuery, ttl);
+    if (!e->ok) {
+      return 502;
+    }
+    body = after.empty() ? e->body : dropBefore(e->body, after, afterHours > 0 ? afterHours : 24);
+    return tatbin ? toWire(station, body, contentType) : 200;
+  }
+
+  Stats stats;
+
+private:
+  upstream_t upstream;
+  bool verbose;
+  std::mutex mutex;
+  std::condition_variable fetched;
+  std::map<std::string, std::shared_ptr<Entry>> cache;
+
+  // Get the cache entry for key, fetching it with query if need be
+  std::shared_ptr<Entry> lookup(const std::string &key, const std::string &query, time_t ttl) {
+    std::unique_lock<std::mutex> lock(mutex);
+    time_t now = time(nullptr);
+    auto it = cache.find(key);
+    if (it != cache.end()) {
+      std::shared_ptr<Entry> e = it->second;
+      if (!e->ready) {
+        stats.coalesced++;
+        fetched.wait(lock, [&]() { return e->ready; });
+        return e;
+      }
+      if (e->ok && now < e->expires) {
+        stats.hits++;
+        return e;
+      }
+    }
+    if (cache.size() >= TP_MAX_ENTRIES) {
+      for (auto i = cache.begin(); i != cache.end(); ) {
+        i = i->second->ready && now >= i->second->expires ? cache.erase(i) : std::next(i);
+      }
+    }
+    std::shared_ptr<Entry> e = std::make_shared<Entry>();
+    cache[key] = e;
+    lock.unlock();
+    std::string body = fetch(query);
+    lock.lock();
+    e->body = body;
+    e->ok = !body.empty();
+    e->expires = now + ttl;
+    e->ready = true;
+    if (!e->ok && cache[key] == e) {
+      cache.erase(key);                             // Try again next time
+    }
+    fetched.notify_all();
+    return e;
+  }
+
+  std::string fetch(const std::string &query) {
+    stats.upstream++;
+    std::string body = upstream(query);
+    if (body.empty()) {
+      stats.failures++;
+    }
+    if (verbose) {
+      fprintf(stderr, "upstream %s: %zu bytes\n", query.c_str(), body.size());
+    }
+    return body;
+  }
+
+  // Turn a NOAA predictions response into a TideWire message; return the HTTP status
+  static int toWire(const std::string &station, std::string &body, std::string &contentType) {
+    std::vector<fx_sample_t> samples;
+    std::string err;
+    if (!fxParse(body, samples, err) || samples.empty()) {
+      return 502;
+    }
+    std::vector<int16_t> levels;
+    std::vector<tt_event_t> events;
+    for (const fx_sample_t &s : samples) {
+      if (s.type < 0) {
+        levels.push_back(s.level);
+      } else {
+        events.push_back({(uint32_t)s.time, s.level, (uint8_t)s.type, 0});
+      }
+    }
+    uint16_t interval = levels.size() > 1 ? samples[1].time - samples[0].time : 0;
+    uint8_t wire[TW_MAX_SIZE];
+    size_t len = twEncode(station.c_str(), samples[0].time, interval, levels.data(), levels.size(), 
+      events.data(), events.size(), wire, sizeof(wire));
+    if (len == 0) {
+      return 502;
+    }
+    body.assign((const char *)wire, len);
+    contentType = "application/octet-stream";
+    return 200;
+  }
+
+  static bool isDigits(const std::string &s) {
+    return !s.empty() && std::all_of(s.begin(), s.end(), ::isdigit);
+  }
+
+  // Split a query into its parameters, decoding %xx and '+'. Ones without '=' are dropped.
+  static std::map<std::string, std::string> parse(const std::string &query) {
+    std::map<std::string, std::string> params;
+    size_t pos = 0;
+    while (pos <= query.size()) {
+      size_t amp = query.find('&', pos);
+      std::string item = query.substr(pos, amp == std::string::npos ? std::string::npos : amp - pos);
+      size_t eq = item.find('=');
+      if (eq != std::string::npos) {
+        params[item.substr(0, eq)] = decode(item.substr(eq + 1));
+      }
+      if (amp == std::string::npos) {
+        break;
+      }
+      pos = amp + 1;
+    }
+    return params;
+  }
+
+  // The cache key for a request: the query made of NOAA for it, less the application name. The
+  // params are in a map, so they come out in the same order however the request had them.
+  // (format stays in: a tatbin request has already been made a json one.)
+  static std::string cacheKey(std::map<std::string, std::string> params) {
+    params.erase("application");
+    return unparse(params);
+  }
+
+  static std::string decode(const std::string &s) {
+    std::string out;
+    for (size_t i = 0; i < s.size(); i++) {
+      if (s[i] == '%' && i + 2 < s.size()) {
+        out += (char)strtol(s.substr(i + 1, 2).c_str(), nullptr, 16);
+        i += 2;
+      } else {
+        out += s[i] == '+' ? ' ' : s[i];
+      }
+    }
+    return out;
+  }
+
+  static std::string unparse(const std::map<std::string, std::string> &params) {
+    std::string query;
+    for (const auto &p : params) {
+      if (p.second.empty()) {
+        continue;
+      }
+      query += (query.empty() ? "" : "&") + p.first + "=";
+      for (char c : p.second) {
+        query += c == ' ' ? std::string("%20") : std::string(1, c);
+      }
+    }
+    return query;
+  }
+
+  // Keep just the predictions whose "t" is at or after after and less than rangeHours after it
+  static std::string dropBefore(const std::string &body, const std::string &after, int rangeHours) {
+    struct tm tm = {};
+    if (strptime(after.c_str(), "%Y-%m-%d %H:%M", &tm) == nullptr) {
+      return body;
+    }
+    time_t until = timegm(&tm) + rangeHours * 3600;
+    char untilStr[20];
+    strftime(untilStr, sizeof(untilStr), "%Y-%m-%d %H:%M", gmtime(&until));
+    std::string out = "{\"predictions\":[";
+    bool first = true;
+    size_t pos = body.find('[');
+    while (pos != std::string::npos && (pos = body.find('{', pos)) != std::string::npos) {
+      size_t end = body.find('}', pos);
+      if (end == std::string::npos) {
+        break;
+      }
+      std::string item = body.substr(pos, end - pos + 1);
+      size_t t = item.find("\"t\"");
+      size_t q = t == std::string::npos ? std::string::npos : item.find('"', item.find(':', t));
+      std::string when = q == std::string::npos ? "" : item.substr(q + 1, 16);
+      if (when >= after && when < untilStr) {
+        out += (first ? "" : ",") + item;
+        first = false;
+      }
+      pos = end + 1;
+    }
+    return out + "]}";
+  }
+};
+
+// The real upstream: NOAA, by way of curl. The query is checked so it can't do anything to the shell.
+static std::string curlUpstream(const std::string &url, const std::string &query) {
+  for (char c : query) {
+    if (!isalnum((unsigned char)c) && strchr("._~%&=:+-", c) == nullptr) {
+      return "";
+    }
+  }
+  std::string cmd = "curl -sf --max-time 30 '" + url + "?" + query + "'";
+  FILE *p = popen(cmd.c_str(), "r");
+  if (p == nullptr) {
+    return "";
+  }
+  std::string body;
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), p)) > 0) {
+    body.append(buf, n);
+  }
+  return pclose(p) == 0 ? body : "";
+}
+
+// The stand-in upstream for --bench: a believable NOAA-shaped answer after delayMillis
+static std::string fakeUpstream(const std::string &query, int delayMillis) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(delayMillis));
+  bool hilo = query.find("interval=hilo") != std::string::npos;
+  if (query.find("date=latest") != std::string::npos) {
+    return "{\"metadata\":{\"id\":\"0000000\"},\"data\":[{\"t\":\"2023-01-01 00:00\",\"v\":\"2.426\"}]}";
+  }
+  size_t b = query.find("begin_date=");
+  std::string day = b == std::string::npos ? "20230101" : query.substr(b + 11, 8);
+  struct tm tm = {};
+  strptime(day.c_str(), "%Y%m%d", &tm);
+  time_t t0 = timegm(&tm);
+  std::string out = "{\"predictions\":[";
+  int n = hilo ? TP_HILO_RANGE_HOURS * 4 / 24 : 241;
+  for (int i = 0; i < n; i++) {
+    time_t t = t0 + (hilo ? i * 22357 : i * 360);
+    char when[20], item[80];
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M", gmtime(&t));
+    snprintf(item, sizeof(item), "%s{\"t\":\"%s\",\"v\":\"%.3f\"%s}", i == 0 ? "" : ",", when, 
+      4.0 + 3.5 * sin(t / 7112.0), hilo ? (i % 2 ? ",\"type\":\"L\"" : ",\"type\":\"H\"") : "");
+    out += item;
+  }
+  return out + "]}";
+}
+
+// Deal with one connection: read a GET, answer it, close
+static void serveConnection(int fd, TideProxy &proxy) {
+  std::string request;
+  char buf[1024];
+  while (request.find("\r\n\r\n") == std::string::npos && request.size() < TP_MAX_REQUEST) {
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n <= 0) {
+      close(fd);
+      return;
+    }
+    request.append(buf, n);
+  }
+  std::string body, contentType = "application/json";
+  int status = 400;
+  if (request.compare(0, 4, "GET ") == 0) {
+    size_t pathEnd = request.find(' ', 4);
+    std::string path = request.substr(4, pathEnd == std::string::npos ? std::string::npos : pathEnd - 4);
+    size_t q = path.find('?');
+    status = path.compare(0, q, "/api/prod/datagetter") == 0 && q != std::string::npos ? 
+      proxy.answer(path.substr(q + 1), body, contentType) : 404;
+  }
+  std::string header = "HTTP/1.1 " + std::to_string(status) + (status == 200 ? " OK" : " Error") + 
+    "\r\nContent-Type: " + contentType + "\r\nContent-Length: " + std::to_string(body.size()) + 
+    "\r\nConnection: close\r\n\r\n";
+  std::string response = header + body;
+  for (size_t sent = 0; sent < response.size(); ) {
+    ssize_t n = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+    if (n <= 0) {
+      break;
+    }
+    sent += n;
+  }
+  close(fd);
+}
+
+static int listenOn(uint16_t port, bool loopbackOnly) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(loopbackOnly ? INADDR_LOOPBACK : INADDR_ANY);
+  if (bind(fd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 512) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static void acceptLoop(int listenFd, TideProxy &proxy) {
+  while (true) {
+    int fd = accept(listenFd, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      return;                                       // Listening socket closed
+    }
+    std::thread(serveConnection, fd, std::ref(proxy)).detach();
+  }
+}
+
+// One GET over loopback; return the HTTP status, or 0 if the connection failed. Add the size of the response to bytes.
+static int get(uint16_t port, const std::string &path, std::atomic<uint64_t> &bytes) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int status = 0;
+  if (connect(fd, (sockaddr *)&addr, sizeof(addr)) == 0) {
+    std::string request = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+    send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+    std::string response;
+    char buf[8192];
+    ssize_t n;
+    while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+      response.append(buf, n);
+    }
+    if (response.size() > 12) {
+      status = atoi(response.c_str() + 9);
+    }
+    bytes += response.size();
+  }
+  close(fd);
+  return status;
+}
+
+// Simulate a fleet of devices doing their daily fetches through the proxy
+static int bench(int devices, int stations, int days, int concurrency, int delayMillis, bool tatbin) {
+  TideProxy proxy([=](const std::string &q) { return fakeUpstream(q, delayMillis); }, false);
+  int listenFd = listenOn(0, true);
+  sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  getsockname(listenFd, (sockaddr *)&addr, &len);
+  uint16_t port = ntohs(addr.sin_port);
+  std::thread server(acceptLoop, listenFd, std::ref(proxy));
+
+  // Each device, each day: the day's six-minute predictions, then the next tides four times a 
+  // day, each at a different time of day, as the tide clock asks for them
+  std::vector<std::string> work;
+  std::string prefix = std::string("/api/prod/datagetter?application=David_Ehnebuske&units=english&time_zone=gmt&datum=MLLW&format=") + 
+    (tatbin ? TW_FORMAT : "json") + "&";
+  for (int d = 0; d < days; d++) {
+    char day[9];
+    time_t t = 1672531200 + d * 86400;              // 2023-01-01 + d days
+    strftime(day, sizeof(day), "%Y%m%d", gmtime(&t));
+    for (int dev = 0; dev < devices; dev++) {
+      std::string station = "&station=" + std::to_string(9440000 + dev % stations);
+      work.push_back(prefix + "range=24&product=predictions&begin_date=" + day + station);
+      for (int tide = 0; tide < 4; tide++) {
+        char when[16];
+        snprintf(when, sizeof(when), "%%20%02d:%02d", tide * 6 + dev % 6, (dev * 7) % 60);
+        work.push_back(prefix + "product=predictions&interval=hilo&range=48&begin_date=" + day + when + station);
+      }
+    }
+  }
+  std::atomic<size_t> next {0};
+  std::atomic<int> errors {0};
+  std::atomic<uint64_t> bytes {0};
+  std::vector<double> latencies(work.size());
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> clients;
+  for (int c = 0; c < concurrency; c++) {
+    clients.emplace_back([&]() {
+      size_t i;
+      while ((i = next++) < work.size()) {
+        auto t0 = std::chrono::steady_clock::now();
+        if (get(port, work[i], bytes) != 200) {
+          errors++;
+        }
+        latencies[i] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+      }
+    });
+  }
+  for (std::thread &t : clients) {
+    t.join();
+  }
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  shutdown(listenFd, SHUT_RDWR);
+  close(listenFd);
+  server.join();
+
+  std::sort(latencies.begin(), latencies.end());
+  uint64_t requests = proxy.stats.requests, upstream = proxy.stats.upstream;
+  printf("Fleet: %d devices, %d stations, %d days; %d concurrent clients; upstream delay %d ms; format %s\n", 
+    devices, stations, days, concurrency, delayMillis, tatbin ? TW_FORMAT : "json");
+  printf("Requests:  %llu in %.2f s = %.0f requests/s, %d errors\n", (unsigned long long)requests, secs, requests / secs, errors.load());
+  printf("Sent:      %.1f MB, %.0f bytes per request\n", bytes / 1e6, (double)bytes / requests);
+  printf("Latency:   p50 %.2f ms, p99 %.2f ms, max %.2f ms\n", 
+    latencies[latencies.size() / 2], latencies[latencies.size() * 99 / 100], latencies.back());
+  printf("Cache:     %llu hits, %llu coalesced onto a fetch under way\n", 
+    (unsigned long long)proxy.stats.hits.load(), (unsigned long long)proxy.stats.coalesced.load());
+  printf("Upstream:  %llu calls instead of %llu; %llu (%.1f%%) saved\n", (unsigned long long)upstream, 
+    (unsigned long long)requests, (unsigned long long)(requests - upstream), 100.0 * (requests - upstream) / requests);
+  return errors == 0 ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+  uint16_t port = TP_DEFAULT_PORT;
+  std::string upstreamUrl = TP_UPSTREAM_URL;
+  bool verbose = false;
+  int concurrency = 64, delayMillis = 300;
+  bool tatbin = false;
+  std::vector<int> benchArgs;
+  bool benchMode = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+      port = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-u") == 0 && i + 1 < argc) {
+      upstreamUrl = argv[++i];
+    } else if (strcmp(argv[i], "-v") == 0) {
+      verbose = true;
+    } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+      concurrency = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+      delayMillis = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-w") == 0) {
+      tatbin = true;
+    } else if (strcmp(argv[i], "--bench") == 0) {
+      benchMode = true;
+    } else if (benchMode && isdigit((unsigned char)argv[i][0])) {
+      benchArgs.push_back(atoi(argv[i]));
+    } else {
+      benchArgs.clear();
+      benchMode = false;
+      port = 0;
+      break;
+    }
+  }
+  if (benchMode) {
+    if (benchArgs.size() != 3) {
+      fprintf(stderr, "Usage: %s --bench <devices> <stations> <days> [-c <concurrency>] [-d <upstream delay ms>] [-w]\n", argv[0]);
+      return 2;
+    }
+    return bench(benchArgs[0], benchArgs[1], benchArgs[2], concurrency, delayMillis, tatbin);
+  }
+  if (port == 0) {
+    fprintf(stderr, "Usage: %s [-p <port>] [-u <upstream url>] [-v]\n", argv[0]);
+    return 2;
+  }
+  int listenFd = listenOn(port, false);
+  if (listenFd < 0) {
+    fprintf(stderr, "Can't listen on port %u: %s\n", port, strerror(errno));
+    return 1;
+  }
+  TideProxy proxy([=](const std::string &q) { return curlUpstream(upstreamUrl, q); }, verbose);
+  printf("Proxying %s at http://<this host>:%u/api/prod/datagetter\n", upstreamUrl.c_str(), port);
+  acceptLoop(listenFd, proxy);
+  return 0;
+}
@@ -0,0 +1,133 @@
+/****
+ *
+ * tidewire.cpp
+ * Host tool for checking the TideWire binary format. Part of Time and Tides.
+ * 
+ * For each saved NOAA predictions response given (six-minute levels or hi/lo tides, as fetched 
+ * by levelTask()), encodes it as a TideWire message (see 
+ * lib/TideData/TideWire.h), decodes it again and checks that what comes out is what went in. 
+ * It also checks that flipping any single bit of the message makes the device reject it. Then 
+ * it compares the message's size with the JSON's and the time taken to decode each, the JSON 
+ * with the same simple scanner the host tools use. (ArduinoJson on the device is slower still; 
+ * the device's "bench wire" command measures that.)
+ * 
+ * Build and run (from the repository root):
+ * 
+ *   g++ -std=c++17 -O2 -Ilib/TideData -Itools -o tidewire tools/tidewire.cpp lib/TideData/TideWire.cpp lib/TideData/TideTable.cpp
+ *   ./tidewire responses/9444900-000-wl.json responses/9444900-000-hilo.json
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ * 
+ ****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "NoaaFixture.h"
+#include "TideWire.h"
+
+#define REPS        (2000)                          // Times to decode each way when timing
+
+static double microsPer(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / REPS;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <NOAA predictions response>...\n", argv[0]);
+    return 2;
+  }
+  int failures = 0;
+  printf("%-40s %8s %8s %6s %10s %10s\n", "Response", "JSON B", "Wire B", "Ratio", "JSON us", "Wire us");
+  for (int f = 1; f < argc; f++) {
+    std::string json, err;
+    std::vector<fx_sample_t> samples;
+    if (!fxReadFile(argv[f], json) || !fxParse(json, samples, err) || samples.empty()) {
+      fprintf(stderr, "%s: %s\n", argv[f], err.empty() ? "can't read it or it's empty" : err.c_str());
+      failures++;
+      continue;
+    }
+    std::vector<int16_t> levels;
+    std::vector<tt_event_t> events;
+    for (const fx_sample_t &s : samples) {
+      if (s.type < 0) {
+        levels.push_back(s.level);
+      } else {
+        events.push_back({(uint32_t)s.time, s.level, (uint8_t)s.type, 0});
+      }
+    }
+    uint16_t interval = levels.size() > 1 ? samples[1].time - samples[0].time : 0;
+    uint8_t wire[TW_MAX_SIZE];
+    size_t len = twEncode("9444900", samples[0].time, interval, levels.data(), levels.size(), 
+      events.data(), events.size(), wire, sizeof(wire));
+    if (len == 0) {
+      fprintf(stderr, "%s: doesn't fit in a TideWire message\n", argv[f]);
+      failures++;
+      continue;
+    }
+
+    // Round trip
+    TideWire tw;
+    bool ok = tw.attach(wire, len) && tw.nLevels() == levels.size() && tw.nEvents() == events.size();
+    for (uint16_t i = 0; ok && i < levels.size(); i++) {
+      ok = tw.level(i) == levels[i] && tw.epoch() + i * tw.interval() == samples[i].time;
+    }
+    for (uint16_t i = 0; ok && i < events.size(); i++) {
+      tt_event_t e;
+      ok = tw.event(i, &e) && e.time == events[i].time && e.level == events[i].level && e.type == events[i].type;
+    }
+    if (!ok) {
+      fprintf(stderr, "%s: what was decoded isn't what was encoded\n", argv[f]);
+      failures++;
+    }
+
+    // Corruption
+    int accepted = 0;
+    for (size_t bit = 0; bit < len * 8; bit++) {
+      wire[bit / 8] ^= 1 << (bit % 8);
+      accepted += tw.attach(wire, len) ? 1 : 0;
+      wire[bit / 8] ^= 1 << (bit % 8);
+    }
+    accepted += tw.attach(wire, len - 1) ? 1 : 0;
+    if (accepted > 0) {
+      fprintf(stderr, "%s: %d corrupted messages accepted\n", argv[f], accepted);
+      failures++;
+    }
+
+    // Timing: get everything into the form the device uses
+    static float predWl[TW_MAX_SIZE];
+    volatile float sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < REPS; r++) {
+      std::vector<fx_sample_t> parsed;
+      fxParse(json, parsed, err);
+      for (size_t i = 0; i < parsed.size(); i++) {
+        predWl[i] = parsed[i].level / 100.0;
+      }
+      sink = sink + predWl[0];
+    }
+    double jsonMicros = microsPer(start);
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < REPS; r++) {
+      tw.attach(wire, len);
+      for (uint16_t i = 0; i < tw.nLevels(); i++) {
+        predWl[i] = tw.level(i) / 100.0;
+      }
+      tt_event_t e;
+      tw.nextEvent(samples[0].time, &e);
+      sink = sink + predWl[0] + e.level;
+    }
+    double wireMicros = microsPer(start);
+    const char *name = strrchr(argv[f], '/') ? strrchr(argv[f], '/') + 1 : argv[f];
+    printf("%-40s %8zu %8zu %5.1fx %10.1f %10.2f\n", name, json.size(), len, (double)json.size() / len, jsonMicros, wireMicros);
+  }
+  printf(failures == 0 ? "All round trips and corruption checks passed.\n" : "%d failures.\n", failures);
+  return failures == 0 ? 0 : 1;
+}
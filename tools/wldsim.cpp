@@ -0,0 +1,437 @@
+/****
+ *
+ * wldsim.cpp
+ * Host tool for seeing how well the water level display tracks the tide. Part of Time and Tides.
+ *
+ * Runs the real WlDisplay code, compiled natively against the stand-in Arduino core in
+ * tools/host, in simulated time for days on end, driving a model of the hardware on the other
+ * side of its pins:
+ *
+ *   - The 28BYJ-48 and chain. The rotor follows the phase pattern on the stepper pins, a half
+ *     step at a time, as long as the 5V is there and it isn't asked to go faster than it can
+ *     (-m). If the phases get more than a full step ahead of it, it loses steps. The chain
+ *     moves the sea surface with it; where it is, relative to the Hall-effect sensor, is the
+ *     level the display is really showing.
+ *   - The 3144 Hall-effect sensor, which reads LOW while the magnet is within WS_HALL_BAND half
+ *     steps past the point that's the display's minimum level.
+ *   - The USB power, which comes and goes according to a script (-p) and random flickers (-f).
+ *
+ * The GyverStepper library is modeled too; see tools/host/GyverStepper.h. Time passes in
+ * WS_DISPLAY_TASK_MILLIS steps while the display is still, as the display task's period does,
+ * and in WS_PASS_MICROS steps while it's moving, when the display task runs as often as
+ * possible. Every digitalRead() takes WS_READ_MICROS, which is what makes time pass while
+ * home() spins driving the display down to the sensor.
+ *
+ * Every WS_LEVEL_CHECK_SECS (or -u) the level task's stand-in sets the display to the predicted
+ * level, the way getPredWl() finds it: from a TideCurve fitted to each day's six-minute
+ * predictions (or, with -i, the predictions themselves, interpolated between the two either
+ * side of the current time). The predictions come from saved NOAA six-minute prediction
+ * responses or, if none are given, a made-up tide. The true level is the predictions
+ * interpolated to the second. Once a second, the tool compares the level the
+ * display is really showing with the true level, and reports the RMS and maximum error, split
+ * into the part due to what it's told to show and the part due to how it gets there, along
+ * with the steps taken and how many homings there were and how long they took.
+ *
+ * Build and run (from the repository root):
+ *
+ *   g++ -std=c++17 -O2 -Itools/host -Itools -Ilib/Snapshot -Ilib/FastGpio -Ilib/WlDisplay -Ilib/TideData -o wldsim tools/wldsim.cpp lib/WlDisplay/WlDisplay.cpp lib/TideData/TideCurve.cpp
+ *   ./wldsim -d 7 -f 4,300
+ *
+ * Usage: wldsim [-d <days>] [-u <secs>] [-i] [-m <steps/sec>] [-p <power script>]
+ *               [-f <per day>[,<millis>]] [-s <seed>] [-t <csv file>] [<NOAA predictions response>...]
+ *
+ *   -d   The number of days to simulate (default 3, or as many as the responses cover)
+ *   -u   How often the display is given a new level (default 360 sec, as on the device)
+ *   -i   Interpolate the predictions rather than using the fitted curves
+ *   -m   The fastest the motor can follow the phases (default 900 half steps/sec)
+ *   -p   A power script: lines of "<seconds from the start> on|off"; the power starts on
+ *   -f   Random power dropouts: this many per day (on average), each this long (default 200 ms)
+ *   -s   The seed for the random dropouts and the display's starting position (default 1)
+ *   -t   Write the time, true, commanded and displayed levels and the power to a CSV file,
+ *        once a second
+ *
+ ****
+ *
+ *  Copyright 2023 by D.L. Ehnebuske
+ *  License: GNU Lesser General Public License v2.1
+ *
+ ****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include "NoaaFixture.h"
+#include "WlDisplay.h"
+#include "TideCurve.h"
+
+// Some constants
+#define WS_START                (1672531200)    // Simulation starts 2023-01-01 00:00:00 UTC if there are no responses
+#define WS_SECONDS_PER_DAY      (86400)         // Seconds in a day
+#define WS_PRED_INTERVAL_SECS   (360)           // The interval between predictions
+#define WS_SAMPLES_PER_DAY      (241)           // Predictions in a day, each day's last being the next's first (TAT_N_PRED_WL in src/config.h)
+#define WS_CURVE_MAX_ERROR      (1)             // The curves' error bound (TAT_CURVE_MAX_ERROR in src/config.h)
+#define WS_LEVEL_CHECK_SECS     (360)           // Level task period (TAT_LEVEL_CHECK_SECS in src/config.h)
+#define WS_DISPLAY_TASK_MILLIS  (20)            // Display task period when still (TAT_DISPLAY_TASK_MILLIS in src/config.h)
+#define WS_PASS_MICROS          (200)           // A pass through the scheduler when the display is moving
+#define WS_READ_MICROS          (5)             // A digitalRead(), or a time round home()'s loop
+#define WS_HALL_BAND            (24)            // Half steps past the minimum level the sensor sees the magnet for
+#define WS_MOTOR_MAX_SPEED      (900)           // The fastest the motor can follow the phases (half steps/sec)
+#define WS_SEMIDIURNAL_SECS     (44714.0)       // Period of the made-up tide's semidiurnal constituent (M2)
+#define WS_DIURNAL_SECS         (86164.0)       // Period of its diurnal constituent (K1)
+
+// The pins; as in src/main.cpp (A4 and A5 are GPIO 14 and 8 on the Feather ESP32-S2)
+#define STEPPER_PIN_1           (10)
+#define STEPPER_PIN_2           (6)
+#define STEPPER_PIN_3           (9)
+#define STEPPER_PIN_4           (5)
+#define LIMIT_PIN               (14)
+#define POWER_PIN               (8)
+
+static const uint8_t phasePins[4] = {STEPPER_PIN_1, STEPPER_PIN_2, STEPPER_PIN_3, STEPPER_PIN_4};
+static const uint8_t halfSteps[8] = {0b0001, 0b0011, 0b0010, 0b0110, 0b0100, 0b1100, 0b1000, 0b1001};
+
+struct ws_power_t {                             // A change in the USB power
+  uint64_t micros;                              //  When
+  bool on;                                      //  What it changed to
+};
+
+/**
+ * @brief The hardware on the other side of WlDisplay's pins
+ */
+class Hardware {
+public:
+  std::vector<ws_power_t> power;                // The power changes, in time order
+  size_t powerIx = 0;                           // The index of the next one
+  bool powerOn = true;                          // Whether the power is on now
+  long rotor = 0;                               // Where the motor is (half steps; larger is lower)
+  long hall = 0;                                // Where it is when the sensor first sees the magnet
+  uint64_t lastMoveMicros = 0;                  // When the rotor last moved
+  uint32_t minMoveMicros;                       // The shortest time it can take to move
+  uint64_t steps = 0;                           // Half steps the rotor has taken
+  uint64_t lostSteps = 0;                       // Times the phases got away from it
+
+  // Bring the power and the rotor up to date with the time and the phases
+  void update() {
+    while (powerIx < power.size() && power[powerIx].micros <= hostMicros) {
+      powerOn = power[powerIx++].on;
+    }
+    if (!powerOn) {
+      return;                                   // No 5V, no torque
+    }
+    uint8_t pattern = 0;
+    for (uint8_t i = 0; i < 4; i++) {
+      pattern |= ((hostGpioOut[phasePins[i] >> 5] >> (phasePins[i] & 0x1F)) & 1) << i;
+    }
+    int8_t phase = -1;
+    for (uint8_t i = 0; i < 8; i++) {
+      if (halfSteps[i] == pattern) {
+        phase = i;
+      }
+    }
+    if (phase < 0) {
+      return;                                   // Coils off
+    }
+    int delta = (phase - (int)(rotor & 0x07) + 8) % 8;
+    delta = delta > 4 ? delta - 8 : delta;
+    if (delta == 0 || hostMicros - lastMoveMicros < minMoveMicros) {
+      return;
+    }
+    if (delta > 2 || delta < -2) {
+      lostSteps++;                              // Too far ahead; it just shudders
+      lastMoveMicros = hostMicros;
+      return;
+    }
+    rotor += delta > 0 ? 1 : -1;                // A full step's pull still only moves it a half step at a time
+    steps++;
+    lastMoveMicros = hostMicros;
+  }
+
+  // What the sensor reads
+  int sensor() {
+    return rotor >= hall && rotor < hall + WS_HALL_BAND ? LOW : HIGH;
+  }
+};
+
+static Hardware hw;
+
+// digitalRead() on the device is answered by the hardware; it takes a little time
+static int readPin(uint8_t pin) {
+  hostMicros += WS_READ_MICROS;
+  hw.update();
+  if (pin == POWER_PIN) {
+    return hw.powerOn ? HIGH : LOW;
+  }
+  if (pin == LIMIT_PIN) {
+    return hw.sensor();
+  }
+  return LOW;
+}
+
+// The predicted level at time t (feet), interpolated
+static float predicted(const std::vector<fx_sample_t> &preds, time_t t) {
+  if (t <= preds.front().time) {
+    return preds.front().level / 100.0;
+  }
+  size_t ix = std::min((size_t)((t - preds.front().time) / WS_PRED_INTERVAL_SECS), preds.size() - 1);
+  if (ix + 1 == preds.size()) {
+    return preds[ix].level / 100.0;
+  }
+  float frac = (float)(t - preds[ix].time) / WS_PRED_INTERVAL_SECS;
+  return (preds[ix].level + frac * (preds[ix + 1].level - preds[ix].level)) / 100.0;
+}
+
+static bool readScript(const char *path, std::vector<ws_power_t> &out) {
+  FILE *f = fopen(path, "r");
+  if (f == nullptr) {
+    return false;
+  }
+  char line[128];
+  while (fgets(line, sizeof(line), f) != nullptr) {
+    double secs;
+    char state[8];
+    if (line[0] == '#' || sscanf(line, "%lf %7s", &secs, state) != 2) {
+      continue;
+    }
+    out.push_back({(uint64_t)(secs * 1e6), strcmp(state, "on") == 0});
+  }
+  fclose(f);
+  return true;
+}
+
+struct ws_stats_t {                             // Error statistics
+  double sumSq = 0;
+  double max = 0;
+  uint64_t n = 0;
+  void add(double e) {
+    sumSq += e * e;
+    max = fabs(e) > max ? fabs(e) : max;
+    n++;
+  }
+  double rms() const {
+    return n == 0 ? 0 : sqrt(sumSq / n);
+  }
+};
+
+int main(int argc, char **argv) {
+  int days = 0;
+  uint32_t updateSecs = WS_LEVEL_CHECK_SECS;
+  bool interpolate = false;
+  uint32_t motorMax = WS_MOTOR_MAX_SPEED;
+  const char *scriptPath = nullptr;
+  double flickersPerDay = 0;
+  uint32_t flickerMillis = 200;
+  uint32_t seed = 1;
+  const char *tracePath = nullptr;
+  std::vector<const char *> files;
+  for (int a = 1; a < argc; a++) {
+    bool more = a + 1 < argc;
+    if (strcmp(argv[a], "-d") == 0 && more) {
+      days = atoi(argv[++a]);
+    } else if (strcmp(argv[a], "-u") == 0 && more) {
+      updateSecs = atoi(argv[++a]);
+    } else if (strcmp(argv[a], "-i") == 0) {
+      interpolate = true;
+    } else if (strcmp(argv[a], "-m") == 0 && more) {
+      motorMax = atoi(argv[++a]);
+    } else if (strcmp(argv[a], "-p") == 0 && more) {
+      scriptPath = argv[++a];
+    } else if (strcmp(argv[a], "-f") == 0 && more) {
+      a++;
+      flickersPerDay = atof(argv[a]);
+      const char *comma = strchr(argv[a], ',');
+      flickerMillis = comma == nullptr ? flickerMillis : atoi(comma + 1);
+    } else if (strcmp(argv[a], "-s") == 0 && more) {
+      seed = atoi(argv[++a]);
+    } else if (strcmp(argv[a], "-t") == 0 && more) {
+      tracePath = argv[++a];
+    } else if (argv[a][0] == '-') {
+      fprintf(stderr, "Usage: %s [-d <days>] [-u <secs>] [-i] [-m <steps/sec>] [-p <power script>]\n"
+        "              [-f <per day>[,<millis>]] [-s <seed>] [-t <csv file>] [<NOAA predictions response>...]\n", argv[0]);
+      return 2;
+    } else {
+      files.push_back(argv[a]);
+    }
+  }
+  if (updateSecs == 0 || motorMax == 0) {
+    fprintf(stderr, "The update period and motor speed must be more than 0.\n");
+    return 2;
+  }
+
+  // The predictions: from the responses if there are any, else made up
+  std::vector<fx_sample_t> preds;
+  for (const char *f : files) {
+    std::string json, err;
+    std::vector<fx_sample_t> samples;
+    if (!fxReadFile(f, json) || !fxParse(json, samples, err)) {
+      fprintf(stderr, "%s: %s\n", f, err.empty() ? "can't read it" : err.c_str());
+      return 1;
+    }
+    for (const fx_sample_t &s : samples) {
+      if (s.type < 0) {
+        preds.push_back(s);
+      }
+    }
+  }
+  if (!files.empty()) {
+    std::sort(preds.begin(), preds.end(), [](const fx_sample_t &x, const fx_sample_t &y) { return x.time < y.time; });
+    preds.erase(std::unique(preds.begin(), preds.end(), [](const fx_sample_t &x, const fx_sample_t &y) { return x.time == y.time; }), preds.end());
+    for (size_t i = 1; i < preds.size(); i++) {
+      if (preds[i].time - preds[i - 1].time != WS_PRED_INTERVAL_SECS) {
+        fprintf(stderr, "The six-minute predictions have a gap before %s", asctime(gmtime(&preds[i].time)));
+        return 1;
+      }
+    }
+    int covered = (int)((preds.size() - 1) * WS_PRED_INTERVAL_SECS / WS_SECONDS_PER_DAY);
+    if (covered == 0) {
+      fprintf(stderr, "The responses don't cover a day of six-minute predictions.\n");
+      return 1;
+    }
+    days = days == 0 || days > covered ? covered : days;
+  } else {
+    days = days == 0 ? 3 : days;
+    for (time_t t = WS_START; t <= WS_START + days * WS_SECONDS_PER_DAY; t += WS_PRED_INTERVAL_SECS) {
+      float level = 4.0 + 4.5 * cos(2 * PI * (t - WS_START) / WS_SEMIDIURNAL_SECS) +
+        1.8 * cos(2 * PI * (t - WS_START) / WS_DIURNAL_SECS + 1.0);
+      preds.push_back({t, (int16_t)lroundf(level * 100), -1});
+    }
+  }
+  time_t start = preds.front().time;
+
+  // The curves getPredWl() uses, one per day
+  std::vector<TideCurve> curves;
+  std::vector<int16_t> dayLevels(WS_SAMPLES_PER_DAY);
+  for (size_t i = 0; i + WS_SAMPLES_PER_DAY <= preds.size(); i += WS_SAMPLES_PER_DAY - 1) {
+    for (size_t j = 0; j < WS_SAMPLES_PER_DAY; j++) {
+      dayLevels[j] = preds[i + j].level;
+    }
+    curves.emplace_back();
+    curves.back().fit(preds[i].time, WS_PRED_INTERVAL_SECS, dayLevels.data(), WS_SAMPLES_PER_DAY, WS_CURVE_MAX_ERROR);
+  }
+  uint64_t endMicros = (uint64_t)days * WS_SECONDS_PER_DAY * 1000000;
+
+  // The power changes: the script's and the flickers
+  std::mt19937 rng(seed);
+  if (scriptPath != nullptr && !readScript(scriptPath, hw.power)) {
+    fprintf(stderr, "%s: can't read it\n", scriptPath);
+    return 1;
+  }
+  uint32_t flickers = 0;
+  if (flickersPerDay > 0) {
+    std::exponential_distribution<double> gap(flickersPerDay / WS_SECONDS_PER_DAY);
+    for (double s = gap(rng); s * 1e6 < endMicros; s += gap(rng)) {
+      hw.power.push_back({(uint64_t)(s * 1e6), false});
+      hw.power.push_back({(uint64_t)(s * 1e6) + flickerMillis * 1000ULL, true});
+      flickers++;
+    }
+  }
+  std::stable_sort(hw.power.begin(), hw.power.end(), [](const ws_power_t &x, const ws_power_t &y) { return x.micros < y.micros; });
+  uint32_t outages = 0;
+  for (const ws_power_t &p : hw.power) {
+    outages += p.on ? 0 : 1;
+  }
+
+  // The display, somewhere above its minimum level, as it would be after a power cut
+  hw.minMoveMicros = 1000000 / motorMax;
+  hw.hall = 0;
+  hw.rotor = -8 * (long)(rng() % 150);          // Same phase as the stepper's position 0
+  hostDigitalRead = readPin;
+  Serial.quiet = true;
+  WlDisplay wld {STEPPER_PIN_1, STEPPER_PIN_2, STEPPER_PIN_3, STEPPER_PIN_4, LIMIT_PIN, POWER_PIN};
+  wld.begin();
+  int32_t maxLevel = lroundf(WLD_MAX_LEVEL * 100);                       // As WlDisplay::begin() works them out
+  int32_t minPos = wldPosition(lroundf(WLD_MIN_LEVEL * 100), maxLevel);
+
+  FILE *trace = nullptr;
+  if (tracePath != nullptr) {
+    trace = fopen(tracePath, "w");
+    if (trace == nullptr) {
+      fprintf(stderr, "%s: can't write it\n", tracePath);
+      return 1;
+    }
+    fprintf(trace, "seconds,true,commanded,displayed,power\n");
+  }
+
+  // Run
+  ws_stats_t total, commandErr, motionErr;
+  uint64_t nextLevelMicros = 0, nextSampleMicros = 0;
+  uint64_t movingMicros = 0, homingMicros = 0, longestRunMicros = 0, unpoweredSecs = 0, recoveringSecs = 0;
+  bool recovering = false;                      // Moving from the minimum level to the commanded one after a homing
+  uint32_t homings = 0, longestHomingMillis = 0;
+  float commanded = NAN;
+  while (hostMicros < endMicros) {
+    time_t now = start + hostMicros / 1000000;
+    if (hostMicros >= nextLevelMicros) {
+      int16_t level;
+      size_t day = (now - start) / WS_SECONDS_PER_DAY;
+      if (interpolate || day >= curves.size() || !curves[day].levelAt(now, &level)) {
+        level = (int16_t)lroundf(predicted(preds, now) * 100);
+      }
+      wld.setLevel(level);
+      commanded = level / 100.0;
+      nextLevelMicros += updateSecs * 1000000ULL;
+    }
+    uint64_t before = hostMicros;
+    wld.run();
+    hw.update();
+    longestRunMicros = std::max(longestRunMicros, hostMicros - before);
+    wld_state_t state = wld.getState();
+    if (state.homings != homings) {
+      homings = state.homings;
+      homingMicros += state.homingMillis * 1000ULL;
+      longestHomingMillis = std::max(longestHomingMillis, state.homingMillis);
+      recovering = true;
+    }
+    recovering = recovering && (wld.isMoving() || !state.homed);
+    while (nextSampleMicros <= hostMicros && nextSampleMicros < endMicros) {
+      time_t t = start + nextSampleMicros / 1000000;
+      float truth = predicted(preds, t);
+      float displayed = (float)(minPos + hw.rotor - hw.hall) * maxLevel / WLD_MIN_POS / 100;
+      if (!hw.powerOn || !state.homed) {
+        unpoweredSecs++;
+      } else if (recovering) {
+        recoveringSecs++;
+      } else {
+        total.add(displayed - truth);
+        commandErr.add(commanded - truth);
+        motionErr.add(displayed - commanded);
+      }
+      if (trace != nullptr) {
+        fprintf(trace, "%llu,%.3f,%.3f,%.3f,%d\n", (unsigned long long)(nextSampleMicros / 1000000),
+          truth, commanded, displayed, hw.powerOn ? 1 : 0);
+      }
+      nextSampleMicros += 1000000;
+    }
+    bool moving = wld.isMoving();
+    uint64_t pass = moving ? WS_PASS_MICROS : WS_DISPLAY_TASK_MILLIS * 1000ULL;
+    movingMicros += moving ? pass : 0;
+    hostMicros += pass;
+  }
+  if (trace != nullptr) {
+    fclose(trace);
+  }
+
+  long drift = wld.getState().position - minPos - (hw.rotor - hw.hall);
+  printf("%d days from %s", days, asctime(gmtime(&start)));
+  printf("Predictions:     %s, new level every %u s%s\n", files.empty() ? "made up" : "from the responses", updateSecs,
+    interpolate ? ", interpolated" : ", as fitted curves");
+  printf("Power:           %u outages (%u flickers of %u ms), %llu s without power or homing\n", outages, flickers, flickerMillis,
+    (unsigned long long)unpoweredSecs);
+  printf("Recovering:      %llu s getting back to the level after homings (not in the errors)\n",
+    (unsigned long long)recoveringSecs);
+  printf("\n%-26s %10s %10s\n", "Error (feet)", "RMS", "Max");
+  printf("%-26s %10.3f %10.3f\n", "Displayed vs true", total.rms(), total.max);
+  printf("%-26s %10.3f %10.3f\n", "  Commanded vs true", commandErr.rms(), commandErr.max);
+  printf("%-26s %10.3f %10.3f\n", "  Displayed vs commanded", motionErr.rms(), motionErr.max);
+  printf("\nSteps taken:     %llu (%.1f per hour), moving %.2f%% of the time\n", (unsigned long long)hw.steps,
+    hw.steps / (days * 24.0), 100.0 * movingMicros / endMicros);
+  printf("Lost steps:      %llu; position off by %ld half steps at the end\n", (unsigned long long)hw.lostSteps, drift);
+  printf("Homings:         %u (%u after the first), %.1f s in all, longest %.1f s\n", homings, homings > 0 ? homings - 1 : 0,
+    homingMicros / 1e6, longestHomingMillis / 1000.0);
+  printf("Longest run():   %.1f ms (homing blocks the scheduler)\n", longestRunMicros / 1000.0);
+  return 0;
+}